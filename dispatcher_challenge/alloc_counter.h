@@ -0,0 +1,56 @@
+#ifndef _ALLOC_COUNTER_H_
+#define _ALLOC_COUNTER_H_
+
+#include <stddef.h>
+#include <atomic>
+
+///
+///@brief counts heap allocations made by the whole process, include from exactly one translation unit.
+///
+///@note interposes malloc/calloc/realloc over the glibc implementation, operator new and the
+///      rapidjson CrtAllocator both end up here.
+///
+
+#ifdef __GLIBC__
+
+extern "C" void *__libc_malloc(size_t size);
+extern "C" void *__libc_calloc(size_t count, size_t size);
+extern "C" void *__libc_realloc(void *ptr, size_t size);
+
+std::atomic<size_t> g_allocations{ 0 };
+
+extern "C" void * malloc(size_t size)
+{
+	g_allocations.fetch_add(1, std::memory_order_relaxed);
+	return __libc_malloc(size);
+}
+
+extern "C" void * calloc(size_t count, size_t size)
+{
+	g_allocations.fetch_add(1, std::memory_order_relaxed);
+	return __libc_calloc(count, size);
+}
+
+extern "C" void * realloc(void *ptr, size_t size)
+{
+	g_allocations.fetch_add(1, std::memory_order_relaxed);
+	return __libc_realloc(ptr, size);
+}
+
+#define ALLOC_COUNTER_ENABLED 1
+
+#else
+
+std::atomic<size_t> g_allocations{ 0 };
+
+#define ALLOC_COUNTER_ENABLED 0
+
+#endif
+
+///@brief heap allocations so far
+inline size_t allocation_count()
+{
+	return g_allocations.load(std::memory_order_relaxed);
+}
+
+#endif
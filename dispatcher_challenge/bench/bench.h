@@ -0,0 +1,122 @@
+#ifndef _DISPATCHER_BENCH_H_
+#define _DISPATCHER_BENCH_H_
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <cstdlib>
+
+#include "dispatcher.h"
+
+///
+///@brief shared by the component benchmarks, include from the one translation unit of each.
+///
+
+using namespace on::dispatcher;
+
+std::atomic_bool g_done{ false };
+
+// ----------------------------------------------------------------------------------------------- //
+
+#define DEFAULT_ITERATIONS 100000
+
+typedef std::chrono::steady_clock BenchClock;
+
+///@brief command line of a benchmark, [iterations] [--suite <name>] [--json]
+struct BenchOptions
+{
+	BenchOptions() : iterations{ DEFAULT_ITERATIONS }, suite{ NULL }, json{ false }
+	{
+	}
+
+	///@brief the suite was asked for, every suite is when none was
+	bool selected(const char *name) const
+	{
+		return suite == NULL || std::strcmp(suite, name) == 0;
+	}
+
+	size_t iterations;   ///< base iteration count, each suite scales it
+	const char *suite;   ///< the one suite to run, NULL for all
+	bool json;           ///< write the results as json to stdout, where the benchmark supports it
+};
+
+///
+///@brief read the command line and keep the console out of the measurement
+///
+///@return false after printing the usage for an unknown argument
+///
+bool bench_init(int argc, char *argv[], BenchOptions &options)
+{
+	for( int n = 1; n < argc; ++n ) {
+		if( std::strcmp(argv[n], "--json") == 0 ) {
+			options.json = true;
+		}
+		else if( std::strcmp(argv[n], "--suite") == 0 && n + 1 < argc ) {
+			options.suite = argv[++n];
+		}
+		else if( argv[n][0] >= '0' && argv[n][0] <= '9' ) {
+			options.iterations = std::strtoul(argv[n], NULL, 10);
+		}
+		else {
+			std::cerr << "usage: " << argv[0] << " [iterations] [--suite <name>] [--json]" << std::endl;
+			return false;
+		}
+	}
+
+	// handlers and dispatcher report on the console, keep it out of the measurement
+	setConsoleEnabled(false);
+	return true;
+}
+
+///@brief the built-in test commands
+std::vector<std::string> builtin_commands()
+{
+	return std::vector<std::string>{ help_command, exit_command, authenticate_command,
+		reloadUser_command, deviceHealth_command };
+}
+
+// ----------------------------------------------------------------------------------------------- //
+
+///
+///@brief parse and dispatch every built-in test command iterations times
+///
+///@return commands per second
+///
+double run_dispatch(CommandDispatcher &dispatcher, const std::vector<std::string> &commands, size_t iterations)
+{
+	auto start = BenchClock::now();
+
+	for( size_t n = 0; n < iterations; ++n ) {
+		for( const std::string &command : commands ) {
+			dispatcher.dispatchCommand(command);
+		}
+	}
+
+	std::chrono::duration<double> elapsed = BenchClock::now() - start;
+	return (iterations * commands.size()) / elapsed.count();
+}
+
+// ----------------------------------------------------------------------------------------------- //
+
+///
+///@brief json array of objects of roughly the given size
+///
+std::string make_samples(size_t bytes)
+{
+	std::string samples = "[";
+	for( size_t n = 0; samples.size() < bytes; ++n ) {
+		if( n > 0 ) {
+			samples += ",";
+		}
+		samples += "{\"id\":" + std::to_string(n) + ",\"temperature\":" + std::to_string(20 + n % 15)
+			+ ".5,\"label\":\"sensor-" + std::to_string(n) + "\",\"ok\":true}";
+	}
+	return samples + "]";
+}
+
+// ----------------------------------------------------------------------------------------------- //
+
+#endif
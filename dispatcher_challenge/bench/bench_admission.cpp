@@ -0,0 +1,93 @@
+#include "bench.h"
+
+///
+///@brief benchmark of admission control, rate limits per command and per client
+///
+
+// ----------------------------------------------------------------------------------------------- //
+
+///
+///@brief cost of the admission check: no limits, command bucket, client and command buckets, rejection
+///
+void bench_admission(size_t iterations)
+{
+	static const size_t kClients = 64;
+
+	CommandTable table;
+	table.insert("free", [](JsonValue &, ResponseWriter &) { return true; });
+	table.insert("limited", [](JsonValue &, ResponseWriter &) { return true; });
+	table.insert("exhausted", [](JsonValue &, ResponseWriter &) { return true; });
+
+	CommandEntry &unlimited = *table.find("free", 4);
+	CommandEntry &limited = *table.find("limited", 7);
+	CommandEntry &exhausted = *table.find("exhausted", 9);
+	limited.limit = std::make_shared<TokenBucket>(1e12, 1e6);
+	exhausted.limit = std::make_shared<TokenBucket>(1e-3, 1);
+
+	AdmissionControl open;
+	AdmissionControl clients;
+	clients.setClientLimit(1e12, 1e6);
+
+	auto measure = [&](AdmissionControl &admission, CommandEntry &entry) {
+		size_t admitted = 0;
+		auto start = BenchClock::now();
+		for( size_t n = 0; n < iterations; ++n ) {
+			admitted += admission.admit(entry, n % kClients + 1) == kAdmitted;
+		}
+		std::chrono::duration<double> elapsed = BenchClock::now() - start;
+		return std::make_pair(elapsed.count() * 1e9 / iterations, admitted);
+	};
+
+	auto report = [&](const char *name, std::pair<double, size_t> result) {
+		std::cerr << "admission: " << name << result.first << " ns/check, admitted " << result.second << " of " << iterations << std::endl;
+	};
+
+	report("no limits           ", measure(open, unlimited));
+	report("command bucket      ", measure(open, limited));
+	report("client+command      ", measure(clients, limited));
+	report("empty bucket        ", measure(open, exhausted));
+
+	// end to end, stream mode stops at "command" when throttled
+	CommandDispatcher dispatcher;
+	dispatcher.addCommandHandler("report", [](JsonValue &, ResponseWriter &) { return true; });
+	dispatcher.setDispatchMode(kDispatchStream);
+	const std::string command = R"({"command":"report","payload":{"status":"ok","samples":[1,2,3,4,5,6,7,8]}})";
+
+	auto dispatchAll = [&]() {
+		auto start = BenchClock::now();
+		for( size_t n = 0; n < iterations / 10; ++n ) {
+			dispatcher.dispatchCommand(command.data(), command.size(), [](const char *, size_t) {}, DispatchOrigin(0, n % kClients + 1));
+		}
+		std::chrono::duration<double> elapsed = BenchClock::now() - start;
+		return static_cast<size_t>((iterations / 10) / elapsed.count());
+	};
+
+	const size_t plain = dispatchAll();
+	dispatcher.setCommandRateLimit("report", 1e12, 1e6);
+	dispatcher.setClientRateLimit(1e12, 1e6);
+	const size_t checked = dispatchAll();
+	dispatcher.setCommandRateLimit("report", 1e-3, 1);
+	const size_t throttled = dispatchAll();
+
+	std::cerr << "admission: dispatch no limits " << plain << " commands/sec, with limits " << checked
+		<< " commands/sec, throttled " << throttled << " commands/sec" << std::endl;
+}
+
+// ----------------------------------------------------------------------------------------------- //
+
+///
+/// usage: dispatcher-bench-admission [iterations] [--suite admission]
+///
+int main(int argc, char *argv[])
+{
+	BenchOptions options;
+	if( !bench_init(argc, argv, options) ) {
+		return 1;
+	}
+
+	if( options.selected("admission") ) {
+		bench_admission(options.iterations * 10);
+	}
+
+	return 0;
+}
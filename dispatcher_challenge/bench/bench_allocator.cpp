@@ -0,0 +1,135 @@
+#include "bench.h"
+#include "alloc_counter.h"
+
+///
+///@brief benchmark of document chunks from malloc or the pool, and steady state allocations of a dispatch
+///
+
+// ----------------------------------------------------------------------------------------------- //
+
+///
+///@brief parse+dispatch throughput with document chunks from malloc and from the pool
+///
+void bench_allocator(const std::vector<std::string> &commands, size_t iterations)
+{
+	Controller controller;
+
+	CommandDispatcher crt_dispatcher(0);
+	init_dispatcher(crt_dispatcher, controller);
+
+	CommandDispatcher pool_dispatcher;
+	init_dispatcher(pool_dispatcher, controller);
+
+	// warm up
+	run_dispatch(crt_dispatcher, commands, iterations / 10 + 1);
+	run_dispatch(pool_dispatcher, commands, iterations / 10 + 1);
+
+	double crt = run_dispatch(crt_dispatcher, commands, iterations);
+	double pool = run_dispatch(pool_dispatcher, commands, iterations);
+
+	std::cerr << "allocator: malloc chunks: " << static_cast<size_t>(crt) << " commands/sec" << std::endl;
+	std::cerr << "allocator: pooled chunks: " << static_cast<size_t>(pool) << " commands/sec ("
+		<< (pool / crt) << "x)" << std::endl;
+}
+
+// ----------------------------------------------------------------------------------------------- //
+
+///
+///@brief heap allocations per command and throughput of one way of dispatching
+///
+template <typename DispatchFunc>
+void measure_allocations(const char *name, const std::vector<std::string> &commands, size_t iterations, DispatchFunc dispatch)
+{
+	// warm up, sizes the reused buffers
+	for( const std::string &command : commands ) {
+		dispatch(command);
+	}
+
+	size_t allocations = allocation_count();
+	auto start = BenchClock::now();
+
+	for( size_t n = 0; n < iterations; ++n ) {
+		for( const std::string &command : commands ) {
+			dispatch(command);
+		}
+	}
+
+	std::chrono::duration<double> elapsed = BenchClock::now() - start;
+	allocations = allocation_count() - allocations;
+
+	const double total = static_cast<double>(iterations * commands.size());
+	std::cerr << "insitu: " << name << ": " << (allocations / total) << " allocations/command, "
+		<< static_cast<size_t>(total / elapsed.count()) << " commands/sec" << std::endl;
+}
+
+///
+///@brief steady state allocations: per call Document::Parse versus the reused in situ context
+///
+void bench_insitu(const std::vector<std::string> &commands, size_t iterations)
+{
+	Controller controller;
+
+	CommandDispatcher crt_dispatcher(0);
+	init_dispatcher(crt_dispatcher, controller);
+
+	CommandDispatcher pool_dispatcher;
+	init_dispatcher(pool_dispatcher, controller);
+
+	if( !ALLOC_COUNTER_ENABLED ) {
+		std::cerr << "insitu: allocation counting needs glibc" << std::endl;
+	}
+
+	measure_allocations("Document::Parse per call", commands, iterations, [](const std::string &command) {
+		rapidjson::Document document;
+		document.Parse(command.c_str());
+		return document.HasMember("command");
+	});
+
+	measure_allocations("dispatchCommand, no pool", commands, iterations, [&crt_dispatcher](const std::string &command) {
+		return crt_dispatcher.dispatchCommand(command);
+	});
+
+	measure_allocations("dispatchCommand, pooled", commands, iterations, [&pool_dispatcher](const std::string &command) {
+		return pool_dispatcher.dispatchCommand(command);
+	});
+
+	// same commands with handlers that do nothing, isolates the dispatcher's own allocations
+	CommandDispatcher noop_dispatcher;
+	for( const char *name : { "help", "exit", "authenticate", "reloadUser", "deviceHealth" } ) {
+		noop_dispatcher.addCommandHandler(name, [](JsonValue &, ResponseWriter &) { return true; });
+	}
+
+	measure_allocations("dispatchCommand, pooled, no-op handlers", commands, iterations, [&noop_dispatcher](const std::string &command) {
+		return noop_dispatcher.dispatchCommand(command);
+	});
+
+	// caller owned mutable buffers, no copy at all
+	std::vector<std::string> buffers(commands);
+	measure_allocations("dispatchCommandInsitu", commands, iterations, [&pool_dispatcher, &buffers](const std::string &command) {
+		std::string &buffer = buffers[0];
+		buffer.assign(command);
+		return pool_dispatcher.dispatchCommandInsitu(&buffer[0]);
+	});
+}
+
+// ----------------------------------------------------------------------------------------------- //
+
+///
+/// usage: dispatcher-bench-allocator [iterations] [--suite allocator|insitu]
+///
+int main(int argc, char *argv[])
+{
+	BenchOptions options;
+	if( !bench_init(argc, argv, options) ) {
+		return 1;
+	}
+
+	if( options.selected("allocator") ) {
+		bench_allocator(builtin_commands(), options.iterations);
+	}
+	if( options.selected("insitu") ) {
+		bench_insitu(builtin_commands(), options.iterations);
+	}
+
+	return 0;
+}
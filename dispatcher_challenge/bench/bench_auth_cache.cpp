@@ -0,0 +1,148 @@
+#include <cmath>
+#include <random>
+#include <thread>
+
+#include "bench.h"
+
+///
+///@brief benchmark of the controller's authentication cache
+///
+
+// ----------------------------------------------------------------------------------------------- //
+
+///
+///@brief length ranks drawn from a Zipf(s) distribution over count ranks, rank 0 the most frequent
+///
+std::vector<size_t> zipf_sequence(size_t count, double s, size_t length, uint64_t seed)
+{
+	std::vector<double> cdf(count);
+	double sum = 0;
+	for( size_t n = 0; n < count; ++n ) {
+		sum += 1.0 / std::pow(double(n + 1), s);
+		cdf[n] = sum;
+	}
+
+	std::mt19937_64 rng(seed);
+	std::uniform_real_distribution<double> uniform(0, sum);
+	std::vector<size_t> sequence(length);
+	for( size_t &rank : sequence ) {
+		rank = std::min(count - 1, static_cast<size_t>(std::lower_bound(cdf.begin(), cdf.end(), uniform(rng)) - cdf.begin()));
+	}
+	return sequence;
+}
+
+///
+///@brief stand in for a real credential check, a few microseconds of hashing
+///
+AuthResult slow_authenticate(const std::string &token)
+{
+	uint64_t hash = fnv1a(token.data(), token.size());
+	for( size_t round = 0; round < 2000; ++round ) {
+		hash = (hash ^ (hash >> 29)) * 0xBF58476D1CE4E5B9ULL;
+	}
+	AuthResult result;
+	result.authenticated = hash != 0;
+	return result;
+}
+
+///
+///@brief hit ratio and throughput of the authentication cache with Zipfian tokens
+///
+void bench_auth_cache(size_t iterations)
+{
+	static const size_t kTokens = 100000;
+	static const double kSkew = 0.99;
+	static const size_t kThreads = 4;
+
+	std::vector<std::string> tokens(kTokens);
+	for( size_t n = 0; n < kTokens; ++n ) {
+		tokens[n] = "token-" + std::to_string(n * 2654435761ULL % 1000000007ULL);
+	}
+	const std::vector<size_t> sequence = zipf_sequence(kTokens, kSkew, iterations, 42);
+
+	auto run = [&](TtlCache<AuthResult> &cache, size_t first, size_t count) {
+		size_t authenticated = 0;
+		for( size_t n = first; n < first + count; ++n ) {
+			const std::string &token = tokens[sequence[n % sequence.size()]];
+			const uint64_t now = monotonicNs();
+			AuthResult result;
+			if( !cache.find(token.data(), token.size(), result, now) ) {
+				result = slow_authenticate(token);
+				cache.insert(token.data(), token.size(), result, now);
+			}
+			authenticated += result.authenticated;
+		}
+		return authenticated;
+	};
+
+	std::cerr << "authcache: " << kTokens << " tokens, zipf s=" << kSkew << std::endl;
+
+	for( size_t capacity : { size_t(0), size_t(1000), size_t(10000), size_t(50000) } ) {
+		TtlCache<AuthResult> cache(capacity, 60ULL * 1000000000ULL);
+		auto start = BenchClock::now();
+		run(cache, 0, iterations);
+		std::chrono::duration<double> elapsed = BenchClock::now() - start;
+
+		const TtlCacheStats stats = cache.stats();
+		std::cerr << "authcache: capacity " << capacity << ": " << static_cast<size_t>(iterations / elapsed.count())
+			<< " lookups/sec, hit ratio " << stats.hitRatio() << ", evictions " << stats.evictions << std::endl;
+	}
+
+	// shared by threads, shards keep them apart
+	{
+		TtlCache<AuthResult> cache(10000, 60ULL * 1000000000ULL);
+		std::vector<std::thread> threads;
+		auto start = BenchClock::now();
+		for( size_t t = 0; t < kThreads; ++t ) {
+			threads.emplace_back([&, t]() { run(cache, t * (iterations / kThreads), iterations); });
+		}
+		for( auto &thread : threads ) {
+			thread.join();
+		}
+		std::chrono::duration<double> elapsed = BenchClock::now() - start;
+
+		std::cerr << "authcache: capacity 10000, " << kThreads << " threads: "
+			<< static_cast<size_t>(kThreads * iterations / elapsed.count()) << " lookups/sec, hit ratio "
+			<< cache.stats().hitRatio() << std::endl;
+	}
+
+	// end to end, authenticate commands through the controller
+	std::vector<std::string> commands;
+	for( size_t n = 0; n < iterations / 10; ++n ) {
+		commands.push_back(R"({"command":"authenticate","payload":{"key":")" + tokens[sequence[n]] + R"("}})");
+	}
+	for( size_t capacity : { size_t(0), Controller::kAuthCacheCapacity } ) {
+		Controller controller(capacity);
+		CommandDispatcher dispatcher;
+		init_dispatcher(dispatcher, controller);
+
+		auto start = BenchClock::now();
+		for( const std::string &command : commands ) {
+			dispatcher.dispatchCommand(command.data(), command.size());
+		}
+		std::chrono::duration<double> elapsed = BenchClock::now() - start;
+
+		std::cerr << "authcache: dispatch authenticate, capacity " << capacity << ": "
+			<< static_cast<size_t>(commands.size() / elapsed.count()) << " commands/sec, hit ratio "
+			<< controller.keyCacheStats().hitRatio() << std::endl;
+	}
+}
+
+// ----------------------------------------------------------------------------------------------- //
+
+///
+/// usage: dispatcher-bench-auth-cache [iterations] [--suite authcache]
+///
+int main(int argc, char *argv[])
+{
+	BenchOptions options;
+	if( !bench_init(argc, argv, options) ) {
+		return 1;
+	}
+
+	if( options.selected("authcache") ) {
+		bench_auth_cache(options.iterations * 10);
+	}
+
+	return 0;
+}
@@ -0,0 +1,98 @@
+#include <thread>
+
+#include "bench.h"
+
+///
+///@brief benchmark of coalescing of idempotent commands
+///
+
+// ----------------------------------------------------------------------------------------------- //
+
+///
+///@brief identical polls of a slow handler from many threads, every run, coalesced in flight and with a result ttl
+///
+void bench_coalesce(size_t iterations)
+{
+	static const size_t kThreads = 8;
+	static const size_t kPayloads = 4;
+
+	const std::string poll = R"({"command":"poll","payload":{"device":"sensor-1","fields":["status","uptime"],"verbose":false}})";
+	const std::string reordered = R"({"command":"poll","payload":{"verbose":false,"fields":["status","uptime"],"device":"sensor-1"}})";
+
+	rapidjson::Document first, second;
+	first.Parse(poll.c_str());
+	second.Parse(reordered.c_str());
+	size_t sum = 0;
+	auto start = BenchClock::now();
+	for( size_t n = 0; n < iterations; ++n ) {
+		sum += canonicalJson(first["payload"]) == canonicalJson(second["payload"]);
+	}
+	std::chrono::duration<double> serializing = BenchClock::now() - start;
+	std::cerr << "coalesce: canonical json " << serializing.count() * 1e9 / iterations << " ns, reordered payload "
+		<< (sum == iterations ? "equal" : "differs") << std::endl;
+
+	auto run = [&](const char *name, bool idempotent, double ttl_ms) {
+		CommandDispatcher dispatcher;
+		std::atomic<size_t> runs{ 0 };
+		dispatcher.addCommandHandler("poll", [&runs](JsonValue &, ResponseWriter &response) {
+			++runs;
+			std::this_thread::sleep_for(std::chrono::microseconds(200));
+			response.StartObject();
+			response.Key("status");
+			response.String("good");
+			response.EndObject();
+			return true;
+		});
+		if( idempotent ) {
+			dispatcher.setCommandIdempotent("poll", true, ttl_ms);
+		}
+
+		std::vector<std::string> payloads;
+		for( size_t n = 0; n < kPayloads; ++n ) {
+			payloads.push_back(R"({"command":"poll","payload":{"device":"sensor-)" + std::to_string(n) + R"("}})");
+		}
+
+		const size_t perThread = iterations / 100 / kThreads + 1;
+		std::vector<std::thread> threads;
+		auto begin = BenchClock::now();
+		for( size_t t = 0; t < kThreads; ++t ) {
+			threads.emplace_back([&, t]() {
+				for( size_t n = 0; n < perThread; ++n ) {
+					const std::string &command = payloads[(n + t) % kPayloads];
+					dispatcher.dispatchCommand(command.data(), command.size());
+				}
+			});
+		}
+		for( auto &thread : threads ) {
+			thread.join();
+		}
+		std::chrono::duration<double> took = BenchClock::now() - begin;
+
+		const size_t dispatched = perThread * kThreads;
+		std::cerr << "coalesce: " << name << static_cast<size_t>(dispatched / took.count()) << " polls/sec, "
+			<< runs << " handler runs for " << dispatched << " polls" << std::endl;
+	};
+
+	run("every poll runs:   ", false, 0);
+	run("in flight:         ", true, 0);
+	run("in flight + 100ms: ", true, 100);
+}
+
+// ----------------------------------------------------------------------------------------------- //
+
+///
+/// usage: dispatcher-bench-coalesce [iterations] [--suite coalesce]
+///
+int main(int argc, char *argv[])
+{
+	BenchOptions options;
+	if( !bench_init(argc, argv, options) ) {
+		return 1;
+	}
+
+	if( options.selected("coalesce") ) {
+		bench_coalesce(options.iterations);
+	}
+
+	return 0;
+}
@@ -0,0 +1,112 @@
+#include <functional>
+
+#include "bench.h"
+#include "alloc_counter.h"
+
+///
+///@brief benchmark of handler construction and call overhead
+///
+
+// ----------------------------------------------------------------------------------------------- //
+
+///@brief handler target of the delegate bench, counts its calls
+struct CallCounter
+{
+	uint64_t calls;
+	char state[16];   ///< makes a bound copy too large for std::function's small buffer
+
+	bool count(JsonValue &, ResponseWriter &)
+	{
+		calls++;
+		return true;
+	}
+};
+
+///
+///@brief time iterations calls of a handler, the handler is reloaded every call so it is not inlined
+///
+///@return ns per call
+///
+template <typename Handler>
+double time_calls(Handler &handler, size_t iterations, JsonValue &command, ResponseWriter &response)
+{
+	auto start = BenchClock::now();
+	for( size_t n = 0; n < iterations; ++n ) {
+		asm volatile("" : : "g"(&handler) : "memory");
+		handler(command, response);
+	}
+	std::chrono::duration<double> elapsed = BenchClock::now() - start;
+	return elapsed.count() * 1e9 / iterations;
+}
+
+///
+///@brief handler construction allocations and call overhead: std::bind in std::function versus CommandDelegate
+///
+void bench_delegate(size_t iterations)
+{
+	static const size_t kHandlers = 1000;
+
+	CallCounter counter = CallCounter();
+	JsonValue command(rapidjson::kObjectType);
+	rapidjson::StringBuffer buffer;
+	ResponseWriter response(buffer);
+
+	typedef std::function<bool(JsonValue &, ResponseWriter &)> FunctionHandler;
+	std::vector<FunctionHandler> functions;
+	std::vector<CommandHandler> lambdas;
+	std::vector<CommandHandler> delegates;
+	functions.reserve(kHandlers);
+	lambdas.reserve(kHandlers);
+	delegates.reserve(kHandlers);
+
+	size_t allocations = allocation_count();
+	for( size_t n = 0; n < kHandlers; ++n ) {
+		functions.emplace_back(std::bind(&CallCounter::count, counter, std::placeholders::_1, std::placeholders::_2));
+	}
+	const size_t functionAllocations = allocation_count() - allocations;
+
+	allocations = allocation_count();
+	for( size_t n = 0; n < kHandlers; ++n ) {
+		lambdas.emplace_back([&counter](JsonValue &json, ResponseWriter &writer) { return counter.count(json, writer); });
+	}
+	const size_t lambdaAllocations = allocation_count() - allocations;
+
+	allocations = allocation_count();
+	for( size_t n = 0; n < kHandlers; ++n ) {
+		delegates.emplace_back(ON_COMMAND_DELEGATE(counter, CallCounter, count));
+	}
+	const size_t delegateAllocations = allocation_count() - allocations;
+
+	allocations = allocation_count();
+	const double functionNs = time_calls(functions[0], iterations, command, response);
+	const double lambdaNs = time_calls(lambdas[0], iterations, command, response);
+	const double delegateNs = time_calls(delegates[0], iterations, command, response);
+	const size_t callAllocations = allocation_count() - allocations;
+
+	std::cerr << "delegate: std::function(std::bind)   " << functionNs << " ns/call, "
+		<< (double(functionAllocations) / kHandlers) << " allocations/handler" << std::endl;
+	std::cerr << "delegate: CommandDelegate(lambda)    " << lambdaNs << " ns/call, "
+		<< (double(lambdaAllocations) / kHandlers) << " allocations/handler" << std::endl;
+	std::cerr << "delegate: CommandDelegate(method)    " << delegateNs << " ns/call, "
+		<< (double(delegateAllocations) / kHandlers) << " allocations/handler" << std::endl;
+	std::cerr << "delegate: " << callAllocations << " allocations in " << iterations * 3 << " calls" << std::endl;
+}
+
+// ----------------------------------------------------------------------------------------------- //
+
+///
+/// usage: dispatcher-bench-delegate [iterations] [--suite delegate]
+///
+int main(int argc, char *argv[])
+{
+	BenchOptions options;
+	if( !bench_init(argc, argv, options) ) {
+		return 1;
+	}
+
+	if( options.selected("delegate") ) {
+		bench_delegate(options.iterations * 10);
+	}
+
+	return 0;
+}
@@ -0,0 +1,265 @@
+#include "bench.h"
+#include "alloc_counter.h"
+
+///
+///@brief benchmark of reading the envelope: DOM versus stream, schema validation, MessagePack
+///
+
+// ----------------------------------------------------------------------------------------------- //
+
+///
+///@brief DOM versus streaming dispatch of commands carrying ~100KB
+///
+void bench_stream(size_t iterations)
+{
+	static const size_t kPayloadBytes = 100 * 1024;
+
+	const std::string samples = make_samples(kPayloadBytes);
+
+	struct Case
+	{
+		const char *name;
+		std::string json;
+	};
+
+	const Case cases[] = {
+		// routing needs the payload, both modes build it
+		{ "large payload", "{\"command\":\"deviceHealth\",\"payload\":{\"status\":\"healthy.\",\"samples\":" + samples + "}}" },
+		// large sibling of the payload, only the DOM builds it
+		{ "large sibling", "{\"command\":\"deviceHealth\",\"trace\":" + samples + ",\"payload\":{\"status\":\"healthy.\"}}" },
+		// unknown command, the stream stops at the command
+		{ "unknown command", "{\"command\":\"deviceStats\",\"payload\":{\"samples\":" + samples + "}}" },
+	};
+
+	Controller controller;
+	CommandDispatcher dispatcher;
+	init_dispatcher(dispatcher, controller);
+
+	for( const Case &test : cases ) {
+		double rates[2];
+		const DispatchMode modes[2] = { kDispatchDom, kDispatchStream };
+
+		for( int m = 0; m < 2; ++m ) {
+			dispatcher.setDispatchMode(modes[m]);
+			dispatcher.dispatchCommand(test.json);
+
+			auto start = BenchClock::now();
+			for( size_t n = 0; n < iterations; ++n ) {
+				dispatcher.dispatchCommand(test.json);
+			}
+			std::chrono::duration<double> elapsed = BenchClock::now() - start;
+			rates[m] = iterations / elapsed.count();
+		}
+
+		const double megabytes = test.json.size() / (1024.0 * 1024.0);
+		std::cerr << "stream: " << test.name << " (" << test.json.size() / 1024 << "KB): dom "
+			<< static_cast<size_t>(rates[0]) << " commands/sec " << rates[0] * megabytes << " MB/s, stream "
+			<< static_cast<size_t>(rates[1]) << " commands/sec " << rates[1] * megabytes << " MB/s" << std::endl;
+	}
+}
+
+// ----------------------------------------------------------------------------------------------- //
+
+///
+///@brief cost of payload schema validation, in the parse (command first) versus a second walk (payload first)
+///
+void bench_schema(size_t iterations)
+{
+	static const size_t kPayloadBytes = 4 * 1024;
+
+	static const char *const kSchema = R"({
+		"type": "object",
+		"properties": {
+			"status": { "type": "string", "minLength": 1 },
+			"samples": {
+				"type": "array",
+				"items": {
+					"type": "object",
+					"properties": {
+						"id": { "type": "integer", "minimum": 0 },
+						"temperature": { "type": "number" },
+						"label": { "type": "string" },
+						"ok": { "type": "boolean" }
+					},
+					"required": [ "id", "temperature", "label", "ok" ]
+				}
+			}
+		},
+		"required": [ "status", "samples" ]
+	})";
+
+	const std::string samples = make_samples(kPayloadBytes);
+	const std::string payload = "{\"status\":\"healthy.\",\"samples\":" + samples + "}";
+	const std::string commandFirst = "{\"command\":\"report\",\"payload\":" + payload + "}";
+	const std::string payloadFirst = "{\"payload\":" + payload + ",\"command\":\"report\"}";
+
+	CommandDispatcher plain;
+	plain.addCommandHandler("report", [](JsonValue &, ResponseWriter &) { return true; });
+
+	CommandDispatcher validated;
+	validated.addCommandHandler("report", [](JsonValue &, ResponseWriter &) { return true; }, kSchema);
+
+	struct Case
+	{
+		const char *name;
+		CommandDispatcher *dispatcher;
+		DispatchMode mode;
+		const std::string *json;
+	};
+
+	const Case cases[] = {
+		{ "dom, no schema          ", &plain, kDispatchDom, &commandFirst },
+		{ "dom, schema (1 pass)    ", &validated, kDispatchDom, &commandFirst },
+		{ "dom, payload first      ", &validated, kDispatchDom, &payloadFirst },
+		{ "stream, no schema       ", &plain, kDispatchStream, &commandFirst },
+		{ "stream, schema (1 pass) ", &validated, kDispatchStream, &commandFirst },
+		{ "stream, payload first   ", &validated, kDispatchStream, &payloadFirst },
+	};
+
+	std::cerr << "schema: " << commandFirst.size() / 1024 << "KB commands" << std::endl;
+
+	for( const Case &test : cases ) {
+		test.dispatcher->setDispatchMode(test.mode);
+		if( !test.dispatcher->dispatchCommand(*test.json) ) {
+			std::cerr << "schema: " << test.name << " rejected" << std::endl;
+			continue;
+		}
+
+		auto start = BenchClock::now();
+		for( size_t n = 0; n < iterations; ++n ) {
+			test.dispatcher->dispatchCommand(*test.json);
+		}
+		std::chrono::duration<double> elapsed = BenchClock::now() - start;
+
+		std::cerr << "schema: " << test.name << static_cast<size_t>(iterations / elapsed.count()) << " commands/sec, "
+			<< (elapsed.count() * 1e6 / iterations) << " us/command" << std::endl;
+	}
+}
+
+// ----------------------------------------------------------------------------------------------- //
+
+///
+///@brief a json command as MessagePack
+///
+std::string to_msgpack(const std::string &json)
+{
+	rapidjson::Document document;
+	document.Parse(json.c_str());
+	std::string packed;
+	MsgPackWriter writer(packed);
+	document.Accept(writer);
+	return packed;
+}
+
+///
+///@brief decode cost and dispatch throughput of the built-in commands as json and as MessagePack
+///
+void bench_msgpack(const std::vector<std::string> &commands, size_t iterations)
+{
+	std::vector<std::string> packed;
+	size_t jsonBytes = 0;
+	size_t packedBytes = 0;
+	for( const std::string &command : commands ) {
+		packed.push_back(to_msgpack(command));
+		jsonBytes += command.size();
+		packedBytes += packed.back().size();
+	}
+	std::cerr << "msgpack: " << commands.size() << " commands, json " << jsonBytes << " bytes, msgpack " << packedBytes << " bytes" << std::endl;
+
+	// decode alone, into a reused document as the dispatcher does
+	auto decode = [&](const std::vector<std::string> &inputs, bool binary) {
+		std::vector<char> scratch;
+		rapidjson::Document document;
+		size_t members = 0;
+		auto start = BenchClock::now();
+		for( size_t n = 0; n < iterations; ++n ) {
+			for( const std::string &input : inputs ) {
+				scratch.assign(input.begin(), input.end());
+				scratch.push_back('\0');
+				if( binary ) {
+					auto generate = [&](rapidjson::Document &out) {
+						MsgPackReader reader;
+						return reader.parseInsitu(scratch.data(), input.size(), out) == kMsgPackOk;
+					};
+					document.Populate(generate);
+				}
+				else {
+					document.ParseInsitu(scratch.data());
+				}
+				members += document.MemberCount();
+			}
+		}
+		std::chrono::duration<double> elapsed = BenchClock::now() - start;
+		return std::make_pair(elapsed.count() * 1e9 / (iterations * inputs.size()), members);
+	};
+
+	const auto json = decode(commands, false);
+	const auto binary = decode(packed, true);
+	std::cerr << "msgpack: decode json " << json.first << " ns/command, msgpack " << binary.first << " ns/command ("
+		<< json.first / binary.first << "x), members " << json.second << "/" << binary.second << std::endl;
+
+	for( DispatchMode mode : { kDispatchDom, kDispatchStream } ) {
+		// no auth cache, the second dispatch of a key would report "cached"
+		Controller controller(0);
+		CommandDispatcher dispatcher;
+		init_dispatcher(dispatcher, controller);
+		dispatcher.setDispatchMode(mode);
+
+		// same responses either way, exit is dispatched but g_done only matters to the application
+		size_t mismatched = 0;
+		for( size_t n = 0; n < commands.size(); ++n ) {
+			std::string expected, actual;
+			dispatcher.dispatchCommand(commands[n].data(), commands[n].size(),
+				[&expected](const char *response, size_t length) { expected.assign(response, length); });
+			dispatcher.dispatchCommand(packed[n].data(), packed[n].size(),
+				[&actual](const char *response, size_t length) { actual.assign(response, length); });
+			mismatched += expected != actual;
+		}
+
+		size_t allocations = 0;
+		auto dispatchAll = [&](const std::vector<std::string> &inputs) {
+			const size_t before = allocation_count();
+			auto start = BenchClock::now();
+			for( size_t n = 0; n < iterations; ++n ) {
+				for( const std::string &input : inputs ) {
+					dispatcher.dispatchCommand(input.data(), input.size());
+				}
+			}
+			std::chrono::duration<double> elapsed = BenchClock::now() - start;
+			allocations = allocation_count() - before;
+			return static_cast<size_t>(iterations * inputs.size() / elapsed.count());
+		};
+
+		const size_t jsonRate = dispatchAll(commands);
+		const size_t packedRate = dispatchAll(packed);
+		std::cerr << "msgpack: dispatch " << (mode == kDispatchDom ? "dom   " : "stream") << " json " << jsonRate
+			<< " commands/sec, msgpack " << packedRate << " commands/sec (" << allocations << " allocations), "
+			<< mismatched << " responses differ" << std::endl;
+	}
+	g_done = false;
+}
+
+// ----------------------------------------------------------------------------------------------- //
+
+///
+/// usage: dispatcher-bench-envelope [iterations] [--suite stream|schema|msgpack]
+///
+int main(int argc, char *argv[])
+{
+	BenchOptions options;
+	if( !bench_init(argc, argv, options) ) {
+		return 1;
+	}
+
+	if( options.selected("stream") ) {
+		bench_stream(options.iterations / 100 + 1);
+	}
+	if( options.selected("schema") ) {
+		bench_schema(options.iterations / 20 + 1);
+	}
+	if( options.selected("msgpack") ) {
+		bench_msgpack(builtin_commands(), options.iterations);
+	}
+
+	return 0;
+}
@@ -0,0 +1,191 @@
+#include "rapidjson/prettywriter.h"
+
+#include "bench.h"
+
+///
+///@brief benchmark of the dispatch latency per command and per phase
+///
+
+// ----------------------------------------------------------------------------------------------- //
+
+///
+///@brief p50/p99/p999 of a set of latency samples in nanoseconds
+///
+struct Percentiles
+{
+	explicit Percentiles(std::vector<uint64_t> &samples)
+	{
+		std::sort(samples.begin(), samples.end());
+		p50 = at(samples, 0.5);
+		p99 = at(samples, 0.99);
+		p999 = at(samples, 0.999);
+	}
+
+	static uint64_t at(const std::vector<uint64_t> &sorted, double rank)
+	{
+		return sorted.empty() ? 0 : sorted[std::min(sorted.size() - 1, static_cast<size_t>(sorted.size() * rank))];
+	}
+
+	template <typename Writer>
+	void write(Writer &writer, const char *name) const
+	{
+		writer.Key(name);
+		writer.StartObject();
+		writer.Key("p50");
+		writer.Uint64(p50);
+		writer.Key("p99");
+		writer.Uint64(p99);
+		writer.Key("p999");
+		writer.Uint64(p999);
+		writer.EndObject();
+	}
+
+	uint64_t p50;
+	uint64_t p99;
+	uint64_t p999;
+};
+
+std::ostream & operator<<(std::ostream &out, const Percentiles &percentiles)
+{
+	return out << percentiles.p50 << "/" << percentiles.p99 << "/" << percentiles.p999;
+}
+
+///
+///@brief per command throughput and parse / lookup / admission / validation / handler latency of the built-in and large commands
+///
+///@param json Receives the results as a json array, NULL for console output only.
+///
+template <typename Writer>
+void bench_latency(const std::vector<std::string> &commands, size_t iterations, Writer *json)
+{
+	static const char *const kNames[] = { "help", "exit", "authenticate", "reloadUser", "deviceHealth" };
+	static const size_t kLargeBytes[] = { 16 * 1024, 256 * 1024 };
+
+	struct Case
+	{
+		std::string name;
+		std::string json;
+		size_t iterations;
+	};
+
+	std::vector<Case> cases;
+	for( size_t n = 0; n < commands.size(); ++n ) {
+		cases.push_back(Case{ kNames[n], commands[n], iterations });
+	}
+	for( size_t bytes : kLargeBytes ) {
+		// same command and handler, the payload carries a large sample array
+		cases.push_back(Case{ "deviceHealth+" + std::to_string(bytes / 1024) + "KB",
+			"{\"command\":\"deviceHealth\",\"payload\":{\"status\":\"healthy.\",\"samples\":" + make_samples(bytes) + "}}",
+			std::max<size_t>(iterations * 1024 / bytes, 100) });
+	}
+
+	Controller controller;
+	CommandDispatcher dispatcher;
+	init_dispatcher(dispatcher, controller);
+	dispatcher.setPhaseTiming(true);
+
+	const DispatchMode modes[] = { kDispatchDom, kDispatchStream };
+
+	if( json != NULL ) {
+		json->StartArray();
+	}
+
+	for( DispatchMode mode : modes ) {
+		const char *modeName = mode == kDispatchDom ? "dom" : "stream";
+		dispatcher.setDispatchMode(mode);
+
+		for( const Case &test : cases ) {
+			std::vector<uint64_t> total, parse, lookup, admission, validation, handler;
+			total.reserve(test.iterations);
+			parse.reserve(test.iterations);
+			lookup.reserve(test.iterations);
+			admission.reserve(test.iterations);
+			validation.reserve(test.iterations);
+			handler.reserve(test.iterations);
+
+			dispatcher.dispatchCommand(test.json);
+
+			auto start = BenchClock::now();
+			for( size_t n = 0; n < test.iterations; ++n ) {
+				const uint64_t begin = monotonicNs();
+				dispatcher.dispatchCommand(test.json);
+				total.push_back(monotonicNs() - begin);
+
+				const DispatchTiming &timing = dispatcher.lastPhaseTiming();
+				parse.push_back(timing.parseNs);
+				lookup.push_back(timing.lookupNs);
+				admission.push_back(timing.admissionNs);
+				validation.push_back(timing.validationNs);
+				handler.push_back(timing.handlerNs);
+			}
+			std::chrono::duration<double> elapsed = BenchClock::now() - start;
+			const double rate = test.iterations / elapsed.count();
+
+			const Percentiles totalP(total), parseP(parse), lookupP(lookup), admissionP(admission), validationP(validation), handlerP(handler);
+
+			std::cerr << "latency: " << modeName << " " << test.name << " (" << test.json.size() << "B): "
+				<< static_cast<size_t>(rate) << " commands/sec, p50/p99/p999 ns total " << totalP
+				<< " parse " << parseP << " lookup " << lookupP << " admission " << admissionP
+				<< " validation " << validationP << " handler " << handlerP << std::endl;
+
+			if( json != NULL ) {
+				json->StartObject();
+				json->Key("command");
+				json->String(test.name.c_str());
+				json->Key("mode");
+				json->String(modeName);
+				json->Key("bytes");
+				json->Uint64(test.json.size());
+				json->Key("iterations");
+				json->Uint64(test.iterations);
+				json->Key("commands_per_sec");
+				json->Double(rate);
+				totalP.write(*json, "total_ns");
+				parseP.write(*json, "parse_ns");
+				lookupP.write(*json, "lookup_ns");
+				admissionP.write(*json, "admission_ns");
+				validationP.write(*json, "validation_ns");
+				handlerP.write(*json, "handler_ns");
+				json->EndObject();
+			}
+		}
+	}
+
+	if( json != NULL ) {
+		json->EndArray();
+	}
+}
+
+// ----------------------------------------------------------------------------------------------- //
+
+///
+/// usage: dispatcher-bench [iterations] [--json]
+///
+///        --json   write the results as json to stdout
+///
+int main(int argc, char *argv[])
+{
+	BenchOptions options;
+	if( !bench_init(argc, argv, options) ) {
+		return 1;
+	}
+
+	rapidjson::StringBuffer buffer;
+	rapidjson::PrettyWriter<rapidjson::StringBuffer> writer(buffer);
+
+	if( options.json ) {
+		writer.StartObject();
+		writer.Key("iterations");
+		writer.Uint64(options.iterations);
+		writer.Key("latency");
+	}
+
+	bench_latency(builtin_commands(), options.iterations, options.json ? &writer : NULL);
+
+	if( options.json ) {
+		writer.EndObject();
+		std::cout << buffer.GetString() << std::endl;
+	}
+
+	return 0;
+}
@@ -0,0 +1,82 @@
+#include "bench.h"
+
+///
+///@brief benchmark of namespace middleware
+///
+
+// ----------------------------------------------------------------------------------------------- //
+
+///@brief middleware counting the dispatches it wraps
+struct CountingMiddleware : public Middleware
+{
+	CountingMiddleware() : calls{ 0 }
+	{
+	}
+
+	bool before(CommandCall &) override
+	{
+		calls.fetch_add(1, std::memory_order_relaxed);
+		return true;
+	}
+
+	std::atomic<size_t> calls;
+};
+
+///
+///@brief dispatch cost by namespace depth, without middleware, with one at the root and with one at every level
+///
+void bench_middleware(size_t iterations)
+{
+	static const size_t kDepth = 6;
+
+	auto run = [&](const char *name, bool root, bool everyLevel) {
+		CommandDispatcher dispatcher;
+		std::vector<std::string> commands;
+		std::string path;
+		for( size_t depth = 1; depth <= kDepth; ++depth ) {
+			path += (depth > 1 ? "." : "") + std::string(1, static_cast<char>('a' + depth - 1));
+			dispatcher.addCommandHandler(path, [](JsonValue &, ResponseWriter &response) {
+				response.Bool(true);
+				return true;
+			});
+			if( everyLevel ) {
+				dispatcher.addMiddleware(path, std::make_shared<CountingMiddleware>());
+			}
+			commands.push_back(R"({"command":")" + path + R"(","payload":{}})");
+		}
+		if( root ) {
+			dispatcher.addMiddleware("", std::make_shared<CountingMiddleware>());
+		}
+
+		std::cerr << "middleware: " << name;
+		for( size_t depth = 1; depth <= kDepth; depth += kDepth - 1 ) {
+			const std::vector<std::string> one{ commands[depth - 1] };
+			const double rate = run_dispatch(dispatcher, one, iterations);
+			std::cerr << " depth " << depth << " " << static_cast<size_t>(1e9 / rate) << " ns";
+		}
+		std::cerr << std::endl;
+	};
+
+	run("none:        ", false, false);
+	run("root:        ", true, false);
+	run("every level: ", false, true);
+}
+
+// ----------------------------------------------------------------------------------------------- //
+
+///
+/// usage: dispatcher-bench-middleware [iterations] [--suite middleware]
+///
+int main(int argc, char *argv[])
+{
+	BenchOptions options;
+	if( !bench_init(argc, argv, options) ) {
+		return 1;
+	}
+
+	if( options.selected("middleware") ) {
+		bench_middleware(options.iterations);
+	}
+
+	return 0;
+}
@@ -0,0 +1,62 @@
+#include "bench.h"
+
+///
+///@brief benchmark of the command recorder
+///
+
+// ----------------------------------------------------------------------------------------------- //
+
+///
+///@brief dispatch throughput with and without the command recorder, and the log it writes
+///
+void bench_record(const std::vector<std::string> &commands, size_t iterations)
+{
+	static const char *const kLog = "dispatcher-bench-record.log";
+
+	Controller controller(0);
+	CommandDispatcher dispatcher;
+	init_dispatcher(dispatcher, controller);
+
+	const double plain = run_dispatch(dispatcher, commands, iterations);
+
+	CommandRecorder recorder;
+	if( !recorder.open(kLog) ) {
+		std::cerr << "record: cannot open " << kLog << std::endl;
+		return;
+	}
+	dispatcher.setRecorder(&recorder);
+	const double recording = run_dispatch(dispatcher, commands, iterations);
+	dispatcher.setRecorder(NULL);
+	recorder.close();
+	g_done = false;
+
+	CommandLog log;
+	std::string error;
+	const bool loaded = log.load(kLog, error);
+	std::remove(kLog);
+
+	std::cerr << "record: dispatch " << static_cast<size_t>(plain) << " commands/sec, recording "
+		<< static_cast<size_t>(recording) << " commands/sec (" << recording / plain << "x)" << std::endl;
+	std::cerr << "record: " << recorder.recorded() << " recorded, " << recorder.dropped() << " dropped, "
+		<< (loaded ? log.commands().size() : 0) << " read back, "
+		<< double(recorder.written()) / std::max<uint64_t>(recorder.recorded(), 1) << " bytes/command" << std::endl;
+}
+
+// ----------------------------------------------------------------------------------------------- //
+
+///
+/// usage: dispatcher-bench-recorder [iterations] [--suite record]
+///
+int main(int argc, char *argv[])
+{
+	BenchOptions options;
+	if( !bench_init(argc, argv, options) ) {
+		return 1;
+	}
+
+	if( options.selected("record") ) {
+		bench_record(builtin_commands(), options.iterations);
+	}
+
+	return 0;
+}
@@ -0,0 +1,135 @@
+#include <thread>
+
+#include "bench.h"
+
+///
+///@brief benchmark of the shared memory ring against the Unix socket front end
+///
+
+// ----------------------------------------------------------------------------------------------- //
+
+///
+///@brief round trip latency percentiles in ns, and the rate, of send(n) followed by receive(n)
+///
+template <typename Send, typename Receive>
+void measure_round_trips(const char *name, size_t round_trips, size_t pipeline, Send &&send, Receive &&receive)
+{
+	std::vector<uint64_t> latencies;
+	latencies.reserve(round_trips);
+	size_t failed = 0;
+
+	auto start = BenchClock::now();
+	for( size_t n = 0; n < round_trips; n += pipeline ) {
+		const uint64_t sent = monotonicNs();
+		for( size_t p = 0; p < pipeline; ++p ) {
+			failed += !send();
+		}
+		for( size_t p = 0; p < pipeline; ++p ) {
+			failed += !receive();
+			latencies.push_back(monotonicNs() - sent);
+		}
+	}
+	std::chrono::duration<double> elapsed = BenchClock::now() - start;
+
+	std::sort(latencies.begin(), latencies.end());
+	auto percentile = [&latencies](double rank) {
+		return latencies[std::min(latencies.size() - 1, static_cast<size_t>(latencies.size() * rank))];
+	};
+	std::cerr << "shm: " << name << " pipeline " << pipeline << ": " << static_cast<size_t>(latencies.size() / elapsed.count())
+		<< " requests/sec, latency ns p50 " << percentile(0.5) << " p99 " << percentile(0.99) << " p999 " << percentile(0.999)
+		<< (failed > 0 ? ", " + std::to_string(failed) + " failed" : std::string()) << std::endl;
+}
+
+///
+///@brief request/response latency of the shared memory ring against the Unix socket front end
+///
+void bench_shm(size_t round_trips)
+{
+	const std::string socketPath = "/tmp/dispatcher-bench-" + std::to_string(::getpid()) + ".sock";
+	const std::string shmPath = "/tmp/dispatcher-bench-" + std::to_string(::getpid()) + ".shm";
+	// newline framing, the request must be a single line
+	std::string request = help_command;
+	request.erase(std::remove(request.begin(), request.end(), '\n'), request.end());
+
+	Controller controller(0);
+	CommandDispatcher dispatcher;
+	init_dispatcher(dispatcher, controller);
+
+	std::atomic_bool stop{ false };
+	auto done = [&stop]() { return stop.load(); };
+
+	DispatchServer socketServer(dispatcher);
+	ShmServer shmServer(dispatcher);
+	if( !socketServer.listenUnix(socketPath) || !shmServer.listen(shmPath) ) {
+		std::cerr << "shm: cannot listen: " << std::strerror(errno) << std::endl;
+		return;
+	}
+	std::thread socketThread([&]() { socketServer.run(done); });
+	std::thread shmThread([&]() { shmServer.run(done); });
+
+	// unix socket, newline framing, blocking client
+	int fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	sockaddr_un address;
+	std::memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	std::strncpy(address.sun_path, socketPath.c_str(), sizeof(address.sun_path) - 1);
+	if( ::connect(fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) == 0 ) {
+		const std::string line = request + "\n";
+		std::string in;
+		char buffer[4096];
+		auto send = [&]() { return ::write(fd, line.data(), line.size()) == static_cast<ssize_t>(line.size()); };
+		auto receive = [&]() {
+			for( ;; ) {
+				const size_t newline = in.find('\n');
+				if( newline != std::string::npos ) {
+					in.erase(0, newline + 1);
+					return true;
+				}
+				const ssize_t got = ::read(fd, buffer, sizeof(buffer));
+				if( got <= 0 ) {
+					return false;
+				}
+				in.append(buffer, static_cast<size_t>(got));
+			}
+		};
+		measure_round_trips("unix socket", round_trips, 1, send, receive);
+		measure_round_trips("unix socket", round_trips, 32, send, receive);
+	}
+	::close(fd);
+
+	ShmClient client;
+	if( client.connect(shmPath) ) {
+		auto send = [&]() { return client.send(request.data(), request.size()); };
+		auto receive = [&]() { return client.receive([](const char *, size_t) {}); };
+		measure_round_trips("shared ring", round_trips, 1, send, receive);
+		measure_round_trips("shared ring", round_trips, 32, send, receive);
+	}
+	else {
+		std::cerr << "shm: cannot connect: " << std::strerror(errno) << std::endl;
+	}
+	client.close();
+
+	stop = true;
+	socketThread.join();
+	shmThread.join();
+	std::cerr << "shm: " << shmServer.requests() << " ring requests, " << shmServer.dropped() << " responses dropped" << std::endl;
+}
+
+// ----------------------------------------------------------------------------------------------- //
+
+///
+/// usage: dispatcher-bench-shm [iterations] [--suite shm]
+///
+int main(int argc, char *argv[])
+{
+	BenchOptions options;
+	if( !bench_init(argc, argv, options) ) {
+		return 1;
+	}
+
+	if( options.selected("shm") ) {
+		bench_shm(options.iterations / 2 + 1);
+	}
+
+	return 0;
+}
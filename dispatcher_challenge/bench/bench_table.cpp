@@ -0,0 +1,135 @@
+#include <map>
+#include <thread>
+
+#include "bench.h"
+
+///
+///@brief benchmark of the handler table: lookup and re-registration under load
+///
+
+// ----------------------------------------------------------------------------------------------- //
+
+///
+///@brief handler lookup with hundreds of registered commands: std::map and the probing table
+///
+void bench_lookup(size_t iterations)
+{
+	static const size_t kCommands = 500;
+
+	std::vector<std::string> names;
+	std::map<std::string, CommandHandler> map;
+	CommandTable table;
+
+	for( size_t n = 0; n < kCommands; ++n ) {
+		names.push_back("device.command." + std::to_string(n));
+		CommandHandler handler = [](JsonValue &, ResponseWriter &) { return true; };
+		map.emplace(names.back(), handler);
+		table.insert(names.back(), handler);
+	}
+
+	size_t found = 0;
+	auto start = BenchClock::now();
+	for( size_t n = 0; n < iterations; ++n ) {
+		found += map.find(names[n % kCommands].c_str()) != map.end();
+	}
+	std::chrono::duration<double> mapTime = BenchClock::now() - start;
+
+	start = BenchClock::now();
+	for( size_t n = 0; n < iterations; ++n ) {
+		const std::string &name = names[n % kCommands];
+		found += table.find(name.data(), name.size()) != NULL;
+	}
+	std::chrono::duration<double> tableTime = BenchClock::now() - start;
+
+
+	std::cerr << "lookup: " << kCommands << " commands, found " << found << " of " << iterations * 2 << std::endl;
+	std::cerr << "lookup: std::map   " << (mapTime.count() * 1e9 / iterations) << " ns" << std::endl;
+	std::cerr << "lookup: probing    " << (tableTime.count() * 1e9 / iterations) << " ns" << std::endl;
+}
+
+// ----------------------------------------------------------------------------------------------- //
+
+///
+///@brief cost of a table snapshot, and dispatch throughput while another thread keeps re-registering handlers
+///
+void bench_reload(size_t iterations)
+{
+	static const size_t kThreads = 4;
+
+	RcuPointer<CommandTable> pointer;
+	size_t sum = 0;
+	auto start = BenchClock::now();
+	for( size_t n = 0; n < iterations; ++n ) {
+		RcuPointer<CommandTable>::Snapshot table(pointer);
+		sum += table->size();
+	}
+	std::chrono::duration<double> elapsed = BenchClock::now() - start;
+	std::cerr << "reload: snapshot " << elapsed.count() * 1e9 / iterations << " ns (" << sum << ")" << std::endl;
+
+	auto run = [&](bool reload) {
+		CommandDispatcher dispatcher;
+		std::atomic<size_t> calls{ 0 };
+		for( int n = 0; n < 32; ++n ) {
+			dispatcher.addCommandHandler("command" + std::to_string(n), [&calls](JsonValue &, ResponseWriter &) { ++calls; return true; });
+		}
+
+		std::atomic_bool stop{ false };
+		std::atomic<size_t> failed{ 0 };
+		size_t registrations = 0;
+
+		std::thread writer([&]() {
+			while( reload && !stop ) {
+				dispatcher.addCommandHandler("command" + std::to_string(registrations % 32),
+					[&calls](JsonValue &, ResponseWriter &) { ++calls; return true; });
+				++registrations;
+				std::this_thread::yield();
+			}
+		});
+
+		std::vector<std::thread> threads;
+		auto begin = BenchClock::now();
+		for( size_t t = 0; t < kThreads; ++t ) {
+			threads.emplace_back([&, t]() {
+				for( size_t n = 0; n < iterations / kThreads; ++n ) {
+					const std::string command = R"({"command":"command)" + std::to_string((n + t) % 32) + R"(","payload":{}})";
+					failed += !dispatcher.dispatchCommand(command.data(), command.size());
+				}
+			});
+		}
+		for( auto &thread : threads ) {
+			thread.join();
+		}
+		std::chrono::duration<double> took = BenchClock::now() - begin;
+		stop = true;
+		writer.join();
+
+		std::cerr << "reload: " << kThreads << " dispatch threads, " << (reload ? "re-registering: " : "static table:   ")
+			<< static_cast<size_t>(iterations / took.count()) << " commands/sec, " << registrations << " registrations, "
+			<< failed << " failed, " << calls << " handled" << std::endl;
+	};
+
+	run(false);
+	run(true);
+}
+
+// ----------------------------------------------------------------------------------------------- //
+
+///
+/// usage: dispatcher-bench-table [iterations] [--suite lookup|reload]
+///
+int main(int argc, char *argv[])
+{
+	BenchOptions options;
+	if( !bench_init(argc, argv, options) ) {
+		return 1;
+	}
+
+	if( options.selected("lookup") ) {
+		bench_lookup(options.iterations * 10);
+	}
+	if( options.selected("reload") ) {
+		bench_reload(options.iterations);
+	}
+
+	return 0;
+}
@@ -0,0 +1,139 @@
+#include <future>
+#include <mutex>
+#include <thread>
+
+#include "bench.h"
+
+///
+///@brief benchmark of dispatches on worker threads: throughput, per key order and priority classes
+///
+
+// ----------------------------------------------------------------------------------------------- //
+
+///
+///@brief slow handlers inline versus on workers, and per key ordering of async dispatches
+///
+void bench_async(size_t commands)
+{
+	static const size_t kWorkers = 4;
+	static const size_t kKeys = 16;
+	static const std::chrono::microseconds kHandlerTime{ 200 };
+
+	std::mutex orderMtx;
+	std::vector<long> lastSeen(kKeys, -1);
+	size_t outOfOrder = 0;
+
+	CommandDispatcher dispatcher;
+	dispatcher.addCommandHandler("work", [&](JsonValue &command, ResponseWriter &) {
+		const JsonValue &payload = command["payload"];
+		std::this_thread::sleep_for(kHandlerTime);
+
+		std::lock_guard<std::mutex> lock(orderMtx);
+		long &last = lastSeen[payload["key"].GetUint()];
+		const long sequence = payload["sequence"].GetInt64();
+		outOfOrder += sequence < last;
+		last = sequence;
+		return true;
+	});
+	dispatcher.setWorkerCount(kWorkers);
+
+	std::vector<std::string> jsons;
+	for( size_t n = 0; n < commands; ++n ) {
+		jsons.push_back("{\"command\":\"work\",\"payload\":{\"key\":" + std::to_string(n % kKeys)
+			+ ",\"sequence\":" + std::to_string(n) + "}}");
+	}
+
+	auto start = BenchClock::now();
+	for( const std::string &json : jsons ) {
+		dispatcher.dispatchCommand(json);
+	}
+	std::chrono::duration<double> inlineTime = BenchClock::now() - start;
+
+	std::fill(lastSeen.begin(), lastSeen.end(), -1);
+
+	start = BenchClock::now();
+	std::vector< std::future<bool> > results;
+	for( size_t n = 0; n < commands; ++n ) {
+		results.push_back(dispatcher.dispatchCommandAsync(jsons[n], "user-" + std::to_string(n % kKeys)));
+	}
+	size_t succeeded = 0;
+	for( auto &result : results ) {
+		succeeded += result.get();
+	}
+	std::chrono::duration<double> asyncTime = BenchClock::now() - start;
+
+	std::cerr << "async: " << commands << " commands, " << kHandlerTime.count() << "us handlers: inline "
+		<< static_cast<size_t>(commands / inlineTime.count()) << " commands/sec, " << kWorkers << " workers "
+		<< static_cast<size_t>(commands / asyncTime.count()) << " commands/sec, succeeded " << succeeded
+		<< ", out of order per key " << outOfOrder << std::endl;
+}
+
+// ----------------------------------------------------------------------------------------------- //
+
+///
+///@brief latency of a control command queued behind a flood of polls, FIFO versus priority classes and deadlines
+///
+void bench_priority(size_t polls)
+{
+	static const std::chrono::microseconds kPollTime{ 50 };
+	static const char *const kPoll = R"({"command":"poll","deadline_ms":20,"payload":{}})";
+	static const char *const kControl = R"({"command":"control","payload":{}})";
+
+	auto run = [&](bool scheduled) {
+		CommandDispatcher dispatcher;
+		dispatcher.addCommandHandler("poll", [](JsonValue &, ResponseWriter &) {
+			std::this_thread::sleep_for(kPollTime);
+			return true;
+		});
+		dispatcher.addCommandHandler("control", [](JsonValue &, ResponseWriter &) { return true; });
+		if( scheduled ) {
+			dispatcher.setCommandPriority("poll", kPriorityLow);
+			dispatcher.setCommandPriority("control", kPriorityHigh);
+		}
+		dispatcher.setWorkerCount(1);
+
+		std::vector< std::future<bool> > results;
+		for( size_t n = 0; n < polls; ++n ) {
+			// without scheduling the deadline is dropped too, plain FIFO
+			results.push_back(dispatcher.dispatchCommandAsync(scheduled ? kPoll : R"({"command":"poll","payload":{}})"));
+		}
+
+		auto start = BenchClock::now();
+		dispatcher.dispatchCommandAsync(kControl).get();
+		std::chrono::duration<double, std::micro> control = BenchClock::now() - start;
+
+		size_t completed = 0;
+		for( auto &result : results ) {
+			completed += result.get();
+		}
+
+		std::cerr << "priority: " << (scheduled ? "classes+deadlines" : "fifo             ") << " control latency "
+			<< static_cast<size_t>(control.count()) << " us, polls completed " << completed << " of " << polls
+			<< ", dropped past deadline " << polls - completed << std::endl;
+	};
+
+	run(false);
+	run(true);
+}
+
+// ----------------------------------------------------------------------------------------------- //
+
+///
+/// usage: dispatcher-bench-workers [iterations] [--suite async|priority]
+///
+int main(int argc, char *argv[])
+{
+	BenchOptions options;
+	if( !bench_init(argc, argv, options) ) {
+		return 1;
+	}
+
+	if( options.selected("async") ) {
+		bench_async(options.iterations / 50 + 1);
+	}
+	if( options.selected("priority") ) {
+		bench_priority(options.iterations / 50 + 1);
+	}
+
+	return 0;
+}
@@ -0,0 +1,29 @@
+#ifndef _DISPATCHER_H_
+#define _DISPATCHER_H_
+
+#include "on/dispatcher/Common.h"
+#include "on/dispatcher/PoolAllocator.h"
+#include "on/dispatcher/CommandSchema.h"
+#include "on/dispatcher/MsgPack.h"
+#include "on/dispatcher/CommandDelegate.h"
+#include "on/dispatcher/RateLimit.h"
+#include "on/dispatcher/TtlCache.h"
+#include "on/dispatcher/Coalescer.h"
+#include "on/dispatcher/CommandRouter.h"
+#include "on/dispatcher/RcuPointer.h"
+#include "on/dispatcher/CommandTable.h"
+#include "on/dispatcher/Admission.h"
+#include "on/dispatcher/CommandMetrics.h"
+#include "on/dispatcher/CommandRecorder.h"
+#include "on/dispatcher/PayloadBinding.h"
+#include "on/dispatcher/DispatchContext.h"
+#include "on/dispatcher/EnvelopeReader.h"
+#include "on/dispatcher/DispatchWorkers.h"
+#include "on/dispatcher/CommandDispatcher.h"
+#include "on/dispatcher/BatchIngest.h"
+#include "on/dispatcher/DispatchServer.h"
+#include "on/dispatcher/ShmTransport.h"
+#include "on/dispatcher/Controller.h"
+#include "on/dispatcher/TestCommands.h"
+
+#endif
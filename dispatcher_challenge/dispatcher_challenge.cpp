@@ -19,462 +19,187 @@
 // std::map
 // std::make_pair
 
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
 #include <functional>
+#include <memory>
+#include <thread>
+#include <vector>
 
-#include "rapidjson/document.h"
-#include "rapidjson/writer.h"
-#include "rapidjson/stringbuffer.h"
-
-#define INLINE inline
+#include "dispatcher.h"
 
 using namespace rapidjson;
 using namespace std;
+using namespace on::dispatcher;
 
-bool g_done = false;
-
-//
-// TEST COMMANDS
-//
-auto help_command = R"(
- {
-  "command":"help",
-  "payload": {
-    "usage":"Enter json command in 'command':'<command>','payload': { // json payload of arguments }"
-  }
- }
-)";
-
-auto exit_command = R"(
- {
-  "command":"exit",
-  "payload": {
-     "reason":"Exiting program on user request."
-  }
- }
-)";
-
-auto authenticate_command = R"(
- {
-  "command":"authenticate",
-  "payload": {
-     "key":"1kjdi3idmvid."
-  }
- }
-)";
-
-auto reloadUser_command = R"(
- {
-  "command":"reloadUser",
-  "payload": {
-     "token":"1kjdi3idmvid."
-  }
- }
-)";
-
-auto deviceHealth_command = R"(
- {
-  "command":"deviceHealth",
-  "payload": {
-     "status":"healthy."
-  }
- }
-)";
+std::atomic_bool g_done{ false };
 
 // ----------------------------------------------------------------------------------------------- //
 
 ///
-/// @brief Check the json object is NULL or not
+/// usage: dispatcher                 interactive, one command per line
+///        dispatcher --batch [file]  NDJSON or a json array of commands from file, or stdin
+///        dispatcher --unix <path>   serve on a Unix domain socket
+///        dispatcher --tcp <port>    serve on 127.0.0.1, both may be given
+///        dispatcher --shm <path>    serve same host clients over shared memory rings, ShmClient
+///                                   connects to the Unix socket at path, may be given with the others
+///        dispatcher --quiet ...     no per command console output
+///        dispatcher --record <file> ...  append every command to a log for dispatcher-replay
+///        dispatcher --idempotent <command>[:<ms>] ...  identical dispatches of command share a run,
+///                                   and its result for ms, may be given for several commands
 ///
-/// @param json The json to check
+/// interactive and batch runs print the json response of every command on stdout, one per line,
+/// the server sends it back to the client.
 ///
-INLINE bool isNull(const rapidjson::Value &JSON )
+int main(int argc, char *argv[])
 {
-	return false;
-}
-
-// ----------------------------------------------------------------------------------------------- //
-
-///
-/// @brief Output message to console
-///
-/// @param str The string message to output to console.
-///
-INLINE void consoleOut(const std::string &str)
-{
-	std::cout << str << std::endl;
-}
-
-// ----------------------------------------------------------------------------------------------- //
-
-///
-/// @brief controller class
-///
-class Controller {
-public:
-
-// ----------------------------------------------------------------------------------------------- //
-
-    ///
-	/// @brief output command usage
-    ///
-    /// @param payload The json message for with command usage
-    ///
-    bool help(rapidjson::Value &payload)
-    {
-        cout << "Controller::help: command: ";
-
-		const rapidjson::Value &payloadJSON = payload["payload"];
-		if( !payloadJSON.HasMember("usage") )
-		{
-			//malformed json error
-			consoleOut("Malformed json, missing usage field.");
-		}
-
-		const rapidjson::Value &usageJSON = payloadJSON[ "usage" ];
-
-		if( usageJSON.IsNull() && !usageJSON.IsString())
-		{
-			consoleOut("Malformed json, usage field.");
-		}
-		
-
-		std::cout << usageJSON.GetString() << std::endl;
-
-        return true;
+    bool batch = false;
+    bool quiet = false;
+    const char *path = NULL;
+    const char *unix_path = NULL;
+    const char *record_path = NULL;
+    const char *shm_path = NULL;
+    int tcp_port = -1;
+    std::vector<std::string> idempotent;
+
+    for( int n = 1; n < argc; ++n ) {
+        if( strcmp( argv[n], "--batch" ) == 0 ) {
+            batch = true;
+            if( n + 1 < argc && argv[n + 1][0] != '-' ) {
+                path = argv[++n];
+            }
+        }
+        else if( strcmp( argv[n], "--unix" ) == 0 && n + 1 < argc ) {
+            unix_path = argv[++n];
+        }
+        else if( strcmp( argv[n], "--tcp" ) == 0 && n + 1 < argc ) {
+            tcp_port = atoi( argv[++n] );
+        }
+        else if( strcmp( argv[n], "--shm" ) == 0 && n + 1 < argc ) {
+            shm_path = argv[++n];
+        }
+        else if( strcmp( argv[n], "--quiet" ) == 0 ) {
+            quiet = true;
+        }
+        else if( strcmp( argv[n], "--record" ) == 0 && n + 1 < argc ) {
+            record_path = argv[++n];
+        }
+        else if( strcmp( argv[n], "--idempotent" ) == 0 && n + 1 < argc ) {
+            idempotent.push_back( argv[++n] );
+        }
+        else {
+            cerr << "usage: " << argv[0] << " [--batch [file] | --unix <path> | --tcp <port> | --shm <path>] [--quiet] [--record <file>]"
+                 " [--idempotent <command>[:<ms>]]" << endl;
+            return 1;
+        }
     }
 
-// ----------------------------------------------------------------------------------------------- //
-
-    ///
-	/// @brief exit this application
-    ///
-    /// @param payload The json message for the reason to exit
-    ///
-    bool exit(rapidjson::Value &payload)
-    {
-        cout << "Controller::exit: command: \n";
-
-        // implement
-
-		const rapidjson::Value &payloadJSON = payload["payload"];
-		if ( !payloadJSON.HasMember("reason") )
-		{
-			consoleOut("Malformed json, missing reason field.");
-			return false;
-		}
-
-		const rapidjson::Value &reasonJSON = payloadJSON["reason"];
-
-		if ( reasonJSON.IsNull() && !reasonJSON.IsString() )
-		{
-			consoleOut("Malformed json, reason type.");
-			return false;
-		}
-
-		std::cout << reasonJSON.GetString() << std::endl;
+    std::cout << "COMMAND DISPATCHER: STARTED" << std::endl;
 
-		g_done = true;
+    Controller controller;                 // controller class of functions to "dispatch" from Command Dispatcher
+    CommandDispatcher command_dispatcher;
 
-        return true;
+    // silence the console before any handler is registered, registration logs too
+    if( quiet ) {
+        setConsoleEnabled( false );
     }
 
-// ----------------------------------------------------------------------------------------------- //
-
-    ///
-	/// @brief authenticate the user
-    ///
-    /// @param payload The json message for authentication
-    ///
-	bool authenticate( rapidjson::Value &payload )
-	{
-		const rapidjson::Value &payloadJSON = payload["payload"];
-		if (!payloadJSON.HasMember("key"))
-		{
-			consoleOut("Malformed json, missing key field.");
-			return false;
-		}
-
-		const rapidjson::Value &keyJSON = payloadJSON["key"];
-
-		if (keyJSON.IsNull() && !keyJSON.IsString())
-		{
-			consoleOut("Malformed json, key type.");
-			return false;
-		}
-
-		//authentication process
-
-		consoleOut( "User authentiated" );
-
-		return true;
-	}
-
-// ----------------------------------------------------------------------------------------------- //
-
-	///
-	/// @brief attempts to reload the current authenticated user
-    ///
-    /// @param payload The json message for reloading the user
-    ///
-	bool reloadUser( rapidjson::Value &payload )
-	{
-		const rapidjson::Value &payloadJSON = payload["payload"];
-		if (!payloadJSON.HasMember("token"))
-		{
-			consoleOut("Malformed json, missing key field.");
-			return false;
-		}
-
-		const rapidjson::Value &tokenJSON = payloadJSON["token"];
-
-		if (tokenJSON.IsNull() && !tokenJSON.IsString())
-		{
-			consoleOut("Malformed json, key type.");
-			return false;
-		}
-
-		//authentication prodecures via token
-
-		consoleOut("User reloaded");
-
-		return true;
-	}
-
-// ----------------------------------------------------------------------------------------------- //
-
-	///
-	/// @brief query the health status
-    ///
-    /// @param payload The json message for the device
-    ///
-	bool deviceHealth( rapidjson::Value &payload ) 
-	{
-		const rapidjson::Value &payloadJSON = payload["payload"];
-		if (!payloadJSON.HasMember("status"))
-		{
-			consoleOut("Malformed json, missing status field.");
-			return false;
-		}
-
-		const rapidjson::Value &statusJSON = payloadJSON["status"];
-
-		if (statusJSON.IsNull() && !statusJSON.IsString())
-		{
-			consoleOut("Malformed json, status type.");
-			return false;
-		}
-
-		consoleOut(std::string{ "Device health status: " } + std::string{statusJSON.GetString()} );
-
-		return true;
-	}
-
-// ----------------------------------------------------------------------------------------------- //
-
-};
-
-// ----------------------------------------------------------------------------------------------- //
-
-// Bonus Question: why did I type cast this?
-/*
-I can think of the following to typecasting:
-	1] Whenever the prototype needs to be changed then changes is happening only in one place.
-	2] Less typing whenever it's being used
-*/
-typedef std::function<bool(rapidjson::Value &)> CommandHandler;
-
-
-
-
-// ----------------------------------------------------------------------------------------------- //
-
-///
-/// @brief Command dispatcher class to emplace command handler and dispatching.
-///
-class CommandDispatcher {
-public:
-
-// ----------------------------------------------------------------------------------------------- //
+    // add command handlers in Controller class to CommandDispatcher using addCommandHandler
+	init_dispatcher( command_dispatcher, controller );
 
-	///
-	/// @brief emple constrcutor
-	///
-    CommandDispatcher()  
-    {
+    // coalescing is opt in, the handler must depend on nothing but the payload
+    for( const std::string &command : idempotent ) {
+        const size_t colon = command.find( ':' );
+        const double ttl_ms = colon != std::string::npos ? atof( command.c_str() + colon + 1 ) : 0;
+        if( !command_dispatcher.setCommandIdempotent( command.substr( 0, colon ), true, ttl_ms ) ) {
+            cerr << "unknown command " << command.substr( 0, colon ) << endl;
+            return 1;
+        }
     }
 
-// ----------------------------------------------------------------------------------------------- //
-
-    ///
-    /// @brief simple destructor
-    ///
-    virtual ~CommandDispatcher()
-    {
-        // question why is it virtual? Is it needed in this case?
-		/*
-		Making the destrutor virutal will get called from the derived class.
-		It's needed here if this class is extended.
-		*/
-
-		/*
-		If executing the handler in a thread then wait for all tasks to finish but the command
-		displatcher is a linear blocking call.  Not sure anything needs to be here.
-		*/
+    CommandRecorder recorder;
+    if( record_path != NULL ) {
+        if( !recorder.open( record_path ) ) {
+            cerr << "cannot record to " << record_path << ": " << strerror( errno ) << endl;
+            return 1;
+        }
+        command_dispatcher.setRecorder( &recorder );
     }
 
-// ----------------------------------------------------------------------------------------------- //
-
-    ///
-    /// @brief add handler to command
-    ///
-    /// @param command The command string for the handler.
-    /// @param handler The handler to handle the command.
-    ///
-    bool addCommandHandler(std::string command, CommandHandler handler)
-    {
-        cout << "CommandDispatcher: addCommandHandler: " << command << std::endl;
-
-		auto it = command_handlers_.find( command );
-
-		//add new handler for the command
-		if ( it != command_handlers_.end() ) 
-		{
-			command_handlers_.erase( it );
-		}
-
-		command_handlers_.emplace( command, std::move(handler) );
-
-        return true;
+    auto done = []() { return g_done.load(); };
+
+    std::unique_ptr<ShmServer> shm_server;
+    std::thread shm_thread;
+    if( shm_path != NULL ) {
+        shm_server.reset( new ShmServer( command_dispatcher ) );
+        if( !shm_server->listen( shm_path ) ) {
+            cerr << "cannot listen on " << shm_path << ": " << strerror( errno ) << endl;
+            return 1;
+        }
+        cerr << "SERVING: shm:" << shm_path << endl;
     }
 
-// ----------------------------------------------------------------------------------------------- //
-
-    ///
-    /// @brief Dispatch commands
-    ///
-    /// @param command_json The json object with a command strind and it's respective payload
-    ///
-    bool dispatchCommand(std::string command_json)
-    {
-        cout << "COMMAND: " << command_json << endl;
-
-		//contruct json from string
-		rapidjson::Document command;
-
-		try{
-			command.Parse( command_json.c_str() );
-		}
-		catch(const std::runtime_error &er)
-		{
-			std::cout << "Malformed command json string." << std::endl;
-		}
-
-		//check to see if command is present and valid
-		if (!command.IsObject() || !command.HasMember("command"))
-		{
-			std::cout << "Malformed json object." << std::endl;
-			return false;
-		}
-
-		const rapidjson::Value &commandJSON = command["command"];
-		if (commandJSON.IsNull() && !commandJSON.IsString())
-		{
-			std::cout << "Malformed json, missing payload." << std::endl;
-			return false;
-		}
-
-		const char *commandptr = commandJSON.GetString();
-		auto commandItr = command_handlers_.find( commandptr );
-
-
-		//check to see if the command has a handler 
-		if (commandItr == command_handlers_.end())
-		{
-			std::cout << "Malformed json, missing command." << std::endl;
-			return false;
-		}
-
-		//check to see if the payload is present
-		if (!command.HasMember("payload"))
-		{
-			std::cout << "Malformed json, missing payload." << std::endl;
-			return false;
-		}
-		
-		//execute the command handler
-		try 
-		{
-			command_handlers_[commandptr]( command );
-		}
-		catch (const std::runtime_error &er)
-		{
-			std::cout << "Dispatch handler running time error for command: " << 
-				std::string{ commandptr } << " Reason: " << er.what() << std::endl;
-		}
-		
-        return true;
+    if( unix_path != NULL || tcp_port >= 0 ) {
+        DispatchServer::raiseFileLimit();
+        DispatchServer server( command_dispatcher );
+
+        if( unix_path != NULL && !server.listenUnix( unix_path ) ) {
+            cerr << "cannot listen on " << unix_path << ": " << strerror( errno ) << endl;
+            return 1;
+        }
+        if( tcp_port >= 0 && !server.listenTcp( static_cast<uint16_t>( tcp_port ) ) ) {
+            cerr << "cannot listen on 127.0.0.1:" << tcp_port << ": " << strerror( errno ) << endl;
+            return 1;
+        }
+
+        // the shared memory rings are served beside the sockets
+        if( shm_server ) {
+            shm_thread = std::thread( [&shm_server, &done]() { shm_server->run( done ); } );
+        }
+
+        cerr << "SERVING:" << (unix_path != NULL ? " unix:" : "") << (unix_path != NULL ? unix_path : "")
+             << (tcp_port >= 0 ? " tcp:127.0.0.1:" + to_string( tcp_port ) : "") << endl;
+        server.run( done );
+        cerr << "SERVED: " << server.requests() << " requests" << endl;
+    }
+    else if( shm_server ) {
+        shm_server->run( done );
+    }
+    else if( batch ) {
+        ifstream file;
+        if( path != NULL ) {
+            file.open( path, ios::binary );
+            if( !file ) {
+                cerr << "cannot open " << path << endl;
+                return 1;
+            }
+        }
+
+        StreamSource source( path != NULL ? file : cin );
+        IngestStats stats = ingest( source, command_dispatcher, true, done, &cout );
+
+        cerr << "BATCH: " << stats.commands << " commands (" << stats.succeeded << " succeeded) in "
+             << stats.seconds << " s, " << static_cast<uint64_t>( stats.rate() ) << " commands/sec" << endl;
+    }
+    else {
+        // command line interface for testing
+        InteractiveSource source( cin, cout );
+        ingest( source, command_dispatcher, false, done, &cout );
     }
 
-// ----------------------------------------------------------------------------------------------- //
-
-
-private:
-    std::map<std::string, CommandHandler> command_handlers_;  ///< The container for handlers
-
-    // Question: why delete these?
-	/*
-	Reasons I can think of for no copy constructor and assignment:
-		1] keep integrity, only the desired contructed instance should be used.
-		2] Only one controller should be present at any given time, singleton?
-
-	*/
-
-    // delete unused constructors
-    CommandDispatcher (const CommandDispatcher&) = delete;
-    CommandDispatcher& operator= (const CommandDispatcher&) = delete;
-
-};
-
-
-// ----------------------------------------------------------------------------------------------- //
-
-void init_dispatcher( CommandDispatcher &dispatcher, Controller &controller)
-{
-	auto exitFunc = std::bind(&Controller::exit, controller, std::placeholders::_1 );
-	dispatcher.addCommandHandler("exit", std::move(exitFunc));
-
-	auto helpFunc = std::bind(&Controller::help, controller, std::placeholders::_1);
-	dispatcher.addCommandHandler("help", std::move(helpFunc));
-
-	auto authenticateFunc = std::bind(&Controller::authenticate, controller, std::placeholders::_1);
-	dispatcher.addCommandHandler("authenticate", std::move(authenticateFunc));
-
-	auto reloaduserFunc = std::bind(&Controller::reloadUser, controller, std::placeholders::_1);
-	dispatcher.addCommandHandler("reloadUser", std::move(reloaduserFunc));
-
-	auto deviceHealthFunc = std::bind(&Controller::deviceHealth, controller, std::placeholders::_1);
-	dispatcher.addCommandHandler("deviceHealth", std::move(deviceHealthFunc));
-}
-
-// ----------------------------------------------------------------------------------------------- //
-
-int main()
-{
-    std::cout << "COMMAND DISPATCHER: STARTED" << std::endl;
-
-    CommandDispatcher command_dispatcher;
-    Controller controller;                 // controller class of functions to "dispatch" from Command Dispatcher
-
-    // add command handlers in Controller class to CommandDispatcher using addCommandHandler
-	init_dispatcher( command_dispatcher, controller );
+    if( shm_server ) {
+        if( shm_thread.joinable() ) {
+            shm_thread.join();
+        }
+        cerr << "SERVED: " << shm_server->requests() << " shm requests, " << shm_server->dropped() << " responses dropped" << endl;
+    }
 
-    // command line interface for testing
-    string command;
-    while( ! g_done ) {
-        cout << "COMMANDS: {\"command\":\"exit\", \"payload\":{\"reason\":\"User requested exit.\"}}\n";
-        cout << "\tenter command : ";
-        getline(cin, command);
-        command_dispatcher.dispatchCommand(command);
+    if( record_path != NULL ) {
+        command_dispatcher.setRecorder( NULL );
+        recorder.close();
+        cerr << "RECORDED: " << recorder.recorded() << " commands, " << recorder.dropped() << " dropped" << endl;
     }
 
     std::cout << "COMMAND DISPATCHER: ENDED" << std::endl;
@@ -0,0 +1,332 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <string>
+#include <vector>
+
+//
+// load generator for the dispatcher's socket server
+//
+// dispatcher --quiet --unix /tmp/dispatcher.sock &
+// dispatcher-load --unix /tmp/dispatcher.sock --connections 1000 --requests 100 --pipeline 8
+//
+
+// ----------------------------------------------------------------------------------------------- //
+
+typedef std::chrono::steady_clock LoadClock;
+
+static const char *const kDefaultCommand = R"({"command":"reloadUser","payload":{"token":"load-test-token"}})";
+
+struct Options
+{
+	const char *unixPath;
+	int tcpPort;
+	size_t connections;
+	size_t requests;       ///< per connection
+	size_t pipeline;       ///< requests in flight per connection
+	bool lengthPrefix;     ///< 4 byte length prefix instead of newline framing
+	std::string command;
+};
+
+struct Client
+{
+	int fd;
+	size_t sent;
+	size_t received;
+	std::deque<LoadClock::time_point> inFlight;   ///< send time of every unanswered request
+	std::string in;                               ///< partial response
+	std::string out;                              ///< requests not yet written
+	size_t written;
+};
+
+// ----------------------------------------------------------------------------------------------- //
+
+///
+///@brief blocking connect, then switch the socket to non blocking
+///
+int connectClient(const Options &options)
+{
+	int fd;
+
+	if( options.unixPath != NULL ) {
+		sockaddr_un address;
+		std::memset( &address, 0, sizeof(address) );
+		address.sun_family = AF_UNIX;
+		std::strncpy( address.sun_path, options.unixPath, sizeof(address.sun_path) - 1 );
+
+		fd = ::socket( AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0 );
+		if( fd < 0 || ::connect( fd, reinterpret_cast<sockaddr *>( &address ), sizeof(address) ) != 0 ) {
+			return -1;
+		}
+	}
+	else {
+		sockaddr_in address;
+		std::memset( &address, 0, sizeof(address) );
+		address.sin_family = AF_INET;
+		address.sin_port = htons( static_cast<uint16_t>( options.tcpPort ) );
+		address.sin_addr.s_addr = htonl( INADDR_LOOPBACK );
+
+		fd = ::socket( AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0 );
+		if( fd < 0 || ::connect( fd, reinterpret_cast<sockaddr *>( &address ), sizeof(address) ) != 0 ) {
+			return -1;
+		}
+
+		int on = 1;
+		::setsockopt( fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on) );
+	}
+
+	::fcntl( fd, F_SETFL, ::fcntl( fd, F_GETFL ) | O_NONBLOCK );
+	return fd;
+}
+
+// ----------------------------------------------------------------------------------------------- //
+
+///@brief queue requests until the pipeline is full, then write what the socket takes
+bool pump(Client &client, const Options &options, const std::string &frame)
+{
+	while( client.inFlight.size() < options.pipeline && client.sent < options.requests ) {
+		client.out += frame;
+		client.inFlight.push_back( LoadClock::now() );
+		client.sent++;
+	}
+
+	while( client.written < client.out.size() ) {
+		ssize_t wrote = ::send( client.fd, client.out.data() + client.written, client.out.size() - client.written, MSG_NOSIGNAL );
+		if( wrote > 0 ) {
+			client.written += static_cast<size_t>( wrote );
+		}
+		else if( wrote < 0 && errno == EINTR ) {
+			continue;
+		}
+		else {
+			return wrote < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+		}
+	}
+
+	client.out.clear();
+	client.written = 0;
+	return true;
+}
+
+///@brief read responses, record their latency
+///@return false when the connection failed
+bool drain(Client &client, const Options &options, std::vector<double> &latencies, size_t &failures)
+{
+	char buffer[16 * 1024];
+
+	for( ;; ) {
+		ssize_t got = ::read( client.fd, buffer, sizeof(buffer) );
+		if( got > 0 ) {
+			client.in.append( buffer, static_cast<size_t>( got ) );
+			continue;
+		}
+		if( got < 0 && errno == EINTR ) {
+			continue;
+		}
+		if( got < 0 && (errno == EAGAIN || errno == EWOULDBLOCK) ) {
+			break;
+		}
+		return false;
+	}
+
+	size_t start = 0;
+	for( ;; ) {
+		size_t begin, end;
+
+		if( options.lengthPrefix ) {
+			if( client.in.size() - start < 4 ) {
+				break;
+			}
+			const unsigned char *prefix = reinterpret_cast<const unsigned char *>( client.in.data() + start );
+			const size_t length = (size_t( prefix[0] ) << 24) | (size_t( prefix[1] ) << 16) | (size_t( prefix[2] ) << 8) | prefix[3];
+			if( client.in.size() - start - 4 < length ) {
+				break;
+			}
+			begin = start + 4;
+			end = begin + length;
+		}
+		else {
+			size_t newline = client.in.find( '\n', start );
+			if( newline == std::string::npos ) {
+				break;
+			}
+			begin = start;
+			end = newline;
+		}
+
+		if( client.inFlight.empty() ) {
+			return false;
+		}
+
+		std::chrono::duration<double, std::micro> latency = LoadClock::now() - client.inFlight.front();
+		client.inFlight.pop_front();
+		latencies.push_back( latency.count() );
+		client.received++;
+
+		// responses end with their "ok" member
+		static const char kOk[] = "\"ok\":true}";
+		static const size_t kOkLength = sizeof(kOk) - 1;
+		if( end - begin < kOkLength || client.in.compare( end - kOkLength, kOkLength, kOk ) != 0 ) {
+			failures++;
+		}
+
+		start = options.lengthPrefix ? end : end + 1;
+	}
+
+	client.in.erase( 0, start );
+	return true;
+}
+
+// ----------------------------------------------------------------------------------------------- //
+
+int main(int argc, char *argv[])
+{
+	Options options{ NULL, -1, 1000, 100, 8, false, kDefaultCommand };
+
+	for( int n = 1; n < argc; ++n ) {
+		const bool hasValue = n + 1 < argc;
+		if( std::strcmp( argv[n], "--unix" ) == 0 && hasValue ) {
+			options.unixPath = argv[++n];
+		}
+		else if( std::strcmp( argv[n], "--tcp" ) == 0 && hasValue ) {
+			options.tcpPort = std::atoi( argv[++n] );
+		}
+		else if( std::strcmp( argv[n], "--connections" ) == 0 && hasValue ) {
+			options.connections = std::strtoul( argv[++n], NULL, 10 );
+		}
+		else if( std::strcmp( argv[n], "--requests" ) == 0 && hasValue ) {
+			options.requests = std::strtoul( argv[++n], NULL, 10 );
+		}
+		else if( std::strcmp( argv[n], "--pipeline" ) == 0 && hasValue ) {
+			options.pipeline = std::max<size_t>( std::strtoul( argv[++n], NULL, 10 ), 1 );
+		}
+		else if( std::strcmp( argv[n], "--command" ) == 0 && hasValue ) {
+			options.command = argv[++n];
+		}
+		else if( std::strcmp( argv[n], "--length-prefix" ) == 0 ) {
+			options.lengthPrefix = true;
+		}
+		else {
+			options.unixPath = NULL;
+			options.tcpPort = -1;
+			break;
+		}
+	}
+
+	if( options.unixPath == NULL && options.tcpPort < 0 ) {
+		std::cerr << "usage: " << argv[0] << " --unix <path> | --tcp <port> [--connections n] [--requests n]"
+			" [--pipeline n] [--length-prefix] [--command json]" << std::endl;
+		return 1;
+	}
+
+	// one descriptor per connection
+	rlimit limit;
+	if( ::getrlimit( RLIMIT_NOFILE, &limit ) == 0 && limit.rlim_cur < limit.rlim_max ) {
+		limit.rlim_cur = limit.rlim_max;
+		::setrlimit( RLIMIT_NOFILE, &limit );
+	}
+
+	std::string frame;
+	if( options.lengthPrefix ) {
+		const size_t length = options.command.size();
+		const char prefix[4] = {
+			static_cast<char>( (length >> 24) & 0xFF ), static_cast<char>( (length >> 16) & 0xFF ),
+			static_cast<char>( (length >> 8) & 0xFF ), static_cast<char>( length & 0xFF ) };
+		frame.assign( prefix, 4 );
+		frame += options.command;
+	}
+	else {
+		frame = options.command + "\n";
+	}
+
+	int epoll = ::epoll_create1( EPOLL_CLOEXEC );
+	std::vector<Client> clients( options.connections );
+
+	auto start = LoadClock::now();
+
+	for( size_t n = 0; n < clients.size(); ++n ) {
+		Client &client = clients[n];
+		client.fd = connectClient( options );
+		client.sent = client.received = client.written = 0;
+		if( client.fd < 0 ) {
+			std::cerr << "connect " << n << ": " << std::strerror( errno ) << std::endl;
+			return 1;
+		}
+
+		epoll_event event;
+		event.events = EPOLLIN | EPOLLOUT | EPOLLET;
+		event.data.u64 = n;
+		::epoll_ctl( epoll, EPOLL_CTL_ADD, client.fd, &event );
+	}
+
+	auto connected = LoadClock::now();
+
+	std::vector<double> latencies;
+	latencies.reserve( options.connections * options.requests );
+	size_t failures = 0;
+	size_t open = clients.size();
+	std::vector<epoll_event> events( 1024 );
+
+	while( open > 0 ) {
+		const int count = ::epoll_wait( epoll, events.data(), static_cast<int>( events.size() ), 1000 );
+		if( count < 0 && errno != EINTR ) {
+			break;
+		}
+
+		for( int n = 0; n < count; ++n ) {
+			Client &client = clients[events[n].data.u64];
+			if( client.fd < 0 ) {
+				continue;
+			}
+
+			bool ok = true;
+			if( events[n].events & (EPOLLIN | EPOLLHUP | EPOLLERR) ) {
+				ok = drain( client, options, latencies, failures );
+			}
+			if( ok ) {
+				ok = pump( client, options, frame );
+			}
+
+			if( !ok || client.received == options.requests ) {
+				if( !ok ) {
+					std::cerr << "connection " << events[n].data.u64 << " failed after " << client.received << " responses" << std::endl;
+				}
+				::close( client.fd );
+				client.fd = -1;
+				open--;
+			}
+		}
+	}
+
+	std::chrono::duration<double> elapsed = LoadClock::now() - start;
+	std::chrono::duration<double> connecting = connected - start;
+	::close( epoll );
+
+	std::sort( latencies.begin(), latencies.end() );
+	auto percentile = [&latencies](double rank) {
+		return latencies.empty() ? 0.0 : latencies[std::min( latencies.size() - 1, static_cast<size_t>( latencies.size() * rank ) )];
+	};
+
+	std::cout << "load: " << options.connections << " connections, " << options.requests << " requests each, pipeline "
+		<< options.pipeline << (options.lengthPrefix ? ", length prefix" : ", newline") << " framing" << std::endl;
+	std::cout << "load: " << latencies.size() << " responses, " << failures << " not ok, connect "
+		<< connecting.count() << " s, total " << elapsed.count() << " s, "
+		<< static_cast<size_t>( latencies.size() / elapsed.count() ) << " requests/sec" << std::endl;
+	std::cout << "load: latency us p50 " << percentile( 0.5 ) << " p99 " << percentile( 0.99 ) << " p999 " << percentile( 0.999 ) << std::endl;
+
+	return latencies.size() == options.connections * options.requests ? 0 : 1;
+}
@@ -0,0 +1,197 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "dispatcher.h"
+
+using namespace on::dispatcher;
+
+// a recorded exit command must not end the replay
+std::atomic_bool g_done{ false };
+
+//
+// replays a command log into a dispatcher and compares the run with the recorded one
+//
+// dispatcher --quiet --record /tmp/commands.log --unix /tmp/dispatcher.sock
+// dispatcher-replay /tmp/commands.log --speed 4 --concurrency 8
+//
+
+// ----------------------------------------------------------------------------------------------- //
+
+struct Options
+{
+	const char *path;
+	double speed;          ///< 0 for as fast as possible
+	size_t concurrency;    ///< dispatching threads
+	bool stream;           ///< kDispatchStream instead of kDispatchDom
+};
+
+///@brief latency percentile of sorted, 0 when empty
+uint64_t percentile(const std::vector<uint64_t> &sorted, double rank)
+{
+	return sorted.empty() ? 0 : sorted[std::min( sorted.size() - 1, static_cast<size_t>( sorted.size() * rank ) )];
+}
+
+// ----------------------------------------------------------------------------------------------- //
+
+///
+///@brief wait until monotonicNs() reaches ns, sleeping while it is far and spinning the last stretch
+///
+void waitUntil(uint64_t ns)
+{
+	static const uint64_t kSpinNs = 200 * 1000;
+
+	for( uint64_t now = monotonicNs(); now < ns; now = monotonicNs() ) {
+		if( ns - now > kSpinNs ) {
+			std::this_thread::sleep_for( std::chrono::nanoseconds( ns - now - kSpinNs ) );
+		}
+		else {
+			std::this_thread::yield();
+		}
+	}
+}
+
+// ----------------------------------------------------------------------------------------------- //
+
+///
+/// usage: dispatcher-replay <log> [--speed x | --max] [--concurrency n] [--stream]
+///
+///        --speed        replay at x times the recorded rate, 1 by default
+///        --max          dispatch every command as soon as a thread is free
+///        --concurrency  threads dispatching, 1 by default
+///        --stream       dispatch in kDispatchStream mode
+///
+/// a command is due at its recorded arrival scaled by the speed. Its latency counts from when it
+/// was due, so a replay falling behind shows the queueing the recorded run would have seen.
+///
+int main(int argc, char *argv[])
+{
+	Options options{ NULL, 1, 1, false };
+
+	for( int n = 1; n < argc; ++n ) {
+		const bool hasValue = n + 1 < argc;
+		if( std::strcmp( argv[n], "--speed" ) == 0 && hasValue ) {
+			options.speed = std::max( std::atof( argv[++n] ), 0.0 );
+		}
+		else if( std::strcmp( argv[n], "--max" ) == 0 ) {
+			options.speed = 0;
+		}
+		else if( std::strcmp( argv[n], "--concurrency" ) == 0 && hasValue ) {
+			options.concurrency = std::max<size_t>( std::strtoul( argv[++n], NULL, 10 ), 1 );
+		}
+		else if( std::strcmp( argv[n], "--stream" ) == 0 ) {
+			options.stream = true;
+		}
+		else if( argv[n][0] != '-' && options.path == NULL ) {
+			options.path = argv[n];
+		}
+		else {
+			options.path = NULL;
+			break;
+		}
+	}
+
+	if( options.path == NULL ) {
+		std::cerr << "usage: " << argv[0] << " <log> [--speed x | --max] [--concurrency n] [--stream]" << std::endl;
+		return 1;
+	}
+
+	CommandLog log;
+	std::string error;
+	if( !log.load( options.path, error ) ) {
+		std::cerr << error << std::endl;
+		return 1;
+	}
+	const std::vector<RecordedCommand> &commands = log.commands();
+
+	setConsoleEnabled( false );
+
+	Controller controller;
+	CommandDispatcher dispatcher;
+	init_dispatcher( dispatcher, controller );
+	dispatcher.setDispatchMode( options.stream ? kDispatchStream : kDispatchDom );
+
+	std::vector<uint64_t> latencies( commands.size() );
+	std::atomic<size_t> next{ 0 };
+	std::atomic<size_t> differing{ 0 };
+	const uint64_t first = commands.empty() ? 0 : commands.front().arrivalNs;
+	const uint64_t start = monotonicNs();
+
+	auto replay = [&]() {
+		for( size_t n = next++; n < commands.size(); n = next++ ) {
+			const RecordedCommand &recorded = commands[n];
+
+			uint64_t due;
+			if( options.speed > 0 ) {
+				due = start + static_cast<uint64_t>( (recorded.arrivalNs - first) / options.speed );
+				waitUntil( due );
+			}
+			else {
+				due = monotonicNs();
+			}
+
+			const bool ok = dispatcher.dispatchCommand( log.command( recorded ), recorded.length,
+				[](const char *, size_t) {}, DispatchOrigin( due, recorded.client ) );
+			latencies[n] = monotonicNs() - due;
+			differing += ok != recorded.ok;
+		}
+	};
+
+	std::vector<std::thread> threads;
+	for( size_t n = 0; n < options.concurrency; ++n ) {
+		threads.emplace_back( replay );
+	}
+	for( std::thread &thread : threads ) {
+		thread.join();
+	}
+	const double elapsed = (monotonicNs() - start) / 1e9;
+
+	// throughput of the recorded run over the span of its arrivals
+	std::vector<uint64_t> original;
+	original.reserve( commands.size() );
+	uint64_t end = first;
+	size_t slower = 0;
+	for( size_t n = 0; n < commands.size(); ++n ) {
+		original.push_back( commands[n].latencyNs );
+		end = std::max( end, commands[n].arrivalNs + commands[n].latencyNs );
+		slower += latencies[n] > 2 * commands[n].latencyNs;
+	}
+	const double recordedSeconds = (end - first) / 1e9;
+
+	std::sort( original.begin(), original.end() );
+	std::sort( latencies.begin(), latencies.end() );
+
+	std::cout << "replay: " << commands.size() << " commands, ";
+	if( options.speed > 0 ) {
+		std::cout << options.speed << "x";
+	}
+	else {
+		std::cout << "max speed";
+	}
+	std::cout << ", concurrency " << options.concurrency << (options.stream ? ", stream" : ", dom") << std::endl;
+
+	std::cout << "replay: recorded " << recordedSeconds << " s, "
+		<< static_cast<uint64_t>( recordedSeconds > 0 ? commands.size() / recordedSeconds : 0 ) << " commands/sec" << std::endl;
+	std::cout << "replay: replayed " << elapsed << " s, "
+		<< static_cast<uint64_t>( elapsed > 0 ? commands.size() / elapsed : 0 ) << " commands/sec" << std::endl;
+
+	static const struct { const char *name; double rank; } kRanks[] = {
+		{ "p50", 0.5 }, { "p90", 0.9 }, { "p99", 0.99 }, { "p999", 0.999 }, { "max", 1.0 } };
+	for( const auto &rank : kRanks ) {
+		const uint64_t was = percentile( original, rank.rank );
+		const uint64_t now = percentile( latencies, rank.rank );
+		std::cout << "replay: latency " << rank.name << " recorded " << was << " ns, replayed " << now << " ns ("
+			<< (was > 0 ? double( now ) / was : 0.0) << "x)" << std::endl;
+	}
+
+	std::cout << "replay: " << slower << " commands more than 2x slower than recorded, "
+		<< differing << " with a different result" << std::endl;
+
+	return 0;
+}
@@ -0,0 +1,106 @@
+#ifndef _ON_DISPATCHER_ADMISSION_H_
+#define _ON_DISPATCHER_ADMISSION_H_
+
+#include <stdint.h>
+#include <memory>
+
+#include "on/dispatcher/Common.h"
+#include "on/dispatcher/CommandTable.h"
+#include "on/dispatcher/RateLimit.h"
+
+namespace on {
+namespace dispatcher {
+
+// ----------------------------------------------------------------------------------------------- //
+
+///@brief outcome of the admission check of a command
+enum AdmissionResult
+{
+	kAdmitted = 0,
+	kThrottledClient,      ///< the client's bucket is empty
+	kThrottledCommand      ///< the command's bucket is empty
+};
+
+///@brief "client" or "command", the limit that rejected a command
+INLINE const char * throttledBy(AdmissionResult result)
+{
+	return result == kThrottledClient ? "client" : "command";
+}
+
+// ----------------------------------------------------------------------------------------------- //
+
+///
+///@brief token bucket admission, run as soon as the command is known and before its payload is parsed
+///
+///@note the per command buckets live in the command entries, the per client buckets here. A
+///      command without limits costs one branch, no clock read. Limits are configured before
+///      dispatching starts, like handlers.
+///
+class AdmissionControl
+{
+
+// ----------------------------------------------------------------------------------------------- //
+
+public:
+
+	///
+	///@brief limit every client, identified by DispatchOrigin::client, to rate commands per second
+	///
+	///@param rate Commands per second, 0 or less to remove the limit.
+	///@param burst Commands admitted back to back.
+	///
+	void setClientLimit(double rate, double burst)
+	{
+		m_clients.reset( rate > 0 ? new ClientRateLimit( rate, burst ) : NULL );
+	}
+
+	///@brief the per client limit, NULL when clients are not limited
+	const ClientRateLimit * clientLimit() const
+	{
+		return m_clients.get();
+	}
+
+// ----------------------------------------------------------------------------------------------- //
+
+	///
+	///@brief take a token from the client's and the command's bucket
+	///
+	///@param client The client's id, 0 for an anonymous client, not limited per client.
+	///
+	///@note a command is charged to both buckets or to neither: when the command's bucket is
+	///      empty the client's token is given back, a throttled command costs the client nothing.
+	///
+	AdmissionResult admit(const CommandEntry &entry, uint64_t client)
+	{
+		if( !m_clients && !entry.limit ) {
+			return kAdmitted;
+		}
+
+		const uint64_t now = monotonicNs();
+		const bool perClient = m_clients && client != 0;
+		if( perClient && !m_clients->tryAcquire( client, now ) ) {
+			return kThrottledClient;
+		}
+		if( entry.limit && !entry.limit->tryAcquire( now ) ) {
+			if( perClient ) {
+				m_clients->refund( client, now );
+			}
+			return kThrottledCommand;
+		}
+		return kAdmitted;
+	}
+
+// ----------------------------------------------------------------------------------------------- //
+
+private:
+
+	std::unique_ptr<ClientRateLimit> m_clients;   ///< per client buckets, NULL when not limited
+
+};
+
+// ----------------------------------------------------------------------------------------------- //
+
+}
+}
+
+#endif
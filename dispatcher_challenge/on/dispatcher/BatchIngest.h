@@ -0,0 +1,459 @@
+#ifndef _ON_DISPATCHER_BATCHINGEST_H_
+#define _ON_DISPATCHER_BATCHINGEST_H_
+
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "on/dispatcher/CommandDispatcher.h"
+
+namespace on {
+namespace dispatcher {
+
+// ----------------------------------------------------------------------------------------------- //
+
+///
+///@brief commands split out of one read, null terminated and mutable so they can be parsed in situ
+///
+struct CommandBatch
+{
+	std::vector<char> buffer;       ///< bytes read, commands point into it
+	std::vector<char *> commands;   ///< start of every command in buffer
+
+	void clear()
+	{
+		buffer.clear();
+		commands.clear();
+	}
+};
+
+// ----------------------------------------------------------------------------------------------- //
+
+///
+///@brief front end producing batches of commands
+///
+class CommandSource
+{
+public:
+	virtual ~CommandSource()
+	{
+	}
+
+	///
+	///@brief fill the next batch
+	///
+	///@return false once the source is exhausted
+	///
+	virtual bool next(CommandBatch &batch) = 0;
+};
+
+// ----------------------------------------------------------------------------------------------- //
+
+///
+///@brief one command per line typed at the console, the original command line interface
+///
+class InteractiveSource : public CommandSource
+{
+public:
+	InteractiveSource(std::istream &in, std::ostream &out) : m_in( in ), m_out( out )
+	{
+	}
+
+	bool next(CommandBatch &batch) override
+	{
+		m_out << "COMMANDS: {\"command\":\"exit\", \"payload\":{\"reason\":\"User requested exit.\"}}\n";
+		m_out << "\tenter command : ";
+
+		if( !std::getline( m_in, m_line ) ) {
+			return false;
+		}
+
+		batch.clear();
+		batch.buffer.assign( m_line.begin(), m_line.end() );
+		batch.buffer.push_back( '\0' );
+		batch.commands.push_back( batch.buffer.data() );
+		return true;
+	}
+
+private:
+	std::istream &m_in;
+	std::ostream &m_out;
+	std::string m_line;
+};
+
+// ----------------------------------------------------------------------------------------------- //
+
+///
+///@brief newline delimited json, or a top level json array of commands, read in large chunks
+///
+///@note the format is picked from the first non blank byte, '[' for an array. NDJSON lines are
+///      found with an SSE2 scan that handles 16 bytes per step. Array elements are split at top
+///      level commas by a scanner tracking nesting and strings. A command cut by the end of a
+///      chunk is carried over to the next batch.
+///
+class StreamSource : public CommandSource
+{
+public:
+
+	static const size_t kDefaultChunkSize = 1 << 20;
+
+	explicit StreamSource(std::istream &in, size_t chunkSize = kDefaultChunkSize)
+		: m_in( in ), m_chunkSize{ chunkSize }, m_format{ kFormatUnknown }, m_eof{ false }, m_arrayDone{ false }
+	{
+	}
+
+// ----------------------------------------------------------------------------------------------- //
+
+	bool next(CommandBatch &batch) override
+	{
+		batch.clear();
+		batch.buffer.swap( m_carry );
+		m_carry.clear();
+
+		while( batch.commands.empty() ) {
+			if( m_eof || m_arrayDone ) {
+				if( batch.buffer.empty() || m_arrayDone ) {
+					return false;
+				}
+				// last command without a trailing delimiter
+				split( batch, true );
+				return !batch.commands.empty();
+			}
+
+			read( batch.buffer );
+			split( batch, m_eof );
+
+			if( batch.commands.empty() ) {
+				// no delimiter yet, keep reading after the carried bytes
+				batch.buffer.swap( m_carry );
+				m_carry.clear();
+			}
+		}
+		return true;
+	}
+
+// ----------------------------------------------------------------------------------------------- //
+
+private:
+
+	enum Format
+	{
+		kFormatUnknown,
+		kFormatNdjson,
+		kFormatArray
+	};
+
+	void read(std::vector<char> &buffer)
+	{
+		const size_t used = buffer.size();
+		buffer.resize( used + m_chunkSize );
+		m_in.read( buffer.data() + used, m_chunkSize );
+		const size_t got = static_cast<size_t>( m_in.gcount() );
+		buffer.resize( used + got );
+		m_eof = got < m_chunkSize;
+	}
+
+	///@brief split buffer into commands, the unterminated tail goes to m_carry unless final
+	void split(CommandBatch &batch, bool final)
+	{
+		std::vector<char> &buffer = batch.buffer;
+		const size_t size = buffer.size();
+
+		// room for the terminator of a final command and for whole 16 byte scan steps
+		buffer.resize( size + 16, '\0' );
+		char *begin = buffer.data();
+		char *end = begin + size;
+
+		if( m_format == kFormatUnknown ) {
+			char *first = begin;
+			while( first < end && isBlank( *first ) ) {
+				++first;
+			}
+			if( first == end ) {
+				buffer.resize( size );
+				m_carry.swap( buffer );
+				return;
+			}
+			m_format = *first == '[' ? kFormatArray : kFormatNdjson;
+			if( m_format == kFormatArray ) {
+				begin = first + 1;
+			}
+		}
+
+		char *tail = m_format == kFormatArray ? splitArray( batch, begin, end ) : splitLines( batch, begin, end );
+
+		if( tail < end ) {
+			if( final ) {
+				*end = '\0';
+				addCommand( batch, tail, end );
+			}
+			else {
+				m_carry.assign( tail, end );
+			}
+		}
+	}
+
+// ----------------------------------------------------------------------------------------------- //
+
+	///@brief split at every newline, returns the start of the unterminated tail
+	char * splitLines(CommandBatch &batch, char *begin, char *end)
+	{
+		char *line = begin;
+		char *p = begin;
+
+#ifdef __SSE2__
+		const __m128i newline = _mm_set1_epi8( '\n' );
+		for( ; p < end; p += 16 ) {
+			unsigned mask = static_cast<unsigned>( _mm_movemask_epi8(
+				_mm_cmpeq_epi8( _mm_loadu_si128( reinterpret_cast<const __m128i *>( p ) ), newline ) ) );
+			while( mask != 0 ) {
+				char *found = p + __builtin_ctz( mask );
+				mask &= mask - 1;
+				if( found >= end ) {
+					break;
+				}
+				*found = '\0';
+				addCommand( batch, line, found );
+				line = found + 1;
+			}
+		}
+#else
+		while( p < end && (p = static_cast<char *>( std::memchr( p, '\n', end - p ) )) != NULL ) {
+			*p = '\0';
+			addCommand( batch, line, p );
+			line = ++p;
+		}
+#endif
+		return line;
+	}
+
+	///@brief split at top level commas of the array, returns the start of the unterminated tail
+	char * splitArray(CommandBatch &batch, char *begin, char *end)
+	{
+		// every scan starts at an element boundary: depth 1, outside a string
+		unsigned depth = 1;
+		bool inString = false;
+		char *element = begin;
+
+		for( char *p = begin; p < end; ++p ) {
+			const char c = *p;
+
+			if( inString ) {
+				if( c == '\\' ) {
+					++p;
+				}
+				else if( c == '"' ) {
+					inString = false;
+				}
+				continue;
+			}
+
+			switch( c ) {
+			case '"':
+				inString = true;
+				break;
+			case '{':
+			case '[':
+				++depth;
+				break;
+			case '}':
+			case ']':
+				if( --depth == 0 ) {
+					*p = '\0';
+					addCommand( batch, element, p );
+					m_arrayDone = true;
+					return end;
+				}
+				break;
+			case ',':
+				if( depth == 1 ) {
+					*p = '\0';
+					addCommand( batch, element, p );
+					element = p + 1;
+				}
+				break;
+			default:
+				break;
+			}
+		}
+		return element;
+	}
+
+// ----------------------------------------------------------------------------------------------- //
+
+	static bool isBlank(char c)
+	{
+		return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+	}
+
+	///@brief keep [begin, end) unless it is blank, *end is already a terminator
+	static void addCommand(CommandBatch &batch, char *begin, char *end)
+	{
+		while( begin < end && isBlank( *begin ) ) {
+			++begin;
+		}
+		if( begin < end ) {
+			batch.commands.push_back( begin );
+		}
+	}
+
+// ----------------------------------------------------------------------------------------------- //
+
+	std::istream &m_in;
+	size_t m_chunkSize;         ///< bytes per read
+	Format m_format;            ///< detected from the first non blank byte
+	bool m_eof;                 ///< the stream is exhausted
+	bool m_arrayDone;           ///< the closing bracket of the array was read
+	std::vector<char> m_carry;  ///< unterminated tail of the previous batch
+
+};
+
+// ----------------------------------------------------------------------------------------------- //
+
+///@brief totals of one ingest run
+struct IngestStats
+{
+	size_t commands;     ///< commands dispatched
+	size_t succeeded;    ///< dispatches returning true
+	double seconds;      ///< wall time
+
+	double rate() const
+	{
+		return seconds > 0 ? commands / seconds : 0;
+	}
+};
+
+// ----------------------------------------------------------------------------------------------- //
+
+///
+///@brief dispatch every command of a source
+///
+///@param source The front end producing commands.
+///@param dispatcher The dispatcher to run them on, in source order.
+///@param overlap Read and split the next batch on a reader thread while the current one executes.
+///               Leave off for interactive sources so the prompt follows the previous command.
+///@param done Checked after every command, stops the run when true.
+///@param responses Receives the json response of every command, one per line, NULL to drop them.
+///
+INLINE IngestStats ingest(CommandSource &source, CommandDispatcher &dispatcher, bool overlap, std::function<bool()> done,
+	std::ostream *responses = NULL)
+{
+	typedef std::chrono::steady_clock IngestClock;
+
+	IngestStats stats{ 0, 0, 0 };
+	const IngestClock::time_point start = IngestClock::now();
+
+	auto execute = [&]( CommandBatch &batch ) {
+		for( char *command : batch.commands ) {
+			stats.succeeded += dispatcher.dispatchCommandInsitu( command, [responses](const char *response, size_t length) {
+				if( responses != NULL ) {
+					responses->write( response, static_cast<std::streamsize>( length ) ).put( '\n' );
+				}
+			} );
+			stats.commands++;
+			if( done() ) {
+				return false;
+			}
+		}
+		return true;
+	};
+
+	if( !overlap ) {
+		CommandBatch batch;
+		while( !done() && source.next( batch ) && execute( batch ) ) {
+		}
+	}
+	else {
+		// three batches: one executing, one being filled, one ready in between
+		static const size_t kBatches = 3;
+
+		std::mutex mtx;
+		std::condition_variable changed;
+		std::vector<CommandBatch> batches( kBatches );
+		std::deque<CommandBatch *> free;
+		std::deque<CommandBatch *> ready;
+		bool exhausted = false;
+		bool stop = false;
+
+		for( CommandBatch &batch : batches ) {
+			free.push_back( &batch );
+		}
+
+		std::thread reader( [&]() {
+			for( ;; ) {
+				CommandBatch *batch;
+				{
+					std::unique_lock<std::mutex> lock( mtx );
+					changed.wait( lock, [&]() { return stop || !free.empty(); } );
+					if( stop ) {
+						return;
+					}
+					batch = free.front();
+					free.pop_front();
+				}
+
+				const bool more = source.next( *batch );
+
+				std::lock_guard<std::mutex> lock( mtx );
+				if( more ) {
+					ready.push_back( batch );
+				}
+				else {
+					exhausted = true;
+				}
+				changed.notify_all();
+				if( !more ) {
+					return;
+				}
+			}
+		} );
+
+		for( ;; ) {
+			CommandBatch *batch;
+			{
+				std::unique_lock<std::mutex> lock( mtx );
+				changed.wait( lock, [&]() { return exhausted || !ready.empty(); } );
+				if( ready.empty() ) {
+					break;
+				}
+				batch = ready.front();
+				ready.pop_front();
+			}
+
+			const bool more = execute( *batch );
+
+			std::lock_guard<std::mutex> lock( mtx );
+			free.push_back( batch );
+			if( !more ) {
+				stop = true;
+			}
+			changed.notify_all();
+			if( !more ) {
+				break;
+			}
+		}
+
+		reader.join();
+	}
+
+	stats.seconds = std::chrono::duration<double>( IngestClock::now() - start ).count();
+	return stats;
+}
+
+// ----------------------------------------------------------------------------------------------- //
+
+}
+}
+
+#endif
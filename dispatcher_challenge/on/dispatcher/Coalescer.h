@@ -0,0 +1,289 @@
+#ifndef _ON_DISPATCHER_COALESCER_H_
+#define _ON_DISPATCHER_COALESCER_H_
+
+#include <stdint.h>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "on/dispatcher/Common.h"
+#include "on/dispatcher/TtlCache.h"
+
+namespace on {
+namespace dispatcher {
+
+// ----------------------------------------------------------------------------------------------- //
+
+///
+///@brief write a json value so that equal values are written the same however they were written
+///
+///@note object members are written sorted by name, numbers by value: 1, 1.0 and 1e0 are all
+///      written 1. Strings keep their bytes, arrays the order of their elements.
+///
+template <typename Writer, typename Value>
+void writeCanonical(Writer &writer, const Value &value)
+{
+	switch( value.GetType() ) {
+	case rapidjson::kNullType:
+		writer.Null();
+		break;
+
+	case rapidjson::kFalseType:
+	case rapidjson::kTrueType:
+		writer.Bool( value.GetBool() );
+		break;
+
+	case rapidjson::kNumberType:
+	{
+		if( value.IsInt64() ) {
+			writer.Int64( value.GetInt64() );
+			break;
+		}
+		if( value.IsUint64() ) {
+			writer.Uint64( value.GetUint64() );
+			break;
+		}
+
+		const double number = value.GetDouble();
+		if( number >= -9.2e18 && number <= 9.2e18 && number == static_cast<double>( static_cast<int64_t>( number ) ) ) {
+			writer.Int64( static_cast<int64_t>( number ) );
+		}
+		else {
+			writer.Double( number );
+		}
+		break;
+	}
+
+	case rapidjson::kStringType:
+		writer.String( value.GetString(), value.GetStringLength() );
+		break;
+
+	case rapidjson::kArrayType:
+		writer.StartArray();
+		for( typename Value::ConstValueIterator element = value.Begin(); element != value.End(); ++element ) {
+			writeCanonical( writer, *element );
+		}
+		writer.EndArray();
+		break;
+
+	case rapidjson::kObjectType:
+	default:
+	{
+		typedef typename Value::ConstMemberIterator Member;
+		std::vector<Member> members;
+		members.reserve( value.MemberCount() );
+		for( Member member = value.MemberBegin(); member != value.MemberEnd(); ++member ) {
+			members.push_back( member );
+		}
+		std::sort( members.begin(), members.end(), []( const Member &a, const Member &b ) {
+			const rapidjson::SizeType la = a->name.GetStringLength(), lb = b->name.GetStringLength();
+			const int order = std::memcmp( a->name.GetString(), b->name.GetString(), std::min( la, lb ) );
+			return order != 0 ? order < 0 : la < lb;
+		} );
+
+		writer.StartObject();
+		for( const Member &member : members ) {
+			writer.Key( member->name.GetString(), member->name.GetStringLength() );
+			writeCanonical( writer, member->value );
+		}
+		writer.EndObject();
+		break;
+	}
+	}
+}
+
+///@brief the canonical json of value, equal json values have the same canonical json, see writeCanonical
+template <typename Value>
+std::string canonicalJson(const Value &value)
+{
+	rapidjson::StringBuffer buffer;
+	rapidjson::Writer<rapidjson::StringBuffer> writer( buffer );
+	writeCanonical( writer, value );
+	return std::string( buffer.GetString(), buffer.GetSize() );
+}
+
+///@brief the type of a json value written by a Writer, from its first character
+INLINE rapidjson::Type jsonTypeOf(char first)
+{
+	switch( first ) {
+	case '{': return rapidjson::kObjectType;
+	case '[': return rapidjson::kArrayType;
+	case '"': return rapidjson::kStringType;
+	case 't': return rapidjson::kTrueType;
+	case 'f': return rapidjson::kFalseType;
+	case 'n': return rapidjson::kNullType;
+	default:  return rapidjson::kNumberType;
+	}
+}
+
+// ----------------------------------------------------------------------------------------------- //
+
+///@brief counters of a Coalescer
+struct CoalesceStats
+{
+	uint64_t executed;     ///< handler runs
+	uint64_t coalesced;    ///< dispatches answered by a run in flight
+	uint64_t cached;       ///< dispatches answered by a cached result
+
+	///@brief share of dispatches that did not run the handler
+	double ratio() const
+	{
+		const uint64_t total = executed + coalesced + cached;
+		return total > 0 ? double(coalesced + cached) / total : 0;
+	}
+};
+
+// ----------------------------------------------------------------------------------------------- //
+
+///
+///@brief collapses identical dispatches of an idempotent command into one handler run
+///
+///@note dispatches are identical when the canonicalJson of their payload is, the whole
+///      serialization is compared, not a hash of it. The first becomes
+///      the leader and runs the handler, identical dispatches arriving meanwhile wait for it and
+///      reuse the json result it wrote. With a result ttl, a result is also reused by identical
+///      dispatches for that long after it was written. Only successful results are cached.
+///
+///      A leader whose handler throws publishes nothing, its waiters run the handler themselves.
+///
+class Coalescer
+{
+
+// ----------------------------------------------------------------------------------------------- //
+
+public:
+
+	static const size_t kDefaultCacheCapacity = 1024;   ///< results kept when there is a result ttl
+
+	///@brief a result written by a handler run
+	struct Result
+	{
+		std::string json;        ///< the "result" value
+		rapidjson::Type type;    ///< json type of the value
+		bool ok;                 ///< the handler returned true
+	};
+
+	typedef std::shared_ptr<const Result> SharedResult;
+
+	///
+	///@param resultTtlNs How long a result is reused after its run, 0 to share only runs in flight.
+	///
+	explicit Coalescer(uint64_t resultTtlNs, size_t cacheCapacity = kDefaultCacheCapacity)
+		: m_results( resultTtlNs > 0 ? cacheCapacity : 0, resultTtlNs ),
+		  m_executed{ 0 }, m_coalesced{ 0 }, m_cached{ 0 }
+	{
+	}
+
+	Coalescer(const Coalescer&) = delete;
+	Coalescer& operator=(const Coalescer&) = delete;
+
+// ----------------------------------------------------------------------------------------------- //
+
+	///
+	///@brief join the dispatches of a payload, waiting for a run in flight
+	///
+	///@param payload The canonicalJson of the payload.
+	///@param leader Set when the caller must run the handler and then call complete().
+	///
+	///@return the result to reuse, NULL when the caller runs the handler
+	///
+	SharedResult join(const std::string &payload, uint64_t nowNs, bool &leader)
+	{
+		leader = false;
+
+		SharedResult result;
+		if( m_results.find( payload.data(), payload.size(), result, nowNs ) ) {
+			m_cached.fetch_add( 1, std::memory_order_relaxed );
+			return result;
+		}
+
+		std::unique_lock<std::mutex> lock( m_mtx );
+		auto found = m_flights.find( payload );
+		if( found == m_flights.end() ) {
+			m_flights.emplace( payload, std::make_shared<Flight>() );
+			m_executed.fetch_add( 1, std::memory_order_relaxed );
+			leader = true;
+			return nullptr;
+		}
+
+		std::shared_ptr<Flight> flight = found->second;
+		m_landed.wait( lock, [&flight]() { return flight->landed; } );
+		if( !flight->result ) {
+			m_executed.fetch_add( 1, std::memory_order_relaxed );
+			return nullptr;
+		}
+
+		m_coalesced.fetch_add( 1, std::memory_order_relaxed );
+		return flight->result;
+	}
+
+	///
+	///@brief hand the result of the leader's run to its waiters and the cache
+	///
+	///@param result NULL when the handler threw.
+	///
+	void complete(const std::string &payload, SharedResult result, uint64_t nowNs)
+	{
+		if( result && result->ok ) {
+			m_results.insert( payload.data(), payload.size(), result, nowNs );
+		}
+
+		{
+			std::lock_guard<std::mutex> lock( m_mtx );
+			auto found = m_flights.find( payload );
+			found->second->result = std::move( result );
+			found->second->landed = true;
+			m_flights.erase( found );
+		}
+		m_landed.notify_all();
+	}
+
+// ----------------------------------------------------------------------------------------------- //
+
+	CoalesceStats stats() const
+	{
+		return CoalesceStats{ m_executed.load( std::memory_order_relaxed ), m_coalesced.load( std::memory_order_relaxed ),
+			m_cached.load( std::memory_order_relaxed ) };
+	}
+
+	uint64_t resultTtlNs() const
+	{
+		return m_results.ttlNs();
+	}
+
+// ----------------------------------------------------------------------------------------------- //
+
+private:
+
+	struct Flight
+	{
+		Flight() : landed{ false }
+		{
+		}
+
+		bool landed;           ///< the leader completed, guarded by m_mtx
+		SharedResult result;   ///< NULL when the leader's handler threw
+	};
+
+	TtlCache<SharedResult> m_results;    ///< recent results by canonical payload, disabled without a ttl
+	std::mutex m_mtx;                    ///< guards m_flights and the flights
+	std::condition_variable m_landed;    ///< a flight landed
+	std::unordered_map< std::string, std::shared_ptr<Flight> > m_flights;   ///< runs in flight by canonical payload
+	std::atomic<uint64_t> m_executed;
+	std::atomic<uint64_t> m_coalesced;
+	std::atomic<uint64_t> m_cached;
+
+};
+
+// ----------------------------------------------------------------------------------------------- //
+
+}
+}
+
+#endif
@@ -0,0 +1,154 @@
+#ifndef _ON_DISPATCHER_COMMANDDELEGATE_H_
+#define _ON_DISPATCHER_COMMANDDELEGATE_H_
+
+#include <functional>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <utility>
+
+#include "on/dispatcher/Common.h"
+
+namespace on {
+namespace dispatcher {
+
+// ----------------------------------------------------------------------------------------------- //
+
+///
+///@brief thrown by a handler, or the payload binding in front of it, to reject the command as malformed
+///
+///@note the dispatcher drops what the handler wrote, answers {"error":"<what>","ok":false} and
+///      counts the command as malformed rather than as a handler error.
+///
+struct MalformedCommand : public std::runtime_error
+{
+	explicit MalformedCommand(const std::string &message) : std::runtime_error( message )
+	{
+	}
+};
+
+// ----------------------------------------------------------------------------------------------- //
+
+///
+///@brief handler of a command: an object pointer and a thunk calling one of its methods
+///
+///@note a delegate built from a method copies two pointers, nothing is allocated and a call is one
+///      indirect call into a thunk the method is inlined into. Any other callable, e.g. a capturing
+///      lambda, is moved into a std::function shared by the copies of the delegate, the one
+///      allocation happens at registration.
+///
+class CommandDelegate
+{
+
+// ----------------------------------------------------------------------------------------------- //
+
+public:
+
+	typedef bool (*Thunk)(void *object, JsonValue &command, ResponseWriter &response);
+
+	CommandDelegate() : m_object{ NULL }, m_thunk{ NULL }
+	{
+	}
+
+	///@brief call thunk on object, see ON_COMMAND_DELEGATE
+	CommandDelegate(void *object, Thunk thunk) : m_object{ object }, m_thunk{ thunk }
+	{
+	}
+
+	///@brief any callable taking (JsonValue &, ResponseWriter &) and returning bool
+	template <typename Function, typename = typename std::enable_if<
+		!std::is_same<typename std::decay<Function>::type, CommandDelegate>::value>::type>
+	CommandDelegate(Function function)
+		: m_function{ std::make_shared<FunctionHandler>( std::move(function) ) },
+		  m_object{ m_function.get() },
+		  m_thunk{ &callFunction }
+	{
+	}
+
+// ----------------------------------------------------------------------------------------------- //
+
+	bool operator()(JsonValue &command, ResponseWriter &response) const
+	{
+		return m_thunk( m_object, command, response );
+	}
+
+	explicit operator bool() const
+	{
+		return m_thunk != NULL;
+	}
+
+// ----------------------------------------------------------------------------------------------- //
+
+private:
+
+	typedef std::function<bool(JsonValue &, ResponseWriter &)> FunctionHandler;
+
+	static bool callFunction(void *function, JsonValue &command, ResponseWriter &response)
+	{
+		return (*static_cast<FunctionHandler *>( function ))( command, response );
+	}
+
+	std::shared_ptr<FunctionHandler> m_function;   ///< owned callable, NULL for methods
+	void *m_object;                                ///< argument of the thunk
+	Thunk m_thunk;                                 ///< NULL for an empty delegate
+
+};
+
+// ----------------------------------------------------------------------------------------------- //
+
+///
+///@brief thunk of a handler method, specialized per method signature
+///
+///@note bool (T::*)(JsonValue &, ResponseWriter &) gets the raw command, methods taking a typed
+///      payload, bool (T::*)(const Payload &, ResponseWriter &), are specialized in PayloadBinding.h.
+///
+template <typename Method, Method method>
+struct CommandMethod;
+
+template <typename T, bool (T::*method)(JsonValue &, ResponseWriter &)>
+struct CommandMethod<bool (T::*)(JsonValue &, ResponseWriter &), method>
+{
+	typedef T Object;
+
+	static bool call(void *object, JsonValue &command, ResponseWriter &response)
+	{
+		return (static_cast<T *>( object )->*method)( command, response );
+	}
+};
+
+///
+///@brief the thunk of Class::method, a constant expression
+///
+#define ON_COMMAND_METHOD(Class, method) \
+	&on::dispatcher::CommandMethod<decltype(&Class::method), &Class::method>::call
+
+///
+///@brief a delegate calling object.method, object must outlive the delegate
+///
+#define ON_COMMAND_DELEGATE(object, Class, method) \
+	on::dispatcher::CommandDelegate( static_cast<Class *>( &(object) ), ON_COMMAND_METHOD( Class, method ) )
+
+// ----------------------------------------------------------------------------------------------- //
+
+///
+///@brief one row of a compile time command table of T, see CommandDispatcher::addCommandHandlers
+///
+///		constexpr CommandBinding<Controller> kControllerCommands[] = {
+///			{ "help", ON_COMMAND_METHOD( Controller, help ), &HelpPayload::schema },
+///		};
+///
+template <typename T>
+struct CommandBinding
+{
+	const char *name;                 ///< the command string
+	CommandDelegate::Thunk thunk;     ///< ON_COMMAND_METHOD of a method of T
+	const char *(*schema)();          ///< returns the payload schema, NULL for none
+};
+
+// ----------------------------------------------------------------------------------------------- //
+
+}
+}
+
+#endif
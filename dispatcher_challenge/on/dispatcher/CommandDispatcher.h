@@ -0,0 +1,1108 @@
+#ifndef _ON_DISPATCHER_COMMANDDISPATCHER_H_
+#define _ON_DISPATCHER_COMMANDDISPATCHER_H_
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <stdexcept>
+#include <memory>
+#include <utility>
+#include <future>
+#include <mutex>
+#include <thread>
+
+#include "on/dispatcher/Common.h"
+#include "on/dispatcher/CommandTable.h"
+#include "on/dispatcher/RcuPointer.h"
+#include "on/dispatcher/Admission.h"
+#include "on/dispatcher/CommandMetrics.h"
+#include "on/dispatcher/CommandRecorder.h"
+#include "on/dispatcher/DispatchContext.h"
+#include "on/dispatcher/EnvelopeReader.h"
+#include "on/dispatcher/DispatchWorkers.h"
+
+namespace on {
+namespace dispatcher {
+
+// ----------------------------------------------------------------------------------------------- //
+
+///
+/// @brief how a command is parsed before its handler runs
+///
+enum DispatchMode
+{
+	kDispatchDom,      ///< build the whole command into a DOM, routed and validated during the parse
+	kDispatchStream    ///< as DOM, materialize only "command" and "payload"
+};
+
+// ----------------------------------------------------------------------------------------------- //
+
+///
+/// @brief Command dispatcher class to emplace command handler and dispatching.
+///
+/// @note the handler table is published through an RcuPointer: a dispatch reads a snapshot
+///       without locking, registering builds a new table and never waits for a dispatch. Handlers
+///       can be added, replaced or reconfigured while other threads dispatch.
+///
+class CommandDispatcher {
+public:
+
+// ----------------------------------------------------------------------------------------------- //
+
+	///
+	/// @brief emple constrcutor
+	///
+	/// @param document_pool_blocks Number of pooled arena blocks, 0 to allocate every block with malloc.
+	///
+    explicit CommandDispatcher(size_t document_pool_blocks = kDefaultDocumentPoolBlocks)
+		: document_pool_{ NULL }, dispatch_mode_{ kDispatchDom }, phase_timing_{ false }, recorder_{ NULL }
+    {
+		if ( document_pool_blocks > 0 )
+		{
+			const size_t block_size = kDocumentBlockSize + PoolAllocator::kChunkOverhead;
+			document_pool_ = memory_pool_init( document_pool_blocks, block_size );
+			document_allocator_ = PoolAllocator( document_pool_, document_pool_ ? block_size : 0 );
+		}
+
+		context_.reset( new DispatchContext( document_allocator_ ) );
+
+		//built-in introspection, {"command":"stats","payload":{}}
+		command_handlers_.update( [this]( CommandTable &table ) {
+			table.insert( kStatsCommand, ON_COMMAND_DELEGATE( *this, CommandDispatcher, respondStats ) );
+			return true;
+		} );
+    }
+
+// ----------------------------------------------------------------------------------------------- //
+
+    ///
+    /// @brief simple destructor
+    ///
+    virtual ~CommandDispatcher()
+    {
+        // question why is it virtual? Is it needed in this case?
+		/*
+		Making the destrutor virutal will get called from the derived class.
+		It's needed here if this class is extended.
+		*/
+
+		/*
+		If executing the handler in a thread then wait for all tasks to finish but the command
+		displatcher is a linear blocking call.  Not sure anything needs to be here.
+		*/
+
+		//async dispatches may still be queued or running, drain them before anything goes away
+		workers_.reset();
+
+		//the context holds pool blocks, give them back first
+		context_.reset();
+
+		if ( document_pool_ != NULL )
+		{
+			memory_pool_destroy( document_pool_ );
+		}
+    }
+
+// ----------------------------------------------------------------------------------------------- //
+
+    ///
+    /// @brief add handler to command
+    ///
+    /// @param command The command string for the handler.
+    /// @param handler The handler to handle the command.
+    /// @param payload_schema JSON Schema the payload must match before the handler runs, NULL for none.
+    ///                       It is compiled once here and cached with the command.
+    ///
+    /// @return false if the schema is not valid json, the handler is not added
+    ///
+    bool addCommandHandler(std::string command, CommandHandler handler, const char *payload_schema = NULL)
+    {
+        console() << "CommandDispatcher: addCommandHandler: " << command << '\n';
+
+		std::shared_ptr<const PayloadSchema> schema;
+		if ( payload_schema != NULL )
+		{
+			std::string error;
+			schema = compileSchema( payload_schema, error );
+			if ( !schema )
+			{
+				console() << "CommandDispatcher: addCommandHandler: " << command << " invalid schema: " << error << '\n';
+				return false;
+			}
+		}
+
+		//add new handler for the command, replaces an existing one, in a new table
+		command_handlers_.update( [&]( CommandTable &table ) {
+			table.insert( command, std::move(handler), std::move(schema) );
+			return true;
+		} );
+
+        return true;
+    }
+
+// ----------------------------------------------------------------------------------------------- //
+
+    ///
+    /// @brief add the handlers of a compile time command table, each calling a method of object
+    ///
+    /// @param object The object the methods are called on, it must outlive the dispatcher.
+    /// @param commands The command table, see CommandBinding.
+    ///
+    /// @return false if a schema is not valid json, the other commands are still added
+    ///
+    template <typename T, size_t Count>
+    bool addCommandHandlers(T &object, const CommandBinding<T> (&commands)[Count])
+    {
+		bool added = true;
+		for ( const CommandBinding<T> &command : commands )
+		{
+			added &= addCommandHandler( command.name, CommandHandler( &object, command.thunk ),
+				command.schema != NULL ? command.schema() : NULL );
+		}
+		return added;
+    }
+
+// ----------------------------------------------------------------------------------------------- //
+
+    ///
+    /// @brief set the scheduling class of a registered command, kPriorityNormal until set
+    ///
+    /// @note queued (async) dispatches run by class, then earliest "deadline_ms" first.
+    ///
+    /// @return false if the command is not registered
+    ///
+    bool setCommandPriority(const std::string &command, CommandPriority priority)
+    {
+		return command_handlers_.update( [&]( CommandTable &table ) {
+			CommandEntry *entry = table.find( command.data(), command.size() );
+			if ( entry == NULL )
+			{
+				return false;
+			}
+
+			entry->priority = priority;
+			return true;
+		} );
+    }
+
+// ----------------------------------------------------------------------------------------------- //
+
+    ///
+    /// @brief limit a registered command to rate dispatches per second, from all clients together
+    ///
+    /// @param rate Dispatches per second, 0 or less to remove the limit.
+    /// @param burst Dispatches admitted back to back.
+    ///
+    /// @note checked as soon as the command is routed, before its payload is parsed (stream mode)
+    ///       or validated (DOM mode).
+    ///
+    /// @return false if the command is not registered
+    ///
+    bool setCommandRateLimit(const std::string &command, double rate, double burst)
+    {
+		return command_handlers_.update( [&]( CommandTable &table ) {
+			CommandEntry *entry = table.find( command.data(), command.size() );
+			if ( entry == NULL )
+			{
+				return false;
+			}
+
+			entry->limit = rate > 0 ? std::make_shared<TokenBucket>( rate, burst ) : nullptr;
+			return true;
+		} );
+    }
+
+    ///
+    /// @brief mark a registered command idempotent, identical dispatches then share one handler run
+    ///
+    /// @param idempotent false to run the handler for every dispatch again.
+    /// @param result_ttl_ms How long a successful result is reused after its run, 0 to share only
+    ///                      runs in flight.
+    ///
+    /// @note dispatches are identical when their payloads are equal json (canonicalJson), the
+    ///       handler must not depend on anything else. Waiting dispatches receive the "result"
+    ///       the run wrote, see Coalescer.
+    ///
+    /// @return false if the command is not registered
+    ///
+    bool setCommandIdempotent(const std::string &command, bool idempotent = true, double result_ttl_ms = 0)
+    {
+		return command_handlers_.update( [&]( CommandTable &table ) {
+			CommandEntry *entry = table.find( command.data(), command.size() );
+			if ( entry == NULL )
+			{
+				return false;
+			}
+
+			entry->coalescer = idempotent
+				? std::make_shared<Coalescer>( static_cast<uint64_t>( std::max( result_ttl_ms, 0.0 ) * 1e6 ) ) : nullptr;
+			return true;
+		} );
+    }
+
+    ///
+    /// @brief run middleware around the handlers of a command namespace
+    ///
+    /// @param prefix The namespace of dotted command names, "device" for "device" and "device.*",
+    ///               empty for every command. Commands registered later join their namespaces.
+    ///
+    /// @note middleware of enclosing namespaces runs outside, middleware of one namespace in the
+    ///       order it was added. The chain of every command is composed here, a dispatch walks
+    ///       a flat list, see CommandTrie.
+    ///
+    void addMiddleware(const std::string &prefix, std::shared_ptr<Middleware> middleware)
+    {
+		command_handlers_.update( [&]( CommandTable &table ) {
+			table.use( prefix, std::move( middleware ) );
+			return true;
+		} );
+    }
+
+// ----------------------------------------------------------------------------------------------- //
+
+    ///
+    /// @brief limit every client to rate dispatches per second, see DispatchOrigin::client
+    ///
+    void setClientRateLimit(double rate, double burst)
+    {
+		admission_.setClientLimit( rate, burst );
+    }
+
+// ----------------------------------------------------------------------------------------------- //
+
+    ///
+    /// @brief select how commands are parsed
+    ///
+    /// @param mode kDispatchDom (default) or kDispatchStream.
+    ///
+    /// @note both modes stop at an unknown or throttled "command" and validate a payload
+    ///       following "command" in the same pass. Otherwise both modes read every byte and run
+    ///       at about the same speed, skipping a large sibling of "payload" saves little.
+    ///
+    void setDispatchMode(DispatchMode mode)
+    {
+		dispatch_mode_ = mode;
+    }
+
+    DispatchMode dispatchMode() const
+    {
+		return dispatch_mode_;
+    }
+
+// ----------------------------------------------------------------------------------------------- //
+
+    ///
+    /// @brief append every dispatched command to recorder's log, NULL to stop recording
+    ///
+    /// @note the command is copied before it is parsed and handed to the recorder with its
+    ///       arrival, client, latency and result once its response is complete. The recorder
+    ///       must outlive the dispatcher or be detached first, async dispatches included.
+    ///
+    void setRecorder(CommandRecorder *recorder)
+    {
+		recorder_.store( recorder, std::memory_order_release );
+    }
+
+// ----------------------------------------------------------------------------------------------- //
+
+    ///
+    /// @brief time the parse, lookup, admission, validation and handler phases of every dispatch, off by default
+    ///
+    void setPhaseTiming(bool enabled)
+    {
+		phase_timing_ = enabled;
+    }
+
+    ///
+    /// @brief phase times of the last synchronous dispatch that ran a handler, see setPhaseTiming
+    ///
+    const DispatchTiming & lastPhaseTiming() const
+    {
+		return context_->timing();
+    }
+
+// ----------------------------------------------------------------------------------------------- //
+
+    ///
+    /// @brief Dispatch commands
+    ///
+    /// @param command_json The json object with a command strind and it's respective payload
+    ///
+    bool dispatchCommand(const std::string &command_json)
+    {
+		return dispatchCommand( command_json.data(), command_json.size() );
+    }
+
+// ----------------------------------------------------------------------------------------------- //
+
+    ///
+    /// @brief Dispatch commands, the command is copied into reused scratch space and parsed in situ
+    ///
+    /// @param command_json The json command, need not be null terminated, or a MessagePack
+    ///                     envelope of the same shape, told apart by its first byte (isMsgPack).
+    /// @param length The length of the command.
+    ///
+    bool dispatchCommand(const char *command_json, size_t length)
+    {
+		ContextScope scope( *this );
+		return dispatch( scope.context(), scope.context().copy( command_json, length ), length );
+    }
+
+// ----------------------------------------------------------------------------------------------- //
+
+    ///
+    /// @brief Dispatch commands without copying, the buffer is parsed in situ
+    ///
+    /// @param command_json The null terminated json command. It is modified by the parse and
+    ///                     payload strings handed to the handler point into it.
+    ///
+    bool dispatchCommandInsitu(char *command_json)
+    {
+		ContextScope scope( *this );
+		return dispatch( scope.context(), command_json, std::strlen( command_json ) );
+    }
+
+// ----------------------------------------------------------------------------------------------- //
+
+    ///
+    /// @brief Dispatch commands and hand the json response to the caller
+    ///
+    /// @param respond Called as respond(const char *response, size_t length) before the dispatch
+    ///                returns, the response is the dispatcher's reused buffer and is only valid
+    ///                during the call, e.g.
+    ///
+    ///                {"result":{"usage":"..."},"command":"help","ok":true}
+    ///                {"error":"Malformed json, missing command.","ok":false}
+    ///
+    /// @param origin When the command was received, a "deadline_ms" in the envelope counts from
+    ///               there, and the client it came from, for per client rate limits.
+    ///
+    template <typename Respond>
+    bool dispatchCommand(const char *command_json, size_t length, Respond &&respond, const DispatchOrigin &origin = DispatchOrigin())
+    {
+		ContextScope scope( *this );
+		scope.context().setOrigin( origin );
+		const bool result = dispatch( scope.context(), scope.context().copy( command_json, length ), length );
+		respond( scope.context().response().GetString(), scope.context().response().GetSize() );
+		return result;
+    }
+
+    template <typename Respond>
+    bool dispatchCommandInsitu(char *command_json, Respond &&respond, const DispatchOrigin &origin = DispatchOrigin())
+    {
+		return dispatchCommandInsitu( command_json, std::strlen( command_json ), std::forward<Respond>( respond ), origin );
+    }
+
+    ///
+    /// @brief Dispatch a json or MessagePack command of length bytes in situ, json must also be null terminated
+    ///
+    template <typename Respond>
+    bool dispatchCommandInsitu(char *command_json, size_t length, Respond &&respond, const DispatchOrigin &origin = DispatchOrigin())
+    {
+		ContextScope scope( *this );
+		scope.context().setOrigin( origin );
+		const bool result = dispatch( scope.context(), command_json, length );
+		respond( scope.context().response().GetString(), scope.context().response().GetSize() );
+		return result;
+    }
+
+// ----------------------------------------------------------------------------------------------- //
+
+    ///
+    /// @brief set the number of worker threads running async dispatches
+    ///
+    /// @param count Number of workers, 0 for one per hardware thread. Queued work is drained first.
+    ///
+    /// @note replaces the running workers, it must not be called while async dispatches are
+    ///       submitted or from a handler. Creating the workers on the first async dispatch is safe.
+    ///
+    void setWorkerCount(size_t count)
+    {
+		std::lock_guard<std::mutex> lock( workers_mtx_ );
+		startWorkers( count );
+    }
+
+    size_t workerCount() const
+    {
+		std::lock_guard<std::mutex> lock( workers_mtx_ );
+		return workers_ ? workers_->size() : 0;
+    }
+
+// ----------------------------------------------------------------------------------------------- //
+
+    ///
+    /// @brief Dispatch commands on the worker pool, starts one worker per hardware thread if none are running
+    ///
+    /// @param command_json The json or MessagePack command, parsed in situ by the worker.
+    /// @param key Ordering key, commands sharing a key (e.g. a user token) run in submission order.
+    ///            Commands with different or no keys run in parallel.
+    /// @param origin When the command was received, 0 for now, and the client it came from, as
+    ///               for dispatchCommand.
+    ///
+    /// @note queued commands run by the priority class of their command, then earliest
+    ///       "deadline_ms" first, both read by a peek at the envelope before it is queued,
+    ///       except that a keyed command never overtakes an earlier one of its key.
+    ///       A command still queued past its deadline is dropped before its handler runs.
+    ///
+    /// @return the result of dispatchCommand once a worker has run it
+    ///
+    std::future<bool> dispatchCommandAsync(std::string command_json, const std::string &key = std::string(),
+		const DispatchOrigin &origin = DispatchOrigin())
+    {
+		DispatchWorkers &workers = runningWorkers();
+
+		const uint64_t arrival = origin.arrivalNs > 0 ? origin.arrivalNs : monotonicNs();
+		EnvelopePeek peek;
+		CommandPriority priority = kPriorityNormal;
+		{
+			RcuPointer<CommandTable>::Snapshot table( command_handlers_ );
+			peek = peekEnvelope( command_json.data(), command_json.size(), *table );
+			priority = peek.entry != NULL ? peek.entry->priority : kPriorityNormal;
+		}
+		const uint64_t deadline = peek.deadlineMs != kNoDeadline
+			? arrival + static_cast<uint64_t>( peek.deadlineMs * 1e6 ) : DispatchWorkers::kNoDeadlineNs;
+
+		return workers.submit( std::move(command_json), key.data(), key.size(), priority, deadline,
+			DispatchOrigin( arrival, origin.client ) );
+    }
+
+// ----------------------------------------------------------------------------------------------- //
+
+	static constexpr const char *kStatsCommand = "stats";                                ///< built-in command responding with writeStats()
+
+// ----------------------------------------------------------------------------------------------- //
+
+    ///
+    /// @brief write the per command counters and latency percentiles of all threads as json
+    ///
+    /// @note {"commands":{"<name>":{"dispatched":n,"malformed":n,"handler_errors":n,"expired":n,"throttled":n,"rejected":n,
+    ///       "latency_ns":{"mean":n,"p50":n,"p99":n,"p999":n,"max":n},"rate_limit":{"rate":r,"burst":b},
+    ///       "coalescing":{"executed":n,"coalesced":n,"cached":n,"ratio":r,"result_ttl_ms":t}},...},
+    ///       "unrouted":{...},"client_rate_limit":{"rate":r,"burst":b,"clients":n}}
+    ///       "unrouted" counts commands rejected before a handler was found, the limits appear when
+    ///       set, "coalescing" for idempotent commands. Its ratio is the share of dispatches that
+    ///       reused another run's result.
+    ///
+    template <typename Writer>
+    void writeStats(Writer &writer)
+    {
+		RcuPointer<CommandTable>::Snapshot table( command_handlers_ );
+
+		writer.StartObject();
+
+		writer.Key( "commands" );
+		writer.StartObject();
+		for ( const CommandEntry &entry : *table )
+		{
+			writer.Key( entry.name.c_str(), static_cast<rapidjson::SizeType>( entry.name.size() ) );
+			writeCommandStats( writer, table->index( entry ) + 1, entry.limit.get(), entry.coalescer.get() );
+		}
+		writer.EndObject();
+
+		writer.Key( "unrouted" );
+		writeCommandStats( writer, CommandMetrics::kUnrouted, NULL, NULL );
+
+		const ClientRateLimit *clients = admission_.clientLimit();
+		if ( clients != NULL )
+		{
+			writer.Key( "client_rate_limit" );
+			writer.StartObject();
+			writer.Key( "rate" );
+			writer.Double( clients->rate() );
+			writer.Key( "burst" );
+			writer.Double( clients->burst() );
+			writer.Key( "clients" );
+			writer.Uint64( clients->clients() );
+			writer.EndObject();
+		}
+
+		writer.EndObject();
+    }
+
+    std::string statsJson()
+    {
+		rapidjson::StringBuffer buffer;
+		rapidjson::Writer<rapidjson::StringBuffer> writer( buffer );
+		writeStats( writer );
+		return std::string( buffer.GetString(), buffer.GetSize() );
+    }
+
+// ----------------------------------------------------------------------------------------------- //
+
+	static const size_t kDefaultDocumentPoolBlocks = 4;                                  ///< arena blocks of the dispatch contexts
+	static const size_t kDocumentBlockSize = DispatchContext::kBlockSize;               ///< arena block size
+
+// ----------------------------------------------------------------------------------------------- //
+
+private:
+
+    ///
+    /// @brief the async workers, started with one per hardware thread by the first caller
+    ///
+    DispatchWorkers & runningWorkers()
+    {
+		std::lock_guard<std::mutex> lock( workers_mtx_ );
+		if ( !workers_ )
+		{
+			startWorkers( 0 );
+		}
+		return *workers_;
+    }
+
+    ///
+    /// @brief replace the workers by count new ones, workers_mtx_ held
+    ///
+    void startWorkers(size_t count)
+    {
+		workers_.reset();
+
+		if ( count == 0 )
+		{
+			count = std::thread::hardware_concurrency();
+		}
+
+		workers_.reset( new DispatchWorkers( count,
+			[this]( DispatchContext &context, char *command_json, size_t length ) { return dispatch( context, command_json, length ); },
+			kDocumentBlockSize + PoolAllocator::kChunkOverhead ) );
+    }
+
+// ----------------------------------------------------------------------------------------------- //
+
+	///
+	/// @brief borrow the reused context for one dispatch, a nested or concurrent dispatch gets a temporary one
+	///
+	class ContextScope
+	{
+	public:
+		explicit ContextScope( CommandDispatcher &dispatcher )
+		{
+			if ( dispatcher.context_->tryAcquire() )
+			{
+				context_ = dispatcher.context_.get();
+			}
+			else
+			{
+				temporary_.reset( new DispatchContext( dispatcher.document_allocator_ ) );
+				context_ = temporary_.get();
+				context_->tryAcquire();
+			}
+		}
+
+		~ContextScope()
+		{
+			context_->reset();
+			context_->release();
+		}
+
+		DispatchContext &context()
+		{
+			return *context_;
+		}
+
+	private:
+		DispatchContext *context_;
+		std::unique_ptr<DispatchContext> temporary_;
+	};
+
+// ----------------------------------------------------------------------------------------------- //
+
+	///@brief the command a dispatch was routed to and how it ended
+	struct DispatchOutcome
+	{
+		const CommandEntry *entry;  ///< NULL until the command is found
+		CommandOutcome status;      ///< malformed until the handler runs
+	};
+
+    ///
+    /// @brief parse a mutable command buffer in situ and run its handler, counting it in the metrics
+    ///
+    /// @note the response object is written into the context: the handler's "result" or an
+    ///       "error", then the "command" once it is known and "ok".
+    ///
+    /// @note the whole dispatch reads one snapshot of the handler table, a handler replaced
+    ///       meanwhile is deleted only after it returns.
+    ///
+    /// @note a MessagePack command is read by a MsgPackReader emitting the events of a json
+    ///       parse, routing, validation and handlers are the same. The response is json.
+    ///
+    bool dispatch(DispatchContext &context, char *command_json, size_t length)
+    {
+		const bool binary = isMsgPack( command_json, length );
+		if ( binary )
+		{
+			console() << "COMMAND: <msgpack " << length << " bytes>\n";
+		}
+		else
+		{
+			console() << "COMMAND: " << command_json << '\n';
+		}
+
+		//handlers allocate their scratch in the arena of this dispatch, see ScratchString
+		RequestArenaScope arena( context.arena() );
+
+		//the parse below modifies the command
+		CommandRecorder *recorder = recorder_.load( std::memory_order_acquire );
+		const char *recorded = recorder != NULL ? context.keep( command_json, length ) : NULL;
+
+		RcuPointer<CommandTable>::Snapshot table( command_handlers_ );
+		const uint64_t start = monotonicNs();
+		DispatchOutcome outcome{ NULL, kCommandMalformed };
+
+		if ( context.arrival() == 0 )
+		{
+			context.setArrival( start );
+		}
+
+		ResponseWriter &response = context.beginResponse();
+		response.StartObject();
+
+		const bool result = dispatchEnvelope( *table, context, command_json, length, binary, response, outcome );
+
+		if ( outcome.entry != NULL )
+		{
+			response.Key( "command" );
+			response.String( outcome.entry->name.c_str(), static_cast<rapidjson::SizeType>( outcome.entry->name.size() ) );
+		}
+		response.Key( "ok" );
+		response.Bool( outcome.status == kCommandOk );
+		response.EndObject();
+
+		const uint64_t end = monotonicNs();
+		const size_t slot = outcome.entry != NULL ? table->index( *outcome.entry ) + 1 : CommandMetrics::kUnrouted;
+		metrics_.record( slot, outcome.status, end - start );
+
+		if ( recorder != NULL )
+		{
+			recorder->record( recorded, length, context.arrival(), context.client(), end - context.arrival(), result );
+		}
+
+		return result;
+    }
+
+// ----------------------------------------------------------------------------------------------- //
+
+    ///
+    /// @brief parse the envelope, routing on "command" as soon as it is read
+    ///
+    /// @note in DOM mode the whole envelope is built, in stream mode only "command" and "payload".
+    ///       Either way a payload following "command" is validated while it is built, one that
+    ///       comes first is validated in a second walk.
+    ///
+    bool dispatchEnvelope(const CommandTable &table, DispatchContext &context, char *command_json, size_t length, bool binary,
+		ResponseWriter &response, DispatchOutcome &outcome)
+    {
+		const uint64_t start = phaseStamp();
+		const bool dom = dispatch_mode_ == kDispatchDom;
+
+		//admitted at "command", a throttled command is not parsed any further
+		EnvelopeGenerator envelope( command_json, length, table, context.schemaState(), &admission_, context.client(), dom );
+		envelope.timed = phase_timing_;
+		JsonDocument &command = context.document();
+		command.Populate( envelope );
+		outcome.entry = envelope.entry;
+		const uint64_t parsed = phaseStamp();
+
+		switch ( envelope.status )
+		{
+		case kEnvelopeOk:
+		{
+			if ( expired( context, envelope.deadlineMs ) )
+			{
+				outcome.status = kCommandExpired;
+				return reject( response, "Deadline expired." );
+			}
+			const uint64_t checked = phaseStamp();
+
+			//validated during the parse unless "payload" came before "command"
+			const bool walk = !envelope.payloadValidated && envelope.entry->schema;
+			if ( walk && !checkPayload( context, *envelope.entry, command, response ) )
+			{
+				return false;
+			}
+			const uint64_t validated = walk ? phaseStamp() : checked;
+
+			const bool handled = runHandler( context, *envelope.entry, command, response, outcome.status );
+			if ( phase_timing_ )
+			{
+				//lookup and admission happen inside the parse, take them out of it
+				DispatchTiming &timing = context.timing();
+				timing.parseNs = (parsed - start) - envelope.lookupNs - envelope.admissionNs;
+				timing.lookupNs = envelope.lookupNs;
+				timing.admissionNs = envelope.admissionNs + (checked - parsed);
+				timing.validationNs = validated - checked;
+				timing.handlerNs = monotonicNs() - validated;
+			}
+			return handled;
+		}
+
+		case kEnvelopeInvalidPayload:
+			return reject( response, "Malformed json, payload fails schema: " + envelope.payloadError );
+
+		case kEnvelopeMalformed:
+			return reject( response, binary ? "Malformed msgpack command." : "Malformed command json string." );
+
+		case kEnvelopeBadDeadline:
+			return reject( response, "Malformed json, deadline_ms type." );
+
+		case kEnvelopeThrottled:
+			return throttle( response, envelope.admitted, outcome );
+
+		case kEnvelopeBadCommand:
+			return reject( response, "Malformed json, missing payload." );
+
+		case kEnvelopeUnknownCommand:
+			return reject( response, "Malformed json, missing command." );
+
+		case kEnvelopeDuplicateMember:
+			return reject( response, "Malformed json, duplicate member." );
+
+		default:
+			return reject( response, "Malformed json object." );
+		}
+    }
+
+// ----------------------------------------------------------------------------------------------- //
+
+    ///
+    /// @brief the deadline of a command, deadline_ms after its arrival, has passed
+    ///
+    bool expired(const DispatchContext &context, double deadline_ms) const
+    {
+		return deadline_ms != kNoDeadline && monotonicNs() - context.arrival() > static_cast<uint64_t>( deadline_ms * 1e6 );
+    }
+
+    ///
+    /// @brief a timestamp when phase timing is on, 0 otherwise
+    ///
+    uint64_t phaseStamp() const
+    {
+		return phase_timing_ ? monotonicNs() : 0;
+    }
+
+// ----------------------------------------------------------------------------------------------- //
+
+    ///
+    /// @brief handler of the stats command
+    ///
+    bool respondStats(JsonValue &, ResponseWriter &response)
+    {
+		writeStats( response );
+		return true;
+    }
+
+    ///
+    /// @brief write the merged counters and latency of one metrics slot, its rate limit and coalescing if any
+    ///
+    template <typename Writer>
+    void writeCommandStats(Writer &writer, size_t slot, const TokenBucket *limit, const Coalescer *coalescer)
+    {
+		CommandStats stats;
+		metrics_.snapshot( slot, stats );
+
+		writer.StartObject();
+		writer.Key( "dispatched" );
+		writer.Uint64( stats.dispatched );
+		writer.Key( "malformed" );
+		writer.Uint64( stats.malformed );
+		writer.Key( "handler_errors" );
+		writer.Uint64( stats.handlerErrors );
+		writer.Key( "expired" );
+		writer.Uint64( stats.expired );
+		writer.Key( "throttled" );
+		writer.Uint64( stats.throttled );
+		writer.Key( "rejected" );
+		writer.Uint64( stats.rejected );
+
+		writer.Key( "latency_ns" );
+		writer.StartObject();
+		writer.Key( "mean" );
+		writer.Uint64( stats.dispatched > 0 ? stats.latencyTotalNs / stats.dispatched : 0 );
+		writer.Key( "p50" );
+		writer.Uint64( stats.percentile( 0.5 ) );
+		writer.Key( "p99" );
+		writer.Uint64( stats.percentile( 0.99 ) );
+		writer.Key( "p999" );
+		writer.Uint64( stats.percentile( 0.999 ) );
+		writer.Key( "max" );
+		writer.Uint64( stats.latencyMaxNs );
+		writer.EndObject();
+
+		if ( limit != NULL )
+		{
+			writer.Key( "rate_limit" );
+			writer.StartObject();
+			writer.Key( "rate" );
+			writer.Double( limit->rate() );
+			writer.Key( "burst" );
+			writer.Double( limit->burst() );
+			writer.EndObject();
+		}
+
+		if ( coalescer != NULL )
+		{
+			const CoalesceStats coalesced = coalescer->stats();
+			writer.Key( "coalescing" );
+			writer.StartObject();
+			writer.Key( "executed" );
+			writer.Uint64( coalesced.executed );
+			writer.Key( "coalesced" );
+			writer.Uint64( coalesced.coalesced );
+			writer.Key( "cached" );
+			writer.Uint64( coalesced.cached );
+			writer.Key( "ratio" );
+			writer.Double( coalesced.ratio() );
+			writer.Key( "result_ttl_ms" );
+			writer.Double( coalescer->resultTtlNs() / 1e6 );
+			writer.EndObject();
+		}
+
+		writer.EndObject();
+    }
+
+// ----------------------------------------------------------------------------------------------- //
+
+    ///
+    /// @brief log why a command was rejected and report it as the "error" of the response
+    ///
+    /// @return false, the result of the rejected dispatch
+    ///
+    bool reject(ResponseWriter &response, const char *message)
+    {
+		console() << message << '\n';
+		response.Key( "error" );
+		response.String( message );
+		return false;
+    }
+
+    bool reject(ResponseWriter &response, const std::string &message)
+    {
+		console() << message << '\n';
+		response.Key( "error" );
+		response.String( message.data(), static_cast<rapidjson::SizeType>( message.size() ) );
+		return false;
+    }
+
+// ----------------------------------------------------------------------------------------------- //
+
+    ///
+    /// @brief report a command rejected by a rate limit, {"error":"Throttled.","throttled":"client"|"command"}
+    ///
+    bool throttle(ResponseWriter &response, AdmissionResult admitted, DispatchOutcome &outcome)
+    {
+		outcome.status = kCommandThrottled;
+		reject( response, "Throttled." );
+		response.Key( "throttled" );
+		response.String( throttledBy( admitted ) );
+		return false;
+    }
+
+// ----------------------------------------------------------------------------------------------- //
+
+    ///
+    /// @brief validate the payload of a parsed command against the command's schema, if it has one
+    ///
+    bool checkPayload(DispatchContext &context, const CommandEntry &entry, const JsonValue &command, ResponseWriter &response)
+    {
+		if ( !entry.schema )
+		{
+			return true;
+		}
+
+		//a missing payload is reported by runHandler
+		JsonValue::ConstMemberIterator payload = command.FindMember( "payload" );
+		if ( payload == command.MemberEnd() )
+		{
+			return true;
+		}
+
+		std::string error;
+		if ( !validatePayload( *entry.schema, payload->value, context.schemaState(), error ) )
+		{
+			return reject( response, "Malformed json, payload fails schema: " + error );
+		}
+
+		return true;
+    }
+
+// ----------------------------------------------------------------------------------------------- //
+
+    ///
+    /// @brief run the handler of a parsed command envelope
+    ///
+    /// @note the handler writes the "result" value, null when it writes nothing.
+    ///
+    bool runHandler(DispatchContext &context, const CommandEntry &entry, JsonValue &command, ResponseWriter &response, CommandOutcome &outcome)
+    {
+		//check to see if the payload is present
+		if (!command.HasMember("payload"))
+		{
+			return reject( response, "Malformed json, missing payload." );
+		}
+
+		const MiddlewareChain *chain = entry.middleware.get();
+		if ( chain == NULL )
+		{
+			return callHandler( context, entry, command, response, outcome );
+		}
+
+		//befores outermost first, afters of those that ran in reverse
+		CommandCall call{ entry.name, command, context.client(), monotonicNs(), false, NULL };
+		size_t entered = 0;
+		bool result;
+		try
+		{
+			while ( entered < chain->size() && (*chain)[entered]->before( call ) )
+			{
+				++entered;
+			}
+
+			if ( entered < chain->size() )
+			{
+				outcome = kCommandRejected;
+				result = reject( response, call.error != NULL ? call.error : "Rejected." );
+			}
+			else
+			{
+				result = callHandler( context, entry, command, response, outcome );
+			}
+		}
+		catch (...)
+		{
+			//what a before() started, e.g. a span or an in flight count, must end
+			call.ok = false;
+			while ( entered > 0 )
+			{
+				(*chain)[--entered]->after( call );
+			}
+			throw;
+		}
+
+		call.ok = outcome == kCommandOk;
+		while ( entered > 0 )
+		{
+			(*chain)[--entered]->after( call );
+		}
+		return result;
+    }
+
+    ///
+    /// @brief run the handler of a command that passed its middleware, or reuse an identical run
+    ///
+    bool callHandler(DispatchContext &context, const CommandEntry &entry, JsonValue &command, ResponseWriter &response, CommandOutcome &outcome)
+    {
+		//an identical dispatch of an idempotent command may have written the result already
+		std::string key;
+		bool leader = false;
+		if ( entry.coalescer )
+		{
+			JsonValue::ConstMemberIterator payload = command.FindMember( "payload" );
+			key = payload != command.MemberEnd() ? canonicalJson( payload->value ) : canonicalJson( JsonValue() );
+			Coalescer::SharedResult shared = entry.coalescer->join( key, monotonicNs(), leader );
+			if ( shared )
+			{
+				outcome = shared->ok ? kCommandOk : kCommandHandlerError;
+				response.Key( "result" );
+				response.RawValue( shared->json.data(), shared->json.size(), shared->type );
+				return true;
+			}
+		}
+
+		//execute the command handler
+		outcome = kCommandHandlerError;
+		response.Key( "result" );
+		const size_t keyed = context.response().GetSize();
+		try 
+		{
+			if ( entry.handler( command, response ) )
+			{
+				outcome = kCommandOk;
+			}
+
+			if ( context.response().GetSize() == keyed )
+			{
+				response.Null();
+			}
+		}
+		catch (const MalformedCommand &er)
+		{
+			//the payload did not bind, drop whatever the handler wrote
+			context.beginResponse().StartObject();
+			outcome = kCommandMalformed;
+			reject( response, er.what() );
+
+			if ( leader )
+			{
+				entry.coalescer->complete( key, nullptr, monotonicNs() );
+			}
+			return false;
+		}
+		catch (const std::runtime_error &er)
+		{
+			//the handler may have left the result half written, start the response over
+			context.beginResponse().StartObject();
+			reject( response, "Dispatch handler running time error for command: " + entry.name + " Reason: " + er.what() );
+
+			if ( leader )
+			{
+				entry.coalescer->complete( key, nullptr, monotonicNs() );
+			}
+			return true;
+		}
+		catch (...)
+		{
+			//waiters must not wait for a run that never completes
+			if ( leader )
+			{
+				entry.coalescer->complete( key, nullptr, monotonicNs() );
+			}
+			throw;
+		}
+
+		if ( leader )
+		{
+			//the writer put the ':' after "result" in front of the value
+			const char *written = context.response().GetString() + keyed + 1;
+			entry.coalescer->complete( key, std::make_shared<const Coalescer::Result>( Coalescer::Result{
+				std::string( written, context.response().GetSize() - keyed - 1 ), jsonTypeOf( *written ), outcome == kCommandOk } ),
+				monotonicNs() );
+		}
+		
+        return true;
+    }
+
+// ----------------------------------------------------------------------------------------------- //
+
+    RcuPointer<CommandTable> command_handlers_;  ///< The container for handlers, replaced as a whole on registration
+
+	memory_pool_t *document_pool_;                ///< recycled arena blocks, NULL when pooling is disabled
+	PoolAllocator document_allocator_;            ///< base allocator of the context arenas
+	std::unique_ptr<DispatchContext> context_;    ///< parse state reused across dispatches
+	DispatchMode dispatch_mode_;                  ///< how commands are parsed
+	bool phase_timing_;                           ///< record DispatchTiming for every dispatch
+	CommandMetrics metrics_;                      ///< per command counters, per thread shards
+	AdmissionControl admission_;                  ///< per client rate limits, per command ones are in the entries
+	std::atomic<CommandRecorder *> recorder_;     ///< log of dispatched commands, NULL when not recording
+	std::unique_ptr<DispatchWorkers> workers_;    ///< async dispatch workers, started on demand, guarded by workers_mtx_
+	mutable std::mutex workers_mtx_;              ///< serializes starting and replacing workers_
+
+    // Question: why delete these?
+	/*
+	Reasons I can think of for no copy constructor and assignment:
+		1] keep integrity, only the desired contructed instance should be used.
+		2] Only one controller should be present at any given time, singleton?
+
+	*/
+
+    // delete unused constructors
+    CommandDispatcher (const CommandDispatcher&) = delete;
+    CommandDispatcher& operator= (const CommandDispatcher&) = delete;
+
+};
+
+// ----------------------------------------------------------------------------------------------- //
+
+}
+}
+
+#endif
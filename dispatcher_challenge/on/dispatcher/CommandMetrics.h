@@ -0,0 +1,447 @@
+#ifndef _ON_DISPATCHER_COMMANDMETRICS_H_
+#define _ON_DISPATCHER_COMMANDMETRICS_H_
+
+#include <stdint.h>
+#include <atomic>
+#include <cmath>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "on/dispatcher/Common.h"
+
+namespace on {
+namespace dispatcher {
+
+// ----------------------------------------------------------------------------------------------- //
+
+///@brief how a dispatch ended, for the per command counters
+enum CommandOutcome
+{
+	kCommandOk = 0,          ///< the handler ran and returned true
+	kCommandMalformed,       ///< rejected before the handler: bad json, unknown command, bad payload
+	kCommandHandlerError,    ///< the handler returned false or threw
+	kCommandExpired,         ///< dropped before the handler, its deadline had passed
+	kCommandThrottled,       ///< rejected by a rate limit before its payload was parsed
+	kCommandRejected         ///< rejected by middleware before the handler
+};
+
+// ----------------------------------------------------------------------------------------------- //
+
+///
+///@brief log-linear latency histogram: 8 linear buckets per power of two, about 12% resolution
+///
+///@note values below 8 have a bucket each, values beyond 2^36 ns (about 68 s) share the last.
+///
+struct LatencyBuckets
+{
+	static const size_t kSubBits = 3;
+	static const size_t kSubBuckets = 1 << kSubBits;
+	static const size_t kMaxExponent = 36;
+	static const size_t kBuckets = (kMaxExponent - kSubBits + 2) * kSubBuckets;
+
+	///@brief bucket of a value
+	static size_t index(uint64_t value)
+	{
+		if( value < kSubBuckets ) {
+			return static_cast<size_t>( value );
+		}
+
+		size_t exponent = 63 - static_cast<size_t>( __builtin_clzll( value ) );
+		if( exponent > kMaxExponent ) {
+			return kBuckets - 1;
+		}
+
+		const size_t sub = static_cast<size_t>( value >> (exponent - kSubBits) ) & (kSubBuckets - 1);
+		return (exponent - kSubBits + 1) * kSubBuckets + sub;
+	}
+
+	///@brief smallest value of a bucket
+	static uint64_t lowerBound(size_t index)
+	{
+		if( index < kSubBuckets ) {
+			return index;
+		}
+
+		const size_t exponent = index / kSubBuckets + kSubBits - 1;
+		const uint64_t sub = index % kSubBuckets;
+		return (kSubBuckets + sub) << (exponent - kSubBits);
+	}
+
+	///@brief middle of a bucket, the value reported for it
+	static uint64_t midpoint(size_t index)
+	{
+		const uint64_t lower = lowerBound( index );
+		const uint64_t upper = index + 1 < kBuckets ? lowerBound( index + 1 ) : lower * 2;
+		return lower + (upper - lower) / 2;
+	}
+};
+
+// ----------------------------------------------------------------------------------------------- //
+
+///@brief merged counters and latency of one command
+struct CommandStats
+{
+	uint64_t dispatched;         ///< dispatches routed to the command
+	uint64_t malformed;          ///< rejected before the handler ran
+	uint64_t handlerErrors;      ///< handler returned false or threw
+	uint64_t expired;            ///< dropped past their deadline
+	uint64_t throttled;          ///< rejected by a rate limit
+	uint64_t rejected;           ///< rejected by middleware
+	uint64_t latencyTotalNs;     ///< sum of dispatch latencies
+	uint64_t latencyMaxNs;       ///< slowest dispatch
+	uint64_t buckets[LatencyBuckets::kBuckets];   ///< dispatches per latency bucket
+
+	///
+	///@brief latency at a rank between 0 and 1, from the histogram
+	///
+	///@note nearest rank: the latency of dispatch ceil(rank * dispatched) in latency order, so the
+	///      tail of a small sample is its slowest dispatch, e.g. p99 of 2 dispatches is the max.
+	///
+	uint64_t percentile(double rank) const
+	{
+		if( dispatched == 0 ) {
+			return 0;
+		}
+
+		const double nearest = std::ceil( rank * dispatched );
+		const uint64_t target = nearest < 1 ? 0 : nearest >= dispatched ? dispatched - 1 : static_cast<uint64_t>( nearest ) - 1;
+		if( target == dispatched - 1 ) {
+			return latencyMaxNs;
+		}
+
+		uint64_t seen = 0;
+		for( size_t n = 0; n < LatencyBuckets::kBuckets; ++n ) {
+			seen += buckets[n];
+			if( seen > target ) {
+				const uint64_t value = LatencyBuckets::midpoint( n );
+				return value < latencyMaxNs ? value : latencyMaxNs;
+			}
+		}
+		return latencyMaxNs;
+	}
+};
+
+// ----------------------------------------------------------------------------------------------- //
+
+///
+///@brief per command counters and latency histograms, recorded without locks
+///
+///@note every thread records into its own shard, so a record is a handful of relaxed loads and
+///      stores with no read-modify-write. A shard is an array of lazily allocated chunks of
+///      kChunkSlots slots, chunks are never moved, so new commands never relocate counters a
+///      snapshot may be reading. The mutex guards only the list of shards: taken when a thread
+///      records for the first time, when it exits and by snapshots.
+///
+///      When a thread exits its counts are folded into a retired total and its shard, zeroed, is
+///      handed to the next thread that records, so memory follows the peak number of recording
+///      threads, not the number of threads ever started.
+///
+///      Slot 0 collects commands that could not be routed, command n of the table uses slot n + 1.
+///
+class CommandMetrics
+{
+
+// ----------------------------------------------------------------------------------------------- //
+
+public:
+
+	static const size_t kChunkSlots = 16;
+	static const size_t kMaxChunks = 256;
+	static const size_t kMaxSlots = kChunkSlots * kMaxChunks;   ///< slots beyond are not recorded
+	static const size_t kUnrouted = 0;                          ///< slot of commands without an entry
+
+	CommandMetrics() : m_id{ nextId() }, m_registry{ std::make_shared<Registry>() }
+	{
+	}
+
+	CommandMetrics(const CommandMetrics&) = delete;
+	CommandMetrics& operator=(const CommandMetrics&) = delete;
+
+// ----------------------------------------------------------------------------------------------- //
+
+	///
+	///@brief count one dispatch
+	///
+	///@param slot kUnrouted or the command's table index + 1.
+	///@param outcome How the dispatch ended.
+	///@param latencyNs Dispatch time.
+	///
+	void record(size_t slot, CommandOutcome outcome, uint64_t latencyNs)
+	{
+		if( slot >= kMaxSlots ) {
+			return;
+		}
+
+		Counters &counters = local().counters( slot );
+
+		bump( counters.dispatched );
+		if( outcome == kCommandMalformed ) {
+			bump( counters.malformed );
+		}
+		else if( outcome == kCommandHandlerError ) {
+			bump( counters.handlerErrors );
+		}
+		else if( outcome == kCommandExpired ) {
+			bump( counters.expired );
+		}
+		else if( outcome == kCommandThrottled ) {
+			bump( counters.throttled );
+		}
+		else if( outcome == kCommandRejected ) {
+			bump( counters.rejected );
+		}
+
+		counters.latencyTotalNs.store( counters.latencyTotalNs.load( std::memory_order_relaxed ) + latencyNs, std::memory_order_relaxed );
+		if( latencyNs > counters.latencyMaxNs.load( std::memory_order_relaxed ) ) {
+			counters.latencyMaxNs.store( latencyNs, std::memory_order_relaxed );
+		}
+		bump( counters.buckets[LatencyBuckets::index( latencyNs )] );
+	}
+
+// ----------------------------------------------------------------------------------------------- //
+
+	///@brief merge the shards of every thread for one slot
+	void snapshot(size_t slot, CommandStats &stats) const
+	{
+		stats = CommandStats();
+		if( slot >= kMaxSlots ) {
+			return;
+		}
+
+		std::lock_guard<std::mutex> lock( m_registry->mtx );
+		add( stats, m_registry->retired, slot );
+		for( const std::unique_ptr<Shard> &shard : m_registry->shards ) {
+			add( stats, *shard, slot );
+		}
+	}
+
+// ----------------------------------------------------------------------------------------------- //
+
+private:
+
+	///@brief one slot of one thread, written only by that thread
+	struct Counters
+	{
+		std::atomic<uint64_t> dispatched;
+		std::atomic<uint64_t> malformed;
+		std::atomic<uint64_t> handlerErrors;
+		std::atomic<uint64_t> expired;
+		std::atomic<uint64_t> throttled;
+		std::atomic<uint64_t> rejected;
+		std::atomic<uint64_t> latencyTotalNs;
+		std::atomic<uint64_t> latencyMaxNs;
+		std::atomic<uint64_t> buckets[LatencyBuckets::kBuckets];
+	};
+
+	///@brief the slots of one thread
+	struct Shard
+	{
+		Shard()
+		{
+			for( std::atomic<Counters *> &chunk : chunks ) {
+				chunk.store( NULL, std::memory_order_relaxed );
+			}
+		}
+
+		~Shard()
+		{
+			for( std::atomic<Counters *> &chunk : chunks ) {
+				delete[] chunk.load( std::memory_order_relaxed );
+			}
+		}
+
+		Counters & counters(size_t slot)
+		{
+			std::atomic<Counters *> &chunk = chunks[slot / kChunkSlots];
+			Counters *counters = chunk.load( std::memory_order_relaxed );
+			if( counters == NULL ) {
+				// value initialized, every counter starts at 0
+				counters = new Counters[kChunkSlots]();
+				chunk.store( counters, std::memory_order_release );
+			}
+			return counters[slot % kChunkSlots];
+		}
+
+		std::atomic<Counters *> chunks[kMaxChunks];   ///< published by the owning thread
+	};
+
+	///@brief the shards of an instance, shared with the threads recording into it
+	struct Registry
+	{
+		///@brief fold the counts of an exiting thread's shard into retired and free the shard
+		void retire(Shard *shard)
+		{
+			std::lock_guard<std::mutex> lock( mtx );
+			for( size_t c = 0; c < kMaxChunks; ++c ) {
+				Counters *chunk = shard->chunks[c].load( std::memory_order_relaxed );
+				if( chunk == NULL ) {
+					continue;
+				}
+				for( size_t n = 0; n < kChunkSlots; ++n ) {
+					fold( retired.counters( c * kChunkSlots + n ), chunk[n] );
+				}
+			}
+			free.push_back( shard );
+		}
+
+		std::mutex mtx;                                 ///< guards everything below
+		std::vector< std::unique_ptr<Shard> > shards;   ///< every shard, recording or free
+		std::vector<Shard *> free;                      ///< zeroed shards of exited threads
+		Shard retired;                                  ///< counts of exited threads
+	};
+
+	///@brief a shard as seen from its thread
+	struct LocalShard
+	{
+		uint64_t owner;   ///< m_id of the CommandMetrics
+		Shard *shard;
+	};
+
+	///@brief a thread's shards, handed back to their instances when the thread exits
+	struct LocalShards
+	{
+		struct Known
+		{
+			uint64_t owner;                    ///< m_id of the CommandMetrics
+			std::weak_ptr<Registry> registry;  ///< expired once the instance is destroyed
+			Shard *shard;
+		};
+
+		~LocalShards()
+		{
+			for( const Known &known : shards ) {
+				std::shared_ptr<Registry> registry = known.registry.lock();
+				if( registry ) {
+					registry->retire( known.shard );
+				}
+			}
+			lastShard() = LocalShard{ 0, NULL };
+		}
+
+		std::vector<Known> shards;
+	};
+
+// ----------------------------------------------------------------------------------------------- //
+
+	static void bump(std::atomic<uint64_t> &counter)
+	{
+		counter.store( counter.load( std::memory_order_relaxed ) + 1, std::memory_order_relaxed );
+	}
+
+	///@brief add one counter set to another and clear it
+	static void fold(Counters &into, Counters &from)
+	{
+		auto move = [](std::atomic<uint64_t> &to, std::atomic<uint64_t> &counter) {
+			to.store( to.load( std::memory_order_relaxed ) + counter.load( std::memory_order_relaxed ), std::memory_order_relaxed );
+			counter.store( 0, std::memory_order_relaxed );
+		};
+
+		move( into.dispatched, from.dispatched );
+		move( into.malformed, from.malformed );
+		move( into.handlerErrors, from.handlerErrors );
+		move( into.expired, from.expired );
+		move( into.throttled, from.throttled );
+		move( into.rejected, from.rejected );
+		move( into.latencyTotalNs, from.latencyTotalNs );
+
+		const uint64_t max = from.latencyMaxNs.load( std::memory_order_relaxed );
+		if( max > into.latencyMaxNs.load( std::memory_order_relaxed ) ) {
+			into.latencyMaxNs.store( max, std::memory_order_relaxed );
+		}
+		from.latencyMaxNs.store( 0, std::memory_order_relaxed );
+
+		for( size_t n = 0; n < LatencyBuckets::kBuckets; ++n ) {
+			move( into.buckets[n], from.buckets[n] );
+		}
+	}
+
+	///@brief merge one slot of a shard into stats
+	static void add(CommandStats &stats, const Shard &shard, size_t slot)
+	{
+		const Counters *chunk = shard.chunks[slot / kChunkSlots].load( std::memory_order_acquire );
+		if( chunk == NULL ) {
+			return;
+		}
+
+		const Counters &counters = chunk[slot % kChunkSlots];
+		stats.dispatched += counters.dispatched.load( std::memory_order_relaxed );
+		stats.malformed += counters.malformed.load( std::memory_order_relaxed );
+		stats.handlerErrors += counters.handlerErrors.load( std::memory_order_relaxed );
+		stats.expired += counters.expired.load( std::memory_order_relaxed );
+		stats.throttled += counters.throttled.load( std::memory_order_relaxed );
+		stats.rejected += counters.rejected.load( std::memory_order_relaxed );
+		stats.latencyTotalNs += counters.latencyTotalNs.load( std::memory_order_relaxed );
+
+		const uint64_t max = counters.latencyMaxNs.load( std::memory_order_relaxed );
+		stats.latencyMaxNs = max > stats.latencyMaxNs ? max : stats.latencyMaxNs;
+
+		for( size_t n = 0; n < LatencyBuckets::kBuckets; ++n ) {
+			stats.buckets[n] += counters.buckets[n].load( std::memory_order_relaxed );
+		}
+	}
+
+	///@brief the shard the calling thread recorded into last, trivially destructible for a cheap lookup
+	static LocalShard & lastShard()
+	{
+		static thread_local LocalShard last{ 0, NULL };
+		return last;
+	}
+
+	///@brief ids are never reused, a thread's cached shard of a destroyed instance is never matched again
+	static uint64_t nextId()
+	{
+		static std::atomic<uint64_t> next{ 1 };
+		return next.fetch_add( 1, std::memory_order_relaxed );
+	}
+
+	///@brief the calling thread's shard, taken from the free list or created on its first record
+	Shard & local()
+	{
+		LocalShard &last = lastShard();
+		if( last.owner == m_id ) {
+			return *last.shard;
+		}
+
+		static thread_local LocalShards owned;
+
+		for( auto known = owned.shards.begin(); known != owned.shards.end(); ) {
+			if( known->owner == m_id ) {
+				last = LocalShard{ m_id, known->shard };
+				return *last.shard;
+			}
+			// the instance is gone, so is its shard
+			known = known->registry.expired() ? owned.shards.erase( known ) : known + 1;
+		}
+
+		Shard *shard = NULL;
+		{
+			std::lock_guard<std::mutex> lock( m_registry->mtx );
+			if( !m_registry->free.empty() ) {
+				shard = m_registry->free.back();
+				m_registry->free.pop_back();
+			}
+			else {
+				shard = new Shard();
+				m_registry->shards.emplace_back( shard );
+			}
+		}
+
+		last = LocalShard{ m_id, shard };
+		owned.shards.push_back( LocalShards::Known{ m_id, m_registry, shard } );
+		return *shard;
+	}
+
+// ----------------------------------------------------------------------------------------------- //
+
+	const uint64_t m_id;                              ///< identifies the instance in thread caches
+	std::shared_ptr<Registry> m_registry;             ///< shards, weakly referenced by the recording threads
+
+};
+
+// ----------------------------------------------------------------------------------------------- //
+
+}
+}
+
+#endif
@@ -0,0 +1,442 @@
+#ifndef _ON_DISPATCHER_COMMANDRECORDER_H_
+#define _ON_DISPATCHER_COMMANDRECORDER_H_
+
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "on/dispatcher/Common.h"
+
+namespace on {
+namespace dispatcher {
+
+// ----------------------------------------------------------------------------------------------- //
+
+///
+///@brief command log format
+///
+///@note a 24 byte header: the magic "ONCMDLOG", the version as 4 bytes little endian, 4 reserved
+///      bytes and monotonicNs() when recording started as 8 bytes little endian. Then one record
+///      per command, every field a LEB128 varint:
+///
+///      arrival    zigzag delta in ns to the arrival of the previous record, the first one counts
+///                 from the start, records are appended in completion order so it may be negative
+///      client     DispatchOrigin::client
+///      latency    ns from the arrival until the response was written
+///      flags      bit 0: the dispatch returned true
+///      length     bytes of the command that follow, json or MessagePack as received
+///
+static const char kCommandLogMagic[8] = { 'O', 'N', 'C', 'M', 'D', 'L', 'O', 'G' };
+static const uint32_t kCommandLogVersion = 1;
+static const size_t kCommandLogHeaderSize = 24;
+static const uint64_t kRecordOk = 1;
+
+///@brief one command of a log, see CommandLog
+struct RecordedCommand
+{
+	uint64_t arrivalNs;     ///< since the start of the recording
+	uint64_t client;
+	uint64_t latencyNs;     ///< of the recorded run
+	bool ok;                ///< result of the recorded dispatch
+	size_t offset;          ///< of the command in CommandLog::data()
+	size_t length;
+};
+
+// ----------------------------------------------------------------------------------------------- //
+
+///
+///@brief appends every dispatched command to a command log, written by a background thread
+///
+///@note record() encodes into a buffer under a mutex held for a memcpy, the writer thread swaps
+///      it for the one it wrote last and writes it out, so a dispatch never waits for the disk.
+///      The writer wakes when kFlushSize bytes are buffered or every kFlushMs. When the disk
+///      falls kMaxBuffered bytes behind, records are dropped and counted instead of blocking.
+///
+class CommandRecorder
+{
+
+// ----------------------------------------------------------------------------------------------- //
+
+public:
+
+	static const size_t kFlushSize = 1024 * 1024;           ///< buffered bytes that wake the writer
+	static const size_t kMaxBuffered = 64 * 1024 * 1024;    ///< buffered bytes past which records are dropped
+	static const int kFlushMs = 100;                        ///< longest a record waits for the writer
+
+	CommandRecorder() : m_fd{ -1 }, m_running{ false }, m_failed{ false }, m_startNs{ 0 }, m_previousNs{ 0 },
+		m_activeRecords{ 0 }, m_recorded{ 0 }, m_dropped{ 0 }, m_written{ 0 }
+	{
+	}
+
+	///@brief flushes and closes the log
+	~CommandRecorder()
+	{
+		close();
+	}
+
+	CommandRecorder(const CommandRecorder&) = delete;
+	CommandRecorder& operator=(const CommandRecorder&) = delete;
+
+// ----------------------------------------------------------------------------------------------- //
+
+	///
+	///@brief create or truncate the log at path, write its header and start the writer
+	///
+	///@return false with errno set on failure
+	///
+	bool open(const std::string &path)
+	{
+		close();
+
+		m_fd = ::open( path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644 );
+		if( m_fd < 0 ) {
+			return false;
+		}
+
+		m_startNs = m_previousNs = monotonicNs();
+		m_failed = false;
+
+		char header[kCommandLogHeaderSize] = {};
+		std::memcpy( header, kCommandLogMagic, sizeof(kCommandLogMagic) );
+		putFixed( header + 8, kCommandLogVersion, 4 );
+		putFixed( header + 16, m_startNs, 8 );
+		if( !writeAll( header, sizeof(header) ) ) {
+			const int error = errno;
+			::close( m_fd );
+			m_fd = -1;
+			errno = error;
+			return false;
+		}
+
+		m_active.reserve( kFlushSize + kFlushSize / 4 );
+		m_running = true;
+		m_writer = std::thread( &CommandRecorder::writeLoop, this );
+		return true;
+	}
+
+	///@brief write what is buffered and close the log, records after it are ignored
+	void close()
+	{
+		{
+			std::lock_guard<std::mutex> lock( m_mtx );
+			if( !m_running ) {
+				return;
+			}
+			m_running = false;
+		}
+		m_wake.notify_one();
+		m_writer.join();
+
+		::close( m_fd );
+		m_fd = -1;
+	}
+
+	bool isOpen() const
+	{
+		return m_fd >= 0;
+	}
+
+// ----------------------------------------------------------------------------------------------- //
+
+	///
+	///@brief append one dispatched command
+	///
+	///@param command The command as received, before an in situ parse modified it.
+	///@param arrivalNs monotonicNs() when it arrived.
+	///@param latencyNs From the arrival until its response was written.
+	///
+	void record(const char *command, size_t length, uint64_t arrivalNs, uint64_t client, uint64_t latencyNs, bool ok)
+	{
+		// everything but the arrival delta is encoded before taking the lock
+		char fields[4 * kMaxVarint];
+		char *end = fields;
+		end = putVarint( end, client );
+		end = putVarint( end, latencyNs );
+		end = putVarint( end, ok ? kRecordOk : 0 );
+		end = putVarint( end, length );
+
+		bool wake;
+		{
+			std::lock_guard<std::mutex> lock( m_mtx );
+			const size_t buffered = m_active.size();
+			if( !m_running || m_failed || buffered + length > kMaxBuffered ) {
+				++m_dropped;
+				return;
+			}
+
+			const int64_t delta = static_cast<int64_t>( arrivalNs - m_previousNs );
+			m_previousNs = arrivalNs;
+
+			char arrival[kMaxVarint];
+			m_active.insert( m_active.end(), arrival,
+				putVarint( arrival, (static_cast<uint64_t>( delta ) << 1) ^ static_cast<uint64_t>( delta >> 63 ) ) );
+			m_active.insert( m_active.end(), fields, end );
+			m_active.insert( m_active.end(), command, command + length );
+			++m_activeRecords;
+
+			wake = buffered < kFlushSize && m_active.size() >= kFlushSize;
+		}
+		if( wake ) {
+			m_wake.notify_one();
+		}
+	}
+
+// ----------------------------------------------------------------------------------------------- //
+
+	///@brief commands written to the log
+	uint64_t recorded() const
+	{
+		std::lock_guard<std::mutex> lock( m_mtx );
+		return m_recorded;
+	}
+
+	///@brief commands lost to a full buffer or a failed write
+	uint64_t dropped() const
+	{
+		std::lock_guard<std::mutex> lock( m_mtx );
+		return m_dropped;
+	}
+
+	///@brief bytes of records written to the log, without the header
+	uint64_t written() const
+	{
+		return m_written.load( std::memory_order_relaxed );
+	}
+
+	///@brief a write failed, nothing is recorded after it
+	bool failed() const
+	{
+		std::lock_guard<std::mutex> lock( m_mtx );
+		return m_failed;
+	}
+
+// ----------------------------------------------------------------------------------------------- //
+
+	static const size_t kMaxVarint = 10;   ///< bytes of a 64 bit varint
+
+	///@return the end of the encoding
+	static char * putVarint(char *out, uint64_t value)
+	{
+		while( value >= 0x80 ) {
+			*out++ = static_cast<char>( (value & 0x7F) | 0x80 );
+			value >>= 7;
+		}
+		*out++ = static_cast<char>( value );
+		return out;
+	}
+
+	static void putFixed(char *out, uint64_t value, size_t bytes)
+	{
+		for( size_t n = 0; n < bytes; ++n ) {
+			out[n] = static_cast<char>( (value >> (8 * n)) & 0xFF );
+		}
+	}
+
+// ----------------------------------------------------------------------------------------------- //
+
+private:
+
+	void writeLoop()
+	{
+		std::unique_lock<std::mutex> lock( m_mtx );
+
+		for( ;; ) {
+			const bool running = m_running;
+			if( running && m_active.size() < kFlushSize ) {
+				m_wake.wait_for( lock, std::chrono::milliseconds( static_cast<int>( kFlushMs ) ) );
+			}
+
+			// the buffer written last time is empty, record() continues in it
+			m_writing.swap( m_active );
+			const uint64_t records = m_activeRecords;
+			m_activeRecords = 0;
+
+			if( !m_writing.empty() ) {
+				lock.unlock();
+				const bool wrote = !m_failed && writeAll( m_writing.data(), m_writing.size() );
+				if( wrote ) {
+					m_written.fetch_add( m_writing.size(), std::memory_order_relaxed );
+				}
+				m_writing.clear();
+				lock.lock();
+
+				m_failed = m_failed || !wrote;
+				(wrote ? m_recorded : m_dropped) += records;
+			}
+
+			if( !running && m_active.empty() ) {
+				return;
+			}
+		}
+	}
+
+	bool writeAll(const char *data, size_t size)
+	{
+		while( size > 0 ) {
+			const ssize_t wrote = ::write( m_fd, data, size );
+			if( wrote < 0 ) {
+				if( errno == EINTR ) {
+					continue;
+				}
+				return false;
+			}
+			data += wrote;
+			size -= static_cast<size_t>( wrote );
+		}
+		return true;
+	}
+
+// ----------------------------------------------------------------------------------------------- //
+
+	int m_fd;
+	std::thread m_writer;
+	mutable std::mutex m_mtx;                 ///< guards everything below but m_writing and m_written
+	std::condition_variable m_wake;
+	bool m_running;
+	bool m_failed;
+	uint64_t m_startNs;                       ///< monotonicNs() in the header
+	uint64_t m_previousNs;                    ///< arrival of the last record
+	uint64_t m_activeRecords;                 ///< records in m_active
+	uint64_t m_recorded;                      ///< records written
+	uint64_t m_dropped;
+	std::vector<char> m_active;               ///< records not yet handed to the writer
+	std::vector<char> m_writing;              ///< records being written, owned by the writer thread
+	std::atomic<uint64_t> m_written;
+
+};
+
+// ----------------------------------------------------------------------------------------------- //
+
+///
+///@brief a command log read into memory, see CommandRecorder
+///
+class CommandLog
+{
+
+// ----------------------------------------------------------------------------------------------- //
+
+public:
+
+	CommandLog() : m_startNs{ 0 }
+	{
+	}
+
+	///
+	///@brief read the log at path, replacing what was loaded
+	///
+	///@param error Receives why the log could not be read.
+	///
+	///@return false if it cannot be read or is not a command log, a truncated last record is dropped
+	///
+	bool load(const std::string &path, std::string &error)
+	{
+		m_commands.clear();
+		m_data.clear();
+
+		std::ifstream file( path, std::ios::binary );
+		if( !file ) {
+			error = "cannot open " + path;
+			return false;
+		}
+		m_data.assign( std::istreambuf_iterator<char>( file ), std::istreambuf_iterator<char>() );
+
+		if( m_data.size() < kCommandLogHeaderSize || std::memcmp( m_data.data(), kCommandLogMagic, sizeof(kCommandLogMagic) ) != 0 ) {
+			error = path + " is not a command log";
+			return false;
+		}
+		if( getFixed( m_data.data() + 8, 4 ) != kCommandLogVersion ) {
+			error = path + " has an unknown command log version";
+			return false;
+		}
+		m_startNs = getFixed( m_data.data() + 16, 8 );
+
+		size_t at = kCommandLogHeaderSize;
+		uint64_t previous = 0;
+		for( ;; ) {
+			uint64_t delta, client, latency, flags, length;
+			if( !getVarint( at, delta ) || !getVarint( at, client ) || !getVarint( at, latency ) ||
+				!getVarint( at, flags ) || !getVarint( at, length ) || m_data.size() - at < length ) {
+				break;
+			}
+
+			previous += (delta >> 1) ^ (0 - (delta & 1));
+			m_commands.push_back( RecordedCommand{ previous, client, latency, (flags & kRecordOk) != 0, at, static_cast<size_t>( length ) } );
+			at += length;
+		}
+
+		// completion order to arrival order
+		std::stable_sort( m_commands.begin(), m_commands.end(), [](const RecordedCommand &a, const RecordedCommand &b) {
+			return static_cast<int64_t>( a.arrivalNs - b.arrivalNs ) < 0;
+		} );
+		return true;
+	}
+
+// ----------------------------------------------------------------------------------------------- //
+
+	///@brief the commands in arrival order
+	const std::vector<RecordedCommand> & commands() const
+	{
+		return m_commands;
+	}
+
+	const char * command(const RecordedCommand &recorded) const
+	{
+		return m_data.data() + recorded.offset;
+	}
+
+	///@brief monotonicNs() of the recording process when it started
+	uint64_t startNs() const
+	{
+		return m_startNs;
+	}
+
+// ----------------------------------------------------------------------------------------------- //
+
+private:
+
+	static uint64_t getFixed(const char *in, size_t bytes)
+	{
+		uint64_t value = 0;
+		for( size_t n = 0; n < bytes; ++n ) {
+			value |= uint64_t( static_cast<unsigned char>( in[n] ) ) << (8 * n);
+		}
+		return value;
+	}
+
+	bool getVarint(size_t &at, uint64_t &value) const
+	{
+		value = 0;
+		for( unsigned shift = 0; at < m_data.size() && shift < 64; shift += 7 ) {
+			const unsigned char byte = static_cast<unsigned char>( m_data[at++] );
+			value |= uint64_t( byte & 0x7F ) << shift;
+			if( (byte & 0x80) == 0 ) {
+				return true;
+			}
+		}
+		return false;
+	}
+
+	uint64_t m_startNs;
+	std::vector<char> m_data;                   ///< the whole log
+	std::vector<RecordedCommand> m_commands;
+
+};
+
+// ----------------------------------------------------------------------------------------------- //
+
+}
+}
+
+#endif
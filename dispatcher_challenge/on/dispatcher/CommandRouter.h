@@ -0,0 +1,289 @@
+#ifndef _ON_DISPATCHER_COMMANDROUTER_H_
+#define _ON_DISPATCHER_COMMANDROUTER_H_
+
+#include <stdint.h>
+#include <algorithm>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "on/dispatcher/Common.h"
+
+namespace on {
+namespace dispatcher {
+
+// ----------------------------------------------------------------------------------------------- //
+
+///@brief one dispatch as middleware sees it
+struct CommandCall
+{
+	const std::string &command;   ///< the command path, e.g. "device.health.get"
+	JsonValue &envelope;          ///< the parsed command, its "payload" is present
+	uint64_t client;              ///< DispatchOrigin::client
+	uint64_t startNs;             ///< monotonicNs() before the first middleware ran
+	bool ok;                      ///< in after(): the handler ran and returned true
+	const char *error;            ///< set by a before() returning false, the "error" of the response
+};
+
+///
+///@brief shared logic around the handlers of a namespace, e.g. auth checks, metrics, tracing
+///
+///@note before() runs outermost first, after() innermost first and only for middleware whose
+///      before() returned true, also when an inner one rejected the dispatch or something threw.
+///      Both run on the dispatching thread, concurrently for concurrent dispatches.
+///
+class Middleware
+{
+public:
+
+	virtual ~Middleware()
+	{
+	}
+
+	///@brief false rejects the dispatch before the handler runs, with call.error if set
+	virtual bool before(CommandCall & /*call*/)
+	{
+		return true;
+	}
+
+	virtual void after(CommandCall & /*call*/)
+	{
+	}
+};
+
+///@brief the middleware of a command, outermost first, composed once at registration
+typedef std::vector< std::shared_ptr<Middleware> > MiddlewareChain;
+
+// ----------------------------------------------------------------------------------------------- //
+
+///
+///@brief radix trie of dotted command paths, e.g. "device.health.get", with middleware at any prefix
+///
+///@note nodes are kept in one vector and linked by index, every node's label is the longest run
+///      of bytes shared by all paths below it, so a path of n bytes is at most n nodes deep and
+///      usually far fewer. Middleware is attached to a namespace: the node of its prefix, split
+///      out of an edge when needed. A namespace "device" covers the command "device" and every
+///      "device.*" but not "devices", the empty prefix covers every command.
+///
+///      The trie answers which middleware applies to a command at registration, dispatches
+///      route through the CommandTable hash and call the chain composed from it.
+///
+class CommandTrie
+{
+
+// ----------------------------------------------------------------------------------------------- //
+
+public:
+
+	CommandTrie() : m_nodes( 1 ), m_commands{ 0 }
+	{
+	}
+
+// ----------------------------------------------------------------------------------------------- //
+
+	///@brief add a command path, nothing happens if it is present
+	void insert(const std::string &path)
+	{
+		Node &node = m_nodes[nodeOf( path )];
+		m_commands += node.command ? 0 : 1;
+		node.command = true;
+	}
+
+	///@brief attach middleware to the namespace prefix, after the middleware already attached there
+	void use(const std::string &prefix, std::shared_ptr<Middleware> middleware)
+	{
+		m_nodes[nodeOf( prefix )].middleware.push_back( std::move( middleware ) );
+	}
+
+	bool contains(const char *path, size_t length) const
+	{
+		size_t consumed = 0;
+		const uint32_t node = walk( path, length, consumed, NULL );
+		return consumed == length && m_nodes[node].command;
+	}
+
+// ----------------------------------------------------------------------------------------------- //
+
+	///@brief the middleware of every namespace containing path, outermost first
+	MiddlewareChain chain(const std::string &path) const
+	{
+		MiddlewareChain chain;
+		size_t consumed = 0;
+		walk( path.data(), path.size(), consumed, &chain );
+		return chain;
+	}
+
+	///@brief call visit(const std::string &path) for every command in the namespace prefix, in byte order
+	template <typename Visit>
+	void visit(const std::string &prefix, Visit &&visit) const
+	{
+		std::string path;
+		collect( 0, path, prefix, visit );
+	}
+
+	///@brief path is prefix or below it
+	static bool inNamespace(const std::string &path, const std::string &prefix)
+	{
+		return prefix.empty() || (path.compare( 0, prefix.size(), prefix ) == 0 &&
+			(path.size() == prefix.size() || path[prefix.size()] == '.'));
+	}
+
+// ----------------------------------------------------------------------------------------------- //
+
+	size_t size() const
+	{
+		return m_commands;
+	}
+
+	size_t nodes() const
+	{
+		return m_nodes.size();
+	}
+
+// ----------------------------------------------------------------------------------------------- //
+
+private:
+
+	struct Node
+	{
+		Node() : command{ false }
+		{
+		}
+
+		std::string label;                  ///< bytes from the parent to this node
+		std::vector<uint32_t> children;     ///< sorted by the first byte of their label
+		bool command;                       ///< a command ends here
+		MiddlewareChain middleware;         ///< of the namespace ending here
+	};
+
+	///@brief the child of node whose label starts with byte, 0 when there is none
+	uint32_t child(uint32_t node, char byte) const
+	{
+		for( uint32_t index : m_nodes[node].children ) {
+			if( m_nodes[index].label[0] == byte ) {
+				return index;
+			}
+		}
+		return 0;
+	}
+
+	///
+	///@brief follow path from the root as far as whole labels match
+	///
+	///@param consumed Receives the bytes of path matched.
+	///@param chain Receives the middleware of the namespaces passed, may be NULL.
+	///
+	///@return the deepest node reached
+	///
+	uint32_t walk(const char *path, size_t length, size_t &consumed, MiddlewareChain *chain) const
+	{
+		uint32_t node = 0;
+		consumed = 0;
+
+		for( ;; ) {
+			// the root is the empty namespace, other nodes count where a segment of path ends
+			if( chain != NULL && (consumed == 0 || consumed == length || path[consumed] == '.') ) {
+				const MiddlewareChain &here = m_nodes[node].middleware;
+				chain->insert( chain->end(), here.begin(), here.end() );
+			}
+			if( consumed == length ) {
+				return node;
+			}
+
+			const uint32_t next = child( node, path[consumed] );
+			if( next == 0 ) {
+				return node;
+			}
+			const std::string &label = m_nodes[next].label;
+			if( length - consumed < label.size() || std::memcmp( path + consumed, label.data(), label.size() ) != 0 ) {
+				return node;
+			}
+
+			consumed += label.size();
+			node = next;
+		}
+	}
+
+	///@brief the node of path, created and split out of an edge as needed
+	uint32_t nodeOf(const std::string &path)
+	{
+		uint32_t node = 0;
+		size_t consumed = 0;
+
+		while( consumed < path.size() ) {
+			uint32_t next = child( node, path[consumed] );
+			if( next == 0 ) {
+				return addChild( node, path.substr( consumed ) );
+			}
+
+			const std::string label = m_nodes[next].label;
+			size_t common = 0;
+			while( common < label.size() && consumed + common < path.size() && label[common] == path[consumed + common] ) {
+				++common;
+			}
+
+			if( common < label.size() ) {
+				// split the edge: node -> middle -> next
+				std::vector<uint32_t> &children = m_nodes[node].children;
+				children.erase( std::find( children.begin(), children.end(), next ) );
+				const uint32_t middle = addChild( node, label.substr( 0, common ) );
+				m_nodes[next].label.erase( 0, common );
+				m_nodes[middle].children.push_back( next );
+				next = middle;
+			}
+
+			consumed += common;
+			node = next;
+		}
+		return node;
+	}
+
+	uint32_t addChild(uint32_t parent, const std::string &label)
+	{
+		const uint32_t index = static_cast<uint32_t>( m_nodes.size() );
+		m_nodes.push_back( Node() );
+		m_nodes[index].label = label;
+
+		std::vector<uint32_t> &children = m_nodes[parent].children;
+		std::vector<uint32_t>::iterator at = children.begin();
+		while( at != children.end() && static_cast<unsigned char>( m_nodes[*at].label[0] ) < static_cast<unsigned char>( label[0] ) ) {
+			++at;
+		}
+		children.insert( at, index );
+		return index;
+	}
+
+	template <typename Visit>
+	void collect(uint32_t node, std::string &path, const std::string &prefix, Visit &visit) const
+	{
+		const size_t length = path.size();
+		path += m_nodes[node].label;
+
+		// skip subtrees that cannot reach the prefix
+		const size_t shared = path.size() < prefix.size() ? path.size() : prefix.size();
+		if( path.compare( 0, shared, prefix, 0, shared ) == 0 ) {
+			if( m_nodes[node].command && inNamespace( path, prefix ) ) {
+				visit( path );
+			}
+			for( uint32_t index : m_nodes[node].children ) {
+				collect( index, path, prefix, visit );
+			}
+		}
+
+		path.resize( length );
+	}
+
+// ----------------------------------------------------------------------------------------------- //
+
+	std::vector<Node> m_nodes;   ///< m_nodes[0] is the root, its label is empty
+	size_t m_commands;
+
+};
+
+// ----------------------------------------------------------------------------------------------- //
+
+}
+}
+
+#endif
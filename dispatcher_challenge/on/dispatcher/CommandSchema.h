@@ -0,0 +1,198 @@
+#ifndef _ON_DISPATCHER_COMMANDSCHEMA_H_
+#define _ON_DISPATCHER_COMMANDSCHEMA_H_
+
+#include <memory>
+#include <new>
+#include <string>
+#include <type_traits>
+
+#include "rapidjson/document.h"
+#include "rapidjson/error/en.h"
+#include "rapidjson/schema.h"
+#include "rapidjson/stringbuffer.h"
+
+#include "on/dispatcher/Common.h"
+
+namespace on {
+namespace dispatcher {
+
+// ----------------------------------------------------------------------------------------------- //
+
+typedef rapidjson::SchemaDocument PayloadSchema;                   ///< compiled json schema of a command payload
+typedef rapidjson::MemoryPoolAllocator<ArenaAllocator> SchemaStateAllocator;   ///< validator state, overflow in the RequestArena, cleared after each dispatch
+
+///@brief validator of a payload schema forwarding the validated events to OutputHandler
+template <typename OutputHandler>
+using PayloadValidator = rapidjson::GenericSchemaValidator<PayloadSchema, OutputHandler, SchemaStateAllocator>;
+
+// ----------------------------------------------------------------------------------------------- //
+
+///
+///@brief compile the json schema of a command payload
+///
+///@param json The schema, a json string.
+///@param error Set to the reason when the schema is not valid json.
+///
+///@return the compiled schema, NULL on error
+///
+INLINE std::shared_ptr<const PayloadSchema> compileSchema(const char *json, std::string &error)
+{
+	rapidjson::Document source;
+	source.Parse( json );
+	if( source.HasParseError() ) {
+		error = std::string{ rapidjson::GetParseError_En( source.GetParseError() ) } +
+			" at offset " + std::to_string( source.GetErrorOffset() );
+		return std::shared_ptr<const PayloadSchema>();
+	}
+
+	// the compiled schema does not reference the source document
+	return std::make_shared<const PayloadSchema>( source );
+}
+
+// ----------------------------------------------------------------------------------------------- //
+
+///@brief describe why a validator rejected the payload, e.g. "type at #/usage"
+template <typename Validator>
+std::string schemaError(const Validator &validator)
+{
+	rapidjson::StringBuffer where;
+	validator.GetInvalidDocumentPointer().StringifyUriFragment( where );
+	return std::string{ validator.GetInvalidSchemaKeyword() } + " at " + where.GetString();
+}
+
+// ----------------------------------------------------------------------------------------------- //
+
+///
+///@brief validate an already parsed payload, a second walk over the value
+///
+///@param error Set to the reason when the payload is rejected.
+///
+INLINE bool validatePayload(const PayloadSchema &schema, const JsonValue &payload, SchemaStateAllocator &state, std::string &error)
+{
+	PayloadValidator< rapidjson::BaseReaderHandler<> > validator( schema, &state );
+	if( payload.Accept( validator ) ) {
+		return true;
+	}
+	error = schemaError( validator );
+	return false;
+}
+
+// ----------------------------------------------------------------------------------------------- //
+
+///
+///@brief target of the payload events of a command envelope
+///
+///@note events go straight to the output handler until validate() is called, from then on they
+///      pass through the schema validator, which forwards them to the output handler while
+///      checking them, so the payload is validated in the same pass that builds it. After
+///      finish() events go straight to the output again, e.g. the members following the payload.
+///
+template <typename OutputHandler>
+class PayloadSink
+{
+
+// ----------------------------------------------------------------------------------------------- //
+
+public:
+
+	typedef char Ch;
+	typedef PayloadValidator<OutputHandler> Validator;
+
+	explicit PayloadSink(OutputHandler &out) : m_out( out ), m_validator{ NULL }, m_route{ NULL }
+	{
+	}
+
+	~PayloadSink()
+	{
+		if( m_validator != NULL ) {
+			m_validator->~Validator();
+		}
+	}
+
+	PayloadSink(const PayloadSink&) = delete;
+	PayloadSink& operator=(const PayloadSink&) = delete;
+
+// ----------------------------------------------------------------------------------------------- //
+
+	///@brief validate the events that follow, call before the first event of the payload value
+	void validate(const PayloadSchema &schema, SchemaStateAllocator &state)
+	{
+		if( m_validator == NULL ) {
+			m_validator = new (&m_storage) Validator( schema, m_out, &state );
+			m_route = m_validator;
+		}
+	}
+
+	///@brief the payload value is complete, stop validating the events that follow
+	void finish()
+	{
+		m_route = NULL;
+	}
+
+	///@brief the validator, NULL when the payload is not validated
+	const Validator * validator() const
+	{
+		return m_validator;
+	}
+
+	///@brief the payload failed its schema
+	bool invalid() const
+	{
+		return m_validator != NULL && !m_validator->IsValid();
+	}
+
+// ----------------------------------------------------------------------------------------------- //
+
+	bool Null()                   { return m_route ? m_route->Null() : m_out.Null(); }
+	bool Bool(bool b)             { return m_route ? m_route->Bool(b) : m_out.Bool(b); }
+	bool Int(int i)               { return m_route ? m_route->Int(i) : m_out.Int(i); }
+	bool Uint(unsigned u)         { return m_route ? m_route->Uint(u) : m_out.Uint(u); }
+	bool Int64(int64_t i)         { return m_route ? m_route->Int64(i) : m_out.Int64(i); }
+	bool Uint64(uint64_t u)       { return m_route ? m_route->Uint64(u) : m_out.Uint64(u); }
+	bool Double(double d)         { return m_route ? m_route->Double(d) : m_out.Double(d); }
+
+	bool RawNumber(const Ch *str, rapidjson::SizeType length, bool copy)
+	{
+		return m_route ? m_route->RawNumber(str, length, copy) : m_out.RawNumber(str, length, copy);
+	}
+
+	bool String(const Ch *str, rapidjson::SizeType length, bool copy)
+	{
+		return m_route ? m_route->String(str, length, copy) : m_out.String(str, length, copy);
+	}
+
+	bool Key(const Ch *str, rapidjson::SizeType length, bool copy)
+	{
+		return m_route ? m_route->Key(str, length, copy) : m_out.Key(str, length, copy);
+	}
+
+	bool StartObject()            { return m_route ? m_route->StartObject() : m_out.StartObject(); }
+	bool StartArray()             { return m_route ? m_route->StartArray() : m_out.StartArray(); }
+
+	bool EndObject(rapidjson::SizeType memberCount)
+	{
+		return m_route ? m_route->EndObject(memberCount) : m_out.EndObject(memberCount);
+	}
+
+	bool EndArray(rapidjson::SizeType elementCount)
+	{
+		return m_route ? m_route->EndArray(elementCount) : m_out.EndArray(elementCount);
+	}
+
+// ----------------------------------------------------------------------------------------------- //
+
+private:
+
+	OutputHandler &m_out;        ///< receives the payload
+	Validator *m_validator;      ///< constructed in m_storage by validate()
+	Validator *m_route;          ///< m_validator while the payload is read, NULL otherwise
+	typename std::aligned_storage<sizeof(Validator), alignof(Validator)>::type m_storage;
+
+};
+
+// ----------------------------------------------------------------------------------------------- //
+
+}
+}
+
+#endif
@@ -0,0 +1,265 @@
+#ifndef _ON_DISPATCHER_COMMANDTABLE_H_
+#define _ON_DISPATCHER_COMMANDTABLE_H_
+
+#include <stdint.h>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <functional>
+#include <memory>
+
+#include "on/dispatcher/Common.h"
+#include "on/dispatcher/CommandSchema.h"
+#include "on/dispatcher/CommandDelegate.h"
+#include "on/dispatcher/RateLimit.h"
+#include "on/dispatcher/Coalescer.h"
+#include "on/dispatcher/CommandRouter.h"
+
+namespace on {
+namespace dispatcher {
+
+// Bonus Question: why did I type cast this?
+/*
+I can think of the following to typecasting:
+	1] Whenever the prototype needs to be changed then changes is happening only in one place.
+	2] Less typing whenever it's being used
+*/
+//the handler writes one json value, the "result" of the response, false reports a failure
+typedef CommandDelegate CommandHandler;
+
+// ----------------------------------------------------------------------------------------------- //
+
+///@brief scheduling class of a command, queued commands of a higher class run first
+enum CommandPriority
+{
+	kPriorityHigh = 0,     ///< control commands, e.g. exit and authenticate
+	kPriorityNormal,       ///< default
+	kPriorityLow           ///< bulk traffic, e.g. polls
+};
+
+// ----------------------------------------------------------------------------------------------- //
+
+///@brief a registered command and its handler
+struct CommandEntry
+{
+	std::string name;         ///< the command string
+	CommandHandler handler;   ///< the handler to handle the command
+	std::shared_ptr<const PayloadSchema> schema;   ///< schema of the payload, NULL when not validated
+	CommandPriority priority; ///< scheduling class of queued dispatches
+	std::shared_ptr<TokenBucket> limit;            ///< rate limit of the command, NULL when unlimited
+	std::shared_ptr<Coalescer> coalescer;          ///< shares runs of an idempotent command, NULL when not idempotent
+	std::shared_ptr<const MiddlewareChain> middleware;   ///< of the namespaces of the command, NULL when none
+};
+
+// ----------------------------------------------------------------------------------------------- //
+
+///
+///@brief hash indexed command table with lookup by (pointer, length), no temporary std::string.
+///
+///@note open addressing with linear probing at a load factor of at most 1/2, so a lookup is one
+///      hash of the name and usually a single compare.
+///
+///      A table is a value: the dispatcher publishes it through an RcuPointer and registers by
+///      modifying a copy, entries keep their index and share their schema, rate limit and coalescing state.
+///
+///      Dotted names form namespaces, e.g. "device.health.get" is in "device.health" and "device".
+///      A CommandTrie of the names holds the middleware of each namespace, every entry carries the
+///      chain composed for it, so routing stays one hash lookup.
+///
+class CommandTable
+{
+
+// ----------------------------------------------------------------------------------------------- //
+
+public:
+
+	CommandTable() : m_mask{ 0 }
+	{
+	}
+
+// ----------------------------------------------------------------------------------------------- //
+
+	///
+	///@brief add or replace the handler of a command
+	///
+	///@param command The command string.
+	///@param handler The handler to handle the command.
+	///@param schema The compiled payload schema, NULL for none.
+	///
+	void insert(const std::string &command, CommandHandler handler, std::shared_ptr<const PayloadSchema> schema = nullptr)
+	{
+		CommandEntry *entry = find(command.data(), command.size());
+
+		if( entry != NULL ) {
+			entry->handler = std::move(handler);
+			entry->schema = std::move(schema);
+			return;
+		}
+
+		m_paths.insert(command);
+		m_entries.push_back(CommandEntry{ command, std::move(handler), std::move(schema), kPriorityNormal, nullptr, nullptr,
+			compose(command) });
+
+		if( (m_entries.size() * 2) > m_slots.size() ) {
+			// keep the load factor at or below 1/2
+			buildOpen(m_slots.empty() ? 16 : m_slots.size() * 2);
+		}
+		else {
+			placeOpen(static_cast<uint32_t>(m_entries.size() - 1));
+		}
+	}
+
+// ----------------------------------------------------------------------------------------------- //
+
+	///
+	///@brief find the entry of a command
+	///
+	///@param command The command string, need not be null terminated.
+	///@param length The length of the command string.
+	///
+	///@return the entry, NULL if the command is not registered. Valid until the next insert.
+	///
+	CommandEntry * find(const char *command, size_t length)
+	{
+		return const_cast<CommandEntry *>( static_cast<const CommandTable *>(this)->find(command, length) );
+	}
+
+	const CommandEntry * find(const char *command, size_t length) const
+	{
+		if( m_entries.empty() ) {
+			return NULL;
+		}
+
+		const uint64_t hash = hashOf(command, length);
+
+		for( size_t slot = hash & m_mask; ; slot = (slot + 1) & m_mask ) {
+			const uint32_t index = m_slots[slot];
+			if( index == 0 ) {
+				return NULL;
+			}
+			if( matches(m_entries[index - 1], command, length) ) {
+				return &m_entries[index - 1];
+			}
+		}
+	}
+
+// ----------------------------------------------------------------------------------------------- //
+
+	///
+	///@brief attach middleware to a namespace and recompose the chains of its commands
+	///
+	///@param prefix The namespace, e.g. "device" for "device" and "device.*", empty for every command.
+	///@param middleware Runs inside the middleware of enclosing namespaces and after earlier
+	///       middleware of the same namespace.
+	///
+	void use(const std::string &prefix, std::shared_ptr<Middleware> middleware)
+	{
+		m_paths.use(prefix, std::move(middleware));
+
+		for( CommandEntry &entry : m_entries ) {
+			if( CommandTrie::inNamespace(entry.name, prefix) ) {
+				entry.middleware = compose(entry.name);
+			}
+		}
+	}
+
+	///@brief the command names and namespace middleware
+	const CommandTrie & paths() const
+	{
+		return m_paths;
+	}
+
+// ----------------------------------------------------------------------------------------------- //
+
+	size_t size() const
+	{
+		return m_entries.size();
+	}
+
+	///@brief position of an entry in registration order, stable while the command stays registered
+	size_t index(const CommandEntry &entry) const
+	{
+		return static_cast<size_t>(&entry - m_entries.data());
+	}
+
+	std::vector<CommandEntry>::iterator begin()
+	{
+		return m_entries.begin();
+	}
+
+	std::vector<CommandEntry>::iterator end()
+	{
+		return m_entries.end();
+	}
+
+	std::vector<CommandEntry>::const_iterator begin() const
+	{
+		return m_entries.begin();
+	}
+
+	std::vector<CommandEntry>::const_iterator end() const
+	{
+		return m_entries.end();
+	}
+
+// ----------------------------------------------------------------------------------------------- //
+
+private:
+
+	///@brief the flat middleware chain of a command, NULL when no namespace of it has middleware
+	std::shared_ptr<const MiddlewareChain> compose(const std::string &command) const
+	{
+		MiddlewareChain chain = m_paths.chain(command);
+		if( chain.empty() ) {
+			return nullptr;
+		}
+		return std::make_shared<const MiddlewareChain>(std::move(chain));
+	}
+
+	///@brief FNV-1a over the command bytes
+	static uint64_t hashOf(const char *command, size_t length)
+	{
+		return fnv1a(command, length);
+	}
+
+	static bool matches(const CommandEntry &entry, const char *command, size_t length)
+	{
+		return entry.name.size() == length && std::memcmp(entry.name.data(), command, length) == 0;
+	}
+
+// ----------------------------------------------------------------------------------------------- //
+
+	void placeOpen(uint32_t index)
+	{
+		const CommandEntry &entry = m_entries[index];
+		size_t slot = hashOf(entry.name.data(), entry.name.size()) & m_mask;
+		while( m_slots[slot] != 0 ) {
+			slot = (slot + 1) & m_mask;
+		}
+		m_slots[slot] = index + 1;
+	}
+
+	void buildOpen(size_t slots)
+	{
+		m_slots.assign(slots, 0);
+		m_mask = slots - 1;
+		for( uint32_t n = 0; n < m_entries.size(); ++n ) {
+			placeOpen(n);
+		}
+	}
+
+// ----------------------------------------------------------------------------------------------- //
+
+	std::vector<CommandEntry> m_entries;   ///< registered commands, in registration order
+	std::vector<uint32_t> m_slots;         ///< entry index + 1 per slot, 0 = empty
+	size_t m_mask;                         ///< m_slots.size() - 1
+	CommandTrie m_paths;                   ///< command names and the middleware of their namespaces
+
+};
+
+// ----------------------------------------------------------------------------------------------- //
+
+}
+}
+
+#endif
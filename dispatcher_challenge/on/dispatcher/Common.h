@@ -0,0 +1,143 @@
+#ifndef _ON_DISPATCHER_COMMON_H_
+#define _ON_DISPATCHER_COMMON_H_
+
+#include <stdint.h>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <string>
+
+#include "rapidjson/document.h"
+#include "rapidjson/writer.h"
+#include "rapidjson/stringbuffer.h"
+
+#define INLINE inline
+
+#include "on/dispatcher/PoolAllocator.h"
+#include "on/dispatcher/RequestArena.h"
+
+namespace on {
+namespace dispatcher {
+
+// ----------------------------------------------------------------------------------------------- //
+
+typedef rapidjson::MemoryPoolAllocator<ArenaAllocator> JsonAllocator;                         ///< document allocator, chunks from the RequestArena
+typedef rapidjson::GenericValue<rapidjson::UTF8<>, JsonAllocator> JsonValue;                  ///< json value handed to handlers
+typedef rapidjson::GenericDocument<rapidjson::UTF8<>, JsonAllocator, ArenaAllocator> JsonDocument;  ///< command document, parse stack in the RequestArena
+typedef rapidjson::Writer<rapidjson::StringBuffer> ResponseWriter;                            ///< writes the response of a dispatch
+
+// ----------------------------------------------------------------------------------------------- //
+
+///
+/// @brief FNV-1a hash of a byte string
+///
+/// @param data The bytes to hash, need not be null terminated.
+/// @param length The number of bytes.
+///
+INLINE uint64_t fnv1a(const char *data, size_t length)
+{
+	uint64_t hash = 14695981039346656037ULL;
+	for( size_t n = 0; n < length; ++n ) {
+		hash ^= static_cast<unsigned char>(data[n]);
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+// ----------------------------------------------------------------------------------------------- //
+
+///
+/// @brief monotonic clock in nanoseconds, for latency measurement
+///
+INLINE uint64_t monotonicNs()
+{
+	return static_cast<uint64_t>( std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now().time_since_epoch() ).count() );
+}
+
+// ----------------------------------------------------------------------------------------------- //
+
+///
+/// @brief Check the json object is NULL or not
+///
+/// @param json The json to check
+///
+INLINE bool isNull(const JsonValue &JSON )
+{
+	return false;
+}
+
+// ----------------------------------------------------------------------------------------------- //
+
+///
+/// @brief switch for the dispatcher's console output, on by default
+///
+INLINE std::atomic<bool> & consoleSwitch()
+{
+	static std::atomic<bool> enabled{ true };
+	return enabled;
+}
+
+///
+/// @brief turn the console output of dispatcher and handlers on or off, e.g. off for benchmarks
+///
+INLINE void setConsoleEnabled(bool enabled)
+{
+	consoleSwitch().store( enabled, std::memory_order_relaxed );
+}
+
+INLINE bool consoleEnabled()
+{
+	return consoleSwitch().load( std::memory_order_relaxed );
+}
+
+INLINE std::atomic<std::ostream *> & consoleSink()
+{
+	static std::atomic<std::ostream *> sink{ &std::cout };
+	return sink;
+}
+
+///
+/// @brief send the console output to another stream, e.g. std::clog or a file, std::cout by default
+///
+/// @note lines end with '\n' and are never flushed one by one, the sink's own buffering decides
+///       when they are written. The sink must outlive the dispatches using it.
+///
+INLINE void setConsoleSink(std::ostream &sink)
+{
+	consoleSink().store( &sink, std::memory_order_relaxed );
+}
+
+///
+/// @brief the console stream, the sink or a per thread stream discarding everything when disabled
+///
+INLINE std::ostream & console()
+{
+	static thread_local std::ostream discard( NULL );
+	return consoleEnabled() ? *consoleSink().load( std::memory_order_relaxed ) : discard;
+}
+
+// ----------------------------------------------------------------------------------------------- //
+
+///
+/// @brief Output message to console
+///
+/// @param str The string message to output to console.
+///
+INLINE void consoleOut(const std::string &str)
+{
+	console() << str << '\n';
+}
+
+///@brief same for a literal or ScratchString::c_str(), no temporary std::string
+INLINE void consoleOut(const char *str)
+{
+	console() << str << '\n';
+}
+
+// ----------------------------------------------------------------------------------------------- //
+
+}
+}
+
+#endif
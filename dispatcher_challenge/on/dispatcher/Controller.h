@@ -0,0 +1,380 @@
+#ifndef _ON_DISPATCHER_CONTROLLER_H_
+#define _ON_DISPATCHER_CONTROLLER_H_
+
+#include <atomic>
+#include <iostream>
+#include <string>
+
+#include "on/dispatcher/Common.h"
+#include "on/dispatcher/CommandDispatcher.h"
+#include "on/dispatcher/PayloadBinding.h"
+#include "on/dispatcher/TtlCache.h"
+
+///@brief set by the exit command, defined by the application
+extern std::atomic_bool g_done;
+
+namespace on {
+namespace dispatcher {
+
+// ----------------------------------------------------------------------------------------------- //
+
+///
+/// @brief payloads of the controller commands, validated against schema() and bound before the handler runs
+///
+struct HelpPayload
+{
+	const char *usage;    ///< command usage text
+
+	static PayloadFields<HelpPayload> fields()
+	{
+		static constexpr PayloadField<HelpPayload> kFields[] = {
+			ON_PAYLOAD_FIELD( HelpPayload, usage, kRequired )
+		};
+		return payloadFields( kFields );
+	}
+
+	static const char * schema()
+	{
+		return R"({"type":"object","properties":{"usage":{"type":"string"}},"required":["usage"]})";
+	}
+};
+
+struct ExitPayload
+{
+	const char *reason;   ///< why the application exits
+
+	static PayloadFields<ExitPayload> fields()
+	{
+		static constexpr PayloadField<ExitPayload> kFields[] = {
+			ON_PAYLOAD_FIELD( ExitPayload, reason, kRequired )
+		};
+		return payloadFields( kFields );
+	}
+
+	static const char * schema()
+	{
+		return R"({"type":"object","properties":{"reason":{"type":"string"}},"required":["reason"]})";
+	}
+};
+
+struct AuthenticatePayload
+{
+	PayloadString key;    ///< user key
+
+	static PayloadFields<AuthenticatePayload> fields()
+	{
+		static constexpr PayloadField<AuthenticatePayload> kFields[] = {
+			ON_PAYLOAD_FIELD( AuthenticatePayload, key, kRequired )
+		};
+		return payloadFields( kFields );
+	}
+
+	static const char * schema()
+	{
+		return R"({"type":"object","properties":{"key":{"type":"string","minLength":1}},"required":["key"]})";
+	}
+};
+
+struct ReloadUserPayload
+{
+	PayloadString token;  ///< token of the authenticated user
+
+	static PayloadFields<ReloadUserPayload> fields()
+	{
+		static constexpr PayloadField<ReloadUserPayload> kFields[] = {
+			ON_PAYLOAD_FIELD( ReloadUserPayload, token, kRequired )
+		};
+		return payloadFields( kFields );
+	}
+
+	static const char * schema()
+	{
+		return R"({"type":"object","properties":{"token":{"type":"string","minLength":1}},"required":["token"]})";
+	}
+};
+
+struct DeviceHealthPayload
+{
+	const char *status;   ///< reported device status
+
+	static PayloadFields<DeviceHealthPayload> fields()
+	{
+		static constexpr PayloadField<DeviceHealthPayload> kFields[] = {
+			ON_PAYLOAD_FIELD( DeviceHealthPayload, status, kRequired )
+		};
+		return payloadFields( kFields );
+	}
+
+	static const char * schema()
+	{
+		return R"({"type":"object","properties":{"status":{"type":"string"}},"required":["status"]})";
+	}
+};
+
+// ----------------------------------------------------------------------------------------------- //
+
+///
+/// @brief outcome of the authentication procedure of a key or token, cached by the controller
+///
+struct AuthResult
+{
+	bool authenticated;   ///< the key or token is valid
+};
+
+// ----------------------------------------------------------------------------------------------- //
+
+///
+/// @brief controller class
+///
+/// @note handlers receive their payload bound and validated, see bindHandler
+///
+/// @note authenticate and reloadUser run the authentication procedure once per key or token and
+///       answer repeats from a TtlCache until the entry expires or is evicted. Only successes are
+///       cached, a failure is answered by the procedure every time: a key or token that becomes
+///       valid is not refused for a ttl, and guessed keys do not evict valid ones.
+///
+class Controller {
+public:
+
+	static const size_t kAuthCacheCapacity = 4096;
+	static const uint64_t kAuthCacheTtlNs = 60ULL * 1000000000ULL;
+
+    ///
+    /// @param authCacheCapacity Keys and tokens cached each, 0 runs the procedure every time.
+    /// @param authCacheTtlNs How long an authentication result is reused.
+    ///
+	explicit Controller( size_t authCacheCapacity = kAuthCacheCapacity, uint64_t authCacheTtlNs = kAuthCacheTtlNs )
+		: m_keys{ authCacheCapacity, authCacheTtlNs }, m_tokens{ authCacheCapacity, authCacheTtlNs }
+	{
+	}
+
+// ----------------------------------------------------------------------------------------------- //
+
+    ///
+	/// @brief output command usage
+    ///
+    /// @param payload The command usage
+    /// @param response Receives {"usage":"..."}
+    ///
+    bool help(const HelpPayload &payload, ResponseWriter &response)
+    {
+        console() << "Controller::help: command: ";
+
+		console() << payload.usage << '\n';
+
+		response.StartObject();
+		response.Key( "usage" );
+		response.String( payload.usage );
+		response.EndObject();
+
+        return true;
+    }
+
+// ----------------------------------------------------------------------------------------------- //
+
+    ///
+	/// @brief exit this application
+    ///
+    /// @param payload The reason to exit
+    /// @param response Receives {"reason":"..."}
+    ///
+    bool exit(const ExitPayload &payload, ResponseWriter &response)
+    {
+        console() << "Controller::exit: command: \n";
+
+		console() << payload.reason << '\n';
+
+		g_done = true;
+
+		response.StartObject();
+		response.Key( "reason" );
+		response.String( payload.reason );
+		response.EndObject();
+
+        return true;
+    }
+
+// ----------------------------------------------------------------------------------------------- //
+
+    ///
+	/// @brief authenticate the user
+    ///
+    /// @param payload The user key
+    /// @param response Receives {"authenticated":bool,"cached":bool}
+    ///
+	bool authenticate( const AuthenticatePayload &payload, ResponseWriter &response )
+	{
+		AuthResult result;
+		const bool cached = cachedAuth( m_keys, payload.key, result, &Controller::authenticateKey );
+
+		response.StartObject();
+		response.Key( "authenticated" );
+		response.Bool( result.authenticated );
+		response.Key( "cached" );
+		response.Bool( cached );
+		response.EndObject();
+
+		return result.authenticated;
+	}
+
+// ----------------------------------------------------------------------------------------------- //
+
+	///
+	/// @brief attempts to reload the current authenticated user
+    ///
+    /// @param payload The token of the user to reload
+    /// @param response Receives {"reloaded":bool,"cached":bool}
+    ///
+	bool reloadUser( const ReloadUserPayload &payload, ResponseWriter &response )
+	{
+		AuthResult result;
+		const bool cached = cachedAuth( m_tokens, payload.token, result, &Controller::authenticateToken );
+
+		response.StartObject();
+		response.Key( "reloaded" );
+		response.Bool( result.authenticated );
+		response.Key( "cached" );
+		response.Bool( cached );
+		response.EndObject();
+
+		return result.authenticated;
+	}
+
+// ----------------------------------------------------------------------------------------------- //
+
+	///
+	/// @brief query the health status
+    ///
+    /// @param payload The device status
+    /// @param response Receives {"status":"..."}
+    ///
+	bool deviceHealth( const DeviceHealthPayload &payload, ResponseWriter &response )
+	{
+		console() << "Device health status: " << payload.status << '\n';
+
+		response.StartObject();
+		response.Key( "status" );
+		response.String( payload.status );
+		response.EndObject();
+
+		return true;
+	}
+
+// ----------------------------------------------------------------------------------------------- //
+
+	///
+	/// @brief forget the cached result of a key or token, e.g. when it is revoked
+	///
+	/// @param keyOrToken The key or token, need not be null terminated.
+	/// @param length Its length, it may contain \u0000.
+	///
+	void invalidate( const char *keyOrToken, size_t length )
+	{
+		m_keys.erase( keyOrToken, length );
+		m_tokens.erase( keyOrToken, length );
+	}
+
+	void invalidate( const std::string &keyOrToken )
+	{
+		invalidate( keyOrToken.data(), keyOrToken.size() );
+	}
+
+	TtlCacheStats keyCacheStats() const
+	{
+		return m_keys.stats();
+	}
+
+	TtlCacheStats tokenCacheStats() const
+	{
+		return m_tokens.stats();
+	}
+
+// ----------------------------------------------------------------------------------------------- //
+
+private:
+
+	typedef TtlCache<AuthResult> AuthCache;
+
+	///
+	/// @brief result of procedure for credential, from cache when it succeeded within the ttl
+	///
+	/// @return true when the result came from the cache
+	///
+	bool cachedAuth( AuthCache &cache, const PayloadString &credential, AuthResult &result,
+		AuthResult (Controller::*procedure)( const PayloadString & ) )
+	{
+		const uint64_t now = monotonicNs();
+
+		if( cache.find( credential.data, credential.length, result, now ) ) {
+			return true;
+		}
+		result = (this->*procedure)( credential );
+		if( result.authenticated ) {
+			cache.insert( credential.data, credential.length, result, now );
+		}
+		return false;
+	}
+
+	AuthResult authenticateKey( const PayloadString & /*key*/ )
+	{
+		//authentication process
+
+		consoleOut( "User authentiated" );
+
+		AuthResult result;
+		result.authenticated = true;
+		return result;
+	}
+
+	AuthResult authenticateToken( const PayloadString & /*token*/ )
+	{
+		//authentication prodecures via token
+
+		consoleOut("User reloaded");
+
+		AuthResult result;
+		result.authenticated = true;
+		return result;
+	}
+
+	AuthCache m_keys;      ///< results of authenticate by key
+	AuthCache m_tokens;    ///< results of reloadUser by token
+
+// ----------------------------------------------------------------------------------------------- //
+
+};
+
+// ----------------------------------------------------------------------------------------------- //
+
+///
+/// @brief the controller commands, resolved at compile time
+///
+constexpr CommandBinding<Controller> kControllerCommands[] = {
+	{ "exit", ON_COMMAND_METHOD( Controller, exit ), &ExitPayload::schema },
+	{ "help", ON_COMMAND_METHOD( Controller, help ), &HelpPayload::schema },
+	{ "authenticate", ON_COMMAND_METHOD( Controller, authenticate ), &AuthenticatePayload::schema },
+	{ "reloadUser", ON_COMMAND_METHOD( Controller, reloadUser ), &ReloadUserPayload::schema },
+	{ "deviceHealth", ON_COMMAND_METHOD( Controller, deviceHealth ), &DeviceHealthPayload::schema },
+};
+
+// ----------------------------------------------------------------------------------------------- //
+
+///
+/// @brief register the controller commands, the handlers call controller, it must outlive the dispatcher
+///
+INLINE void init_dispatcher( CommandDispatcher &dispatcher, Controller &controller)
+{
+	dispatcher.addCommandHandlers( controller, kControllerCommands );
+
+	//control commands overtake queued polls
+	dispatcher.setCommandPriority( "exit", kPriorityHigh );
+	dispatcher.setCommandPriority( "authenticate", kPriorityHigh );
+	dispatcher.setCommandPriority( "deviceHealth", kPriorityLow );
+}
+
+// ----------------------------------------------------------------------------------------------- //
+
+}
+}
+
+#endif
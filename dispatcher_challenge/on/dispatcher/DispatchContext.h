@@ -0,0 +1,239 @@
+#ifndef _ON_DISPATCHER_DISPATCHCONTEXT_H_
+#define _ON_DISPATCHER_DISPATCHCONTEXT_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+#include "on/dispatcher/Common.h"
+#include "on/dispatcher/CommandSchema.h"
+#include "on/dispatcher/PoolAllocator.h"
+#include "on/dispatcher/RequestArena.h"
+
+namespace on {
+namespace dispatcher {
+
+// ----------------------------------------------------------------------------------------------- //
+
+///@brief time spent in each phase of one dispatch, recorded when phase timing is on
+struct DispatchTiming
+{
+	uint64_t parseNs;      ///< parse, including payload schema validation done in the same pass
+	uint64_t lookupNs;     ///< handler lookup of "command"
+	uint64_t admissionNs;  ///< rate limits and the deadline check
+	uint64_t validationNs; ///< second walk validating a payload that came before "command", else 0
+	uint64_t handlerNs;    ///< handler run
+};
+
+///@brief where and when a command came from, filled in by the front end
+struct DispatchOrigin
+{
+	DispatchOrigin() : arrivalNs{ 0 }, client{ 0 }
+	{
+	}
+
+	DispatchOrigin(uint64_t arrivalNs, uint64_t client) : arrivalNs{ arrivalNs }, client{ client }
+	{
+	}
+
+	uint64_t arrivalNs;    ///< monotonicNs() when received, 0 for the start of the dispatch
+	uint64_t client;       ///< identity of the client for per client rate limits, 0 for anonymous
+};
+
+// ----------------------------------------------------------------------------------------------- //
+
+///
+///@brief parse state reused from one dispatch to the next.
+///
+///@note everything a dispatch allocates lives in the context's RequestArena: the copy of the
+///      command, the document chunks, the parse stack and the scratch of handlers. The first
+///      document chunk is pinned in the arena for the lifetime of the context, reset() rewinds
+///      the rest in O(1). The command is parsed in situ, so strings in the document point into
+///      the command buffer. Once the first dispatches have sized the arena and the response
+///      buffer, a dispatch allocates nothing from the heap.
+///
+class DispatchContext
+{
+
+// ----------------------------------------------------------------------------------------------- //
+
+public:
+
+	static const size_t kBlockSize = RAPIDJSON_ALLOCATOR_DEFAULT_CHUNK_CAPACITY;       ///< arena block size, a document pool block
+	static const size_t kChunkCapacity = kBlockSize / 2;                              ///< pinned first chunk and overflow chunk size
+	static const size_t kParseStackCapacity = 1024;                                   ///< initial parse stack size
+	static const size_t kSchemaStateCapacity = 4096;                                  ///< reused schema validator state
+
+// ----------------------------------------------------------------------------------------------- //
+
+	///
+	///@brief constructor
+	///
+	///@param base The allocator of the arena blocks.
+	///
+	explicit DispatchContext(const PoolAllocator &base)
+		: m_arena{ base, kBlockSize },
+		  m_arenaAllocator{ &m_arena },
+		  m_allocator{ m_arena.allocate(kChunkCapacity), kChunkCapacity, kChunkCapacity, &m_arenaAllocator },
+		  m_document{ &m_allocator, kParseStackCapacity, &m_arenaAllocator },
+		  m_schemaState{ m_schemaBuffer, kSchemaStateCapacity, kSchemaStateCapacity, &m_arenaAllocator },
+		  m_responseWriter{ m_response },
+		  m_timing{ 0, 0, 0, 0, 0 },
+		  m_busy{ false }
+	{
+		m_arena.pin();
+	}
+
+	~DispatchContext()
+	{
+		m_document.SetNull();
+		m_allocator.Clear();
+	}
+
+	DispatchContext(const DispatchContext&) = delete;
+	DispatchContext& operator=(const DispatchContext&) = delete;
+
+// ----------------------------------------------------------------------------------------------- //
+
+	///
+	///@brief copy a command into the arena so it can be parsed in situ
+	///
+	///@return the null terminated copy, valid until reset()
+	///
+	char * copy(const char *data, size_t length)
+	{
+		char *copy = static_cast<char *>(m_arena.allocate(length + 1));
+		std::memcpy(copy, data, length);
+		copy[length] = '\0';
+		return copy;
+	}
+
+	///
+	///@brief keep the command as received before an in situ parse modifies it, for the recorder
+	///
+	///@return the copy, valid until reset()
+	///
+	const char * keep(const char *data, size_t length)
+	{
+		char *kept = static_cast<char *>( m_arena.allocate( length ) );
+		std::memcpy( kept, data, length );
+		return kept;
+	}
+
+// ----------------------------------------------------------------------------------------------- //
+
+	///@brief drop the parsed document and everything else in the arena, O(1) unless the document overflowed its first chunk
+	void reset()
+	{
+		m_document.SetNull();
+		m_allocator.Clear();
+		m_schemaState.Clear();
+		m_arena.reset();
+		m_origin = DispatchOrigin();
+	}
+
+// ----------------------------------------------------------------------------------------------- //
+
+	///
+	///@brief start the response of a dispatch, dropping the previous one but keeping its capacity
+	///
+	ResponseWriter & beginResponse()
+	{
+		m_response.Clear();
+		m_responseWriter.Reset( m_response );
+		return m_responseWriter;
+	}
+
+	///@brief the response written since beginResponse(), valid until the next one
+	const rapidjson::StringBuffer & response() const
+	{
+		return m_response;
+	}
+
+// ----------------------------------------------------------------------------------------------- //
+
+	JsonDocument & document()
+	{
+		return m_document;
+	}
+
+	///@brief memory of the dispatch in progress, current on the dispatching thread, see requestArena()
+	RequestArena & arena()
+	{
+		return m_arena;
+	}
+
+	///@brief phase times of the last dispatch on this context that ran a handler
+	DispatchTiming & timing()
+	{
+		return m_timing;
+	}
+
+	///@brief when the command reached the front end or queue, monotonicNs(), 0 for the start of the dispatch
+	uint64_t arrival() const
+	{
+		return m_origin.arrivalNs;
+	}
+
+	///@brief set before a dispatch, deadline_ms counts from the arrival, cleared by reset()
+	void setArrival(uint64_t ns)
+	{
+		m_origin.arrivalNs = ns;
+	}
+
+	///@brief the client the command came from, 0 for anonymous
+	uint64_t client() const
+	{
+		return m_origin.client;
+	}
+
+	///@brief set before a dispatch, cleared by reset()
+	void setOrigin(const DispatchOrigin &origin)
+	{
+		m_origin = origin;
+	}
+
+	///@brief state allocator for payload schema validation, cleared by reset()
+	SchemaStateAllocator & schemaState()
+	{
+		return m_schemaState;
+	}
+
+	///@brief claim the context for one dispatch, false if another or an enclosing dispatch is using it
+	bool tryAcquire()
+	{
+		bool expected = false;
+		return m_busy.compare_exchange_strong(expected, true, std::memory_order_acquire);
+	}
+
+	void release()
+	{
+		m_busy.store(false, std::memory_order_release);
+	}
+
+// ----------------------------------------------------------------------------------------------- //
+
+private:
+
+	RequestArena m_arena;          ///< memory of the dispatch, before m_allocator whose destructor still writes its first chunk
+	ArenaAllocator m_arenaAllocator;   ///< document chunks and parse stack in m_arena
+	JsonAllocator m_allocator;     ///< document allocator, cleared after each dispatch
+	JsonDocument m_document;       ///< reused command document
+	alignas(std::max_align_t) char m_schemaBuffer[kSchemaStateCapacity];   ///< first chunk of m_schemaState
+	SchemaStateAllocator m_schemaState;          ///< schema validator state
+	rapidjson::StringBuffer m_response;     ///< response of the current dispatch
+	ResponseWriter m_responseWriter;        ///< writes m_response
+	DispatchTiming m_timing;       ///< phase times, written only when phase timing is on
+	DispatchOrigin m_origin;       ///< arrival and client of the command being dispatched
+	std::atomic<bool> m_busy;      ///< a dispatch is in progress
+
+};
+
+// ----------------------------------------------------------------------------------------------- //
+
+}
+}
+
+#endif
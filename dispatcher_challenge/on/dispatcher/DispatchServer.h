@@ -0,0 +1,626 @@
+#ifndef _ON_DISPATCHER_DISPATCHSERVER_H_
+#define _ON_DISPATCHER_DISPATCHSERVER_H_
+
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "on/dispatcher/Common.h"
+#include "on/dispatcher/CommandDispatcher.h"
+
+namespace on {
+namespace dispatcher {
+
+// ----------------------------------------------------------------------------------------------- //
+
+///
+///@brief socket front end: Unix domain and localhost TCP listeners on one edge-triggered epoll loop
+///
+///@note every connection has its own read buffer. Requests are framed either by newline or by a
+///      4 byte big endian length prefix, picked from the first byte a client sends: a json text
+///      starts with '{', '[' or white space, a length prefix of a sane request starts with 0.
+///      All complete requests of a read are dispatched in order, in situ in the read buffer, and
+///      their responses are written back on the same connection with the same framing.
+///      Length prefixed requests may be MessagePack envelopes, the responses stay json.
+///
+///      A connection is served at most kMaxRequestsPerWakeup requests per turn, one with more
+///      buffered or unread is resumed on the next turn of the loop, after the other ready
+///      connections. A client that does not read its responses stops being read: above
+///      kOutHighWater pending bytes EPOLLIN is dropped until the responses are written.
+///
+///      Per client rate limits see the uid of a Unix socket peer as the client, every connection
+///      of one user shares a bucket. TCP listens on loopback only, where every peer has the same
+///      address, so each TCP connection is a client of its own.
+///
+class DispatchServer
+{
+
+// ----------------------------------------------------------------------------------------------- //
+
+public:
+
+	static const size_t kReadSize = 64 * 1024;             ///< bytes requested per read
+	static const size_t kMaxRequest = 16 * 1024 * 1024;    ///< larger requests close the connection
+	static const size_t kOutHighWater = 1024 * 1024;       ///< pending response bytes that pause reading
+	static const size_t kMaxRequestsPerWakeup = 64;        ///< requests of one connection per turn
+	static const int kMaxEvents = 256;
+	static const int kPollMs = 100;                        ///< how often run() checks done
+
+	explicit DispatchServer(CommandDispatcher &dispatcher)
+		: m_dispatcher( dispatcher ), m_epoll{ epoll_create1( EPOLL_CLOEXEC ) }, m_requests{ 0 }, m_tcpClients{ 0 }
+	{
+	}
+
+	~DispatchServer()
+	{
+		for( std::unique_ptr<Connection> &connection : m_connections ) {
+			if( connection ) {
+				::close( connection->fd );
+			}
+		}
+		for( const Listener &listener : m_listeners ) {
+			::close( listener.fd );
+			if( !listener.path.empty() ) {
+				::unlink( listener.path.c_str() );
+			}
+		}
+		if( m_epoll >= 0 ) {
+			::close( m_epoll );
+		}
+	}
+
+	DispatchServer(const DispatchServer&) = delete;
+	DispatchServer& operator=(const DispatchServer&) = delete;
+
+// ----------------------------------------------------------------------------------------------- //
+
+	///
+	///@brief listen on a Unix domain socket, an existing socket file is replaced
+	///
+	///@return false with errno set on failure
+	///
+	bool listenUnix(const std::string &path)
+	{
+		sockaddr_un address;
+		std::memset( &address, 0, sizeof(address) );
+		address.sun_family = AF_UNIX;
+		if( path.size() >= sizeof(address.sun_path) ) {
+			errno = ENAMETOOLONG;
+			return false;
+		}
+		std::memcpy( address.sun_path, path.c_str(), path.size() + 1 );
+
+		int fd = ::socket( AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0 );
+		if( fd < 0 ) {
+			return false;
+		}
+
+		::unlink( path.c_str() );
+		if( ::bind( fd, reinterpret_cast<sockaddr *>( &address ), sizeof(address) ) != 0 || !addListener( fd, path ) ) {
+			closePreservingErrno( fd );
+			return false;
+		}
+		return true;
+	}
+
+	///
+	///@brief listen on 127.0.0.1
+	///
+	///@return false with errno set on failure
+	///
+	bool listenTcp(uint16_t port)
+	{
+		sockaddr_in address;
+		std::memset( &address, 0, sizeof(address) );
+		address.sin_family = AF_INET;
+		address.sin_port = htons( port );
+		address.sin_addr.s_addr = htonl( INADDR_LOOPBACK );
+
+		int fd = ::socket( AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0 );
+		if( fd < 0 ) {
+			return false;
+		}
+
+		int on = 1;
+		::setsockopt( fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on) );
+		if( ::bind( fd, reinterpret_cast<sockaddr *>( &address ), sizeof(address) ) != 0 || !addListener( fd, std::string() ) ) {
+			closePreservingErrno( fd );
+			return false;
+		}
+		return true;
+	}
+
+// ----------------------------------------------------------------------------------------------- //
+
+	///@brief raise the open file limit to the hard limit, every connection is a descriptor
+	static void raiseFileLimit()
+	{
+		rlimit limit;
+		if( ::getrlimit( RLIMIT_NOFILE, &limit ) == 0 && limit.rlim_cur < limit.rlim_max ) {
+			limit.rlim_cur = limit.rlim_max;
+			::setrlimit( RLIMIT_NOFILE, &limit );
+		}
+	}
+
+// ----------------------------------------------------------------------------------------------- //
+
+	///
+	///@brief serve until done returns true, it is checked at least every kPollMs
+	///
+	void run(std::function<bool()> done)
+	{
+		epoll_event events[kMaxEvents];
+
+		while( !done() ) {
+			// connections with work left from the last turn do not wait for an event
+			const int count = ::epoll_wait( m_epoll, events, kMaxEvents, m_ready.empty() ? kPollMs : 0 );
+			if( count < 0 && errno != EINTR ) {
+				return;
+			}
+
+			for( int n = 0; n < count; ++n ) {
+				const int fd = events[n].data.fd;
+
+				if( isListener( fd ) ) {
+					acceptAll( fd );
+					continue;
+				}
+
+				Connection *connection = find( fd );
+				if( connection == NULL ) {
+					continue;
+				}
+
+				serve( *connection, (events[n].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) != 0 );
+			}
+
+			serveReady();
+		}
+	}
+
+// ----------------------------------------------------------------------------------------------- //
+
+	///@brief requests dispatched so far
+	uint64_t requests() const
+	{
+		return m_requests;
+	}
+
+	///@brief open client connections
+	size_t connections() const
+	{
+		size_t open = 0;
+		for( const std::unique_ptr<Connection> &connection : m_connections ) {
+			open += connection ? 1 : 0;
+		}
+		return open;
+	}
+
+// ----------------------------------------------------------------------------------------------- //
+
+private:
+
+	enum Framing
+	{
+		kFramingUnknown,
+		kFramingNewline,
+		kFramingLength
+	};
+
+	struct Listener
+	{
+		int fd;
+		std::string path;   ///< Unix socket file, empty for TCP
+	};
+
+	struct Connection
+	{
+		Connection(int fd, uint64_t client)
+			: fd{ fd }, client{ client }, framing{ kFramingUnknown }, used{ 0 }, scanned{ 0 }, readNs{ 0 }, sent{ 0 }, eof{ false },
+			  reading{ true }, ready{ false }
+		{
+		}
+
+		int fd;
+		uint64_t client;          ///< the peer, see clientOf
+		Framing framing;          ///< detected from the first byte
+		std::vector<char> in;     ///< read buffer, in[0, used) holds unprocessed bytes
+		size_t used;
+		size_t scanned;           ///< newline framing: bytes already searched for a newline
+		uint64_t readNs;          ///< when the last read completed, buffered requests arrived then
+		std::string out;          ///< responses not yet written, out[sent, size())
+		size_t sent;
+		bool eof;                 ///< the client shut down its side
+		bool reading;             ///< EPOLLIN is registered, false while the responses pile up
+		bool ready;               ///< in m_ready, to be served on the next turn
+	};
+
+// ----------------------------------------------------------------------------------------------- //
+
+	static void closePreservingErrno(int fd)
+	{
+		const int error = errno;
+		::close( fd );
+		errno = error;
+	}
+
+	bool addListener(int fd, const std::string &path)
+	{
+		if( ::listen( fd, SOMAXCONN ) != 0 ) {
+			return false;
+		}
+
+		epoll_event event;
+		event.events = EPOLLIN | EPOLLET;
+		event.data.fd = fd;
+		if( ::epoll_ctl( m_epoll, EPOLL_CTL_ADD, fd, &event ) != 0 ) {
+			return false;
+		}
+
+		m_listeners.push_back( Listener{ fd, path } );
+		return true;
+	}
+
+	bool isListener(int fd) const
+	{
+		for( const Listener &listener : m_listeners ) {
+			if( listener.fd == fd ) {
+				return true;
+			}
+		}
+		return false;
+	}
+
+	Connection * find(int fd)
+	{
+		return static_cast<size_t>( fd ) < m_connections.size() ? m_connections[fd].get() : NULL;
+	}
+
+// ----------------------------------------------------------------------------------------------- //
+
+	///@brief edge triggered: accept until the backlog is empty
+	void acceptAll(int listener)
+	{
+		for( ;; ) {
+			int fd = ::accept4( listener, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC );
+			if( fd < 0 ) {
+				if( errno == EINTR || errno == ECONNABORTED ) {
+					continue;
+				}
+				// EAGAIN once drained, EMFILE and friends leave the rest queued
+				return;
+			}
+
+			int on = 1;
+			::setsockopt( fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on) );
+			const uint64_t client = clientOf( fd );
+
+			epoll_event event;
+			event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+			event.data.fd = fd;
+			if( ::epoll_ctl( m_epoll, EPOLL_CTL_ADD, fd, &event ) != 0 ) {
+				::close( fd );
+				continue;
+			}
+
+			if( static_cast<size_t>( fd ) >= m_connections.size() ) {
+				m_connections.resize( fd + 1 );
+			}
+			m_connections[fd].reset( new Connection( fd, client ) );
+		}
+	}
+
+	///@brief identity of the peer for per client rate limits, never 0
+	uint64_t clientOf(int fd)
+	{
+		sockaddr_storage address;
+		socklen_t length = sizeof(address);
+		if( ::getsockname( fd, reinterpret_cast<sockaddr *>( &address ), &length ) == 0 && address.ss_family == AF_UNIX ) {
+			ucred credentials;
+			socklen_t size = sizeof(credentials);
+			if( ::getsockopt( fd, SOL_SOCKET, SO_PEERCRED, &credentials, &size ) == 0 ) {
+				return (uint64_t( 1 ) << 32) | credentials.uid;
+			}
+			return uint64_t( 3 ) << 32;
+		}
+
+		// a loopback address tells the peers apart no better than a connection number, never reused
+		return (uint64_t( 2 ) << 48) | ++m_tcpClients;
+	}
+
+	///@brief read, dispatch and write what a connection allows this turn, close it once finished
+	void serve(Connection &connection, bool readable)
+	{
+		bool open = true;
+		if( readable ) {
+			open = readAll( connection );
+		}
+		if( open && !connection.out.empty() ) {
+			open = flush( connection );
+		}
+		if( !open ) {
+			close( connection.fd );
+		}
+	}
+
+	///@brief serve the connections that had work left over last turn
+	void serveReady()
+	{
+		std::vector<int> ready;
+		ready.swap( m_ready );
+
+		for( int fd : ready ) {
+			Connection *connection = find( fd );
+			// closed meanwhile, or its descriptor reused by a new connection
+			if( connection == NULL || !connection->ready ) {
+				continue;
+			}
+			connection->ready = false;
+			serve( *connection, connection->reading );
+		}
+	}
+
+	///@brief serve the connection again on the next turn
+	void resume(Connection &connection)
+	{
+		if( !connection.ready ) {
+			connection.ready = true;
+			m_ready.push_back( connection.fd );
+		}
+	}
+
+	///@brief too many response bytes wait for the client
+	static bool backlogged(const Connection &connection)
+	{
+		return connection.out.size() - connection.sent > kOutHighWater;
+	}
+
+	///@brief register or drop EPOLLIN, edge triggered either way
+	void setReading(Connection &connection, bool reading)
+	{
+		epoll_event event;
+		event.events = (reading ? EPOLLIN : 0) | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+		event.data.fd = connection.fd;
+		::epoll_ctl( m_epoll, EPOLL_CTL_MOD, connection.fd, &event );
+		connection.reading = reading;
+	}
+
+	void close(int fd)
+	{
+		::epoll_ctl( m_epoll, EPOLL_CTL_DEL, fd, NULL );
+		::close( fd );
+		m_connections[fd].reset();
+	}
+
+// ----------------------------------------------------------------------------------------------- //
+
+	///
+	///@brief edge triggered: read until EAGAIN, dispatching complete requests as they arrive
+	///
+	///@note requests left in the buffer by the last turn go first. Once kMaxRequestsPerWakeup
+	///      are dispatched the connection is resumed next turn, once kOutHighWater response bytes
+	///      are pending reading stops until flush has written them.
+	///
+	///@return false when the connection is finished
+	///
+	bool readAll(Connection &connection)
+	{
+		size_t budget = kMaxRequestsPerWakeup;
+
+		if( connection.used > 0 && !process( connection, budget ) ) {
+			return false;
+		}
+
+		for( ;; ) {
+			if( backlogged( connection ) ) {
+				setReading( connection, false );
+				return true;
+			}
+			if( budget == 0 ) {
+				resume( connection );
+				return true;
+			}
+
+			// one spare byte to terminate a request for the in situ parse
+			if( connection.in.size() < connection.used + kReadSize + 1 ) {
+				connection.in.resize( connection.used + kReadSize + 1 );
+			}
+
+			const ssize_t got = ::read( connection.fd, &connection.in[connection.used], kReadSize );
+			if( got > 0 ) {
+				connection.used += static_cast<size_t>( got );
+				connection.readNs = monotonicNs();
+				if( !process( connection, budget ) ) {
+					return false;
+				}
+				continue;
+			}
+			if( got == 0 ) {
+				connection.eof = true;
+				break;
+			}
+			if( errno == EINTR ) {
+				continue;
+			}
+			if( errno == EAGAIN || errno == EWOULDBLOCK ) {
+				break;
+			}
+			return false;
+		}
+
+		// a client that shut down its side still gets the responses it is owed
+		return !connection.eof || !connection.out.empty();
+	}
+
+	///
+	///@brief dispatch the complete requests in the read buffer, keep the partial tail
+	///
+	///@param budget Requests that may still be dispatched this turn, decremented per request.
+	///       Dispatching also stops while the connection is backlogged, the rest stays buffered.
+	///
+	///@return false on a framing error
+	///
+	bool process(Connection &connection, size_t &budget)
+	{
+		char *buffer = connection.in.data();
+		size_t start = 0;
+
+		if( connection.framing == kFramingUnknown ) {
+			const char first = buffer[0];
+			connection.framing = first == '{' || first == '[' || first == ' ' || first == '\t' || first == '\r' || first == '\n'
+				? kFramingNewline : kFramingLength;
+		}
+
+		if( connection.framing == kFramingNewline ) {
+			size_t scan = connection.scanned;
+			bool stopped = false;
+			for( ;; ) {
+				if( budget == 0 || backlogged( connection ) ) {
+					stopped = true;
+					break;
+				}
+
+				char *newline = static_cast<char *>( std::memchr( buffer + scan, '\n', connection.used - scan ) );
+				if( newline == NULL ) {
+					break;
+				}
+
+				*newline = '\0';
+				respond( connection, buffer + start, static_cast<size_t>( newline - buffer ) - start, connection.readNs );
+				start = scan = static_cast<size_t>( newline - buffer ) + 1;
+				--budget;
+			}
+			// stopped early, the rest has not been searched
+			connection.scanned = stopped ? 0 : connection.used - start;
+
+			if( connection.scanned > kMaxRequest ) {
+				return false;
+			}
+		}
+		else {
+			while( connection.used - start >= 4 && budget > 0 && !backlogged( connection ) ) {
+				const unsigned char *prefix = reinterpret_cast<const unsigned char *>( buffer + start );
+				const size_t length = (size_t( prefix[0] ) << 24) | (size_t( prefix[1] ) << 16) | (size_t( prefix[2] ) << 8) | prefix[3];
+
+				if( length > kMaxRequest ) {
+					return false;
+				}
+				if( connection.used - start - 4 < length ) {
+					if( connection.in.size() < start + 4 + length + 1 ) {
+						// size the buffer for the whole request once
+						compact( connection, start );
+						connection.in.resize( 4 + length + kReadSize + 1 );
+						return true;
+					}
+					break;
+				}
+
+				// terminate in place, the byte after the request belongs to the next prefix
+				char *request = buffer + start + 4;
+				const char saved = request[length];
+				request[length] = '\0';
+				respond( connection, request, length, connection.readNs );
+				request[length] = saved;
+
+				start += 4 + length;
+				--budget;
+			}
+		}
+
+		compact( connection, start );
+		return true;
+	}
+
+	///@brief drop the processed bytes in front of the read buffer
+	static void compact(Connection &connection, size_t start)
+	{
+		if( start > 0 ) {
+			std::memmove( connection.in.data(), connection.in.data() + start, connection.used - start );
+			connection.used -= start;
+		}
+	}
+
+// ----------------------------------------------------------------------------------------------- //
+
+	///@brief dispatch one request and queue its json response, copied once from the dispatcher's buffer
+	void respond(Connection &connection, char *request, size_t requestLength, uint64_t arrivalNs)
+	{
+		m_dispatcher.dispatchCommandInsitu( request, requestLength, [&connection](const char *response, size_t length) {
+			if( connection.framing == kFramingLength ) {
+				const char prefix[4] = {
+					static_cast<char>( (length >> 24) & 0xFF ), static_cast<char>( (length >> 16) & 0xFF ),
+					static_cast<char>( (length >> 8) & 0xFF ), static_cast<char>( length & 0xFF ) };
+				connection.out.append( prefix, 4 );
+				connection.out.append( response, length );
+			}
+			else {
+				connection.out.append( response, length );
+				connection.out.push_back( '\n' );
+			}
+		}, DispatchOrigin( arrivalNs, connection.client ) );
+		m_requests++;
+	}
+
+	///@brief write queued responses until done or EAGAIN, EPOLLOUT resumes the rest
+	///@return false when the connection is finished
+	bool flush(Connection &connection)
+	{
+		while( connection.sent < connection.out.size() ) {
+			const ssize_t wrote = ::send( connection.fd, connection.out.data() + connection.sent,
+				connection.out.size() - connection.sent, MSG_NOSIGNAL );
+			if( wrote > 0 ) {
+				connection.sent += static_cast<size_t>( wrote );
+				continue;
+			}
+			if( wrote < 0 && errno == EINTR ) {
+				continue;
+			}
+			if( wrote < 0 && (errno == EAGAIN || errno == EWOULDBLOCK) ) {
+				return true;
+			}
+			return false;
+		}
+
+		connection.out.clear();
+		connection.sent = 0;
+
+		if( !connection.reading ) {
+			// drained, read again and dispatch what is still buffered
+			setReading( connection, true );
+			resume( connection );
+		}
+		return !connection.eof;
+	}
+
+// ----------------------------------------------------------------------------------------------- //
+
+	CommandDispatcher &m_dispatcher;
+	int m_epoll;
+	std::vector<Listener> m_listeners;
+	std::vector< std::unique_ptr<Connection> > m_connections;   ///< indexed by fd
+	std::vector<int> m_ready;                                   ///< connections to serve next turn
+	uint64_t m_requests;
+	uint64_t m_tcpClients;                                      ///< TCP connections accepted, their client ids
+
+};
+
+// ----------------------------------------------------------------------------------------------- //
+
+}
+}
+
+#endif
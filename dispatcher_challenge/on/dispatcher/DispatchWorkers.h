@@ -0,0 +1,288 @@
+#ifndef _ON_DISPATCHER_DISPATCHWORKERS_H_
+#define _ON_DISPATCHER_DISPATCHWORKERS_H_
+
+#include <stdint.h>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "on/dispatcher/Common.h"
+#include "on/dispatcher/CommandTable.h"
+#include "on/dispatcher/DispatchContext.h"
+#include "on/dispatcher/PoolAllocator.h"
+
+namespace on {
+namespace dispatcher {
+
+// ----------------------------------------------------------------------------------------------- //
+
+///
+///@brief worker threads running dispatches off the caller's thread.
+///
+///@note every worker owns a queue and a DispatchContext. A command with an ordering key always
+///      goes to the worker the key hashes to, so commands sharing a key run in submission order
+///      while commands with different keys run in parallel. Commands without a key are spread
+///      round robin.
+///
+///      A queue is a heap: higher priority classes first, earliest deadline first within a class,
+///      then submission order, a flood of low priority polls cannot delay a control command.
+///      Only the oldest queued command of a key is in the heap, the others wait in the key's lane
+///      and the next one enters the heap once it ran, so a key keeps submission order whatever the
+///      priority and deadline of its commands. A command does not overtake an earlier one of its key.
+///
+class DispatchWorkers
+{
+
+// ----------------------------------------------------------------------------------------------- //
+
+public:
+
+	///@brief runs one dispatch on a worker's context, the command buffer and its length, parsed in situ
+	typedef std::function<bool(DispatchContext &, char *, size_t)> DispatchFunc;
+
+// ----------------------------------------------------------------------------------------------- //
+
+	///
+	///@brief start the workers
+	///
+	///@param count Number of worker threads, at least one is started.
+	///@param dispatch The dispatch to run for every command.
+	///@param chunkBlockSize Pool block size for the workers' arena blocks.
+	///
+	DispatchWorkers(size_t count, DispatchFunc dispatch, size_t chunkBlockSize)
+		: m_dispatch{ std::move(dispatch) }, m_next{ 0 }, m_pool{ NULL }
+	{
+		count = count > 0 ? count : 1;
+
+		// a reused chunk per worker plus a parse stack or overflow chunk in flight
+		m_pool = memory_pool_init( count * 2, chunkBlockSize );
+		PoolAllocator base( m_pool, m_pool ? chunkBlockSize : 0 );
+
+		for( size_t n = 0; n < count; ++n ) {
+			m_workers.emplace_back( new Worker( base ) );
+		}
+		for( auto &worker : m_workers ) {
+			Worker *self = worker.get();
+			worker->thread = std::thread( [this, self]() { run( *self ); } );
+		}
+	}
+
+// ----------------------------------------------------------------------------------------------- //
+
+	///@brief drain every queue, then stop and join the workers
+	~DispatchWorkers()
+	{
+		for( auto &worker : m_workers ) {
+			std::lock_guard<std::mutex> lock( worker->mtx );
+			worker->stop = true;
+			worker->wakeup.notify_one();
+		}
+		for( auto &worker : m_workers ) {
+			worker->thread.join();
+		}
+
+		// contexts hold pool blocks
+		m_workers.clear();
+		if( m_pool != NULL ) {
+			memory_pool_destroy( m_pool );
+		}
+	}
+
+	DispatchWorkers(const DispatchWorkers&) = delete;
+	DispatchWorkers& operator=(const DispatchWorkers&) = delete;
+
+// ----------------------------------------------------------------------------------------------- //
+
+	///
+	///@brief queue a command
+	///
+	///@param command The json command, moved into the queue and parsed in situ there.
+	///@param key Ordering key, commands with the same key run in order. NULL or empty for none.
+	///@param keyLength Length of key.
+	///@param priority Scheduling class of the command.
+	///@param deadlineNs Absolute monotonicNs() deadline, kNoDeadlineNs for none.
+	///@param origin When the command arrived, deadline_ms counts from here, 0 for now, and the
+	///       client it came from, for per client rate limits and the recorder.
+	///
+	///@return the dispatch result
+	///
+	std::future<bool> submit(std::string command, const char *key, size_t keyLength,
+		CommandPriority priority = kPriorityNormal, uint64_t deadlineNs = kNoDeadlineNs, const DispatchOrigin &origin = DispatchOrigin())
+	{
+		const size_t index = keyLength > 0
+			? static_cast<size_t>( fnv1a( key, keyLength ) % m_workers.size() )
+			: m_next.fetch_add( 1, std::memory_order_relaxed ) % m_workers.size();
+
+		Worker &worker = *m_workers[index];
+		Task task;
+		task.command = std::move( command );
+		task.key.assign( key, keyLength );
+		task.priority = priority;
+		task.deadlineNs = deadlineNs;
+		task.origin = DispatchOrigin( origin.arrivalNs > 0 ? origin.arrivalNs : monotonicNs(), origin.client );
+		std::future<bool> result = task.result.get_future();
+
+		{
+			std::lock_guard<std::mutex> lock( worker.mtx );
+			task.sequence = worker.sequence++;
+			if( !task.key.empty() ) {
+				auto lane = worker.lanes.find( task.key );
+				if( lane != worker.lanes.end() ) {
+					// behind the queued or running head of its key
+					lane->second.push_back( std::move( task ) );
+				}
+				else {
+					worker.lanes.emplace( task.key, std::deque<Task>() );
+					schedule( worker, std::move( task ) );
+				}
+			}
+			else {
+				schedule( worker, std::move( task ) );
+			}
+		}
+		worker.wakeup.notify_one();
+
+		return result;
+	}
+
+// ----------------------------------------------------------------------------------------------- //
+
+	size_t size() const
+	{
+		return m_workers.size();
+	}
+
+	static const uint64_t kNoDeadlineNs = UINT64_MAX;   ///< deadline of commands without one
+
+// ----------------------------------------------------------------------------------------------- //
+
+private:
+
+	struct Task
+	{
+		std::string command;          ///< in situ command buffer
+		std::promise<bool> result;    ///< dispatch result
+		CommandPriority priority;     ///< scheduling class
+		uint64_t deadlineNs;          ///< absolute deadline, kNoDeadlineNs for none
+		DispatchOrigin origin;        ///< submission time and client
+		uint64_t sequence;            ///< submission order on the worker
+		std::string key;              ///< ordering key, empty for none
+	};
+
+	///@brief heap order, true when a runs after b
+	static bool runsLater(const Task &a, const Task &b)
+	{
+		if( a.priority != b.priority ) {
+			return a.priority > b.priority;
+		}
+		if( a.deadlineNs != b.deadlineNs ) {
+			return a.deadlineNs > b.deadlineNs;
+		}
+		return a.sequence > b.sequence;
+	}
+
+	struct Worker
+	{
+		explicit Worker(const PoolAllocator &base) : context{ base }, sequence{ 0 }, stop{ false }
+		{
+		}
+
+		std::mutex mtx;
+		std::condition_variable wakeup;
+		std::vector<Task> tasks;       ///< runnable commands, a heap ordered by runsLater, guarded by mtx
+		std::unordered_map< std::string, std::deque<Task> > lanes;   ///< per queued or running key, the commands behind its head, guarded by mtx
+		DispatchContext context;       ///< parse state of this worker
+		uint64_t sequence;             ///< next submission number, guarded by mtx
+		bool stop;                     ///< stop once the queue is empty, guarded by mtx
+		std::thread thread;
+	};
+
+// ----------------------------------------------------------------------------------------------- //
+
+	void run(Worker &worker)
+	{
+		std::unique_lock<std::mutex> lock( worker.mtx );
+
+		for( ;; ) {
+			worker.wakeup.wait( lock, [&worker]() { return worker.stop || !worker.tasks.empty(); } );
+
+			if( worker.tasks.empty() ) {
+				// stop requested and drained
+				return;
+			}
+
+			std::pop_heap( worker.tasks.begin(), worker.tasks.end(), runsLater );
+			Task task = std::move( worker.tasks.back() );
+			worker.tasks.pop_back();
+			lock.unlock();
+
+			execute( worker.context, task );
+
+			lock.lock();
+			if( !task.key.empty() ) {
+				advance( worker, task.key );
+			}
+		}
+	}
+
+	///@brief push a runnable command, worker.mtx held
+	static void schedule(Worker &worker, Task task)
+	{
+		worker.tasks.push_back( std::move( task ) );
+		std::push_heap( worker.tasks.begin(), worker.tasks.end(), runsLater );
+	}
+
+	///@brief the head of key ran, schedule the next command of the key or drop its lane, worker.mtx held
+	static void advance(Worker &worker, const std::string &key)
+	{
+		auto lane = worker.lanes.find( key );
+		if( lane->second.empty() ) {
+			worker.lanes.erase( lane );
+			return;
+		}
+		Task next = std::move( lane->second.front() );
+		lane->second.pop_front();
+		schedule( worker, std::move( next ) );
+	}
+
+	void execute(DispatchContext &context, Task &task)
+	{
+		try {
+			context.tryAcquire();
+			context.setOrigin( task.origin );
+			bool result = m_dispatch( context, &task.command[0], task.command.size() );
+			context.reset();
+			context.release();
+			task.result.set_value( result );
+		}
+		catch( ... ) {
+			context.reset();
+			context.release();
+			task.result.set_exception( std::current_exception() );
+		}
+	}
+
+// ----------------------------------------------------------------------------------------------- //
+
+	DispatchFunc m_dispatch;                           ///< the dispatch run by the workers
+	std::vector< std::unique_ptr<Worker> > m_workers;  ///< worker threads and their queues
+	std::atomic<size_t> m_next;                        ///< round robin for commands without a key
+	memory_pool_t *m_pool;                             ///< document chunks of the workers' contexts
+
+};
+
+// ----------------------------------------------------------------------------------------------- //
+
+}
+}
+
+#endif
@@ -0,0 +1,581 @@
+#ifndef _ON_DISPATCHER_ENVELOPEREADER_H_
+#define _ON_DISPATCHER_ENVELOPEREADER_H_
+
+#include <cstring>
+#include <string>
+
+#include "rapidjson/reader.h"
+
+#include "on/dispatcher/Common.h"
+#include "on/dispatcher/CommandTable.h"
+#include "on/dispatcher/CommandSchema.h"
+#include "on/dispatcher/Admission.h"
+#include "on/dispatcher/MsgPack.h"
+
+namespace on {
+namespace dispatcher {
+
+// ----------------------------------------------------------------------------------------------- //
+
+///@brief outcome of reading a command envelope
+enum EnvelopeStatus
+{
+	kEnvelopeOk = 0,            ///< command found and registered
+	kEnvelopeMalformed,         ///< not valid json
+	kEnvelopeNotObject,         ///< top level value is not an object
+	kEnvelopeMissingCommand,    ///< no "command" member
+	kEnvelopeBadCommand,        ///< "command" is not a string
+	kEnvelopeUnknownCommand,    ///< no handler registered for the command
+	kEnvelopeInvalidPayload,    ///< the payload does not match the command's schema
+	kEnvelopeBadDeadline,       ///< "deadline_ms" is not a non negative number
+	kEnvelopeThrottled,         ///< a rate limit rejected the command, the parse stopped at "command"
+	kEnvelopeDuplicateMember    ///< "command", "payload" or "deadline_ms" appears twice
+};
+
+static const double kNoDeadline = -1;   ///< deadline of an envelope without "deadline_ms"
+
+// ----------------------------------------------------------------------------------------------- //
+
+///
+///@brief SAX handler reading a command envelope, {"command": "<name>", "payload": {...}, ...}
+///
+///@note "command" is looked up as soon as its value is read, an unknown command or one rejected
+///      by admission control stops the parse right there. Only "command" and the "payload" subtree are forwarded to the output handler,
+///      every other top level member is consumed without being materialized, so handlers see the
+///      same envelope shape as with a DOM parse. When the command has a payload schema and
+///      "command" comes before "payload", the payload events pass through the schema validator
+///      on their way to the output, validating in the same pass. A top level "deadline_ms" is
+///      read into deadlineMs() instead of the output. A second "command", "payload" or
+///      "deadline_ms" stops the parse, it would be routed, admitted or materialized twice.
+///
+///      With keepMembers every top level member is forwarded, "deadline_ms" included, the output
+///      is the whole envelope as a DOM parse builds it, still routed and validated in one pass.
+///
+///@tparam OutputHandler rapidjson handler receiving the envelope, e.g. a JsonDocument.
+///
+template <typename OutputHandler>
+class EnvelopeHandler
+{
+
+// ----------------------------------------------------------------------------------------------- //
+
+public:
+
+	typedef char Ch;
+
+	///
+	///@param admission Admission control run on the command, NULL for none.
+	///@param client The client id admission control limits.
+	///@param keepMembers Forward every top level member, not only "command" and "payload".
+	///
+	EnvelopeHandler(OutputHandler &out, const CommandTable &commands, SchemaStateAllocator &schemaState,
+		AdmissionControl *admission = NULL, uint64_t client = 0, bool keepMembers = false)
+		: m_out( out ), m_payload( out ), m_commands( commands ), m_schemaState( schemaState ),
+		  m_admission( admission ), m_client{ client }, m_keepMembers{ keepMembers }, m_depth{ 0 }, m_field{ kFieldNone }, m_seen{ 0 }, m_members{ 0 },
+		  m_entry{ NULL }, m_deadlineMs{ kNoDeadline }, m_admitted{ kAdmitted }, m_status{ kEnvelopeMalformed },
+		  m_timed{ false }, m_lookupNs{ 0 }, m_admissionNs{ 0 }
+	{
+	}
+
+	///@brief time the lookup and admission of "command", see lookupNs and admissionNs
+	void timePhases(bool timed)
+	{
+		m_timed = timed;
+	}
+
+// ----------------------------------------------------------------------------------------------- //
+
+	bool Null()                   { return scalar([this]() { return m_payload.Null(); }); }
+	bool Bool(bool b)             { return scalar([this, b]() { return m_payload.Bool(b); }); }
+	bool Int(int i)               { return number(i, [this, i]() { return m_payload.Int(i); }); }
+	bool Uint(unsigned u)         { return number(u, [this, u]() { return m_payload.Uint(u); }); }
+	bool Int64(int64_t i)         { return number(static_cast<double>(i), [this, i]() { return m_payload.Int64(i); }); }
+	bool Uint64(uint64_t u)       { return number(static_cast<double>(u), [this, u]() { return m_payload.Uint64(u); }); }
+	bool Double(double d)         { return number(d, [this, d]() { return m_payload.Double(d); }); }
+
+	bool RawNumber(const Ch *str, rapidjson::SizeType length, bool copy)
+	{
+		return scalar([=]() { return m_payload.RawNumber(str, length, copy); });
+	}
+
+// ----------------------------------------------------------------------------------------------- //
+
+	bool String(const Ch *str, rapidjson::SizeType length, bool copy)
+	{
+		if( m_depth == 1 && m_field == kFieldCommand ) {
+			m_field = kFieldNone;
+			return command(str, length, copy);
+		}
+		return scalar([=]() { return m_payload.String(str, length, copy); });
+	}
+
+// ----------------------------------------------------------------------------------------------- //
+
+	bool Key(const Ch *str, rapidjson::SizeType length, bool copy)
+	{
+		if( m_depth != 1 ) {
+			return forwarded() ? m_payload.Key(str, length, copy) : true;
+		}
+
+		if( length == 7 && std::memcmp(str, "command", 7) == 0 ) {
+			return first(kFieldCommand);
+		}
+		else if( length == 11 && std::memcmp(str, "deadline_ms", 11) == 0 ) {
+			return first(kFieldDeadline) && (!m_keepMembers || keep(str, length, copy));
+		}
+		else if( length == 7 && std::memcmp(str, "payload", 7) == 0 ) {
+			if( !first(kFieldPayload) ) {
+				return false;
+			}
+			m_members++;
+			if( m_entry != NULL && m_entry->schema ) {
+				m_payload.validate( *m_entry->schema, m_schemaState );
+			}
+			return m_out.Key("payload", 7, false);
+		}
+		else if( m_keepMembers ) {
+			m_field = kFieldKeep;
+			return keep(str, length, copy);
+		}
+		else {
+			m_field = kFieldSkip;
+		}
+		return true;
+	}
+
+// ----------------------------------------------------------------------------------------------- //
+
+	bool StartObject()
+	{
+		if( m_depth++ == 0 ) {
+			return m_out.StartObject();
+		}
+		return container([this]() { return m_payload.StartObject(); });
+	}
+
+	bool EndObject(rapidjson::SizeType memberCount)
+	{
+		if( --m_depth == 0 ) {
+			if( m_entry == NULL ) {
+				m_status = kEnvelopeMissingCommand;
+				return false;
+			}
+
+			m_status = kEnvelopeOk;
+			return m_out.EndObject(m_members);
+		}
+		return endContainer([=]() { return m_payload.EndObject(memberCount); });
+	}
+
+	bool StartArray()
+	{
+		if( m_depth++ == 0 ) {
+			m_status = kEnvelopeNotObject;
+			return false;
+		}
+		return container([this]() { return m_payload.StartArray(); });
+	}
+
+	bool EndArray(rapidjson::SizeType elementCount)
+	{
+		--m_depth;
+		return endContainer([=]() { return m_payload.EndArray(elementCount); });
+	}
+
+// ----------------------------------------------------------------------------------------------- //
+
+	///@brief status once the parse has finished or was stopped
+	EnvelopeStatus status() const
+	{
+		return m_payload.invalid() ? kEnvelopeInvalidPayload : m_status;
+	}
+
+	///@brief the payload passed through its schema validator, false if it has no schema or came before "command"
+	bool payloadValidated() const
+	{
+		return m_payload.validator() != NULL;
+	}
+
+	///@brief why the payload failed its schema, valid when status() is kEnvelopeInvalidPayload
+	std::string payloadError() const
+	{
+		return schemaError( *m_payload.validator() );
+	}
+
+	///@brief the registered command, valid when status() is kEnvelopeOk
+	const CommandEntry * entry() const
+	{
+		return m_entry;
+	}
+
+	///@brief the "deadline_ms" of the envelope, kNoDeadline when absent
+	double deadlineMs() const
+	{
+		return m_deadlineMs;
+	}
+
+	///@brief which limit rejected the command when status() is kEnvelopeThrottled
+	AdmissionResult admission() const
+	{
+		return m_admitted;
+	}
+
+	///@brief time spent looking up "command", when timed, part of the parse time
+	uint64_t lookupNs() const
+	{
+		return m_lookupNs;
+	}
+
+	///@brief time spent in admission control, when timed, part of the parse time
+	uint64_t admissionNs() const
+	{
+		return m_admissionNs;
+	}
+
+// ----------------------------------------------------------------------------------------------- //
+
+private:
+
+	///@brief which top level member the events belong to
+	enum Field
+	{
+		kFieldNone,
+		kFieldCommand,
+		kFieldPayload,
+		kFieldDeadline,
+		kFieldSkip,
+		kFieldKeep
+	};
+
+	///@brief events of the current member reach the output
+	bool forwarded() const
+	{
+		return m_field == kFieldPayload || m_field == kFieldKeep;
+	}
+
+	///@brief forward the key of a kept top level member
+	bool keep(const Ch *str, rapidjson::SizeType length, bool copy)
+	{
+		m_members++;
+		return m_out.Key(str, length, copy);
+	}
+
+	///@brief start reading a wanted member, false when the envelope already had it
+	bool first(Field field)
+	{
+		if( (m_seen & (1u << field)) != 0 ) {
+			m_status = kEnvelopeDuplicateMember;
+			return false;
+		}
+		m_seen |= 1u << field;
+		m_field = field;
+		return true;
+	}
+
+	///@brief a number, the deadline when it is the value of "deadline_ms"
+	template <typename Emit>
+	bool number(double value, Emit emit)
+	{
+		if( m_depth == 1 && m_field == kFieldDeadline ) {
+			m_field = kFieldNone;
+			if( value < 0 ) {
+				m_status = kEnvelopeBadDeadline;
+				return false;
+			}
+			m_deadlineMs = value;
+			return m_keepMembers ? emit() : true;
+		}
+		return scalar(emit);
+	}
+
+	///@brief a scalar value, either a whole top level member or inside one
+	template <typename Emit>
+	bool scalar(Emit emit)
+	{
+		if( m_depth == 0 ) {
+			m_status = kEnvelopeNotObject;
+			return false;
+		}
+
+		if( m_depth > 1 ) {
+			return forwarded() ? emit() : true;
+		}
+
+		const Field field = m_field;
+		m_field = kFieldNone;
+
+		if( field == kFieldCommand ) {
+			m_status = kEnvelopeBadCommand;
+			return false;
+		}
+		if( field == kFieldDeadline ) {
+			m_status = kEnvelopeBadDeadline;
+			return false;
+		}
+		if( field == kFieldPayload ) {
+			const bool ok = emit();
+			m_payload.finish();
+			return ok;
+		}
+		return field == kFieldKeep ? emit() : true;
+	}
+
+	template <typename Emit>
+	bool container(Emit emit)
+	{
+		if( m_depth == 2 && m_field == kFieldCommand ) {
+			m_status = kEnvelopeBadCommand;
+			return false;
+		}
+		if( m_depth == 2 && m_field == kFieldDeadline ) {
+			m_status = kEnvelopeBadDeadline;
+			return false;
+		}
+		return forwarded() ? emit() : true;
+	}
+
+	template <typename Emit>
+	bool endContainer(Emit emit)
+	{
+		const bool ok = forwarded() ? emit() : true;
+		if( m_depth == 1 ) {
+			if( m_field == kFieldPayload ) {
+				m_payload.finish();
+			}
+			m_field = kFieldNone;
+		}
+		return ok;
+	}
+
+	bool command(const Ch *str, rapidjson::SizeType length, bool copy)
+	{
+		const uint64_t start = m_timed ? monotonicNs() : 0;
+		m_entry = m_commands.find(str, length);
+		const uint64_t found = m_timed ? monotonicNs() : 0;
+		m_lookupNs = found - start;
+
+		if( m_entry == NULL ) {
+			m_status = kEnvelopeUnknownCommand;
+			return false;
+		}
+
+		if( m_admission != NULL ) {
+			m_admitted = m_admission->admit(*m_entry, m_client);
+			m_admissionNs = (m_timed ? monotonicNs() : 0) - found;
+			if( m_admitted != kAdmitted ) {
+				m_status = kEnvelopeThrottled;
+				return false;
+			}
+		}
+
+		// members of the output envelope may come in any order, emit the command right away
+		m_members++;
+		return m_out.Key("command", 7, false) && m_out.String(str, length, copy);
+	}
+
+// ----------------------------------------------------------------------------------------------- //
+
+	OutputHandler &m_out;           ///< receives the envelope
+	PayloadSink<OutputHandler> m_payload;   ///< receives the payload subtree, validating it when it has a schema
+	const CommandTable &m_commands; ///< registered commands
+	SchemaStateAllocator &m_schemaState;    ///< payload validator state
+	AdmissionControl *m_admission;  ///< rate limits, NULL for none
+	uint64_t m_client;              ///< client id for the per client limit
+	bool m_keepMembers;             ///< forward every top level member
+	unsigned m_depth;               ///< nesting depth, 1 = inside the envelope object
+	Field m_field;                  ///< top level member being read
+	unsigned m_seen;                ///< bit per Field of the wanted members read so far
+	rapidjson::SizeType m_members;  ///< members emitted into the output envelope
+	const CommandEntry *m_entry;    ///< the command's entry
+	double m_deadlineMs;            ///< "deadline_ms", kNoDeadline when absent
+	AdmissionResult m_admitted;     ///< admission of the command
+	EnvelopeStatus m_status;        ///< result
+	bool m_timed;                   ///< time lookup and admission
+	uint64_t m_lookupNs;            ///< lookup time when timed
+	uint64_t m_admissionNs;         ///< admission time when timed
+
+};
+
+// ----------------------------------------------------------------------------------------------- //
+
+///
+///@brief Populate() generator streaming an in situ command buffer through an EnvelopeHandler
+///
+///@note a MessagePack envelope, see isMsgPack, goes through a MsgPackReader instead of the json reader.
+///
+struct EnvelopeGenerator
+{
+	EnvelopeGenerator(char *buffer, size_t length, const CommandTable &commands, SchemaStateAllocator &schemaState,
+		AdmissionControl *admission = NULL, uint64_t client = 0, bool keepMembers = false)
+		: buffer( buffer ), length{ length }, commands( commands ), schemaState( schemaState ), admission( admission ), client{ client },
+		  keepMembers{ keepMembers }, timed{ false }, status{ kEnvelopeMalformed }, entry{ NULL }, deadlineMs{ kNoDeadline }, admitted{ kAdmitted },
+		  payloadValidated{ false }, lookupNs{ 0 }, admissionNs{ 0 }
+	{
+	}
+
+	bool operator()(JsonDocument &document)
+	{
+		EnvelopeHandler<JsonDocument> handler( document, commands, schemaState, admission, client, keepMembers );
+		handler.timePhases( timed );
+
+		if( isMsgPack( buffer, length ) ) {
+			MsgPackReader reader;
+			const MsgPackStatus result = reader.parseInsitu( buffer, length, handler );
+			status = result == kMsgPackOk || result == kMsgPackTerminated ? handler.status() : kEnvelopeMalformed;
+		}
+		else {
+			rapidjson::InsituStringStream stream( buffer );
+			rapidjson::Reader reader;
+
+			rapidjson::ParseResult result =
+				reader.Parse<rapidjson::kParseInsituFlag>( stream, handler );
+
+			status = result || result.Code() == rapidjson::kParseErrorTermination ? handler.status() : kEnvelopeMalformed;
+		}
+		entry = handler.entry();
+		deadlineMs = handler.deadlineMs();
+		admitted = handler.admission();
+		payloadValidated = handler.payloadValidated();
+		lookupNs = handler.lookupNs();
+		admissionNs = handler.admissionNs();
+		if( status == kEnvelopeInvalidPayload ) {
+			payloadError = handler.payloadError();
+		}
+		return status == kEnvelopeOk;
+	}
+
+	char *buffer;                         ///< in situ command buffer
+	size_t length;                        ///< bytes in buffer, a json buffer is also null terminated
+	const CommandTable &commands;         ///< registered commands
+	SchemaStateAllocator &schemaState;    ///< payload validator state
+	AdmissionControl *admission;          ///< rate limits, NULL for none
+	uint64_t client;                      ///< client id for the per client limit
+	bool keepMembers;                     ///< build the whole envelope, see EnvelopeHandler
+	bool timed;                           ///< time lookup and admission, see EnvelopeHandler::timePhases
+	EnvelopeStatus status;                ///< result of the read
+	const CommandEntry *entry;            ///< command entry when status is kEnvelopeOk
+	double deadlineMs;                    ///< "deadline_ms" of the envelope, kNoDeadline when absent
+	AdmissionResult admitted;             ///< which limit rejected the command when status is kEnvelopeThrottled
+	bool payloadValidated;                ///< the payload was validated during the read
+	uint64_t lookupNs;                    ///< lookup time of "command" when timed
+	uint64_t admissionNs;                 ///< admission time of "command" when timed
+	std::string payloadError;             ///< why the payload failed its schema
+};
+
+// ----------------------------------------------------------------------------------------------- //
+
+///@brief what scheduling needs to know about a command before it is queued
+struct EnvelopePeek
+{
+	const CommandEntry *entry;  ///< the command's entry, NULL when unknown or not found
+	double deadlineMs;          ///< "deadline_ms", kNoDeadline when absent or invalid
+};
+
+///
+///@brief SAX handler picking "command" and "deadline_ms" out of an envelope, see peekEnvelope
+///
+class EnvelopePeekHandler : public rapidjson::BaseReaderHandler<rapidjson::UTF8<>, EnvelopePeekHandler>
+{
+public:
+
+	explicit EnvelopePeekHandler(const CommandTable &commands)
+		: m_commands( commands ), m_depth{ 0 }, m_field{ kFieldNone }, m_command{ false }, m_deadline{ false },
+		  m_peek{ NULL, kNoDeadline }
+	{
+	}
+
+	///@brief any value: read it if it is a wanted member, stop once both were read
+	bool Default()
+	{
+		m_field = kFieldNone;
+		return !(m_command && m_deadline);
+	}
+
+	bool Int(int i)            { return number( i ); }
+	bool Uint(unsigned u)      { return number( u ); }
+	bool Int64(int64_t i)      { return number( static_cast<double>( i ) ); }
+	bool Uint64(uint64_t u)    { return number( static_cast<double>( u ) ); }
+	bool Double(double d)      { return number( d ); }
+
+	bool String(const Ch *str, rapidjson::SizeType length, bool)
+	{
+		if( m_depth == 1 && m_field == kFieldCommand ) {
+			m_peek.entry = m_commands.find( str, length );
+			m_command = true;
+		}
+		return Default();
+	}
+
+	bool Key(const Ch *str, rapidjson::SizeType length, bool)
+	{
+		if( m_depth == 1 ) {
+			m_field = length == 7 && std::memcmp( str, "command", 7 ) == 0 ? kFieldCommand
+				: length == 11 && std::memcmp( str, "deadline_ms", 11 ) == 0 ? kFieldDeadline : kFieldNone;
+		}
+		return true;
+	}
+
+	bool StartObject()   { m_field = kFieldNone; return ++m_depth > 0; }
+	bool StartArray()    { m_field = kFieldNone; return ++m_depth > 0; }
+	bool EndObject(rapidjson::SizeType)   { --m_depth; return true; }
+	bool EndArray(rapidjson::SizeType)    { --m_depth; return true; }
+
+	const EnvelopePeek & peek() const
+	{
+		return m_peek;
+	}
+
+private:
+
+	enum Field
+	{
+		kFieldNone,
+		kFieldCommand,
+		kFieldDeadline
+	};
+
+	bool number(double value)
+	{
+		if( m_depth == 1 && m_field == kFieldDeadline ) {
+			m_peek.deadlineMs = value >= 0 ? value : kNoDeadline;
+			m_deadline = true;
+		}
+		return Default();
+	}
+
+	const CommandTable &m_commands;
+	unsigned m_depth;          ///< nesting depth, 1 = inside the envelope object
+	Field m_field;             ///< top level member whose value comes next
+	bool m_command;            ///< "command" was read
+	bool m_deadline;           ///< "deadline_ms" was read
+	EnvelopePeek m_peek;
+
+};
+
+///
+///@brief read the command and deadline of an envelope without building anything
+///
+///@note the parse stops as soon as both are read, a malformed envelope peeks as far as it is valid,
+///      the dispatch reports the error. data is json, null terminated, or MessagePack.
+///
+INLINE EnvelopePeek peekEnvelope(const char *data, size_t length, const CommandTable &commands)
+{
+	EnvelopePeekHandler handler( commands );
+	if( isMsgPack( data, length ) ) {
+		MsgPackReader reader;
+		reader.parse( data, length, handler );
+		return handler.peek();
+	}
+
+	rapidjson::StringStream stream( data );
+	rapidjson::Reader reader;
+	reader.Parse( stream, handler );
+	return handler.peek();
+}
+
+// ----------------------------------------------------------------------------------------------- //
+
+}
+}
+
+#endif
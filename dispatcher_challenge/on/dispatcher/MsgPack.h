@@ -0,0 +1,490 @@
+#ifndef _ON_DISPATCHER_MSGPACK_H_
+#define _ON_DISPATCHER_MSGPACK_H_
+
+#include <stdint.h>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "rapidjson/rapidjson.h"
+
+#include "on/dispatcher/Common.h"
+
+namespace on {
+namespace dispatcher {
+
+// ----------------------------------------------------------------------------------------------- //
+
+///
+///@brief a MessagePack command envelope, a map, starts with a map header
+///
+///@note 0x80-0x8f (fixmap), 0xde (map 16) and 0xdf (map 32) never start a json text, which
+///      starts with white space, '{' or '[', nor a UTF-8 byte order mark.
+///
+INLINE bool isMsgPack(const char *data, size_t length)
+{
+	if( length == 0 ) {
+		return false;
+	}
+	const unsigned char first = static_cast<unsigned char>( data[0] );
+	return (first & 0xF0) == 0x80 || first == 0xDE || first == 0xDF;
+}
+
+// ----------------------------------------------------------------------------------------------- //
+
+///@brief outcome of reading a MessagePack value
+enum MsgPackStatus
+{
+	kMsgPackOk = 0,          ///< one complete value
+	kMsgPackTruncated,       ///< the data ends inside a value
+	kMsgPackUnsupported,     ///< ext types and the never used 0xc1
+	kMsgPackBadKey,          ///< a map key that is not a string
+	kMsgPackTooDeep,         ///< nested deeper than MsgPackReader::kMaxDepth
+	kMsgPackTrailing,        ///< bytes after the value
+	kMsgPackTerminated       ///< the handler stopped the read
+};
+
+// ----------------------------------------------------------------------------------------------- //
+
+///
+///@brief SAX reader of MessagePack, emits the rapidjson Handler events a json parse of the same
+///       data would
+///
+///@note integers are reported as rapidjson reports json numbers: Uint for 0..UINT32_MAX, Int for
+///      negative values from INT32_MIN, Uint64 and Int64 beyond, whatever their encoded width.
+///      Floats are Double, bin is a String. Map keys must be strings.
+///
+///      parseInsitu() terminates strings in place: the bytes move one or more bytes forward over
+///      their own header and a null follows them, the next value is not touched. Strings are
+///      emitted with copy false and stay valid as long as the buffer, as with a json in situ parse.
+///      parse() leaves the data alone and emits strings with copy true, not null terminated.
+///
+class MsgPackReader
+{
+
+// ----------------------------------------------------------------------------------------------- //
+
+public:
+
+	static const unsigned kMaxDepth = 128;
+
+	///@brief read one value from a mutable buffer, strings are null terminated in place
+	template <typename Handler>
+	MsgPackStatus parseInsitu(char *data, size_t length, Handler &handler)
+	{
+		return read<true>( data, length, handler );
+	}
+
+	///@brief read one value without modifying data
+	template <typename Handler>
+	MsgPackStatus parse(const char *data, size_t length, Handler &handler)
+	{
+		return read<false>( const_cast<char *>( data ), length, handler );
+	}
+
+// ----------------------------------------------------------------------------------------------- //
+
+private:
+
+	template <bool Insitu, typename Handler>
+	MsgPackStatus read(char *data, size_t length, Handler &handler)
+	{
+		m_pos = data;
+		m_end = data + length;
+
+		const MsgPackStatus status = value<Insitu>( handler, 0 );
+		if( status == kMsgPackOk && m_pos != m_end ) {
+			return kMsgPackTrailing;
+		}
+		return status;
+	}
+
+	///@brief big endian unsigned of Bytes bytes at m_pos
+	template <size_t Bytes>
+	uint64_t big()
+	{
+		const unsigned char *bytes = reinterpret_cast<const unsigned char *>( m_pos );
+		uint64_t result = 0;
+		for( size_t n = 0; n < Bytes; ++n ) {
+			result = (result << 8) | bytes[n];
+		}
+		m_pos += Bytes;
+		return result;
+	}
+
+	bool available(size_t bytes) const
+	{
+		return static_cast<size_t>( m_end - m_pos ) >= bytes;
+	}
+
+	///@brief read a length field of Bytes bytes
+	template <size_t Bytes>
+	bool size(size_t &length)
+	{
+		if( !available( Bytes ) ) {
+			return false;
+		}
+		length = static_cast<size_t>( big<Bytes>() );
+		return true;
+	}
+
+// ----------------------------------------------------------------------------------------------- //
+
+	static MsgPackStatus emit(bool ok)
+	{
+		return ok ? kMsgPackOk : kMsgPackTerminated;
+	}
+
+	template <typename Handler>
+	static MsgPackStatus unsignedValue(Handler &handler, uint64_t u)
+	{
+		return emit( u <= 0xFFFFFFFFULL ? handler.Uint( static_cast<unsigned>( u ) ) : handler.Uint64( u ) );
+	}
+
+	template <typename Handler>
+	static MsgPackStatus signedValue(Handler &handler, int64_t i)
+	{
+		if( i >= 0 ) {
+			return unsignedValue( handler, static_cast<uint64_t>( i ) );
+		}
+		return emit( i >= INT32_MIN ? handler.Int( static_cast<int>( i ) ) : handler.Int64( i ) );
+	}
+
+	///@brief a string or key of length bytes whose header of header bytes is behind m_pos
+	template <bool Insitu, typename Handler>
+	MsgPackStatus string(Handler &handler, size_t header, size_t length, bool key)
+	{
+		if( !available( length ) ) {
+			return kMsgPackTruncated;
+		}
+
+		char *str = m_pos;
+		m_pos += length;
+
+		if( Insitu ) {
+			// over the header, the null lands on the last byte of the old string or its header
+			std::memmove( str - header, str, length );
+			str -= header;
+			str[length] = '\0';
+		}
+
+		const rapidjson::SizeType size = static_cast<rapidjson::SizeType>( length );
+		return emit( key ? handler.Key( str, size, !Insitu ) : handler.String( str, size, !Insitu ) );
+	}
+
+	///@brief header bytes and length of a string, false if the type is not a string
+	bool stringHeader(unsigned char type, size_t &header, size_t &length, bool &truncated)
+	{
+		truncated = false;
+		if( (type & 0xE0) == 0xA0 ) {
+			header = 1;
+			length = type & 0x1F;
+			return true;
+		}
+
+		switch( type ) {
+		case 0xD9: case 0xC4: header = 2; truncated = !size<1>( length ); return true;
+		case 0xDA: case 0xC5: header = 3; truncated = !size<2>( length ); return true;
+		case 0xDB: case 0xC6: header = 5; truncated = !size<4>( length ); return true;
+		default: return false;
+		}
+	}
+
+// ----------------------------------------------------------------------------------------------- //
+
+	template <bool Insitu, typename Handler>
+	MsgPackStatus value(Handler &handler, unsigned depth)
+	{
+		if( !available( 1 ) ) {
+			return kMsgPackTruncated;
+		}
+		const unsigned char type = static_cast<unsigned char>( *m_pos++ );
+
+		// positive and negative fixint
+		if( type <= 0x7F ) {
+			return emit( handler.Uint( type ) );
+		}
+		if( type >= 0xE0 ) {
+			return emit( handler.Int( static_cast<int8_t>( type ) ) );
+		}
+
+		size_t header = 0;
+		size_t length = 0;
+		bool truncated = false;
+		if( stringHeader( type, header, length, truncated ) ) {
+			return truncated ? kMsgPackTruncated : string<Insitu>( handler, header, length, false );
+		}
+
+		if( (type & 0xF0) == 0x80 ) {
+			return map<Insitu>( handler, type & 0x0F, depth );
+		}
+		if( (type & 0xF0) == 0x90 ) {
+			return array<Insitu>( handler, type & 0x0F, depth );
+		}
+
+		switch( type ) {
+		case 0xC0: return emit( handler.Null() );
+		case 0xC2: return emit( handler.Bool( false ) );
+		case 0xC3: return emit( handler.Bool( true ) );
+
+		case 0xCC: return available( 1 ) ? unsignedValue( handler, big<1>() ) : kMsgPackTruncated;
+		case 0xCD: return available( 2 ) ? unsignedValue( handler, big<2>() ) : kMsgPackTruncated;
+		case 0xCE: return available( 4 ) ? unsignedValue( handler, big<4>() ) : kMsgPackTruncated;
+		case 0xCF: return available( 8 ) ? unsignedValue( handler, big<8>() ) : kMsgPackTruncated;
+
+		case 0xD0: return available( 1 ) ? signedValue( handler, static_cast<int8_t>( big<1>() ) ) : kMsgPackTruncated;
+		case 0xD1: return available( 2 ) ? signedValue( handler, static_cast<int16_t>( big<2>() ) ) : kMsgPackTruncated;
+		case 0xD2: return available( 4 ) ? signedValue( handler, static_cast<int32_t>( big<4>() ) ) : kMsgPackTruncated;
+		case 0xD3: return available( 8 ) ? signedValue( handler, static_cast<int64_t>( big<8>() ) ) : kMsgPackTruncated;
+
+		case 0xCA:
+		{
+			if( !available( 4 ) ) {
+				return kMsgPackTruncated;
+			}
+			const uint32_t bits = static_cast<uint32_t>( big<4>() );
+			float f;
+			std::memcpy( &f, &bits, sizeof(f) );
+			return emit( handler.Double( f ) );
+		}
+		case 0xCB:
+		{
+			if( !available( 8 ) ) {
+				return kMsgPackTruncated;
+			}
+			const uint64_t bits = big<8>();
+			double d;
+			std::memcpy( &d, &bits, sizeof(d) );
+			return emit( handler.Double( d ) );
+		}
+
+		case 0xDC: return size<2>( length ) ? array<Insitu>( handler, length, depth ) : kMsgPackTruncated;
+		case 0xDD: return size<4>( length ) ? array<Insitu>( handler, length, depth ) : kMsgPackTruncated;
+		case 0xDE: return size<2>( length ) ? map<Insitu>( handler, length, depth ) : kMsgPackTruncated;
+		case 0xDF: return size<4>( length ) ? map<Insitu>( handler, length, depth ) : kMsgPackTruncated;
+
+		default:
+			return kMsgPackUnsupported;
+		}
+	}
+
+	template <bool Insitu, typename Handler>
+	MsgPackStatus map(Handler &handler, size_t count, unsigned depth)
+	{
+		if( depth >= kMaxDepth ) {
+			return kMsgPackTooDeep;
+		}
+		if( !handler.StartObject() ) {
+			return kMsgPackTerminated;
+		}
+
+		for( size_t n = 0; n < count; ++n ) {
+			if( !available( 1 ) ) {
+				return kMsgPackTruncated;
+			}
+
+			size_t header = 0;
+			size_t length = 0;
+			bool truncated = false;
+			const unsigned char type = static_cast<unsigned char>( *m_pos++ );
+			if( !stringHeader( type, header, length, truncated ) || type == 0xC4 || type == 0xC5 || type == 0xC6 ) {
+				return kMsgPackBadKey;
+			}
+			MsgPackStatus status = truncated ? kMsgPackTruncated : string<Insitu>( handler, header, length, true );
+			if( status == kMsgPackOk ) {
+				status = value<Insitu>( handler, depth + 1 );
+			}
+			if( status != kMsgPackOk ) {
+				return status;
+			}
+		}
+
+		return emit( handler.EndObject( static_cast<rapidjson::SizeType>( count ) ) );
+	}
+
+	template <bool Insitu, typename Handler>
+	MsgPackStatus array(Handler &handler, size_t count, unsigned depth)
+	{
+		if( depth >= kMaxDepth ) {
+			return kMsgPackTooDeep;
+		}
+		if( !handler.StartArray() ) {
+			return kMsgPackTerminated;
+		}
+
+		for( size_t n = 0; n < count; ++n ) {
+			const MsgPackStatus status = value<Insitu>( handler, depth + 1 );
+			if( status != kMsgPackOk ) {
+				return status;
+			}
+		}
+
+		return emit( handler.EndArray( static_cast<rapidjson::SizeType>( count ) ) );
+	}
+
+// ----------------------------------------------------------------------------------------------- //
+
+	char *m_pos;     ///< next byte
+	char *m_end;     ///< end of the data
+
+};
+
+// ----------------------------------------------------------------------------------------------- //
+
+///
+///@brief rapidjson Handler writing MessagePack, e.g. document.Accept( writer ) converts json
+///
+///@note a container's size is only known at its end: its header is written as one byte and
+///      widened to map 16 / map 32 in place when it has more than 15 members.
+///
+class MsgPackWriter
+{
+
+// ----------------------------------------------------------------------------------------------- //
+
+public:
+
+	typedef char Ch;
+
+	explicit MsgPackWriter(std::string &out) : m_out( out )
+	{
+	}
+
+	bool Null()                { m_out.push_back( static_cast<char>( 0xC0 ) ); return true; }
+	bool Bool(bool b)          { m_out.push_back( static_cast<char>( b ? 0xC3 : 0xC2 ) ); return true; }
+	bool Int(int i)            { return Int64( i ); }
+	bool Uint(unsigned u)      { return Uint64( u ); }
+
+	bool Int64(int64_t i)
+	{
+		if( i >= 0 ) {
+			return Uint64( static_cast<uint64_t>( i ) );
+		}
+		if( i >= -32 ) {
+			m_out.push_back( static_cast<char>( i ) );
+		}
+		else if( i >= INT8_MIN ) {
+			put( 0xD0, static_cast<uint64_t>( i ), 1 );
+		}
+		else if( i >= INT16_MIN ) {
+			put( 0xD1, static_cast<uint64_t>( i ), 2 );
+		}
+		else if( i >= INT32_MIN ) {
+			put( 0xD2, static_cast<uint64_t>( i ), 4 );
+		}
+		else {
+			put( 0xD3, static_cast<uint64_t>( i ), 8 );
+		}
+		return true;
+	}
+
+	bool Uint64(uint64_t u)
+	{
+		if( u <= 0x7F ) {
+			m_out.push_back( static_cast<char>( u ) );
+		}
+		else if( u <= 0xFF ) {
+			put( 0xCC, u, 1 );
+		}
+		else if( u <= 0xFFFF ) {
+			put( 0xCD, u, 2 );
+		}
+		else if( u <= 0xFFFFFFFFULL ) {
+			put( 0xCE, u, 4 );
+		}
+		else {
+			put( 0xCF, u, 8 );
+		}
+		return true;
+	}
+
+	bool Double(double d)
+	{
+		uint64_t bits;
+		std::memcpy( &bits, &d, sizeof(bits) );
+		put( 0xCB, bits, 8 );
+		return true;
+	}
+
+	///@brief not produced by a document, json number text has no MessagePack form
+	bool RawNumber(const Ch *, rapidjson::SizeType, bool)
+	{
+		return false;
+	}
+
+	bool String(const Ch *str, rapidjson::SizeType length, bool = false)
+	{
+		if( length <= 31 ) {
+			m_out.push_back( static_cast<char>( 0xA0 | length ) );
+		}
+		else if( length <= 0xFF ) {
+			put( 0xD9, length, 1 );
+		}
+		else if( length <= 0xFFFF ) {
+			put( 0xDA, length, 2 );
+		}
+		else {
+			put( 0xDB, length, 4 );
+		}
+		m_out.append( str, length );
+		return true;
+	}
+
+	bool Key(const Ch *str, rapidjson::SizeType length, bool copy = false)
+	{
+		return String( str, length, copy );
+	}
+
+	bool StartObject()                      { return start(); }
+	bool EndObject(rapidjson::SizeType count)  { return end( 0x80, 0xDE, count ); }
+	bool StartArray()                       { return start(); }
+	bool EndArray(rapidjson::SizeType count)   { return end( 0x90, 0xDC, count ); }
+
+// ----------------------------------------------------------------------------------------------- //
+
+private:
+
+	void put(unsigned char type, uint64_t value, size_t bytes)
+	{
+		m_out.push_back( static_cast<char>( type ) );
+		for( size_t n = bytes; n > 0; --n ) {
+			m_out.push_back( static_cast<char>( (value >> ((n - 1) * 8)) & 0xFF ) );
+		}
+	}
+
+	bool start()
+	{
+		m_open.push_back( m_out.size() );
+		m_out.push_back( '\0' );
+		return true;
+	}
+
+	///@brief write the header of the innermost container, fix is the fixmap / fixarray type, wide the 16 bit one
+	bool end(unsigned char fix, unsigned char wide, rapidjson::SizeType count)
+	{
+		const size_t at = m_open.back();
+		m_open.pop_back();
+
+		if( count <= 15 ) {
+			m_out[at] = static_cast<char>( fix | count );
+			return true;
+		}
+
+		std::string header;
+		MsgPackWriter widened( header );
+		widened.put( count <= 0xFFFF ? wide : wide + 1, count, count <= 0xFFFF ? 2 : 4 );
+		m_out.replace( at, 1, header );
+		return true;
+	}
+
+	std::string &m_out;               ///< receives the encoding
+	std::vector<size_t> m_open;       ///< header offsets of the open containers
+
+};
+
+// ----------------------------------------------------------------------------------------------- //
+
+}
+}
+
+#endif
@@ -0,0 +1,297 @@
+#ifndef _ON_DISPATCHER_PAYLOADBINDING_H_
+#define _ON_DISPATCHER_PAYLOADBINDING_H_
+
+#include <stdint.h>
+#include <cstring>
+#include <functional>
+#include <string>
+
+#include "on/dispatcher/Common.h"
+#include "on/dispatcher/CommandTable.h"
+
+namespace on {
+namespace dispatcher {
+
+// ----------------------------------------------------------------------------------------------- //
+
+///@brief whether a payload field must be present
+enum PayloadPresence
+{
+	kOptional = 0,
+	kRequired = 1
+};
+
+///@brief outcome of binding a payload to its struct
+enum PayloadBindStatus
+{
+	kBindOk = 0,           ///< every required field bound
+	kBindNotObject,        ///< the payload is not an object
+	kBindMissingField,     ///< a required field is absent
+	kBindFieldType         ///< a field has the wrong json type
+};
+
+struct PayloadBindResult
+{
+	PayloadBindStatus status;   ///< result
+	const char *field;          ///< the offending field, NULL when status is kBindOk or kBindNotObject
+};
+
+// ----------------------------------------------------------------------------------------------- //
+
+///
+///@brief descriptor of one field of a payload struct, declared with ON_PAYLOAD_FIELD
+///
+template <typename Payload>
+struct PayloadField
+{
+	const char *name;                                        ///< json member name
+	rapidjson::SizeType length;                              ///< strlen(name)
+	PayloadPresence presence;                                ///< kRequired or kOptional
+	bool (*assign)(const JsonValue &value, Payload &out);    ///< type check and store into the member
+};
+
+///@brief the field descriptors of a payload struct
+template <typename Payload>
+struct PayloadFields
+{
+	const PayloadField<Payload> *fields;
+	size_t count;
+};
+
+///@brief PayloadFields over a constexpr descriptor array
+template <typename Payload, size_t Count>
+constexpr PayloadFields<Payload> payloadFields(const PayloadField<Payload> (&fields)[Count])
+{
+	static_assert( Count <= 64, "at most 64 fields per payload" );
+	return PayloadFields<Payload>{ fields, Count };
+}
+
+// ----------------------------------------------------------------------------------------------- //
+
+///@brief a string member with its length, a json string may hold \u0000, the length is not strlen
+struct PayloadString
+{
+	const char *data;    ///< null terminated, into the command buffer
+	size_t length;       ///< bytes of the string
+};
+
+// ----------------------------------------------------------------------------------------------- //
+
+///
+///@brief store a json value into a member of the matching C++ type
+///
+///@note const char * and PayloadString point into the command buffer, they are valid until the
+///      handler returns. const JsonValue * takes any value unchecked.
+///
+///@return false when the json type does not match
+///
+INLINE bool assignValue(const JsonValue &value, const char *&out)
+{
+	return value.IsString() ? (out = value.GetString(), true) : false;
+}
+
+INLINE bool assignValue(const JsonValue &value, PayloadString &out)
+{
+	return value.IsString() ? (out = PayloadString{ value.GetString(), value.GetStringLength() }, true) : false;
+}
+
+INLINE bool assignValue(const JsonValue &value, std::string &out)
+{
+	return value.IsString() ? (out.assign( value.GetString(), value.GetStringLength() ), true) : false;
+}
+
+INLINE bool assignValue(const JsonValue &value, bool &out)
+{
+	return value.IsBool() ? (out = value.GetBool(), true) : false;
+}
+
+INLINE bool assignValue(const JsonValue &value, int &out)
+{
+	return value.IsInt() ? (out = value.GetInt(), true) : false;
+}
+
+INLINE bool assignValue(const JsonValue &value, unsigned &out)
+{
+	return value.IsUint() ? (out = value.GetUint(), true) : false;
+}
+
+INLINE bool assignValue(const JsonValue &value, int64_t &out)
+{
+	return value.IsInt64() ? (out = value.GetInt64(), true) : false;
+}
+
+INLINE bool assignValue(const JsonValue &value, uint64_t &out)
+{
+	return value.IsUint64() ? (out = value.GetUint64(), true) : false;
+}
+
+INLINE bool assignValue(const JsonValue &value, double &out)
+{
+	return value.IsNumber() ? (out = value.GetDouble(), true) : false;
+}
+
+INLINE bool assignValue(const JsonValue &value, const JsonValue *&out)
+{
+	out = &value;
+	return true;
+}
+
+///@brief assign thunk of one member, instantiated per field by ON_PAYLOAD_FIELD
+template <typename Payload, typename T, T Payload::*Member>
+bool assignMember(const JsonValue &value, Payload &out)
+{
+	return assignValue( value, out.*Member );
+}
+
+// ----------------------------------------------------------------------------------------------- //
+
+///
+///@brief declare a field of a payload struct, a constant expression
+///
+///@note the name, its length and the assign thunk of the member are resolved at compile time, a
+///      constexpr descriptor array is constant initialized. Matching names and checking types
+///      happens per payload, it is data only known at run time.
+///
+///@param Payload The payload struct.
+///@param member The member, its name is the json member name and its type selects the check.
+///@param presence kRequired or kOptional.
+///
+#define ON_PAYLOAD_FIELD(Payload, member, presence) \
+	{ #member, sizeof(#member) - 1, presence, \
+	  &on::dispatcher::assignMember<Payload, decltype(Payload::member), &Payload::member> }
+
+// ----------------------------------------------------------------------------------------------- //
+
+///
+///@brief fill a payload struct in one pass over the payload members
+///
+///@tparam Payload A struct with a static fields() returning its PayloadFields, e.g.
+///
+///		struct HelpPayload
+///		{
+///			const char *usage;
+///
+///			static PayloadFields<HelpPayload> fields()
+///			{
+///				static constexpr PayloadField<HelpPayload> kFields[] = {
+///					ON_PAYLOAD_FIELD( HelpPayload, usage, kRequired )
+///				};
+///				return payloadFields( kFields );
+///			}
+///		};
+///
+///@param payload The "payload" value of the command.
+///@param out The struct to fill, fields absent from the payload are left untouched.
+///
+template <typename Payload>
+PayloadBindResult bindPayload(const JsonValue &payload, Payload &out)
+{
+	if( !payload.IsObject() ) {
+		return PayloadBindResult{ kBindNotObject, NULL };
+	}
+
+	const PayloadFields<Payload> layout = Payload::fields();
+	uint64_t seen = 0;
+
+	for( JsonValue::ConstMemberIterator member = payload.MemberBegin(); member != payload.MemberEnd(); ++member ) {
+		const rapidjson::SizeType length = member->name.GetStringLength();
+		const char *name = member->name.GetString();
+
+		for( size_t n = 0; n < layout.count; ++n ) {
+			const PayloadField<Payload> &field = layout.fields[n];
+			if( field.length != length || std::memcmp( field.name, name, length ) != 0 ) {
+				continue;
+			}
+			if( !field.assign( member->value, out ) ) {
+				return PayloadBindResult{ kBindFieldType, field.name };
+			}
+			seen |= uint64_t( 1 ) << n;
+			break;
+		}
+	}
+
+	for( size_t n = 0; n < layout.count; ++n ) {
+		if( layout.fields[n].presence == kRequired && (seen & (uint64_t( 1 ) << n)) == 0 ) {
+			return PayloadBindResult{ kBindMissingField, layout.fields[n].name };
+		}
+	}
+
+	return PayloadBindResult{ kBindOk, NULL };
+}
+
+// ----------------------------------------------------------------------------------------------- //
+
+///
+///@brief bind the payload of a command
+///
+///@throw MalformedCommand when the payload does not bind, the handler must not run
+///
+template <typename Payload>
+void bindCommand(const JsonValue &command, Payload &payload)
+{
+	JsonValue::ConstMemberIterator payloadJSON = command.FindMember( "payload" );
+	if( payloadJSON == command.MemberEnd() ) {
+		throw MalformedCommand( "Malformed json, missing payload." );
+	}
+
+	const PayloadBindResult result = bindPayload( payloadJSON->value, payload );
+
+	switch( result.status ) {
+	case kBindOk:
+		return;
+
+	case kBindNotObject:
+		throw MalformedCommand( "Malformed json, payload type." );
+
+	case kBindMissingField:
+		throw MalformedCommand( std::string{ "Malformed json, missing " } + result.field + " field." );
+
+	default:
+		throw MalformedCommand( std::string{ "Malformed json, " } + result.field + " type." );
+	}
+}
+
+// ----------------------------------------------------------------------------------------------- //
+
+///
+///@brief wrap a typed handler into a CommandHandler that binds the payload first
+///
+///@note a payload failing to bind rejects the command as malformed, see MalformedCommand, and the
+///      handler is not called.
+///
+template <typename Payload>
+INLINE CommandHandler bindHandler(std::function<bool(const Payload &, ResponseWriter &)> handler)
+{
+	return [handler](JsonValue &command, ResponseWriter &response) -> bool {
+		Payload payload = Payload();
+		bindCommand( command, payload );
+		return handler( payload, response );
+	};
+}
+
+// ----------------------------------------------------------------------------------------------- //
+
+///
+///@brief thunk of a method taking a typed payload, binds the payload before the call
+///
+///@note the allocation free counterpart of bindHandler, used through ON_COMMAND_METHOD.
+///
+template <typename T, typename Payload, bool (T::*method)(const Payload &, ResponseWriter &)>
+struct CommandMethod<bool (T::*)(const Payload &, ResponseWriter &), method>
+{
+	typedef T Object;
+
+	static bool call(void *object, JsonValue &command, ResponseWriter &response)
+	{
+		Payload payload = Payload();
+		bindCommand( command, payload );
+		return (static_cast<T *>( object )->*method)( payload, response );
+	}
+};
+
+// ----------------------------------------------------------------------------------------------- //
+
+}
+}
+
+#endif
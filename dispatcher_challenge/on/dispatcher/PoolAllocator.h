@@ -0,0 +1,155 @@
+#ifndef _ON_DISPATCHER_POOLALLOCATOR_H_
+#define _ON_DISPATCHER_POOLALLOCATOR_H_
+
+#include <cstdlib>
+#include <cstring>
+
+#include "rapidjson/allocators.h"
+
+#include "memory_pool.h"
+
+namespace on {
+namespace dispatcher {
+
+// ----------------------------------------------------------------------------------------------- //
+
+///
+///@brief rapidjson BaseAllocator serving requests from a fixed block size memory_pool_t.
+///
+///@note MemoryPoolAllocator asks its base allocator for whole chunks, so with a pool block
+///      sized to the chunk capacity every document chunk is recycled through the pool.
+///      Requests larger than a block, or made while the pool is exhausted, fall back to malloc.
+///@note rapidjson requires Free() to be static, so every allocation is prefixed with the pool
+///      it came from (NULL for malloc) and its usable capacity.
+///
+class PoolAllocator
+{
+
+// ----------------------------------------------------------------------------------------------- //
+
+public:
+
+	static const bool kNeedFree = true;   ///< concept Allocator
+
+	///@brief extra bytes a pool block needs on top of a rapidjson chunk capacity
+	static const size_t kChunkOverhead = 64;
+
+// ----------------------------------------------------------------------------------------------- //
+
+	///@brief allocator without a pool, every request goes to malloc.
+	PoolAllocator() : m_pool{ NULL }, m_blockSize{ 0 }
+	{
+	}
+
+	///
+	///@brief allocator backed by a pool
+	///
+	///@param pool The pool to serve requests from, NULL to always use malloc.
+	///@param blockSize The block size the pool was created with.
+	///
+	PoolAllocator(memory_pool_t *pool, size_t blockSize) : m_pool{ pool }, m_blockSize{ blockSize }
+	{
+	}
+
+// ----------------------------------------------------------------------------------------------- //
+
+	void * Malloc(size_t size)
+	{
+		if( size == 0 ) {
+			return NULL;
+		}
+
+		Prefix *prefix = NULL;
+
+		if( m_pool != NULL && size + kPrefixSize <= m_blockSize ) {
+			prefix = static_cast<Prefix *>(memory_pool_acquire(m_pool));
+			if( prefix != NULL ) {
+				prefix->pool = m_pool;
+				prefix->capacity = m_blockSize - kPrefixSize;
+			}
+		}
+
+		if( prefix == NULL ) {
+			prefix = static_cast<Prefix *>(std::malloc(size + kPrefixSize));
+			if( prefix == NULL ) {
+				return NULL;
+			}
+			prefix->pool = NULL;
+			prefix->capacity = size;
+		}
+
+		return reinterpret_cast<char *>(prefix) + kPrefixSize;
+	}
+
+// ----------------------------------------------------------------------------------------------- //
+
+	void * Realloc(void *originalPtr, size_t originalSize, size_t newSize)
+	{
+		if( originalPtr == NULL ) {
+			return Malloc(newSize);
+		}
+
+		if( newSize == 0 ) {
+			Free(originalPtr);
+			return NULL;
+		}
+
+		// still fits in the block it already has
+		if( newSize <= prefixOf(originalPtr)->capacity ) {
+			return originalPtr;
+		}
+
+		void *newPtr = Malloc(newSize);
+		if( newPtr != NULL ) {
+			std::memcpy(newPtr, originalPtr, originalSize < newSize ? originalSize : newSize);
+			Free(originalPtr);
+		}
+		return newPtr;
+	}
+
+// ----------------------------------------------------------------------------------------------- //
+
+	static void Free(void *ptr)
+	{
+		if( ptr == NULL ) {
+			return;
+		}
+
+		Prefix *prefix = prefixOf(ptr);
+
+		if( prefix->pool != NULL ) {
+			memory_pool_release(prefix->pool, prefix);
+		}
+		else {
+			std::free(prefix);
+		}
+	}
+
+// ----------------------------------------------------------------------------------------------- //
+
+private:
+
+	struct Prefix
+	{
+		memory_pool_t *pool;   ///< owning pool, NULL for malloc
+		size_t capacity;       ///< usable bytes after the prefix
+	};
+
+	static const size_t kPrefixSize = RAPIDJSON_ALIGN(sizeof(Prefix));
+
+	static Prefix * prefixOf(void *ptr)
+	{
+		return reinterpret_cast<Prefix *>(static_cast<char *>(ptr) - kPrefixSize);
+	}
+
+	memory_pool_t *m_pool;   ///< the pool to serve requests from
+	size_t m_blockSize;      ///< block size of m_pool
+
+};
+
+// ----------------------------------------------------------------------------------------------- //
+
+}
+}
+
+#endif
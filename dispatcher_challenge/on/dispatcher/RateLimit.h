@@ -0,0 +1,231 @@
+#ifndef _ON_DISPATCHER_RATELIMIT_H_
+#define _ON_DISPATCHER_RATELIMIT_H_
+
+#include <stdint.h>
+#include <atomic>
+#include <memory>
+
+#include "on/dispatcher/Common.h"
+
+namespace on {
+namespace dispatcher {
+
+// ----------------------------------------------------------------------------------------------- //
+
+///
+///@brief token bucket of rate tokens per second holding up to burst tokens, lock free
+///
+///@note kept as the time the bucket is next full (the GCRA "theoretical arrival time") in a single
+///      atomic: a request is admitted when that time is at most (burst - 1) intervals ahead of
+///      now, and pushes it one interval further with one compare and swap. A full bucket costs
+///      one load and one CAS, a rejection only the load.
+///
+class TokenBucket
+{
+
+// ----------------------------------------------------------------------------------------------- //
+
+public:
+
+	///
+	///@param rate Tokens per second, > 0.
+	///@param burst Bucket size, at least one token.
+	///
+	TokenBucket(double rate, double burst)
+		: m_rate{ rate }, m_burst{ burst < 1 ? 1 : burst },
+		  m_intervalNs{ static_cast<uint64_t>( 1e9 / rate ) },
+		  m_toleranceNs{ static_cast<uint64_t>( (m_burst - 1) * (1e9 / rate) ) },
+		  m_full{ 0 }
+	{
+	}
+
+	TokenBucket(const TokenBucket&) = delete;
+	TokenBucket& operator=(const TokenBucket&) = delete;
+
+// ----------------------------------------------------------------------------------------------- //
+
+	///@brief take a token at nowNs, monotonicNs(), false when the bucket is empty
+	bool tryAcquire(uint64_t nowNs)
+	{
+		return acquire( m_full, nowNs, m_intervalNs, m_toleranceNs );
+	}
+
+	///@brief give back a token taken by tryAcquire, e.g. when another limit rejected the request
+	void refund()
+	{
+		refund( m_full, m_intervalNs );
+	}
+
+	///@brief the GCRA step on one bucket state, shared with the per client table
+	static bool acquire(std::atomic<uint64_t> &full, uint64_t nowNs, uint64_t intervalNs, uint64_t toleranceNs)
+	{
+		uint64_t current = full.load( std::memory_order_relaxed );
+		for( ;; ) {
+			const uint64_t base = current > nowNs ? current : nowNs;
+			if( base - nowNs > toleranceNs ) {
+				return false;
+			}
+			if( full.compare_exchange_weak( current, base + intervalNs, std::memory_order_relaxed ) ) {
+				return true;
+			}
+		}
+	}
+
+	///@brief undo one acquire, a state less than intervalNs ahead of 0 is a full bucket already
+	static void refund(std::atomic<uint64_t> &full, uint64_t intervalNs)
+	{
+		uint64_t current = full.load( std::memory_order_relaxed );
+		while( !full.compare_exchange_weak( current, current > intervalNs ? current - intervalNs : 0, std::memory_order_relaxed ) ) {
+		}
+	}
+
+// ----------------------------------------------------------------------------------------------- //
+
+	double rate() const
+	{
+		return m_rate;
+	}
+
+	double burst() const
+	{
+		return m_burst;
+	}
+
+	uint64_t intervalNs() const
+	{
+		return m_intervalNs;
+	}
+
+	uint64_t toleranceNs() const
+	{
+		return m_toleranceNs;
+	}
+
+// ----------------------------------------------------------------------------------------------- //
+
+private:
+
+	const double m_rate;
+	const double m_burst;
+	const uint64_t m_intervalNs;      ///< time to earn one token
+	const uint64_t m_toleranceNs;     ///< how far ahead of now the bucket may be drawn
+	std::atomic<uint64_t> m_full;     ///< when the bucket is next full
+
+};
+
+// ----------------------------------------------------------------------------------------------- //
+
+///
+///@brief one token bucket per client, in a fixed lock free table
+///
+///@note a client is identified by a non zero 64 bit id picked by the front end. Its slot is claimed
+///      with a CAS on first use and probed linearly from the id's hash. Slots are never freed: when
+///      every probed slot is taken, a slot whose bucket is full again is taken over, its state is
+///      the same as a fresh bucket's, its owner gets another slot the same way when it returns.
+///      Only when every probed bucket is in use does the client share the bucket of its home slot,
+///      a conservative fallback that never allocates or locks.
+///
+class ClientRateLimit
+{
+
+// ----------------------------------------------------------------------------------------------- //
+
+public:
+
+	static const size_t kSlots = 4096;   ///< power of two
+	static const size_t kProbes = 8;
+
+	ClientRateLimit(double rate, double burst) : m_bucket( rate, burst ), m_slots{ new Slot[kSlots] }
+	{
+		for( size_t n = 0; n < kSlots; ++n ) {
+			m_slots[n].client.store( 0, std::memory_order_relaxed );
+			m_slots[n].full.store( 0, std::memory_order_relaxed );
+		}
+	}
+
+// ----------------------------------------------------------------------------------------------- //
+
+	///@brief take a token of client at nowNs, false when its bucket is empty
+	bool tryAcquire(uint64_t client, uint64_t nowNs)
+	{
+		Slot &slot = find( client, nowNs );
+		return TokenBucket::acquire( slot.full, nowNs, m_bucket.intervalNs(), m_bucket.toleranceNs() );
+	}
+
+	///@brief give back a token of client taken by tryAcquire at nowNs
+	void refund(uint64_t client, uint64_t nowNs)
+	{
+		TokenBucket::refund( find( client, nowNs ).full, m_bucket.intervalNs() );
+	}
+
+	double rate() const
+	{
+		return m_bucket.rate();
+	}
+
+	double burst() const
+	{
+		return m_bucket.burst();
+	}
+
+	///@brief clients holding a slot
+	size_t clients() const
+	{
+		size_t count = 0;
+		for( size_t n = 0; n < kSlots; ++n ) {
+			count += m_slots[n].client.load( std::memory_order_relaxed ) != 0;
+		}
+		return count;
+	}
+
+// ----------------------------------------------------------------------------------------------- //
+
+private:
+
+	struct Slot
+	{
+		std::atomic<uint64_t> client;   ///< owner id, 0 while free
+		std::atomic<uint64_t> full;     ///< the owner's bucket state
+	};
+
+	Slot & find(uint64_t client, uint64_t nowNs)
+	{
+		const size_t home = static_cast<size_t>( (client * 0x9E3779B97F4A7C15ULL) >> 32 ) & (kSlots - 1);
+
+		for( size_t probe = 0; probe < kProbes; ++probe ) {
+			Slot &slot = m_slots[(home + probe) & (kSlots - 1)];
+			uint64_t owner = slot.client.load( std::memory_order_relaxed );
+			if( owner == client ) {
+				return slot;
+			}
+			if( owner == 0 && (slot.client.compare_exchange_strong( owner, client, std::memory_order_relaxed ) || owner == client) ) {
+				return slot;
+			}
+		}
+
+		// every probed slot is owned, take over one whose owner is idle
+		for( size_t probe = 0; probe < kProbes; ++probe ) {
+			Slot &slot = m_slots[(home + probe) & (kSlots - 1)];
+			uint64_t owner = slot.client.load( std::memory_order_relaxed );
+			if( owner == client ) {
+				return slot;
+			}
+			if( slot.full.load( std::memory_order_relaxed ) <= nowNs
+				&& (slot.client.compare_exchange_strong( owner, client, std::memory_order_relaxed ) || owner == client) ) {
+				return slot;
+			}
+		}
+		return m_slots[home];
+	}
+
+	TokenBucket m_bucket;                 ///< the limit, its own state is unused
+	std::unique_ptr<Slot[]> m_slots;
+
+};
+
+// ----------------------------------------------------------------------------------------------- //
+
+}
+}
+
+#endif
@@ -0,0 +1,275 @@
+#ifndef _ON_DISPATCHER_RCUPOINTER_H_
+#define _ON_DISPATCHER_RCUPOINTER_H_
+
+#include <stdint.h>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#include "on/dispatcher/Common.h"
+
+namespace on {
+namespace dispatcher {
+
+// ----------------------------------------------------------------------------------------------- //
+
+static const size_t kMaxRcuReaders = 128;           ///< threads with their own reader slot
+static const size_t kNoRcuReaderSlot = SIZE_MAX;    ///< the calling thread shares the overflow count
+
+///
+///@brief reader slot of the calling thread, claimed on first use and freed when the thread exits
+///
+///@note the index is process wide, every RcuPointer has one slot per index.
+///
+INLINE size_t rcuReaderSlot()
+{
+	static std::atomic<bool> claimed[kMaxRcuReaders];
+
+	struct Claim
+	{
+		Claim() : index{ kNoRcuReaderSlot }
+		{
+			for( size_t n = 0; n < kMaxRcuReaders; ++n ) {
+				if( !claimed[n].load( std::memory_order_relaxed ) && !claimed[n].exchange( true ) ) {
+					index = n;
+					break;
+				}
+			}
+		}
+
+		~Claim()
+		{
+			if( index != kNoRcuReaderSlot ) {
+				claimed[index].store( false, std::memory_order_release );
+			}
+		}
+
+		size_t index;
+	};
+
+	static thread_local Claim claim;
+	return claim.index;
+}
+
+// ----------------------------------------------------------------------------------------------- //
+
+///
+///@brief pointer to an immutable T, read lock free and replaced by publishing a modified copy
+///
+///@note epoch based reclamation, the scheme of memory_pool_retire: a reader announces the global
+///      epoch in its slot for as long as it holds a Snapshot. A replaced T is retired with the
+///      epoch current after the swap and deleted once the epoch is two ahead, every reader that
+///      could still see it has left by then. The epoch only advances when no reader announces an
+///      older one.
+///
+///      Readers never block: taking a snapshot is one store, a fence and an acquire load. Writers
+///      serialize on a mutex and copy T. Retired copies are deleted by the next writer or by a
+///      reader leaving, when it gets the mutex without waiting.
+///
+template <typename T>
+class RcuPointer
+{
+
+// ----------------------------------------------------------------------------------------------- //
+
+public:
+
+	explicit RcuPointer(std::unique_ptr<T> initial = std::unique_ptr<T>( new T() ))
+		: m_current{ initial.release() }, m_epoch{ 2 }, m_overflow{ 0 }, m_retiredCount{ 0 },
+		  m_slots{ new Slot[kMaxRcuReaders] }
+	{
+	}
+
+	///@brief no snapshot may be held
+	~RcuPointer()
+	{
+		for( Retired &retired : m_retired ) {
+			delete retired.object;
+		}
+		delete m_current.load( std::memory_order_relaxed );
+	}
+
+	RcuPointer(const RcuPointer&) = delete;
+	RcuPointer& operator=(const RcuPointer&) = delete;
+
+// ----------------------------------------------------------------------------------------------- //
+
+	///
+	///@brief the current T, valid while the snapshot lives. Snapshots nest.
+	///
+	class Snapshot
+	{
+	public:
+		explicit Snapshot(const RcuPointer &pointer) : m_pointer( pointer ), m_slot{ rcuReaderSlot() }
+		{
+			m_object = m_pointer.enter( m_slot );
+		}
+
+		~Snapshot()
+		{
+			m_pointer.leave( m_slot );
+		}
+
+		Snapshot(const Snapshot&) = delete;
+		Snapshot& operator=(const Snapshot&) = delete;
+
+		const T & operator*() const
+		{
+			return *m_object;
+		}
+
+		const T * operator->() const
+		{
+			return m_object;
+		}
+
+	private:
+		const RcuPointer &m_pointer;
+		const size_t m_slot;
+		const T *m_object;
+	};
+
+// ----------------------------------------------------------------------------------------------- //
+
+	///
+	///@brief copy the current T, apply update(T &) to the copy and publish it
+	///
+	///@return the result of update, the copy is dropped when it returns false
+	///
+	///@note never waits for readers. A snapshot the calling thread holds keeps showing the copy
+	///      it was taken of.
+	///
+	template <typename Update>
+	bool update(Update &&update)
+	{
+		std::lock_guard<std::mutex> lock( m_writer );
+
+		std::unique_ptr<T> next( new T( *m_current.load( std::memory_order_relaxed ) ) );
+		if( !update( *next ) ) {
+			return false;
+		}
+
+		T *previous = m_current.exchange( next.release(), std::memory_order_seq_cst );
+		m_retired.push_back( Retired{ m_epoch.load( std::memory_order_seq_cst ), previous } );
+		m_retiredCount.store( m_retired.size(), std::memory_order_relaxed );
+
+		reclaim();
+		return true;
+	}
+
+	///@brief copies replaced but not yet deleted
+	size_t retired() const
+	{
+		return m_retiredCount.load( std::memory_order_relaxed );
+	}
+
+// ----------------------------------------------------------------------------------------------- //
+
+private:
+
+	struct Slot
+	{
+		Slot() : active{ 0 }, depth{ 0 }
+		{
+		}
+
+		std::atomic<uint64_t> active;   ///< (epoch << 1) | 1 while a snapshot is held, 0 otherwise
+		size_t depth;                   ///< nested snapshots, touched by the owning thread only
+		char padding[64 - sizeof(std::atomic<uint64_t>) - sizeof(size_t)];
+	};
+
+	struct Retired
+	{
+		uint64_t epoch;   ///< global epoch when it was replaced
+		T *object;
+	};
+
+	const T * enter(size_t slot) const
+	{
+		if( slot == kNoRcuReaderSlot ) {
+			// blocks every epoch advance until it leaves
+			m_overflow.fetch_add( 1, std::memory_order_seq_cst );
+		}
+		else if( m_slots[slot].depth++ == 0 ) {
+			const uint64_t epoch = m_epoch.load( std::memory_order_seq_cst );
+			m_slots[slot].active.store( (epoch << 1) | 1, std::memory_order_relaxed );
+			std::atomic_thread_fence( std::memory_order_seq_cst );
+		}
+		return m_current.load( std::memory_order_acquire );
+	}
+
+	void leave(size_t slot) const
+	{
+		if( slot == kNoRcuReaderSlot ) {
+			m_overflow.fetch_sub( 1, std::memory_order_release );
+		}
+		else if( --m_slots[slot].depth == 0 ) {
+			m_slots[slot].active.store( 0, std::memory_order_release );
+		}
+		else {
+			return;
+		}
+
+		if( m_retiredCount.load( std::memory_order_relaxed ) > 0 && m_writer.try_lock() ) {
+			const_cast<RcuPointer *>( this )->reclaim();
+			m_writer.unlock();
+		}
+	}
+
+	///@brief advance the epoch if every reader announces the current one, m_writer is held
+	bool tryAdvance()
+	{
+		std::atomic_thread_fence( std::memory_order_seq_cst );
+		uint64_t epoch = m_epoch.load( std::memory_order_seq_cst );
+
+		if( m_overflow.load( std::memory_order_acquire ) > 0 ) {
+			return false;
+		}
+		for( size_t n = 0; n < kMaxRcuReaders; ++n ) {
+			const uint64_t active = m_slots[n].active.load( std::memory_order_acquire );
+			if( (active & 1) && (active >> 1) != epoch ) {
+				return false;
+			}
+		}
+		return m_epoch.compare_exchange_strong( epoch, epoch + 1, std::memory_order_seq_cst );
+	}
+
+	///@brief delete the copies no reader can hold any more, m_writer is held
+	void reclaim()
+	{
+		tryAdvance();
+		const uint64_t epoch = m_epoch.load( std::memory_order_seq_cst );
+
+		size_t kept = 0;
+		for( size_t n = 0; n < m_retired.size(); ++n ) {
+			if( m_retired[n].epoch + 2 <= epoch ) {
+				delete m_retired[n].object;
+			}
+			else {
+				m_retired[kept++] = m_retired[n];
+			}
+		}
+		m_retired.resize( kept );
+		m_retiredCount.store( kept, std::memory_order_relaxed );
+	}
+
+// ----------------------------------------------------------------------------------------------- //
+
+	std::atomic<T *> m_current;                 ///< published copy, never modified
+	std::atomic<uint64_t> m_epoch;              ///< global epoch
+	mutable std::atomic<size_t> m_overflow;     ///< snapshots of threads without a slot
+	std::atomic<size_t> m_retiredCount;         ///< m_retired.size() for readers
+	std::unique_ptr<Slot[]> m_slots;            ///< per reader thread, mutable through enter/leave
+	std::vector<Retired> m_retired;             ///< replaced copies, guarded by m_writer
+	mutable std::mutex m_writer;                ///< serializes update and reclaim
+
+};
+
+// ----------------------------------------------------------------------------------------------- //
+
+}
+}
+
+#endif
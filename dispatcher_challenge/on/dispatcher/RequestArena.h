@@ -0,0 +1,413 @@
+#ifndef _ON_DISPATCHER_REQUESTARENA_H_
+#define _ON_DISPATCHER_REQUESTARENA_H_
+
+#include <stdint.h>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "on/dispatcher/PoolAllocator.h"
+
+namespace on {
+namespace dispatcher {
+
+// ----------------------------------------------------------------------------------------------- //
+
+///
+///@brief bump allocator for the memory of one dispatch, rewound in O(1) when the dispatch ends
+///
+///@note blocks come from a PoolAllocator and are kept across resets, so once the first dispatches
+///      have grown the arena to their size a dispatch allocates nothing from the heap. A block
+///      added is as large as all blocks before it, or as the request, so a large dispatch needs
+///      few blocks and little is left unused at their ends. reset() frees blocks only when a
+///      large dispatch left more than kMaxRetained behind.
+///
+///      Allocations made before pin() survive reset(), e.g. the first chunk of the document
+///      allocator. Nothing is freed individually, deallocate() is a no-op.
+///
+class RequestArena
+{
+
+// ----------------------------------------------------------------------------------------------- //
+
+public:
+
+	static const size_t kAlignment = alignof(std::max_align_t);   ///< of every allocation
+	static const size_t kMaxRetained = 4 * 1024 * 1024;           ///< bytes of blocks kept by reset()
+
+	///
+	///@param base Allocator of the blocks.
+	///@param blockSize Size of the first block, allocated right away.
+	///
+	RequestArena(const PoolAllocator &base, size_t blockSize)
+		: m_base{ base }, m_capacity{ 0 }, m_current{ 0 },
+		  m_top{ NULL }, m_end{ NULL }, m_last{ NULL }, m_pinned{ NULL }
+	{
+		m_blocks.reserve( 8 );
+		addBlock( 0, blockSize );
+		m_top = m_pinned = m_blocks[0].data;
+		m_end = m_top + m_blocks[0].size;
+	}
+
+	~RequestArena()
+	{
+		for( const Block &block : m_blocks ) {
+			PoolAllocator::Free( block.data );
+		}
+	}
+
+	RequestArena(const RequestArena&) = delete;
+	RequestArena& operator=(const RequestArena&) = delete;
+
+// ----------------------------------------------------------------------------------------------- //
+
+	///@brief size bytes aligned to kAlignment, valid until reset()
+	void * allocate(size_t size)
+	{
+		char *at = align( m_top );
+		if( size > static_cast<size_t>( m_end - at ) ) {
+			at = nextBlock( size );
+		}
+		m_last = at;
+		m_top = at + size;
+		return at;
+	}
+
+	///@brief grow or shrink an allocation, in place when it is the last one and fits
+	void * reallocate(void *ptr, size_t size, size_t newSize)
+	{
+		if( ptr == NULL ) {
+			return allocate( newSize );
+		}
+		if( ptr == m_last && newSize <= static_cast<size_t>( m_end - m_last ) ) {
+			m_top = m_last + newSize;
+			return ptr;
+		}
+		if( newSize <= size ) {
+			return ptr;
+		}
+
+		void *moved = allocate( newSize );
+		std::memcpy( moved, ptr, size );
+		return moved;
+	}
+
+	///@brief allocations are released all at once by reset()
+	void deallocate(void *)
+	{
+	}
+
+// ----------------------------------------------------------------------------------------------- //
+
+	///@brief keep what was allocated so far across resets, call while the first block is in use
+	void pin()
+	{
+		m_pinned = m_top;
+	}
+
+	///@brief release everything allocated since pin(), O(1) unless blocks beyond kMaxRetained are freed
+	void reset()
+	{
+		if( m_capacity > kMaxRetained ) {
+			trim();
+		}
+		m_current = 0;
+		m_top = m_pinned;
+		m_end = m_blocks[0].data + m_blocks[0].size;
+		m_last = NULL;
+	}
+
+// ----------------------------------------------------------------------------------------------- //
+
+	///@brief bytes of all blocks
+	size_t capacity() const
+	{
+		return m_capacity;
+	}
+
+	size_t blocks() const
+	{
+		return m_blocks.size();
+	}
+
+	///@brief the pinned bytes and, for the dispatch in progress, up to the end of its current block
+	size_t used() const
+	{
+		size_t used = static_cast<size_t>( m_top - m_blocks[m_current].data );
+		for( size_t n = 0; n < m_current; ++n ) {
+			used += m_blocks[n].size;
+		}
+		return used;
+	}
+
+// ----------------------------------------------------------------------------------------------- //
+
+private:
+
+	struct Block
+	{
+		char *data;
+		size_t size;
+	};
+
+	static char * align(char *ptr)
+	{
+		const uintptr_t address = reinterpret_cast<uintptr_t>( ptr );
+		return ptr + ((kAlignment - (address & (kAlignment - 1))) & (kAlignment - 1));
+	}
+
+	///@brief move to a retained block after the current one that holds size bytes, or add one
+	char * nextBlock(size_t size)
+	{
+		const size_t needed = size + kAlignment;
+		size_t next = m_current + 1;
+		while( next < m_blocks.size() && m_blocks[next].size < needed ) {
+			++next;
+		}
+
+		if( next < m_blocks.size() ) {
+			std::swap( m_blocks[m_current + 1], m_blocks[next] );
+		}
+		else {
+			addBlock( m_current + 1, needed > m_capacity ? needed : m_capacity );
+		}
+
+		++m_current;
+		m_end = m_blocks[m_current].data + m_blocks[m_current].size;
+		return align( m_blocks[m_current].data );
+	}
+
+	void addBlock(size_t position, size_t size)
+	{
+		char *data = static_cast<char *>( m_base.Malloc( size ) );
+		if( data == NULL ) {
+			throw std::bad_alloc();
+		}
+		m_blocks.insert( m_blocks.begin() + position, Block{ data, size } );
+		m_capacity += size;
+	}
+
+	///@brief free blocks from the last one until at most kMaxRetained are left, never the first
+	void trim()
+	{
+		while( m_blocks.size() > 1 && m_capacity > kMaxRetained ) {
+			m_capacity -= m_blocks.back().size;
+			PoolAllocator::Free( m_blocks.back().data );
+			m_blocks.pop_back();
+		}
+	}
+
+// ----------------------------------------------------------------------------------------------- //
+
+	PoolAllocator m_base;          ///< allocator of the blocks
+	std::vector<Block> m_blocks;   ///< the first is never freed, blocks after m_current are free
+	size_t m_capacity;             ///< bytes of all blocks
+	size_t m_current;              ///< the block m_top points into
+	char *m_top;                   ///< next free byte of the current block
+	char *m_end;                   ///< end of the current block
+	char *m_last;                  ///< start of the last allocation, it can grow in place
+	char *m_pinned;                ///< m_top of the first block after a reset
+
+};
+
+// ----------------------------------------------------------------------------------------------- //
+
+///
+///@brief rapidjson Allocator in a RequestArena, for the document chunks and the parse stack
+///
+///@note rapidjson requires Free() to be static, so every allocation is prefixed with the arena it
+///      came from. Without an arena, e.g. in a default constructed document, requests go to malloc.
+///
+class ArenaAllocator
+{
+
+// ----------------------------------------------------------------------------------------------- //
+
+public:
+
+	static const bool kNeedFree = true;   ///< concept Allocator, only malloc'ed memory is freed
+
+	ArenaAllocator() : m_arena{ NULL }
+	{
+	}
+
+	explicit ArenaAllocator(RequestArena *arena) : m_arena{ arena }
+	{
+	}
+
+// ----------------------------------------------------------------------------------------------- //
+
+	void * Malloc(size_t size)
+	{
+		if( size == 0 ) {
+			return NULL;
+		}
+
+		Prefix *prefix = static_cast<Prefix *>( m_arena != NULL
+			? m_arena->allocate( size + kPrefixSize ) : std::malloc( size + kPrefixSize ) );
+		if( prefix == NULL ) {
+			return NULL;
+		}
+		prefix->arena = m_arena;
+		return reinterpret_cast<char *>( prefix ) + kPrefixSize;
+	}
+
+	void * Realloc(void *originalPtr, size_t originalSize, size_t newSize)
+	{
+		if( originalPtr == NULL ) {
+			return Malloc( newSize );
+		}
+		if( newSize == 0 ) {
+			Free( originalPtr );
+			return NULL;
+		}
+
+		Prefix *prefix = prefixOf( originalPtr );
+		prefix = static_cast<Prefix *>( prefix->arena != NULL
+			? prefix->arena->reallocate( prefix, originalSize + kPrefixSize, newSize + kPrefixSize )
+			: std::realloc( prefix, newSize + kPrefixSize ) );
+		return prefix != NULL ? reinterpret_cast<char *>( prefix ) + kPrefixSize : NULL;
+	}
+
+	static void Free(void *ptr)
+	{
+		if( ptr != NULL && prefixOf( ptr )->arena == NULL ) {
+			std::free( prefixOf( ptr ) );
+		}
+	}
+
+// ----------------------------------------------------------------------------------------------- //
+
+private:
+
+	struct Prefix
+	{
+		RequestArena *arena;   ///< owning arena, NULL for malloc
+	};
+
+	static const size_t kPrefixSize = RequestArena::kAlignment;
+
+	static Prefix * prefixOf(void *ptr)
+	{
+		return reinterpret_cast<Prefix *>( static_cast<char *>( ptr ) - kPrefixSize );
+	}
+
+	RequestArena *m_arena;   ///< NULL for malloc
+
+};
+
+// ----------------------------------------------------------------------------------------------- //
+
+///@brief slot of the arena of the dispatch running on this thread
+INLINE RequestArena *& requestArenaSlot()
+{
+	static thread_local RequestArena *arena = NULL;
+	return arena;
+}
+
+///@brief the arena of the dispatch running on this thread, NULL outside a dispatch
+INLINE RequestArena * requestArena()
+{
+	return requestArenaSlot();
+}
+
+///@brief makes an arena the current one of this thread for a scope, nested scopes restore the outer one
+class RequestArenaScope
+{
+public:
+
+	explicit RequestArenaScope(RequestArena &arena) : m_outer{ requestArenaSlot() }
+	{
+		requestArenaSlot() = &arena;
+	}
+
+	~RequestArenaScope()
+	{
+		requestArenaSlot() = m_outer;
+	}
+
+	RequestArenaScope(const RequestArenaScope&) = delete;
+	RequestArenaScope& operator=(const RequestArenaScope&) = delete;
+
+private:
+
+	RequestArena *m_outer;
+
+};
+
+// ----------------------------------------------------------------------------------------------- //
+
+///
+///@brief std allocator in the arena of the current dispatch, for handler scratch strings and vectors
+///
+///@note a container using it must not outlive the handler call, its memory is reused by the next
+///      dispatch. Outside a dispatch it uses the heap.
+///
+template <typename T>
+class ScratchAllocator
+{
+public:
+
+	typedef T value_type;
+
+	ScratchAllocator() : m_arena{ requestArena() }
+	{
+	}
+
+	explicit ScratchAllocator(RequestArena *arena) : m_arena{ arena }
+	{
+	}
+
+	template <typename U>
+	ScratchAllocator(const ScratchAllocator<U> &other) : m_arena{ other.arena() }
+	{
+	}
+
+	T * allocate(size_t count)
+	{
+		return static_cast<T *>( m_arena != NULL ? m_arena->allocate( count * sizeof(T) ) : ::operator new( count * sizeof(T) ) );
+	}
+
+	void deallocate(T *ptr, size_t)
+	{
+		if( m_arena == NULL ) {
+			::operator delete( ptr );
+		}
+	}
+
+	RequestArena * arena() const
+	{
+		return m_arena;
+	}
+
+private:
+
+	RequestArena *m_arena;   ///< NULL for the heap
+
+};
+
+template <typename T, typename U>
+bool operator==(const ScratchAllocator<T> &a, const ScratchAllocator<U> &b)
+{
+	return a.arena() == b.arena();
+}
+
+template <typename T, typename U>
+bool operator!=(const ScratchAllocator<T> &a, const ScratchAllocator<U> &b)
+{
+	return a.arena() != b.arena();
+}
+
+///@brief string in the arena of the current dispatch, e.g. to compose a message in a handler
+typedef std::basic_string< char, std::char_traits<char>, ScratchAllocator<char> > ScratchString;
+
+// ----------------------------------------------------------------------------------------------- //
+
+}
+}
+
+#endif
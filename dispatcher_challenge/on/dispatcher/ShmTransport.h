@@ -0,0 +1,952 @@
+#ifndef _ON_DISPATCHER_SHMTRANSPORT_H_
+#define _ON_DISPATCHER_SHMTRANSPORT_H_
+
+#include <stdint.h>
+#include <errno.h>
+#include <poll.h>
+#include <sched.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "on/dispatcher/Common.h"
+#include "on/dispatcher/CommandDispatcher.h"
+
+#if ATOMIC_LLONG_LOCK_FREE != 2
+#error "the shared memory ring needs lock free 64 bit atomics"
+#endif
+
+namespace on {
+namespace dispatcher {
+
+// ----------------------------------------------------------------------------------------------- //
+
+///@brief a pause for spin loops
+INLINE void cpuRelax()
+{
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_ia32_pause();
+#elif defined(__aarch64__)
+	asm volatile( "yield" );
+#endif
+}
+
+///@brief anonymous shared memory of size bytes, -1 with errno set on failure
+INLINE int createMemfd(const char *name, size_t size)
+{
+	const int fd = static_cast<int>( ::syscall( SYS_memfd_create, name, 1u /* MFD_CLOEXEC */ ) );
+	if( fd >= 0 && ::ftruncate( fd, static_cast<off_t>( size ) ) != 0 ) {
+		const int error = errno;
+		::close( fd );
+		errno = error;
+		return -1;
+	}
+	return fd;
+}
+
+// ----------------------------------------------------------------------------------------------- //
+
+///
+///@brief ring of variable length frames in shared memory, many producers and one consumer
+///
+///@note the ring is a header and a power of two data area, producers and the consumer may live in
+///      different processes mapping the same memory. A producer reserves a frame by advancing
+///      the tail with a compare and swap, copies the frame and commits it by stamping the frame
+///      header with its position + 1, a frame that would cross the end is preceded by padding up
+///      to it. The consumer reads committed frames in order at the head, in place, and frees them
+///      by zeroing their bytes and advancing the head. A stamp is only ever found where a producer
+///      committed one, whatever bytes an earlier lap left there: a payload of the last lap cannot
+///      pass for a committed frame header.
+///
+///      Every frame is null terminated after its length, so json can be parsed in situ in the ring.
+///
+///      The consumer parks by setting the sleeping flag and waiting on an eventfd, a producer
+///      that sees the flag after committing clears it and writes the eventfd.
+///
+///      A producer that dies between reserving and committing a frame stalls the ring.
+///
+class ShmRing
+{
+
+// ----------------------------------------------------------------------------------------------- //
+
+public:
+
+	static const size_t kAlignment = 16;           ///< of frames, a padding frame header always fits
+	static const uint32_t kPaddingTag = UINT32_MAX;
+
+	///@brief bytes of shared memory for a ring of capacity data bytes, a power of two
+	static size_t footprint(size_t capacity)
+	{
+		return sizeof(Header) + capacity;
+	}
+
+	ShmRing() : m_header{ NULL }, m_data{ NULL }, m_capacity{ 0 }, m_eventFd{ -1 }
+	{
+	}
+
+	///
+	///@brief view the ring at memory, footprint(capacity) bytes
+	///
+	///@param eventFd Written to wake the consumer.
+	///@param initialize Set up a new ring, memory from a fresh memfd is zero.
+	///
+	ShmRing(void *memory, size_t capacity, int eventFd, bool initialize)
+		: m_header{ static_cast<Header *>( memory ) },
+		  m_data{ static_cast<char *>( memory ) + sizeof(Header) },
+		  m_capacity{ capacity }, m_eventFd{ eventFd }
+	{
+		if( initialize ) {
+			m_header->head.store( 0, std::memory_order_relaxed );
+			m_header->tail.store( 0, std::memory_order_relaxed );
+			m_header->sleeping.store( 0, std::memory_order_relaxed );
+		}
+	}
+
+// ----------------------------------------------------------------------------------------------- //
+
+	///
+	///@brief copy a frame into the ring and wake the consumer if it sleeps
+	///
+	///@param tag Handed to the consumer with the frame, not kPaddingTag.
+	///
+	///@return false when the ring has no room for it, nothing is written
+	///
+	bool write(const char *data, size_t length, uint32_t tag)
+	{
+		const uint64_t size = frameSize( length );
+		if( size > m_capacity / 2 ) {
+			return false;
+		}
+
+		uint64_t tail = m_header->tail.load( std::memory_order_relaxed );
+		uint64_t padding;
+		for( ;; ) {
+			const uint64_t toEnd = m_capacity - (tail & (m_capacity - 1));
+			padding = size <= toEnd ? 0 : toEnd;
+			if( tail + padding + size - m_header->head.load( std::memory_order_acquire ) > m_capacity ) {
+				return false;
+			}
+			if( m_header->tail.compare_exchange_weak( tail, tail + padding + size, std::memory_order_relaxed ) ) {
+				break;
+			}
+		}
+
+		if( padding > 0 ) {
+			commit( tail, 0, kPaddingTag );
+			tail += padding;
+		}
+
+		char *bytes = reinterpret_cast<char *>( at( tail ) ) + sizeof(Frame);
+		std::memcpy( bytes, data, length );
+		bytes[length] = '\0';
+		commit( tail, length, tag );
+
+		wake();
+		return true;
+	}
+
+	///
+	///@brief hand up to max committed frames to consume(char *frame, size_t length, uint32_t tag)
+	///
+	///@note the frame is writable and null terminated, it is freed when consume returns. The
+	///      length and tag are read once and the frame lies inside the ring, but a producer in
+	///      another process can still change its bytes: a consumer not trusting its producers
+	///      copies the frame before parsing it.
+	///
+	///@return frames consumed
+	///
+	template <typename Consume>
+	size_t read(Consume &&consume, size_t max)
+	{
+		uint64_t head = m_header->head.load( std::memory_order_relaxed );
+		size_t count = 0;
+
+		while( count < max ) {
+			Frame *frame = at( head );
+			if( frame->stamp.load( std::memory_order_acquire ) != head + 1 ) {
+				break;
+			}
+
+			const uint64_t toEnd = m_capacity - (head & (m_capacity - 1));
+			const uint32_t length = frame->length;
+			const uint32_t tag = frame->tag;
+			uint64_t size = tag == kPaddingTag ? toEnd : frameSize( length );
+			if( size > toEnd ) {
+				// a corrupt length, drop the rest of the lap
+				size = toEnd;
+			}
+			else if( tag != kPaddingTag ) {
+				consume( reinterpret_cast<char *>( frame ) + sizeof(Frame), static_cast<size_t>( length ), tag );
+				++count;
+			}
+
+			// producers reserve these bytes only once the head moved past them
+			std::memset( static_cast<void *>( frame ), 0, size );
+			head += size;
+			m_header->head.store( head, std::memory_order_release );
+		}
+		return count;
+	}
+
+	///@brief a committed frame is waiting
+	bool ready() const
+	{
+		const uint64_t head = m_header->head.load( std::memory_order_relaxed );
+		return at( head )->stamp.load( std::memory_order_acquire ) == head + 1;
+	}
+
+	///@brief drop every frame, only while no producer writes
+	void clear()
+	{
+		std::memset( m_data, 0, m_capacity );
+		m_header->head.store( m_header->tail.load( std::memory_order_acquire ), std::memory_order_release );
+	}
+
+// ----------------------------------------------------------------------------------------------- //
+
+	///
+	///@brief wait on the eventfd until a producer commits a frame or timeoutMs passes, consumer only
+	///
+	///@param fds More descriptors to wait on after fds[0], which park sets to the eventfd. Their
+	///           revents are filled in when it polls, left alone when a frame is already waiting.
+	///
+	void park(int timeoutMs, pollfd *fds = NULL, size_t count = 0)
+	{
+		pollfd own;
+		if( fds == NULL ) {
+			fds = &own;
+			count = 1;
+		}
+		fds[0].fd = m_eventFd;
+		fds[0].events = POLLIN;
+		fds[0].revents = 0;
+
+		sleep();
+		if( !ready() ) {
+			::poll( fds, static_cast<nfds_t>( count ), timeoutMs );
+			if( fds[0].revents & POLLIN ) {
+				uint64_t value;
+				ssize_t got = ::read( m_eventFd, &value, sizeof(value) );
+				(void)got;
+			}
+		}
+		awake();
+	}
+
+	///
+	///@brief announce that the consumer parks, a producer committing from now on writes the eventfd
+	///
+	///@note check ready() after it and before waiting, see park. A consumer of several rings
+	///      sharing one eventfd calls it on each of them before it waits.
+	///
+	void sleep()
+	{
+		m_header->sleeping.store( 1, std::memory_order_seq_cst );
+	}
+
+	///@brief the consumer is back, producers skip the eventfd
+	void awake()
+	{
+		m_header->sleeping.store( 0, std::memory_order_relaxed );
+	}
+
+	uint64_t capacity() const
+	{
+		return m_capacity;
+	}
+
+// ----------------------------------------------------------------------------------------------- //
+
+private:
+
+	struct Header
+	{
+		alignas(64) std::atomic<uint64_t> head;       ///< next frame to read, written by the consumer
+		alignas(64) std::atomic<uint64_t> tail;       ///< end of the reserved frames, advanced by producers
+		alignas(64) std::atomic<uint32_t> sleeping;   ///< the consumer is parked or about to
+	};
+
+	struct Frame
+	{
+		std::atomic<uint64_t> stamp;   ///< position + 1 once committed
+		uint32_t length;               ///< bytes of the frame without its terminator
+		uint32_t tag;
+	};
+
+	static uint64_t frameSize(size_t length)
+	{
+		return (sizeof(Frame) + length + 1 + kAlignment - 1) & ~uint64_t( kAlignment - 1 );
+	}
+
+	Frame * at(uint64_t position) const
+	{
+		return reinterpret_cast<Frame *>( m_data + (position & (m_capacity - 1)) );
+	}
+
+	void commit(uint64_t position, size_t length, uint32_t tag)
+	{
+		Frame *frame = at( position );
+		frame->length = static_cast<uint32_t>( length );
+		frame->tag = tag;
+		frame->stamp.store( position + 1, std::memory_order_release );
+	}
+
+	void wake()
+	{
+		std::atomic_thread_fence( std::memory_order_seq_cst );
+		if( m_header->sleeping.load( std::memory_order_relaxed ) != 0 && m_header->sleeping.exchange( 0 ) != 0 ) {
+			const uint64_t one = 1;
+			ssize_t wrote = ::write( m_eventFd, &one, sizeof(one) );
+			(void)wrote;
+		}
+	}
+
+	Header *m_header;
+	char *m_data;
+	uint64_t m_capacity;
+	int m_eventFd;
+
+};
+
+// ----------------------------------------------------------------------------------------------- //
+
+///
+///@brief spin before parking, longer while work keeps arriving during the spin
+///
+///@note the budget doubles when a spin finds work and halves when it runs out, so a busy ring is
+///      served without syscalls and an idle one stops burning a core within a few parks.
+///
+class AdaptiveSpin
+{
+public:
+
+	static const uint32_t kMinSpins = 64;
+	static const uint32_t kMaxSpins = 64 * 1024;
+	static const uint32_t kYieldEvery = 64;   ///< spins between sched_yield, the producer may share the core
+
+	///@note on a single cpu the peer can only make progress when this thread yields, every round does
+	AdaptiveSpin() : m_budget{ kMinSpins * 16 }, m_spins{ 0 },
+		m_yieldEvery{ std::thread::hardware_concurrency() > 1 ? kYieldEvery : 1 }
+	{
+	}
+
+	///@brief one idle round, false when the budget is spent and the caller should park
+	bool spin()
+	{
+		if( m_spins >= m_budget ) {
+			m_budget = m_budget / 2 > kMinSpins ? m_budget / 2 : kMinSpins;
+			m_spins = 0;
+			return false;
+		}
+		if( ++m_spins % m_yieldEvery == 0 ) {
+			::sched_yield();
+		}
+		else {
+			cpuRelax();
+		}
+		return true;
+	}
+
+	///@brief work arrived
+	void found()
+	{
+		if( m_spins > 0 ) {
+			m_budget = m_budget * 2 < kMaxSpins ? m_budget * 2 : kMaxSpins;
+		}
+		m_spins = 0;
+	}
+
+private:
+	uint32_t m_budget;       ///< rounds before parking
+	uint32_t m_spins;        ///< rounds since work was last found
+	uint32_t m_yieldEvery;
+};
+
+// ----------------------------------------------------------------------------------------------- //
+
+///
+///@brief shared memory of one client: its request ring, then its response ring
+///
+struct ShmLayout
+{
+	ShmLayout(size_t requestCapacity, size_t responseCapacity)
+		: requestCapacity{ requestCapacity }, responseCapacity{ responseCapacity }
+	{
+	}
+
+	size_t requestOffset() const
+	{
+		return 0;
+	}
+
+	size_t responseOffset() const
+	{
+		return ShmRing::footprint( requestCapacity );
+	}
+
+	size_t size() const
+	{
+		return responseOffset() + ShmRing::footprint( responseCapacity );
+	}
+
+	size_t requestCapacity;
+	size_t responseCapacity;
+};
+
+///@brief what the server sends a client when it connects, with the client's memfd and the two eventfds
+struct ShmHandshake
+{
+	uint64_t requestCapacity;
+	uint64_t responseCapacity;
+};
+
+// ----------------------------------------------------------------------------------------------- //
+
+///
+///@brief shared memory front end for clients on the same host, see ShmClient
+///
+///@note clients connect to a Unix socket and receive a memfd of their own rings and the eventfds
+///      over it, the connection stays open for as long as the client uses its slot. Requests are
+///      dispatched json or MessagePack like the socket front end, and the json response is
+///      written to the client's response ring. A response that does not fit is dropped and
+///      counted, the server never waits for a client.
+///
+///      A client maps only its own two rings and is trusted with nothing: who sent a request is
+///      known from the ring it came from and the connection's credentials, every request is
+///      copied out of shared memory before it is parsed, and lengths are bounded by the ring. A
+///      client scribbling over its rings corrupts its own requests and responses only.
+///
+///      run() polls the request rings while frames keep coming, spins adaptively when they run
+///      dry and then parks on the request eventfd all clients share.
+///
+class ShmServer
+{
+
+// ----------------------------------------------------------------------------------------------- //
+
+public:
+
+	static const size_t kRequestCapacity = 256 * 1024;  ///< per client
+	static const size_t kResponseCapacity = 256 * 1024;
+	static const size_t kSlots = 64;                    ///< clients at once
+	static const int kPollMs = 100;                     ///< how often run() checks done while parked
+	static const uint64_t kMaintenanceNs = 1000000;     ///< how often a busy run() accepts clients
+
+	explicit ShmServer(CommandDispatcher &dispatcher, size_t requestCapacity = kRequestCapacity,
+		size_t responseCapacity = kResponseCapacity, size_t slots = kSlots)
+		: m_dispatcher( dispatcher ), m_layout( requestCapacity, responseCapacity ),
+		  m_requestFd{ -1 }, m_listener{ -1 }, m_clients( slots ), m_requests{ 0 }, m_dropped{ 0 }
+	{
+	}
+
+	~ShmServer()
+	{
+		for( Client &client : m_clients ) {
+			if( client.connection >= 0 ) {
+				release( client );
+			}
+		}
+		if( m_listener >= 0 ) {
+			::close( m_listener );
+			::unlink( m_path.c_str() );
+		}
+		if( m_requestFd >= 0 ) {
+			::close( m_requestFd );
+		}
+	}
+
+	ShmServer(const ShmServer&) = delete;
+	ShmServer& operator=(const ShmServer&) = delete;
+
+// ----------------------------------------------------------------------------------------------- //
+
+	///
+	///@brief listen for clients on a Unix socket, an existing socket file is replaced
+	///
+	///@return false with errno set on failure
+	///
+	bool listen(const std::string &path)
+	{
+		m_requestFd = ::eventfd( 0, EFD_CLOEXEC | EFD_NONBLOCK );
+		if( m_requestFd < 0 ) {
+			return false;
+		}
+
+		sockaddr_un address;
+		std::memset( &address, 0, sizeof(address) );
+		address.sun_family = AF_UNIX;
+		if( path.size() >= sizeof(address.sun_path) ) {
+			errno = ENAMETOOLONG;
+			return false;
+		}
+		std::memcpy( address.sun_path, path.c_str(), path.size() + 1 );
+
+		m_listener = ::socket( AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0 );
+		if( m_listener < 0 ) {
+			return false;
+		}
+		::unlink( path.c_str() );
+		if( ::bind( m_listener, reinterpret_cast<sockaddr *>( &address ), sizeof(address) ) != 0 || ::listen( m_listener, SOMAXCONN ) != 0 ) {
+			return false;
+		}
+		m_path = path;
+		return true;
+	}
+
+// ----------------------------------------------------------------------------------------------- //
+
+	///
+	///@brief serve until done returns true, it is checked at least every kPollMs
+	///
+	void run(std::function<bool()> done)
+	{
+		AdaptiveSpin spin;
+		uint64_t maintained = monotonicNs();
+		std::vector<pollfd> fds;
+
+		while( !done() ) {
+			if( serve() > 0 ) {
+				spin.found();
+				const uint64_t now = monotonicNs();
+				if( now - maintained > kMaintenanceNs ) {
+					maintained = now;
+					maintain( 0, fds );
+				}
+				continue;
+			}
+			if( spin.spin() ) {
+				continue;
+			}
+
+			maintain( kPollMs, fds );
+			maintained = monotonicNs();
+		}
+	}
+
+// ----------------------------------------------------------------------------------------------- //
+
+	///@brief requests dispatched so far
+	uint64_t requests() const
+	{
+		return m_requests;
+	}
+
+	///@brief responses that did not fit their client's ring
+	uint64_t dropped() const
+	{
+		return m_dropped;
+	}
+
+// ----------------------------------------------------------------------------------------------- //
+
+private:
+
+	struct Client
+	{
+		Client() : connection{ -1 }, memfd{ -1 }, eventFd{ -1 }, memory{ NULL }, id{ 0 }
+		{
+		}
+
+		int connection;       ///< the handshake socket, -1 when the slot is free
+		int memfd;            ///< the client's rings
+		int eventFd;          ///< wakes the client parked on its response ring
+		char *memory;         ///< the server's mapping of memfd
+		uint64_t id;          ///< DispatchOrigin::client, from the connection's credentials
+		ShmRing requests;
+		ShmRing responses;
+	};
+
+	///@brief dispatch up to a batch of requests of every client, the number dispatched
+	size_t serve()
+	{
+		static const size_t kBatch = 64;
+
+		size_t served = 0;
+		for( Client &client : m_clients ) {
+			if( client.connection < 0 ) {
+				continue;
+			}
+			served += client.requests.read( [this, &client](char *request, size_t length, uint32_t) {
+				dispatch( client, request, length );
+			}, kBatch );
+		}
+		return served;
+	}
+
+	///@brief dispatch a copy of a request, the client can change the ring under a parse in place
+	void dispatch(Client &client, const char *request, size_t length)
+	{
+		m_request.assign( request, length );
+		m_dispatcher.dispatchCommandInsitu( &m_request[0], length, [this, &client](const char *response, size_t size) {
+			if( !client.responses.write( response, size, 0 ) ) {
+				++m_dropped;
+			}
+		}, DispatchOrigin( monotonicNs(), client.id ) );
+		++m_requests;
+	}
+
+	///@brief accept clients and notice departed ones, parked on the request rings for up to timeoutMs
+	void maintain(int timeoutMs, std::vector<pollfd> &fds)
+	{
+		fds.clear();
+		fds.push_back( pollfd{ m_requestFd, POLLIN, 0 } );
+		fds.push_back( pollfd{ m_listener, POLLIN, 0 } );
+		for( const Client &client : m_clients ) {
+			if( client.connection >= 0 ) {
+				fds.push_back( pollfd{ client.connection, POLLIN, 0 } );
+			}
+		}
+
+		if( timeoutMs > 0 ) {
+			park( timeoutMs, fds );
+		}
+		else {
+			::poll( fds.data() + 1, static_cast<nfds_t>( fds.size() - 1 ), 0 );
+		}
+
+		for( size_t n = 2; n < fds.size(); ++n ) {
+			if( fds[n].revents != 0 ) {
+				// clients send nothing, readable means closed
+				disconnect( fds[n].fd );
+			}
+		}
+		if( fds[1].revents & POLLIN ) {
+			acceptAll();
+		}
+	}
+
+	///@brief wait on the request eventfd and fds unless a request is waiting, see ShmRing::park
+	void park(int timeoutMs, std::vector<pollfd> &fds)
+	{
+		bool ready = false;
+		for( Client &client : m_clients ) {
+			if( client.connection >= 0 ) {
+				client.requests.sleep();
+				ready = ready || client.requests.ready();
+			}
+		}
+
+		if( !ready ) {
+			::poll( fds.data(), static_cast<nfds_t>( fds.size() ), timeoutMs );
+			if( fds[0].revents & POLLIN ) {
+				uint64_t value;
+				ssize_t got = ::read( m_requestFd, &value, sizeof(value) );
+				(void)got;
+			}
+		}
+		else {
+			for( pollfd &fd : fds ) {
+				fd.revents = 0;
+			}
+		}
+
+		for( Client &client : m_clients ) {
+			if( client.connection >= 0 ) {
+				client.requests.awake();
+			}
+		}
+	}
+
+	void acceptAll()
+	{
+		for( ;; ) {
+			const int fd = ::accept4( m_listener, NULL, NULL, SOCK_CLOEXEC );
+			if( fd < 0 ) {
+				if( errno == EINTR || errno == ECONNABORTED ) {
+					continue;
+				}
+				return;
+			}
+
+			size_t slot = 0;
+			while( slot < m_clients.size() && m_clients[slot].connection >= 0 ) {
+				++slot;
+			}
+			if( slot == m_clients.size() || !open( m_clients[slot], fd ) ) {
+				::close( fd );
+			}
+		}
+	}
+
+	///@brief set up the rings of a new client in a free slot and send them, false when it failed
+	bool open(Client &client, int connection)
+	{
+		client.memfd = createMemfd( "dispatcher-shm", m_layout.size() );
+		client.eventFd = ::eventfd( 0, EFD_CLOEXEC | EFD_NONBLOCK );
+		void *memory = client.memfd >= 0
+			? ::mmap( NULL, m_layout.size(), PROT_READ | PROT_WRITE, MAP_SHARED, client.memfd, 0 ) : MAP_FAILED;
+		client.memory = memory != MAP_FAILED ? static_cast<char *>( memory ) : NULL;
+
+		ShmHandshake handshake{ m_layout.requestCapacity, m_layout.responseCapacity };
+		const int fds[3] = { client.memfd, m_requestFd, client.eventFd };
+		if( client.memory == NULL || client.eventFd < 0 || !sendHandshake( connection, handshake, fds ) ) {
+			release( client );
+			return false;
+		}
+
+		client.connection = connection;
+		client.id = peerOf( connection );
+		client.requests = ShmRing( client.memory + m_layout.requestOffset(), m_layout.requestCapacity, m_requestFd, true );
+		client.responses = ShmRing( client.memory + m_layout.responseOffset(), m_layout.responseCapacity, client.eventFd, true );
+		return true;
+	}
+
+	void disconnect(int connection)
+	{
+		for( Client &client : m_clients ) {
+			if( client.connection == connection ) {
+				release( client );
+				return;
+			}
+		}
+	}
+
+	///@brief unmap and close everything of a client, its slot is free again
+	void release(Client &client)
+	{
+		if( client.memory != NULL ) {
+			::munmap( client.memory, m_layout.size() );
+		}
+		for( int *fd : { &client.connection, &client.memfd, &client.eventFd } ) {
+			if( *fd >= 0 ) {
+				::close( *fd );
+			}
+		}
+		client = Client();
+	}
+
+	///@brief the uid of the peer like the socket front end, so rate limits apply across transports
+	static uint64_t peerOf(int fd)
+	{
+		ucred credentials;
+		socklen_t size = sizeof(credentials);
+		if( ::getsockopt( fd, SOL_SOCKET, SO_PEERCRED, &credentials, &size ) == 0 ) {
+			return (uint64_t( 1 ) << 32) | credentials.uid;
+		}
+		return uint64_t( 3 ) << 32;
+	}
+
+	static bool sendHandshake(int fd, const ShmHandshake &handshake, const int (&fds)[3])
+	{
+		iovec data;
+		data.iov_base = const_cast<ShmHandshake *>( &handshake );
+		data.iov_len = sizeof(handshake);
+
+		char control[CMSG_SPACE(sizeof(fds))];
+		std::memset( control, 0, sizeof(control) );
+
+		msghdr message;
+		std::memset( &message, 0, sizeof(message) );
+		message.msg_iov = &data;
+		message.msg_iovlen = 1;
+		message.msg_control = control;
+		message.msg_controllen = sizeof(control);
+
+		cmsghdr *rights = CMSG_FIRSTHDR( &message );
+		rights->cmsg_level = SOL_SOCKET;
+		rights->cmsg_type = SCM_RIGHTS;
+		rights->cmsg_len = CMSG_LEN(sizeof(fds));
+		std::memcpy( CMSG_DATA( rights ), fds, sizeof(fds) );
+
+		return ::sendmsg( fd, &message, MSG_NOSIGNAL ) == static_cast<ssize_t>( sizeof(handshake) );
+	}
+
+// ----------------------------------------------------------------------------------------------- //
+
+	CommandDispatcher &m_dispatcher;
+	const ShmLayout m_layout;
+	int m_requestFd;                 ///< wakes the server parked on the request rings, shared by the clients
+	int m_listener;
+	std::string m_path;
+	std::vector<Client> m_clients;   ///< by slot
+	std::string m_request;           ///< the request being dispatched, copied out of its ring
+	uint64_t m_requests;
+	uint64_t m_dropped;
+
+};
+
+// ----------------------------------------------------------------------------------------------- //
+
+///
+///@brief client of a ShmServer: writes requests into its request ring, reads its responses
+///
+///@note one thread sends and receives at a time. Requests may be pipelined as long as their
+///      responses fit the response ring, the server drops what does not.
+///
+class ShmClient
+{
+
+// ----------------------------------------------------------------------------------------------- //
+
+public:
+
+	ShmClient() : m_connection{ -1 }, m_memfd{ -1 }, m_requestFd{ -1 }, m_responseFd{ -1 }, m_memory{ NULL },
+		m_size{ 0 }
+	{
+	}
+
+	~ShmClient()
+	{
+		close();
+	}
+
+	ShmClient(const ShmClient&) = delete;
+	ShmClient& operator=(const ShmClient&) = delete;
+
+// ----------------------------------------------------------------------------------------------- //
+
+	///
+	///@brief connect to the server's Unix socket and map its rings
+	///
+	///@return false with errno set on failure
+	///
+	bool connect(const std::string &path)
+	{
+		close();
+
+		sockaddr_un address;
+		std::memset( &address, 0, sizeof(address) );
+		address.sun_family = AF_UNIX;
+		std::strncpy( address.sun_path, path.c_str(), sizeof(address.sun_path) - 1 );
+
+		m_connection = ::socket( AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0 );
+		if( m_connection < 0 || ::connect( m_connection, reinterpret_cast<sockaddr *>( &address ), sizeof(address) ) != 0 ) {
+			return false;
+		}
+
+		ShmHandshake handshake;
+		int fds[3];
+		if( !receiveHandshake( handshake, fds ) ) {
+			return false;
+		}
+		m_memfd = fds[0];
+		m_requestFd = fds[1];
+		m_responseFd = fds[2];
+
+		const ShmLayout layout( handshake.requestCapacity, handshake.responseCapacity );
+		m_size = layout.size();
+		void *memory = ::mmap( NULL, m_size, PROT_READ | PROT_WRITE, MAP_SHARED, m_memfd, 0 );
+		if( memory == MAP_FAILED ) {
+			return false;
+		}
+		m_memory = static_cast<char *>( memory );
+		m_requests = ShmRing( m_memory + layout.requestOffset(), layout.requestCapacity, m_requestFd, false );
+		m_responses = ShmRing( m_memory + layout.responseOffset(), layout.responseCapacity, m_responseFd, false );
+		return true;
+	}
+
+	void close()
+	{
+		if( m_memory != NULL ) {
+			::munmap( m_memory, m_size );
+			m_memory = NULL;
+		}
+		for( int *fd : { &m_connection, &m_memfd, &m_requestFd, &m_responseFd } ) {
+			if( *fd >= 0 ) {
+				::close( *fd );
+				*fd = -1;
+			}
+		}
+	}
+
+// ----------------------------------------------------------------------------------------------- //
+
+	///
+	///@brief write a json or MessagePack request into the request ring
+	///
+	///@return false when the ring is full
+	///
+	bool send(const char *request, size_t length)
+	{
+		return m_requests.write( request, length, 0 );
+	}
+
+	///
+	///@brief wait for the next response, spinning adaptively before parking
+	///
+	///@param receive Called as receive(const char *response, size_t length), valid during the call.
+	///
+	///@return false when no response came within timeoutMs
+	///
+	template <typename Receive>
+	bool receive(Receive &&receive, int timeoutMs = 1000)
+	{
+		auto deliver = [&receive](char *response, size_t length, uint32_t) { receive( response, length ); };
+		const uint64_t deadline = monotonicNs() + static_cast<uint64_t>( timeoutMs ) * 1000000;
+
+		for( ;; ) {
+			if( m_responses.read( deliver, 1 ) > 0 ) {
+				m_spin.found();
+				return true;
+			}
+			if( m_spin.spin() ) {
+				continue;
+			}
+
+			const uint64_t now = monotonicNs();
+			if( now >= deadline ) {
+				return false;
+			}
+			m_responses.park( static_cast<int>( (deadline - now) / 1000000 ) + 1 );
+		}
+	}
+
+// ----------------------------------------------------------------------------------------------- //
+
+private:
+
+	bool receiveHandshake(ShmHandshake &handshake, int (&fds)[3])
+	{
+		iovec data;
+		data.iov_base = &handshake;
+		data.iov_len = sizeof(handshake);
+
+		char control[CMSG_SPACE(sizeof(fds))];
+		msghdr message;
+		std::memset( &message, 0, sizeof(message) );
+		message.msg_iov = &data;
+		message.msg_iovlen = 1;
+		message.msg_control = control;
+		message.msg_controllen = sizeof(control);
+
+		if( ::recvmsg( m_connection, &message, MSG_CMSG_CLOEXEC | MSG_WAITALL ) != static_cast<ssize_t>( sizeof(handshake) ) ) {
+			return false;
+		}
+		cmsghdr *rights = CMSG_FIRSTHDR( &message );
+		if( rights == NULL || rights->cmsg_type != SCM_RIGHTS || rights->cmsg_len != CMSG_LEN(sizeof(fds)) ) {
+			errno = EPROTO;
+			return false;
+		}
+		std::memcpy( fds, CMSG_DATA( rights ), sizeof(fds) );
+		return true;
+	}
+
+	int m_connection;
+	int m_memfd;
+	int m_requestFd;
+	int m_responseFd;
+	char *m_memory;
+	size_t m_size;
+	ShmRing m_requests;
+	ShmRing m_responses;
+	AdaptiveSpin m_spin;
+
+};
+
+// ----------------------------------------------------------------------------------------------- //
+
+}
+}
+
+#endif
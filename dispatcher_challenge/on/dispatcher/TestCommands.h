@@ -0,0 +1,58 @@
+#ifndef _ON_DISPATCHER_TESTCOMMANDS_H_
+#define _ON_DISPATCHER_TESTCOMMANDS_H_
+
+namespace on {
+namespace dispatcher {
+
+//
+// TEST COMMANDS
+//
+static const char *const help_command = R"(
+ {
+  "command":"help",
+  "payload": {
+    "usage":"Enter json command in 'command':'<command>','payload': { // json payload of arguments }"
+  }
+ }
+)";
+
+static const char *const exit_command = R"(
+ {
+  "command":"exit",
+  "payload": {
+     "reason":"Exiting program on user request."
+  }
+ }
+)";
+
+static const char *const authenticate_command = R"(
+ {
+  "command":"authenticate",
+  "payload": {
+     "key":"1kjdi3idmvid."
+  }
+ }
+)";
+
+static const char *const reloadUser_command = R"(
+ {
+  "command":"reloadUser",
+  "payload": {
+     "token":"1kjdi3idmvid."
+  }
+ }
+)";
+
+static const char *const deviceHealth_command = R"(
+ {
+  "command":"deviceHealth",
+  "payload": {
+     "status":"healthy."
+  }
+ }
+)";
+
+}
+}
+
+#endif
@@ -0,0 +1,308 @@
+#ifndef _ON_DISPATCHER_TTLCACHE_H_
+#define _ON_DISPATCHER_TTLCACHE_H_
+
+#include <stdint.h>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "on/dispatcher/Common.h"
+
+namespace on {
+namespace dispatcher {
+
+// ----------------------------------------------------------------------------------------------- //
+
+///
+///@brief counters of a TtlCache, summed over its shards
+///
+struct TtlCacheStats
+{
+	uint64_t hits;          ///< lookups answered from the cache
+	uint64_t misses;        ///< lookups of absent keys
+	uint64_t expired;       ///< lookups of entries past their ttl, also misses
+	uint64_t evictions;     ///< live entries dropped to make room
+	size_t size;            ///< live entries
+
+	double hitRatio() const
+	{
+		const uint64_t lookups = hits + misses;
+		return lookups > 0 ? double(hits) / lookups : 0;
+	}
+};
+
+// ----------------------------------------------------------------------------------------------- //
+
+///
+///@brief bounded map from string keys to Value with expiry, safe to share between threads
+///
+///@note keys are spread by hash over shards with a lock each, so lookups of different shards
+///      never contend and no lock covers the whole cache. A shard is a fixed array of slots
+///      indexed by the key's 64 bit hash, a lookup hashes, finds and compares the key without
+///      allocating. When a shard is full the CLOCK hand evicts the first slot not referenced
+///      since the hand last passed, an expired slot is taken even when referenced.
+///
+///      A capacity of 0 disables the cache: find always misses, insert does nothing.
+///
+template <typename Value>
+class TtlCache
+{
+
+// ----------------------------------------------------------------------------------------------- //
+
+public:
+
+	static const size_t kDefaultShards = 16;
+
+	///
+	///@param capacity Maximum number of entries, rounded up to a multiple of the shard count.
+	///@param ttlNs Lifetime of an entry in nanoseconds.
+	///@param shards Number of shards, rounded up to a power of two and to at most capacity.
+	///
+	TtlCache(size_t capacity, uint64_t ttlNs, size_t shards = kDefaultShards)
+		: m_ttlNs{ ttlNs }, m_shardCount{ 0 }
+	{
+		if( capacity == 0 ) {
+			return;
+		}
+
+		size_t count = 1;
+		while( count < shards && count * 2 <= capacity ) {
+			count *= 2;
+		}
+		m_shardCount = count;
+		m_shards.reset( new Shard[count] );
+
+		const size_t slots = (capacity + count - 1) / count;
+		for( size_t n = 0; n < count; ++n ) {
+			m_shards[n].slots.resize( slots );
+			m_shards[n].index.reserve( slots );
+		}
+	}
+
+	TtlCache(const TtlCache&) = delete;
+	TtlCache& operator=(const TtlCache&) = delete;
+
+// ----------------------------------------------------------------------------------------------- //
+
+	///
+	///@brief look key up at nowNs, monotonicNs()
+	///
+	///@param value Receives the cached value on a hit.
+	///
+	///@return true on a hit
+	///
+	bool find(const char *key, size_t length, Value &value, uint64_t nowNs)
+	{
+		if( m_shardCount == 0 ) {
+			return false;
+		}
+
+		const uint64_t hash = fnv1a( key, length );
+		Shard &shard = shardOf( hash );
+		std::lock_guard<std::mutex> lock( shard.mtx );
+
+		auto found = shard.index.find( hash );
+		if( found == shard.index.end() ) {
+			++shard.misses;
+			return false;
+		}
+
+		Slot &slot = shard.slots[found->second];
+		if( slot.key.size() != length || std::memcmp( slot.key.data(), key, length ) != 0 ) {
+			++shard.misses;
+			return false;
+		}
+		if( slot.expiresNs <= nowNs ) {
+			shard.index.erase( found );
+			slot.live = false;
+			++shard.expired;
+			++shard.misses;
+			return false;
+		}
+
+		slot.referenced = true;
+		value = slot.value;
+		++shard.hits;
+		return true;
+	}
+
+	///
+	///@brief cache value under key from nowNs for the ttl, replacing an entry of the same key
+	///
+	void insert(const char *key, size_t length, const Value &value, uint64_t nowNs)
+	{
+		if( m_shardCount == 0 ) {
+			return;
+		}
+
+		const uint64_t hash = fnv1a( key, length );
+		Shard &shard = shardOf( hash );
+		std::lock_guard<std::mutex> lock( shard.mtx );
+
+		size_t index;
+		auto found = shard.index.find( hash );
+		if( found != shard.index.end() ) {
+			// same key, or a hash collision the newer key wins
+			index = found->second;
+		}
+		else {
+			index = victim( shard, nowNs );
+			shard.index.emplace( hash, static_cast<uint32_t>(index) );
+		}
+
+		Slot &slot = shard.slots[index];
+		slot.key.assign( key, length );
+		slot.hash = hash;
+		slot.expiresNs = nowNs + m_ttlNs;
+		slot.value = value;
+		slot.live = true;
+		slot.referenced = false;
+	}
+
+	///@brief drop the entry of key, if any
+	void erase(const char *key, size_t length)
+	{
+		if( m_shardCount == 0 ) {
+			return;
+		}
+
+		const uint64_t hash = fnv1a( key, length );
+		Shard &shard = shardOf( hash );
+		std::lock_guard<std::mutex> lock( shard.mtx );
+
+		auto found = shard.index.find( hash );
+		if( found != shard.index.end() ) {
+			Slot &slot = shard.slots[found->second];
+			if( slot.key.size() == length && std::memcmp( slot.key.data(), key, length ) == 0 ) {
+				slot.live = false;
+				shard.index.erase( found );
+			}
+		}
+	}
+
+	///@brief drop every entry, counters are kept
+	void clear()
+	{
+		for( size_t n = 0; n < m_shardCount; ++n ) {
+			Shard &shard = m_shards[n];
+			std::lock_guard<std::mutex> lock( shard.mtx );
+			for( Slot &slot : shard.slots ) {
+				slot.live = false;
+			}
+			shard.index.clear();
+		}
+	}
+
+// ----------------------------------------------------------------------------------------------- //
+
+	TtlCacheStats stats() const
+	{
+		TtlCacheStats total = TtlCacheStats();
+		for( size_t n = 0; n < m_shardCount; ++n ) {
+			Shard &shard = m_shards[n];
+			std::lock_guard<std::mutex> lock( shard.mtx );
+			total.hits += shard.hits;
+			total.misses += shard.misses;
+			total.expired += shard.expired;
+			total.evictions += shard.evictions;
+			total.size += shard.index.size();
+		}
+		return total;
+	}
+
+	size_t capacity() const
+	{
+		return m_shardCount > 0 ? m_shardCount * m_shards[0].slots.size() : 0;
+	}
+
+	uint64_t ttlNs() const
+	{
+		return m_ttlNs;
+	}
+
+// ----------------------------------------------------------------------------------------------- //
+
+private:
+
+	struct Slot
+	{
+		Slot() : hash{ 0 }, expiresNs{ 0 }, value(), live{ false }, referenced{ false }
+		{
+		}
+
+		std::string key;
+		uint64_t hash;          ///< index key of the slot while live
+		uint64_t expiresNs;     ///< monotonicNs() the entry expires at
+		Value value;
+		bool live;              ///< the slot holds an entry
+		bool referenced;        ///< hit since the clock hand last passed
+	};
+
+	struct Shard
+	{
+		Shard() : hand{ 0 }, hits{ 0 }, misses{ 0 }, expired{ 0 }, evictions{ 0 }
+		{
+		}
+
+		std::mutex mtx;
+		std::vector<Slot> slots;                          ///< fixed at construction
+		std::unordered_map<uint64_t, uint32_t> index;     ///< key hash to slot of live entries
+		size_t hand;                                      ///< CLOCK position
+		uint64_t hits;
+		uint64_t misses;
+		uint64_t expired;
+		uint64_t evictions;
+	};
+
+	Shard & shardOf(uint64_t hash) const
+	{
+		return m_shards[(hash >> 32) & (m_shardCount - 1)];
+	}
+
+	///@brief a free slot of shard, evicting with the CLOCK hand, shard is locked
+	size_t victim(Shard &shard, uint64_t nowNs)
+	{
+		const size_t size = shard.slots.size();
+
+		// every referenced slot is cleared on the first lap, so the second lap finds one
+		for( ;; ) {
+			const size_t index = shard.hand;
+			shard.hand = (shard.hand + 1) % size;
+			Slot &slot = shard.slots[index];
+
+			if( !slot.live ) {
+				return index;
+			}
+			if( slot.expiresNs <= nowNs ) {
+				// expired, reused without counting an eviction
+			}
+			else if( slot.referenced ) {
+				slot.referenced = false;
+				continue;
+			}
+			else {
+				++shard.evictions;
+			}
+
+			shard.index.erase( slot.hash );
+			slot.live = false;
+			return index;
+		}
+	}
+
+	const uint64_t m_ttlNs;
+	size_t m_shardCount;                  ///< power of two, 0 when disabled
+	std::unique_ptr<Shard[]> m_shards;
+
+};
+
+// ----------------------------------------------------------------------------------------------- //
+
+}
+}
+
+#endif
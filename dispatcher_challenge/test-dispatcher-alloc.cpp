@@ -0,0 +1,263 @@
+/*
+ * description: steady state dispatches make no heap allocations, counted by interposing malloc
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <memory>
+#include <streambuf>
+#include <string>
+#include <vector>
+
+#include "alloc_counter.h"
+#include "dispatcher.h"
+
+using namespace on::dispatcher;
+
+#define TEST_CHECK(cond) do { \
+		if( !(cond) ) { \
+			printf("TEST: ERROR: %s(%d): %s\n", __func__, __LINE__, #cond); \
+			return false; \
+		} \
+} while(0)
+
+//---
+// GLOBALS
+//
+
+std::atomic_bool g_done{ false };
+
+static const size_t kRounds = 1000;
+
+///@brief console sink discarding everything, the handlers' output is formatted but not written
+struct NullBuffer : public std::streambuf
+{
+	int overflow(int c) override
+	{
+		return c;
+	}
+};
+
+static std::vector<std::string> builtin_commands()
+{
+	return std::vector<std::string>{ help_command, exit_command, authenticate_command,
+		reloadUser_command, deviceHealth_command };
+}
+
+static std::string to_msgpack(const std::string &json)
+{
+	rapidjson::Document document;
+	document.Parse(json.c_str());
+	std::string packed;
+	MsgPackWriter writer(packed);
+	document.Accept(writer);
+	return packed;
+}
+
+///
+///@brief heap allocations of kRounds rounds of commands, after a warm up round
+///
+static size_t count_allocations(CommandDispatcher &dispatcher, const std::vector<std::string> &commands)
+{
+	size_t responses = 0;
+	auto respond = [&responses](const char *, size_t length) { responses += length; };
+
+	for( const std::string &command : commands ) {
+		dispatcher.dispatchCommand(command.data(), command.size(), respond);
+	}
+
+	const size_t before = allocation_count();
+	for( size_t n = 0; n < kRounds; ++n ) {
+		for( const std::string &command : commands ) {
+			dispatcher.dispatchCommand(command.data(), command.size(), respond);
+		}
+	}
+	return allocation_count() - before;
+}
+
+// ----------------------------------------------------------------------------------------------- //
+
+bool test_arena()
+{
+	RequestArena arena(PoolAllocator(), 1024);
+
+	void *pinned = arena.allocate(100);
+	arena.pin();
+	TEST_CHECK(((uintptr_t)pinned % RequestArena::kAlignment) == 0);
+
+	// reset rewinds to the pinned allocations
+	char *first = static_cast<char *>(arena.allocate(10));
+	TEST_CHECK(first != pinned);
+	arena.reset();
+	TEST_CHECK(arena.allocate(10) == first);
+
+	// the last allocation grows in place
+	void *grown = arena.reallocate(first, 10, 200);
+	TEST_CHECK(grown == first);
+	void *other = arena.allocate(16);
+	TEST_CHECK(arena.reallocate(first, 200, 400) != first);
+	TEST_CHECK(other != NULL);
+
+	// a request larger than a block gets a block of its own, kept across resets
+	arena.reset();
+	const size_t before = allocation_count();
+	void *large = arena.allocate(10000);
+	memset(large, 1, 10000);
+	TEST_CHECK(arena.blocks() == 2);
+	arena.reset();
+	arena.allocate(10000);
+	TEST_CHECK(arena.blocks() == 2);
+	TEST_CHECK(!ALLOC_COUNTER_ENABLED || allocation_count() - before == 1);
+
+	// blocks beyond the retained limit are freed by reset
+	arena.allocate(RequestArena::kMaxRetained);
+	TEST_CHECK(arena.capacity() > RequestArena::kMaxRetained);
+	arena.reset();
+	TEST_CHECK(arena.capacity() <= RequestArena::kMaxRetained);
+
+	// the rapidjson allocator falls back to malloc without an arena
+	ArenaAllocator heap;
+	void *ptr = heap.Malloc(32);
+	ptr = heap.Realloc(ptr, 32, 64);
+	TEST_CHECK(ptr != NULL);
+	ArenaAllocator::Free(ptr);
+	return true;
+}
+
+// ----------------------------------------------------------------------------------------------- //
+
+bool test_dispatch_modes()
+{
+	TEST_CHECK(ALLOC_COUNTER_ENABLED);
+
+	Controller controller;
+	const std::vector<std::string> commands = builtin_commands();
+
+	CommandDispatcher pooled;
+	init_dispatcher(pooled, controller);
+	TEST_CHECK(count_allocations(pooled, commands) == 0);
+
+	// the arena blocks come from malloc, once
+	CommandDispatcher unpooled(0);
+	init_dispatcher(unpooled, controller);
+	TEST_CHECK(count_allocations(unpooled, commands) == 0);
+
+	pooled.setDispatchMode(kDispatchStream);
+	TEST_CHECK(count_allocations(pooled, commands) == 0);
+	pooled.setDispatchMode(kDispatchDom);
+
+	std::vector<std::string> packed;
+	for( const std::string &command : commands ) {
+		packed.push_back(to_msgpack(command));
+	}
+	TEST_CHECK(count_allocations(pooled, packed) == 0);
+
+	// handlers and dispatcher writing to the console
+	NullBuffer buffer;
+	std::ostream sink(&buffer);
+	setConsoleSink(sink);
+	setConsoleEnabled(true);
+	const size_t console = count_allocations(pooled, commands);
+	setConsoleEnabled(false);
+	setConsoleSink(std::cout);
+	TEST_CHECK(console == 0);
+	return true;
+}
+
+// ----------------------------------------------------------------------------------------------- //
+
+bool test_large_command()
+{
+	// the copy and the document overflow the first block
+	std::string samples = "[";
+	for( size_t n = 0; samples.size() < 2 * DispatchContext::kBlockSize; ++n ) {
+		samples += (n > 0 ? ",{\"id\":" : "{\"id\":") + std::to_string(n) + ",\"label\":\"sensor\",\"ok\":true}";
+	}
+	samples += "]";
+	const std::vector<std::string> commands{ R"({"command":"samples","payload":{"samples":)" + samples + "}}" };
+
+	CommandDispatcher dispatcher;
+	size_t seen = 0;
+	dispatcher.addCommandHandler("samples", [&seen](JsonValue &command, ResponseWriter &response) {
+		seen = command["payload"]["samples"].Size();
+		response.Uint64(seen);
+		return true;
+	});
+
+	TEST_CHECK(count_allocations(dispatcher, commands) == 0);
+	TEST_CHECK(seen > 1000);
+
+	dispatcher.setDispatchMode(kDispatchStream);
+	TEST_CHECK(count_allocations(dispatcher, commands) == 0);
+	return true;
+}
+
+// ----------------------------------------------------------------------------------------------- //
+
+///@brief middleware composing a message in scratch memory
+struct TraceMiddleware : public Middleware
+{
+	bool before(CommandCall &call) override
+	{
+		ScratchString line("trace: ");
+		line.append(call.command.data(), call.command.size());
+		consoleOut(line.c_str());
+		return true;
+	}
+};
+
+bool test_handler_scratch()
+{
+	CommandDispatcher dispatcher;
+	const char *scratch = NULL;
+	bool reused = true;
+
+	dispatcher.addCommandHandler("device.report", [&](JsonValue &command, ResponseWriter &response) {
+		ScratchString report("device ");
+		report += command["payload"]["name"].GetString();
+		report += " reported ";
+		report.append(200, '.');
+
+		// every dispatch composes in the same, rewound, memory
+		reused = reused && (scratch == NULL || scratch == report.data());
+		scratch = report.data();
+
+		response.String(report.data(), static_cast<rapidjson::SizeType>(report.size()));
+		return true;
+	});
+	dispatcher.addMiddleware("device", std::make_shared<TraceMiddleware>());
+
+	const std::vector<std::string> commands{ R"({"command":"device.report","payload":{"name":"sensor-1"}})" };
+	TEST_CHECK(count_allocations(dispatcher, commands) == 0);
+	TEST_CHECK(reused);
+	TEST_CHECK(requestArena() == NULL);
+
+	// outside a dispatch scratch memory comes from the heap
+	const size_t before = allocation_count();
+	{
+		ScratchString outside(100, 'x');
+		TEST_CHECK(outside.get_allocator().arena() == NULL);
+	}
+	TEST_CHECK(allocation_count() - before == 1);
+	return true;
+}
+
+// ----------------------------------------------------------------------------------------------- //
+
+int main (int argc, char *argv[])
+{
+	printf("BEGIN TEST :\n");
+
+	setConsoleEnabled(false);
+
+	bool ok = test_arena();
+	ok = test_dispatch_modes() && ok;
+	ok = test_large_command() && ok;
+	ok = test_handler_scratch() && ok;
+
+	printf("\nSTOP: %s\n", ok ? "PASS" : "FAIL");
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,86 @@
+/*
+ * description: latency percentiles of the command metrics, nearest rank on small samples
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include <atomic>
+
+#include "dispatcher.h"
+
+using namespace on::dispatcher;
+
+#define TEST_CHECK(cond) do { \
+		if( !(cond) ) { \
+			printf("TEST: ERROR: %s(%d): %s\n", __func__, __LINE__, #cond); \
+			return false; \
+		} \
+} while(0)
+
+//---
+// GLOBALS
+//
+
+std::atomic_bool g_done{ false };
+
+static const size_t kSlot = 1;
+
+//---
+// TESTS
+//
+
+///@brief the tail of a small sample is its slowest dispatch
+static bool test_small_sample()
+{
+	CommandMetrics metrics;
+	metrics.record(kSlot, kCommandOk, 1472);
+	metrics.record(kSlot, kCommandOk, 23123);
+
+	CommandStats stats;
+	metrics.snapshot(kSlot, stats);
+	TEST_CHECK(stats.dispatched == 2);
+	TEST_CHECK(stats.percentile(0.99) == stats.latencyMaxNs);
+	TEST_CHECK(stats.percentile(0.999) == stats.latencyMaxNs);
+	TEST_CHECK(stats.percentile(0.5) < 2000);
+	return true;
+}
+
+///@brief one slow dispatch among ten is the p99, not hidden by the fast ones
+static bool test_single_outlier()
+{
+	CommandMetrics metrics;
+	for( size_t n = 0; n < 9; ++n ) {
+		metrics.record(kSlot, kCommandOk, 1000);
+	}
+	metrics.record(kSlot, kCommandOk, 1000000);
+
+	CommandStats stats;
+	metrics.snapshot(kSlot, stats);
+	TEST_CHECK(stats.percentile(0.99) == 1000000);
+	TEST_CHECK(stats.percentile(0.9) < 2000);
+	TEST_CHECK(stats.percentile(0) < 2000);
+	return true;
+}
+
+///@brief no dispatches, no latency
+static bool test_empty()
+{
+	CommandMetrics metrics;
+	CommandStats stats;
+	metrics.snapshot(kSlot, stats);
+	TEST_CHECK(stats.percentile(0.99) == 0);
+	return true;
+}
+
+int main (int argc, char *argv[])
+{
+	printf("BEGIN TEST :\n");
+
+	bool ok = test_small_sample();
+	ok = test_single_outlier() && ok;
+	ok = test_empty() && ok;
+
+	printf("\nSTOP: %s\n", ok ? "PASS" : "FAIL");
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,88 @@
+/*
+ * description: per client rate limits keep working after many more clients than table slots
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include <atomic>
+
+#include "dispatcher.h"
+
+using namespace on::dispatcher;
+
+#define TEST_CHECK(cond) do { \
+		if( !(cond) ) { \
+			printf("TEST: ERROR: %s(%d): %s\n", __func__, __LINE__, #cond); \
+			return false; \
+		} \
+} while(0)
+
+//---
+// GLOBALS
+//
+
+std::atomic_bool g_done{ false };
+
+static const uint64_t kSecondNs = 1000000000ULL;
+static const uint64_t kTcpClient = uint64_t(2) << 48;   ///< ids as DispatchServer gives TCP connections
+
+///@brief tokens client gets at nowNs before its bucket is empty, at most limit
+static size_t drain(ClientRateLimit &clients, uint64_t client, uint64_t nowNs, size_t limit)
+{
+	size_t tokens = 0;
+	while( tokens < limit && clients.tryAcquire(client, nowNs) ) {
+		++tokens;
+	}
+	return tokens;
+}
+
+//---
+// TESTS
+//
+
+///@brief a new client gets its own burst after the ids of idle clients filled the table
+static bool test_client_churn()
+{
+	ClientRateLimit clients(1, 2);
+
+	// one connection after the other, each draining its bucket, ids never reused
+	uint64_t now = kSecondNs;
+	uint64_t next = 0;
+	for( ; next < 5 * ClientRateLimit::kSlots; ++next ) {
+		TEST_CHECK(drain(clients, kTcpClient | (next + 1), now, 4) == 2);
+		now += kSecondNs / 1000;
+	}
+	TEST_CHECK(clients.clients() == ClientRateLimit::kSlots);
+
+	// later, many clients at the same time, every one with a bucket of its own
+	now += 10 * kSecondNs;
+	for( size_t n = 0; n < 512; ++n, ++next ) {
+		TEST_CHECK(drain(clients, kTcpClient | (next + 1), now, 4) == 2);
+	}
+	return true;
+}
+
+///@brief a refunded token of a client that lost its slot does not break the bucket it lands in
+static bool test_refund_reclaimed()
+{
+	ClientRateLimit clients(1, 2);
+
+	const uint64_t now = kSecondNs;
+	TEST_CHECK(clients.tryAcquire(1, now));
+	clients.refund(1, now);
+	clients.refund(1, now);
+	TEST_CHECK(drain(clients, 1, now, 4) == 2);
+	return true;
+}
+
+int main (int argc, char *argv[])
+{
+	printf("BEGIN TEST :\n");
+
+	bool ok = test_client_churn();
+	ok = test_refund_reclaimed() && ok;
+
+	printf("\nSTOP: %s\n", ok ? "PASS" : "FAIL");
+	return ok ? 0 : 1;
+}
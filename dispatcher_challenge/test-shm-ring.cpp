@@ -0,0 +1,205 @@
+/*
+ * description: the shared memory ring hands out exactly the frames written, whatever their payload,
+ *              and every shared memory client has rings of its own
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "dispatcher.h"
+
+using namespace on::dispatcher;
+
+#define TEST_CHECK(cond) do { \
+		if( !(cond) ) { \
+			printf("TEST: ERROR: %s(%d): %s\n", __func__, __LINE__, #cond); \
+			return false; \
+		} \
+} while(0)
+
+//---
+// GLOBALS
+//
+
+std::atomic_bool g_done{ false };
+
+static const size_t kCapacity = 256;
+static const size_t kFrameHeader = 16;   ///< stamp, length and tag in front of every frame
+static const size_t kRounds = 20000;
+
+///@brief mirrors the ring's frame layout: header, bytes, terminator, 16 byte aligned
+static uint64_t frame_size(size_t length)
+{
+	return (kFrameHeader + length + 1 + ShmRing::kAlignment - 1) & ~uint64_t(ShmRing::kAlignment - 1);
+}
+
+///
+///@brief a payload at position whose 16 byte aligned words forge a committed frame header for
+///       the same bytes one lap later: stamp position + 1, a short length and tag 7
+///
+static std::string forged_payload(uint64_t position, size_t length)
+{
+	std::string payload(length, 'x');
+	const uint64_t start = position + kFrameHeader;
+	for( uint64_t at = (start + 15) & ~uint64_t(15); at + kFrameHeader <= start + length; at += 16 ) {
+		const uint64_t stamp = at + kCapacity + 1;
+		const uint32_t shortLength = 4, tag = 7;
+		memcpy(&payload[at - start], &stamp, sizeof(stamp));
+		memcpy(&payload[at - start + 8], &shortLength, sizeof(shortLength));
+		memcpy(&payload[at - start + 12], &tag, sizeof(tag));
+	}
+	return payload;
+}
+
+struct Mapping
+{
+	explicit Mapping(size_t size) : size(size)
+	{
+		memory = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	}
+
+	~Mapping()
+	{
+		munmap(memory, size);
+	}
+
+	void *memory;
+	size_t size;
+};
+
+//---
+// TESTS
+//
+
+///@brief bytes a producer wrote one lap ago never pass for a committed frame
+static bool test_stale_stamp()
+{
+	Mapping mapping(ShmRing::footprint(kCapacity));
+	TEST_CHECK(mapping.memory != MAP_FAILED);
+	ShmRing ring(mapping.memory, kCapacity, -1, true);
+
+	size_t frames = 0;
+	auto consume = [&frames](char *, size_t, uint32_t) { ++frames; };
+
+	// 128 bytes at 0, 128 at 128, then 32 at 256: the head lands on a forged header of the first frame
+	TEST_CHECK(ring.write(forged_payload(0, 111).data(), 111, 1));
+	TEST_CHECK(ring.read(consume, 16) == 1);
+	TEST_CHECK(ring.write(std::string(111, 'y').data(), 111, 1));
+	TEST_CHECK(ring.read(consume, 16) == 1);
+	TEST_CHECK(ring.write("z", 1, 1));
+	TEST_CHECK(ring.read(consume, 16) == 1);
+
+	TEST_CHECK(!ring.ready());
+	TEST_CHECK(ring.read(consume, 16) == 0);
+	TEST_CHECK(frames == 3);
+	return true;
+}
+
+///@brief many laps of random frames forging headers, read back in order and nothing else
+static bool test_adversarial_laps()
+{
+	Mapping mapping(ShmRing::footprint(kCapacity));
+	TEST_CHECK(mapping.memory != MAP_FAILED);
+	ShmRing ring(mapping.memory, kCapacity, -1, true);
+
+	std::mt19937 rng(42);
+	std::vector<std::string> written;
+	uint64_t tail = 0;
+	size_t next = 0;
+	bool ordered = true;
+
+	auto consume = [&](char *frame, size_t length, uint32_t tag) {
+		ordered = ordered && next < written.size() && tag == next % 1000 && length == written[next].size()
+			&& memcmp(frame, written[next].data(), length) == 0 && frame[length] == '\0';
+		++next;
+	};
+
+	for( size_t round = 0; round < kRounds; ++round ) {
+		const size_t batch = 1 + rng() % 4;
+		for( size_t n = 0; n < batch; ++n ) {
+			const size_t length = rng() % 100;
+			const uint64_t toEnd = kCapacity - (tail & (kCapacity - 1));
+			const uint64_t position = frame_size(length) <= toEnd ? tail : tail + toEnd;
+
+			std::string payload = forged_payload(position, length);
+			if( !ring.write(payload.data(), payload.size(), static_cast<uint32_t>(written.size() % 1000)) ) {
+				break;
+			}
+			written.push_back(payload);
+			tail = position + frame_size(length);
+		}
+
+		ring.read(consume, rng() % 2 == 0 ? 1 : 16);
+		TEST_CHECK(ordered);
+	}
+
+	ring.read(consume, SIZE_MAX);
+	TEST_CHECK(ordered);
+	TEST_CHECK(next == written.size());
+	TEST_CHECK(!ring.ready());
+	return true;
+}
+
+///@brief clients have rings of their own, each receives the responses to its requests only
+static bool test_client_rings()
+{
+	CommandDispatcher dispatcher;
+	dispatcher.addCommandHandler("echo", [](JsonValue &command, ResponseWriter &response) {
+		response.String(command["payload"]["text"].GetString());
+		return true;
+	});
+
+	const std::string path = "/tmp/dispatcher-shm-test-" + std::to_string(::getpid()) + ".shm";
+	ShmServer server(dispatcher);
+	TEST_CHECK(server.listen(path));
+	std::atomic_bool stop{ false };
+	std::thread serving([&]() { server.run([&]() { return stop.load(); }); });
+
+	ShmClient first, second;
+	const bool connected = first.connect(path) && second.connect(path);
+
+	std::string answers[2];
+	bool extra = false;
+	if( connected ) {
+		const std::string hello = R"({"command":"echo","payload":{"text":"first"}})";
+		const std::string world = R"({"command":"echo","payload":{"text":"second"}})";
+		first.send(hello.data(), hello.size());
+		second.send(world.data(), world.size());
+		first.receive([&](const char *response, size_t length) { answers[0].assign(response, length); });
+		second.receive([&](const char *response, size_t length) { answers[1].assign(response, length); });
+		extra = first.receive([](const char *, size_t) {}, 50);
+	}
+
+	stop = true;
+	serving.join();
+	TEST_CHECK(connected);
+	TEST_CHECK(!extra);
+	TEST_CHECK(answers[0].find("\"first\"") != std::string::npos && answers[0].find("second") == std::string::npos);
+	TEST_CHECK(answers[1].find("\"second\"") != std::string::npos && answers[1].find("first") == std::string::npos);
+	TEST_CHECK(server.requests() == 2);
+	return true;
+}
+
+int main (int argc, char *argv[])
+{
+	printf("BEGIN TEST :\n");
+
+	setConsoleEnabled(false);
+
+	bool ok = true;
+	ok = test_stale_stamp() && ok;
+	ok = test_adversarial_laps() && ok;
+	ok = test_client_rings() && ok;
+
+	printf("\nSTOP: %s\n", ok ? "PASS" : "FAIL");
+	return ok ? 0 : 1;
+}
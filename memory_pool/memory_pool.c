@@ -7,6 +7,7 @@
 #include <stdbool.h>
 #include <stdint.h>
 #include <memory.h>
+#include <sched.h>
 #include "memory_pool.h"
 
 // PRIVATE: declared inside *.c file
@@ -18,8 +19,20 @@ typedef struct memory_pool_block_header
 
     struct memory_pool_block_header * next;
 
+    // deferred reclamation: retired list link and epoch the block was retired in
+    struct memory_pool_block_header * retired_next;
+    unsigned long retire_epoch;
+
 } memory_pool_block_header_t;
 
+// per thread epoch announcement, padded to its own cache line
+typedef struct memory_pool_epoch_slot
+{
+    unsigned long active;    // (epoch << 1) | 1 inside a critical section, 0 outside
+    int registered;          // slot is owned by a thread
+    char pad[64 - sizeof(unsigned long) - sizeof(int)];
+} memory_pool_epoch_slot_t;
+
 struct memory_pool {
     size_t count;         // total elements
     size_t block_size;   // size of each block
@@ -27,10 +40,18 @@ struct memory_pool {
 
     struct memory_pool_block_header * pool;
     void ** shadow; // shadow copy of nodes to free on destroy even if caller/user still has them in acquired state
-};
 
-struct memory_pool_block_header ** memory_pool_stack;
-int memory_pool_stack_top;
+    // free stack, guarded by lock
+    struct memory_pool_block_header ** stack;
+    int stack_top;
+    int lock;
+
+    // epoch based deferred reclamation
+    unsigned long epoch;                                   // global epoch
+    struct memory_pool_block_header * retired[3];          // retired blocks, bucket = retire epoch % 3
+    unsigned long retired_count;                           // retires since init, triggers reclaim
+    memory_pool_epoch_slot_t threads[MEMORY_POOL_MAX_THREADS];
+};
 
 //---
 // MACROS
@@ -52,23 +73,61 @@ int memory_pool_stack_top;
 // magic value to check for data corruption
 #define NODE_MAGIC 0xBAADA555
 
+// retires between two reclaim attempts
+#define MEMORY_POOL_RECLAIM_THRESHOLD 64
+
+// per operation tracing, build with -DMEMORY_POOL_TRACE=0 to silence
+#ifndef MEMORY_POOL_TRACE
+#define MEMORY_POOL_TRACE 1
+#endif
+
+#define TRACE(...) do { if( MEMORY_POOL_TRACE ) printf(__VA_ARGS__); } while(0)
+
+//---
+// LOCKING
+//
+
+static void memory_pool_lock(memory_pool_t *mp)
+{
+    int spins = 0;
+
+    while( __atomic_exchange_n(&mp->lock, 1, __ATOMIC_ACQUIRE) ) {
+        while( __atomic_load_n(&mp->lock, __ATOMIC_RELAXED) ) {
+            if( ++spins > 100 ) {
+                sched_yield();
+                spins = 0;
+            }
+        }
+    }
+}
+
+static void memory_pool_unlock(memory_pool_t *mp)
+{
+    __atomic_store_n(&mp->lock, 0, __ATOMIC_RELEASE);
+}
+
 memory_pool_t * memory_pool_init(size_t count, size_t block_size)
 {
     memory_pool_t *mp = NULL;
-    memory_pool_block_header_t * last;
+    memory_pool_block_header_t * last = NULL;
     void * block = NULL;
-    int n = 0;
+    size_t n = 0;
 
     // allocate memory pool struct. give ownership back to caller
-    mp = (memory_pool_t*) malloc (sizeof(memory_pool_t));
+    mp = (memory_pool_t*) calloc (1, sizeof(memory_pool_t));
     if( mp == NULL ) {
         printf("ERROR: memory_pool_destroy: unable to malloc memory_pool_t. OOM\n");
         return NULL;
     }
 
 	///construct stack
-	memory_pool_stack = malloc(sizeof(memory_pool_block_header_t *) * count);
-	memory_pool_stack_top = INVALID_STACK_VALUE;
+	mp->stack = malloc(sizeof(memory_pool_block_header_t *) * count);
+	mp->stack_top = INVALID_STACK_VALUE;
+	if( mp->stack == NULL ) {
+		printf("ERROR: memory_pool_init: unable to malloc free stack. OOM\n");
+		free( mp );
+		return NULL;
+	}
 
     for( n = 0; n < count; ++n ) {
         // allocate data block
@@ -76,13 +135,20 @@ memory_pool_t * memory_pool_init(size_t count, size_t block_size)
         //
         size_t total_size = block_size + sizeof(memory_pool_block_header_t);
 		block = (void *)malloc (total_size);
+		if( block == NULL ) {
+			break;
+		}
 
         // move to end of data block to create header
 		memory_pool_block_header_t * header = MEMORY_POOL_DBTOH(block, block_size);
-		header->inuse = 0;
-		header->size = 0;
+		header->magic = NODE_MAGIC;
+		header->inuse = false;
+		header->size = block_size;
+		header->next = NULL;
+		header->retired_next = NULL;
+		header->retire_epoch = 0;
+
 
-        
 		if (n == 0)
 		{
 			/// the first node
@@ -96,30 +162,36 @@ memory_pool_t * memory_pool_init(size_t count, size_t block_size)
 		}
 
 		// add to stack (just a simple stack)
-		memory_pool_stack[n] = header;
-		memory_pool_stack_top++;
+		mp->stack[n] = header;
+		mp->stack_top++;
 
-        printf("MEMORY_POOL: i=%d, data=%p, header=%p, block_size=%zu, next=%p\n",
+        TRACE("MEMORY_POOL: i=%zu, data=%p, header=%p, block_size=%zu, next=%p\n",
                n, block, header, header->size, header->next);
     }
 
-    printf("memory_pool_init(mp=%p, count=%zu, block_size=%zu)\n", mp, count, block_size);
+    TRACE("memory_pool_init(mp=%p, count=%zu, block_size=%zu)\n", mp, count, block_size);
 
-    mp->count = count;
+    mp->count = n;
     mp->block_size = block_size;
-    mp->available = count;
+    mp->available = n;
 
-    return n == count ? mp : NULL;
+    if( n != count ) {
+        printf("ERROR: memory_pool_init: unable to malloc block %zu of %zu. OOM\n", n, count);
+        memory_pool_destroy(mp);
+        return NULL;
+    }
+
+    return mp;
 }
 
 bool memory_pool_destroy(memory_pool_t *mp)
 {
 
-    printf("memory_pool_destroy(mp = %p, count=%zu, block_size=%zu)\n", mp, mp->count, mp->block_size);
+    TRACE("memory_pool_destroy(mp = %p, count=%zu, block_size=%zu)\n", mp, mp->count, mp->block_size);
 
 	memory_pool_block_header_t * header = mp->pool;
 
-    for(int n = 0; n < mp->count; ++n ) {
+    for(size_t n = 0; n < mp->count; ++n ) {
         // free all data blocks from pool
 		///void * data_block = MEMORY_POOL_DBTOH( header, mp->block_size );
     	void * data_block = MEMORY_POOL_HTODB( header, mp->block_size );
@@ -127,65 +199,95 @@ bool memory_pool_destroy(memory_pool_t *mp)
 		free( data_block );
     }
 
+	/// free simple stack
+	free( mp->stack );
+
     // free memory pool itself
 	free( mp );
 
-	/// free simple stack
-	free( memory_pool_stack );
-
     return true;
 }
 
 void * memory_pool_acquire(memory_pool_t * mp)
 {
+	memory_pool_lock(mp);
 
-	if (memory_pool_stack_top == INVALID_STACK_VALUE)
+	if (mp->stack_top == INVALID_STACK_VALUE)
 	{
-		return NULL;
+		memory_pool_unlock(mp);
+
+		// out of blocks, return any retired blocks that are safe to reuse and retry once
+		if( memory_pool_reclaim(mp) == 0 ) {
+			return NULL;
+		}
+
+		memory_pool_lock(mp);
+		if (mp->stack_top == INVALID_STACK_VALUE)
+		{
+			memory_pool_unlock(mp);
+			return NULL;
+		}
 	}
 
-	memory_pool_block_header_t * header = memory_pool_stack[memory_pool_stack_top];
+	memory_pool_block_header_t * header = mp->stack[mp->stack_top];
 
     // get data block from header
     void * data = MEMORY_POOL_HTODB(header, mp->block_size);
 
     // pop stack
-	header->inuse = false;
+	__atomic_store_n(&header->inuse, true, __ATOMIC_RELAXED);
 	mp->available--;
-	memory_pool_stack_top--;
+	mp->stack_top--;
+
+	memory_pool_unlock(mp);
 
-    printf("memory_pool_acquire: mp=%p, data=%p\n", mp, data);
+    TRACE("memory_pool_acquire: mp=%p, data=%p\n", mp, data);
     return data;  // return to caller
 }
 
+// PRIVATE: validate a data block handed back by the caller, NULL when it is not a pool block
+static memory_pool_block_header_t * memory_pool_header_of(memory_pool_t * mp, void * data, const char * caller)
+{
+	if( data == NULL ) {
+		printf("ERROR: %s: NULL data\n", caller);
+		return NULL;
+	}
+
+	// move to header inside memory block
+	memory_pool_block_header_t * header = MEMORY_POOL_DBTOH(data, mp->block_size);
+
+	if( header->magic != NODE_MAGIC ) {
+		printf("ERROR: %s: data=%p is not a pool block or is corrupt\n", caller, data);
+		return NULL;
+	}
+
+	return header;
+}
+
 bool memory_pool_release(memory_pool_t * mp, void * data)
 {
-	int datasz = sizeof( (char *)data);
+	memory_pool_block_header_t * header = memory_pool_header_of(mp, data, "memory_pool_release");
+	if( header == NULL ) {
+		return false;
+	}
 
-	if (memory_pool_stack_top + 1 == mp->count)
+	// claim the block, a concurrent release or retire of the same block fails here
+	if( !__atomic_exchange_n(&header->inuse, false, __ATOMIC_ACQ_REL) )
 	{
-		printf("Unable to add more data, maximum data slot has been reached.\n");
+		printf("ERROR: memory_pool_release: double release data=%p\n", data);
 		return false;
 	}
 
-	memory_pool_stack_top++;
-	memory_pool_block_header_t * header = memory_pool_stack[memory_pool_stack_top];
-	header->size = datasz;
-	header->inuse = true;
-
+    // push on stack
+	memory_pool_lock(mp);
+	mp->stack[++mp->stack_top] = header;
+	mp->available++;
 
-	// move to header inside memory block using MEMORY_POOL_DBTOH(data, mp->block_size);
-	void * datablock = MEMORY_POOL_HTODB(header, mp->block_size);
-	memcpy(datablock, data, datasz);
-    
+	memory_pool_unlock(mp);
 
-    printf("memory_pool_release: data=%p, header=%p, block_size=%zu, next=%p\n",
+    TRACE("memory_pool_release: data=%p, header=%p, block_size=%zu, next=%p\n",
            data, header, header->size, header->next);
 
-    // push on stack
-	//memory_pool_stack_top++;
-	mp->available++;
-
     return true;
 }
 
@@ -195,7 +297,7 @@ size_t memory_pool_available(memory_pool_t *mp)
         printf("ERROR: memory_pool_available: memory pool invalid\n");
         return 0;
     }
-    return mp->available;
+    return __atomic_load_n(&mp->available, __ATOMIC_RELAXED);
 }
 
 void memory_pool_dump(memory_pool_t *mp)
@@ -210,11 +312,164 @@ void memory_pool_dump(memory_pool_t *mp)
 
     memory_pool_block_header_t * header = mp->pool;
 
-    for(int n = 0; n < mp->available; ++n ) {
+    for(size_t n = 0; n < mp->available; ++n ) {
         void * data_block = MEMORY_POOL_HTODB(header, mp->block_size);
-        printf(" + block: i=%d, data=%p, header=%p, inuse=%s, block_size=%zu, next=%p\n",
+        printf(" + block: i=%zu, data=%p, header=%p, inuse=%s, block_size=%zu, next=%p\n",
                n, data_block, header, header->inuse ? "TRUE":"FALSE", header->size, header->next);
 
         header = header->next;
     }
 }
+
+//---
+// EPOCH BASED DEFERRED RECLAMATION
+//
+// A retired block is tagged with the global epoch E at retire time. Readers announce the
+// epoch they observed when entering a critical section. The global epoch only advances
+// once every active reader has announced the current epoch, so when the global epoch
+// reaches E + 2 no reader can still hold a reference taken before the block was retired.
+//
+
+int memory_pool_thread_register(memory_pool_t *mp)
+{
+    for( int n = 0; n < MEMORY_POOL_MAX_THREADS; ++n ) {
+        int expected = 0;
+        if( __atomic_compare_exchange_n(&mp->threads[n].registered, &expected, 1, false,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_RELAXED) ) {
+            __atomic_store_n(&mp->threads[n].active, 0, __ATOMIC_RELEASE);
+            return n;
+        }
+    }
+
+    printf("ERROR: memory_pool_thread_register: all %d thread slots in use\n", MEMORY_POOL_MAX_THREADS);
+    return -1;
+}
+
+void memory_pool_thread_unregister(memory_pool_t *mp, int tid)
+{
+    __atomic_store_n(&mp->threads[tid].active, 0, __ATOMIC_RELEASE);
+    __atomic_store_n(&mp->threads[tid].registered, 0, __ATOMIC_RELEASE);
+}
+
+void memory_pool_enter(memory_pool_t *mp, int tid)
+{
+    unsigned long epoch = __atomic_load_n(&mp->epoch, __ATOMIC_RELAXED);
+    __atomic_store_n(&mp->threads[tid].active, (epoch << 1) | 1, __ATOMIC_RELAXED);
+
+    // announcement must be visible before any shared pointer is read
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+void memory_pool_leave(memory_pool_t *mp, int tid)
+{
+    __atomic_store_n(&mp->threads[tid].active, 0, __ATOMIC_RELEASE);
+}
+
+bool memory_pool_retire(memory_pool_t *mp, void *data)
+{
+	memory_pool_block_header_t * header = memory_pool_header_of(mp, data, "memory_pool_retire");
+	if( header == NULL ) {
+		return false;
+	}
+
+	// a block never acquired, already released or retired twice would go on the free stack twice
+	if( !__atomic_exchange_n(&header->inuse, false, __ATOMIC_ACQ_REL) )
+	{
+		printf("ERROR: memory_pool_retire: block not in use data=%p\n", data);
+		return false;
+	}
+
+	unsigned long epoch = __atomic_load_n(&mp->epoch, __ATOMIC_SEQ_CST);
+	header->retire_epoch = epoch;
+
+	// push on the retired list of this epoch
+	memory_pool_block_header_t ** bucket = &mp->retired[epoch % 3];
+	memory_pool_block_header_t * head = __atomic_load_n(bucket, __ATOMIC_RELAXED);
+	do {
+		header->retired_next = head;
+	} while( !__atomic_compare_exchange_n(bucket, &head, header, true, __ATOMIC_RELEASE, __ATOMIC_RELAXED) );
+
+	if( __atomic_add_fetch(&mp->retired_count, 1, __ATOMIC_RELAXED) % MEMORY_POOL_RECLAIM_THRESHOLD == 0 ) {
+		memory_pool_reclaim(mp);
+	}
+
+	return true;
+}
+
+// PRIVATE: advance the global epoch if every active reader has observed it
+static bool memory_pool_try_advance(memory_pool_t *mp)
+{
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+    unsigned long epoch = __atomic_load_n(&mp->epoch, __ATOMIC_SEQ_CST);
+
+    for( int n = 0; n < MEMORY_POOL_MAX_THREADS; ++n ) {
+        unsigned long active = __atomic_load_n(&mp->threads[n].active, __ATOMIC_ACQUIRE);
+        if( (active & 1) && (active >> 1) != epoch ) {
+            return false;
+        }
+    }
+
+    return __atomic_compare_exchange_n(&mp->epoch, &epoch, epoch + 1, false,
+                                       __ATOMIC_SEQ_CST, __ATOMIC_RELAXED);
+}
+
+size_t memory_pool_reclaim(memory_pool_t *mp)
+{
+    memory_pool_try_advance(mp);
+
+    unsigned long epoch = __atomic_load_n(&mp->epoch, __ATOMIC_SEQ_CST);
+    if( epoch < 2 ) {
+        return 0;
+    }
+
+    // bucket of epoch - 2, take the whole list
+    memory_pool_block_header_t ** bucket = &mp->retired[(epoch + 1) % 3];
+    memory_pool_block_header_t * header = __atomic_exchange_n(bucket, NULL, __ATOMIC_ACQUIRE);
+    memory_pool_block_header_t * batch = NULL;
+    memory_pool_block_header_t * late = NULL;
+    size_t released = 0;
+
+    while( header != NULL ) {
+        memory_pool_block_header_t * next = header->retired_next;
+
+        if( header->retire_epoch + 2 <= epoch ) {
+            header->retired_next = batch;
+            batch = header;
+            released++;
+        }
+        else {
+            // retired after the bucket was recycled for a newer epoch
+            header->retired_next = late;
+            late = header;
+        }
+        header = next;
+    }
+
+    while( late != NULL ) {
+        memory_pool_block_header_t * next = late->retired_next;
+        memory_pool_block_header_t ** home = &mp->retired[late->retire_epoch % 3];
+        memory_pool_block_header_t * head = __atomic_load_n(home, __ATOMIC_RELAXED);
+        do {
+            late->retired_next = head;
+        } while( !__atomic_compare_exchange_n(home, &head, late, true, __ATOMIC_RELEASE, __ATOMIC_RELAXED) );
+        late = next;
+    }
+
+    if( batch == NULL ) {
+        return 0;
+    }
+
+    // return the whole batch under a single lock
+    memory_pool_lock(mp);
+    while( batch != NULL ) {
+        mp->stack[++mp->stack_top] = batch;
+        batch = batch->retired_next;
+    }
+    mp->available += released;
+    memory_pool_unlock(mp);
+
+    TRACE("memory_pool_reclaim: mp=%p, epoch=%lu, released=%zu\n", mp, epoch, released);
+
+    return released;
+}
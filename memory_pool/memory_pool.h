@@ -20,6 +20,10 @@
 #include <stdlib.h>
 #include <stdbool.h>   // NOTE: c99 bool requires #include <stdbool.h>
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 typedef struct memory_pool memory_pool_t;
 
 memory_pool_t * memory_pool_init(size_t count, size_t block_size);
@@ -31,3 +35,23 @@ bool memory_pool_release(memory_pool_t *mp, void * data);
 // convieneince functions
 size_t memory_pool_available(memory_pool_t *mp);
 void memory_pool_dump(memory_pool_t *mp);
+
+// epoch based deferred reclamation
+//   a block that may still be read by other threads is retired instead of released.
+//   readers bracket every access with enter/leave using the slot from thread_register.
+//   retired blocks return to the pool in batches once every reader has left the epoch
+//   the block was retired in.
+#define MEMORY_POOL_MAX_THREADS 64
+
+int memory_pool_thread_register(memory_pool_t *mp);          // returns slot, -1 if all slots are taken
+void memory_pool_thread_unregister(memory_pool_t *mp, int tid);
+
+void memory_pool_enter(memory_pool_t *mp, int tid);
+void memory_pool_leave(memory_pool_t *mp, int tid);
+
+bool memory_pool_retire(memory_pool_t *mp, void * data);
+size_t memory_pool_reclaim(memory_pool_t *mp);               // returns number of blocks released
+
+#ifdef __cplusplus
+}
+#endif
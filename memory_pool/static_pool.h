@@ -0,0 +1,235 @@
+/*
+ * description:
+ * Objective: compile-time sized C++ front end for the fixed size memory pool. All block
+              storage and the free list live inside the object, so a pool placed in static
+              or automatic storage never touches the heap.
+   Limitations: Geometry (block size, count, alignment) is fixed at compile time.
+
+  Support O(1) operation in acquire and release operations
+  Strategy:
+    free list of block indices threaded through a side table
+       acquire = pop free list, or take the next never used block (bump index)
+       release = push block index back on the free list
+    the bump index means a zero initialized pool is already a valid pool: the constructor
+    is constexpr and a pool with static storage duration is constant initialized.
+ */
+
+#ifndef _MEMORY_POOL_STATIC_POOL_H_
+#define _MEMORY_POOL_STATIC_POOL_H_
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdint.h>
+
+#include <type_traits>
+
+namespace on {
+namespace memory {
+
+///@brief smallest unsigned integer able to hold the value N
+template <size_t N>
+struct static_pool_index
+{
+	typedef typename std::conditional< (N < UINT8_MAX), uint8_t,
+		typename std::conditional< (N < UINT16_MAX), uint16_t,
+			typename std::conditional< (N < UINT32_MAX), uint32_t, size_t >::type >::type >::type type;
+};
+
+// ----------------------------------------------------------------------------------------------- //
+
+///
+///@brief fixed size memory pool with compile-time geometry and no heap usage.
+///
+///@tparam BlockSize The usable size of each block in bytes.
+///@tparam Count The number of blocks in the pool.
+///@tparam Align The alignment of each block, must be a power of two.
+///
+template <size_t BlockSize, size_t Count, size_t Align = alignof(max_align_t)>
+class StaticPool
+{
+
+// ----------------------------------------------------------------------------------------------- //
+
+public:
+
+	static_assert(BlockSize > 0, "StaticPool: block size must be greater than zero");
+	static_assert(Count > 0, "StaticPool: count must be greater than zero");
+	static_assert(Align > 0 && (Align & (Align - 1)) == 0, "StaticPool: alignment must be a power of two");
+
+	typedef typename static_pool_index<Count>::type index_type;
+
+	static constexpr size_t block_size = BlockSize;
+	static constexpr size_t count = Count;
+	static constexpr size_t alignment = Align;
+
+	///@brief distance between two consecutive blocks, block size rounded up to the alignment
+	static constexpr size_t stride = (BlockSize + Align - 1) & ~(Align - 1);
+
+	///@brief total bytes of block storage
+	static constexpr size_t storage_size = stride * Count;
+
+// ----------------------------------------------------------------------------------------------- //
+
+	///@brief constant initializable constructor, all blocks are available.
+	constexpr StaticPool()
+		: m_storage{}, m_next{}, m_inuse{}, m_head{ kNil }, m_bump{ 0 }, m_available{ Count }
+	{
+	}
+
+	///@note the pool owns its storage, copying it would duplicate outstanding blocks.
+	StaticPool(const StaticPool&) = delete;
+	StaticPool& operator=(const StaticPool&) = delete;
+
+// ----------------------------------------------------------------------------------------------- //
+
+	///
+	///@brief acquire a block from the pool.
+	///
+	///@return pointer to the block, NULL if the pool is exhausted.
+	///
+	void * acquire()
+	{
+		index_type n;
+
+		if( m_head != kNil ) {
+			// pop free list
+			n = m_head;
+			m_head = m_next[n];
+		}
+		else if( m_bump < Count ) {
+			// first use of this block
+			n = static_cast<index_type>(m_bump++);
+		}
+		else {
+			return NULL;
+		}
+
+		m_inuse[n] = true;
+		m_available--;
+
+		return m_storage + n * stride;
+	}
+
+// ----------------------------------------------------------------------------------------------- //
+
+	///
+	///@brief release a block back to the pool.
+	///
+	///@param data The block previously returned by acquire.
+	///
+	///@return false if the block does not belong to this pool or is not acquired.
+	///
+	bool release(void * data)
+	{
+		if( !owns(data) ) {
+			printf("ERROR: StaticPool::release: data=%p not owned by pool=%p\n", data, (void*)this);
+			return false;
+		}
+
+		const index_type n = index_of(data);
+
+		if( !m_inuse[n] ) {
+			printf("ERROR: StaticPool::release: double release data=%p\n", data);
+			return false;
+		}
+
+		// push free list
+		m_inuse[n] = false;
+		m_next[n] = m_head;
+		m_head = n;
+		m_available++;
+
+		return true;
+	}
+
+// ----------------------------------------------------------------------------------------------- //
+
+	///@brief number of blocks that can still be acquired
+	size_t available() const
+	{
+		return m_available;
+	}
+
+// ----------------------------------------------------------------------------------------------- //
+
+	///@brief true if data points at the start of a block of this pool
+	bool owns(const void * data) const
+	{
+		const unsigned char * p = static_cast<const unsigned char *>(data);
+		return p >= m_storage && p < m_storage + storage_size && (p - m_storage) % stride == 0;
+	}
+
+// ----------------------------------------------------------------------------------------------- //
+
+	///@brief output the pool state to console
+	void dump() const
+	{
+		printf("StaticPool::dump(pool = %p, count=%zu, available=%zu, block_size=%zu, stride=%zu)\n",
+				(void*)this, Count, m_available, BlockSize, stride);
+
+		for( size_t n = 0; n < m_bump; ++n ) {
+			printf(" + block: i=%zu, data=%p, inuse=%s\n",
+					n, (void*)(m_storage + n * stride), m_inuse[n] ? "TRUE" : "FALSE");
+		}
+	}
+
+// ----------------------------------------------------------------------------------------------- //
+
+private:
+
+	static constexpr index_type kNil = static_cast<index_type>(~static_cast<index_type>(0));
+
+	static_assert(Count < static_cast<size_t>(kNil), "StaticPool: count does not fit the index type");
+
+	index_type index_of(const void * data) const
+	{
+		return static_cast<index_type>((static_cast<const unsigned char *>(data) - m_storage) / stride);
+	}
+
+	alignas(Align) unsigned char m_storage[storage_size];  ///< block storage
+	index_type m_next[Count];                              ///< free list links, valid for free blocks only
+	bool m_inuse[Count];                                   ///< error checking for double release
+	index_type m_head;                                     ///< top of the free list, kNil when empty
+	size_t m_bump;                                         ///< blocks [m_bump, Count) were never acquired
+	size_t m_available;                                    ///< blocks that can still be acquired
+};
+
+template <size_t BlockSize, size_t Count, size_t Align>
+constexpr typename StaticPool<BlockSize, Count, Align>::index_type StaticPool<BlockSize, Count, Align>::kNil;
+
+// ----------------------------------------------------------------------------------------------- //
+
+}
+}
+
+// ----------------------------------------------------------------------------------------------- //
+
+//---
+// memory_pool.h compatible surface so a StaticPool can stand in for a memory_pool_t
+//
+
+template <size_t BlockSize, size_t Count, size_t Align>
+inline void * memory_pool_acquire(on::memory::StaticPool<BlockSize, Count, Align> * mp)
+{
+	return mp->acquire();
+}
+
+template <size_t BlockSize, size_t Count, size_t Align>
+inline bool memory_pool_release(on::memory::StaticPool<BlockSize, Count, Align> * mp, void * data)
+{
+	return mp->release(data);
+}
+
+template <size_t BlockSize, size_t Count, size_t Align>
+inline size_t memory_pool_available(on::memory::StaticPool<BlockSize, Count, Align> * mp)
+{
+	return mp->available();
+}
+
+template <size_t BlockSize, size_t Count, size_t Align>
+inline void memory_pool_dump(on::memory::StaticPool<BlockSize, Count, Align> * mp)
+{
+	mp->dump();
+}
+
+#endif
@@ -0,0 +1,159 @@
+/*
+ * description: stress test of epoch based deferred reclamation.
+ *   threads push and pop a lock-free (Treiber) stack whose nodes live in pool memory.
+ *   popped nodes are retired, not released, so a node is never reused while another
+ *   thread may still be reading it. Reuse before that would show up as ABA: lost or
+ *   duplicated nodes and a checksum mismatch at the end.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include "memory_pool.h"
+
+#define NUMBER_OF_THREADS 8
+#define OPERATIONS_PER_THREAD 200000
+#define POOL_COUNT 512
+
+typedef struct node
+{
+    struct node * next;
+    uint64_t value;
+    uint64_t check;     // ~value, detects a node overwritten while still reachable
+} node_t;
+
+//---
+// GLOBALS
+//
+
+memory_pool_t * g_pool;
+node_t * g_top;
+
+uint64_t g_pushed_sum;
+uint64_t g_popped_sum;
+uint64_t g_corrupt;
+
+//---
+// LOCK-FREE STACK
+//
+
+void stack_push(node_t * node)
+{
+    node_t * top = __atomic_load_n(&g_top, __ATOMIC_RELAXED);
+    do {
+        node->next = top;
+    } while( !__atomic_compare_exchange_n(&g_top, &top, node, true, __ATOMIC_RELEASE, __ATOMIC_RELAXED) );
+}
+
+// caller must be inside a critical section
+node_t * stack_pop(void)
+{
+    node_t * top = __atomic_load_n(&g_top, __ATOMIC_ACQUIRE);
+    while( top != NULL ) {
+        node_t * next = __atomic_load_n(&top->next, __ATOMIC_RELAXED);
+        if( __atomic_compare_exchange_n(&g_top, &top, next, true, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE) ) {
+            break;
+        }
+    }
+    return top;
+}
+
+void * worker(void * arg)
+{
+    uint64_t id = (uint64_t)(uintptr_t)arg;
+    uint64_t pushed = 0;
+    uint64_t popped = 0;
+    uint64_t corrupt = 0;
+
+    int tid = memory_pool_thread_register(g_pool);
+    if( tid < 0 ) {
+        __atomic_add_fetch(&g_corrupt, 1, __ATOMIC_RELAXED);
+        return NULL;
+    }
+
+    for( uint64_t n = 0; n < OPERATIONS_PER_THREAD; ++n ) {
+        // push, pool may be momentarily exhausted by retired nodes
+        node_t * node = memory_pool_acquire(g_pool);
+        if( node != NULL ) {
+            node->value = (id << 32) | n;
+            node->check = ~node->value;
+            pushed += node->value;
+            stack_push(node);
+        }
+
+        // pop
+        memory_pool_enter(g_pool, tid);
+        node = stack_pop();
+        if( node != NULL ) {
+            if( node->check != ~node->value ) {
+                corrupt++;
+            }
+            popped += node->value;
+            memory_pool_retire(g_pool, node);
+        }
+        memory_pool_leave(g_pool, tid);
+    }
+
+    memory_pool_thread_unregister(g_pool, tid);
+
+    __atomic_add_fetch(&g_pushed_sum, pushed, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&g_popped_sum, popped, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&g_corrupt, corrupt, __ATOMIC_RELAXED);
+    return NULL;
+}
+
+int main (int argc, char *argv[])
+{
+    printf("BEGIN TEST : threads=%d, operations=%d, pool=%d\n",
+           NUMBER_OF_THREADS, OPERATIONS_PER_THREAD, POOL_COUNT);
+
+    g_pool = memory_pool_init(POOL_COUNT, sizeof(node_t));
+    if( g_pool == NULL ) {
+        printf("TEST: ERROR: memory_pool_init failed\n");
+        return 1;
+    }
+
+    pthread_t threads[NUMBER_OF_THREADS];
+    for( int n = 0; n < NUMBER_OF_THREADS; ++n ) {
+        pthread_create(&threads[n], NULL, worker, (void *)(uintptr_t)n);
+    }
+    for( int n = 0; n < NUMBER_OF_THREADS; ++n ) {
+        pthread_join(threads[n], NULL);
+    }
+
+    // drain what is left on the stack
+    node_t * node;
+    while( (node = stack_pop()) != NULL ) {
+        if( node->check != ~node->value ) {
+            g_corrupt++;
+        }
+        g_popped_sum += node->value;
+        memory_pool_retire(g_pool, node);
+    }
+
+    // retiring a block that is not in use is rejected, as release rejects a double release
+    void * spare = memory_pool_acquire(g_pool);
+    bool rejected = spare != NULL && memory_pool_retire(g_pool, spare) && !memory_pool_retire(g_pool, spare);
+    spare = memory_pool_acquire(g_pool);
+    rejected = rejected && spare != NULL && memory_pool_release(g_pool, spare) && !memory_pool_retire(g_pool, spare);
+
+    // no readers left, each reclaim advances one epoch
+    for( int n = 0; n < 3; ++n ) {
+        memory_pool_reclaim(g_pool);
+    }
+
+    size_t available = memory_pool_available(g_pool);
+    bool ok = g_corrupt == 0 && g_pushed_sum == g_popped_sum && available == POOL_COUNT && rejected;
+
+    printf("TEST: pushed_sum=%llu, popped_sum=%llu, corrupt=%llu, available=%zu of %d, rejected=%s\n",
+           (unsigned long long)g_pushed_sum, (unsigned long long)g_popped_sum,
+           (unsigned long long)g_corrupt, available, POOL_COUNT, rejected ? "true" : "false");
+
+    memory_pool_destroy(g_pool);
+
+    printf("\nSTOP: %s\n", ok ? "PASS" : "FAIL");
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,110 @@
+/*
+ * description: test the compile-time sized StaticPool front end
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+
+#include <type_traits>
+
+#include "memory_pool.h"
+#include "static_pool.h"
+
+#define TEST_CHECK(cond) do { \
+		if( !(cond) ) { \
+			printf("TEST: ERROR: %s(%d): %s\n", __func__, __LINE__, #cond); \
+			return false; \
+		} \
+} while(0)
+
+//---
+// GLOBALS
+//
+
+// constant initialized, lives in .bss and is usable before main
+static on::memory::StaticPool<10, 5> g_pool;
+
+// geometry is computed at compile time
+typedef on::memory::StaticPool<10, 5, 16> Pool10x5x16;
+static_assert(Pool10x5x16::stride == 16, "stride rounds block size up to alignment");
+static_assert(Pool10x5x16::storage_size == 80, "storage is stride * count");
+static_assert(std::is_same<Pool10x5x16::index_type, uint8_t>::value, "small pools use small indices");
+static_assert(std::is_same<on::memory::StaticPool<8, 1000>::index_type, uint16_t>::value, "index widens with count");
+
+///
+///@brief exercise any pool through the memory_pool.h surface
+///
+template <typename PoolPtr>
+bool exercise(PoolPtr mp, size_t count, size_t block_size)
+{
+	void * blocks[16];
+
+	TEST_CHECK(count <= sizeof(blocks) / sizeof(blocks[0]));
+	TEST_CHECK(memory_pool_available(mp) == count);
+
+	for( size_t n = 0; n < count; ++n ) {
+		blocks[n] = memory_pool_acquire(mp);
+		TEST_CHECK(blocks[n] != NULL);
+		memset(blocks[n], (int)n, block_size);
+	}
+
+	// over acquire
+	TEST_CHECK(memory_pool_acquire(mp) == NULL);
+	TEST_CHECK(memory_pool_available(mp) == 0);
+
+	// release in reverse order
+	for( size_t n = count; n-- > 0; ) {
+		TEST_CHECK(memory_pool_release(mp, blocks[n]));
+	}
+
+	TEST_CHECK(memory_pool_available(mp) == count);
+	return true;
+}
+
+bool test_static_pool()
+{
+	TEST_CHECK(exercise(&g_pool, 5, 10));
+
+	// blocks are aligned and distinct
+	on::memory::StaticPool<10, 5, 16> pool;
+	void * a = pool.acquire();
+	void * b = pool.acquire();
+	TEST_CHECK(a != b);
+	TEST_CHECK(((uintptr_t)a % 16) == 0 && ((uintptr_t)b % 16) == 0);
+
+	// release of foreign, misaligned and already released blocks fails
+	char foreign[16];
+	TEST_CHECK(!pool.release(foreign));
+	TEST_CHECK(!pool.release((char *)a + 1));
+	TEST_CHECK(pool.release(a));
+	TEST_CHECK(!pool.release(a));   // double release
+
+	// released block is reused first
+	TEST_CHECK(pool.acquire() == a);
+	TEST_CHECK(pool.available() == 3);
+
+	pool.dump();
+	return true;
+}
+
+bool test_memory_pool_interchangeable()
+{
+	memory_pool_t * mp = memory_pool_init(5, 10);
+	TEST_CHECK(mp != NULL);
+
+	bool ok = exercise(mp, 5, 10);
+	memory_pool_destroy(mp);
+	return ok;
+}
+
+int main (int argc, char *argv[])
+{
+	printf("BEGIN TEST :\n");
+
+	bool ok = test_static_pool();
+	ok = test_memory_pool_interchangeable() && ok;
+
+	printf("\nSTOP: %s\n", ok ? "PASS" : "FAIL");
+	return ok ? 0 : 1;
+}